@@ -6,14 +6,6 @@
 #include "cmd.hpp"
 #include "server.h"
 
-std::optional<std::string> load404Page(const std::filesystem::path &docRoot,
-                                       const std::string &templateText) {
-  auto path = docRoot / "404.md";
-  return std::filesystem::exists(path)
-             ? renderFile(path, templateText)
-             : renderText("# 404 Not Found", templateText);
-}
-
 bool copyDefaultConfig(const std::filesystem::path &configPath) {
   // Check if the default config file exists.
   const auto defaultConfigPath =
@@ -44,7 +36,107 @@ bool copyDefaultConfig(const std::filesystem::path &configPath) {
   return true;
 }
 
+/// The layout that was compiled into the executable, if any.  See the
+/// `MAGENTA_BUILTIN_TEMPLATE` CMake option.
+static std::optional<compiledTemplate> builtinLayout() {
+#ifdef MAGENTA_BUILTIN_TEMPLATE
+  return builtinTemplate();
+#else
+  return {};
+#endif
+}
+
+/// Load the layout of the site with `config`, unless `layout` already holds
+/// one, and render its 404 page.  Returns none on failure.
+static std::optional<siteSnapshot>
+loadSiteLayout(struct config config, std::optional<compiledTemplate> layout) {
+  if (!layout) {
+    layout = compiledTemplate::load(config.templatePath);
+  }
+
+  if (!layout) {
+    return {};
+  }
+
+  auto maybeNotFoundHtml = renderNotFoundPage(config.docRoot, *layout);
+  if (!maybeNotFoundHtml) {
+    std::cerr << "failed to load 404 page content" << std::endl;
+    return {};
+  }
+
+  return siteSnapshot{std::move(config), std::move(*layout),
+                      std::move(*maybeNotFoundHtml), {}};
+}
+
+/// Load the configuration at `configPath`, along with the layouts and the 404
+/// pages of the main site and of each virtual host.  Returns none on failure.
+static std::optional<siteSnapshot>
+loadSite(const std::filesystem::path &configPath) {
+  auto maybeConfig = validateAndLoadConfiguration(configPath);
+  if (!maybeConfig) {
+    return {};
+  }
+
+  // A builtin layout takes the place of the template file of the main site,
+  // which is then neither read nor watched for changes.  Virtual hosts always
+  // use their own template files.
+  auto maybeSite = loadSiteLayout(*maybeConfig, builtinLayout());
+  if (!maybeSite) {
+    return {};
+  }
+
+  for (const auto &host : maybeConfig->hosts) {
+    auto maybeHost = loadSiteLayout(configForHost(*maybeConfig, host), {});
+    if (!maybeHost) {
+      return {};
+    }
+    maybeSite->hosts.push_back(std::move(*maybeHost));
+  }
+  return maybeSite;
+}
+
+/// Serve the configuration, template and document root that were bundled into
+/// the executable, without touching any of them on disk.
+int runBundled(const std::filesystem::path &handoffPath) {
+  auto maybeConfigText = fetchBundledFile("/config.json");
+  if (!maybeConfigText) {
+    std::cerr << "the bundle has no configuration" << std::endl;
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  auto maybeConfig = loadBundledConfiguration(*maybeConfigText);
+  if (!maybeConfig) {
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  auto maybeLayout = builtinLayout();
+  if (!maybeLayout) {
+    maybeLayout = compiledTemplate::parse(*fetchBundledFile("/template.html"));
+  }
+  auto maybeNotFoundHtml = fetchBundledFile("/404.html");
+  if (!maybeLayout || !maybeNotFoundHtml) {
+    std::cerr << "failed to load template or 404 page from the bundle"
+              << std::endl;
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  std::cout << "Listening for connections on port " << maybeConfig->port
+            << ", serving the bundled document root ..." << std::endl;
+
+  // The bundle never changes, so there is nothing to reload.
+  startWebServer(siteSnapshot{std::move(*maybeConfig), std::move(*maybeLayout),
+                              std::string{*maybeNotFoundHtml}, {}},
+                 nullptr, handoffPath);
+
+  std::cout << "No longer listening for connections." << std::endl;
+  return static_cast<int>(Err::NONE);
+}
+
 int magenta::run() {
+  if (hasBundle()) {
+    return runBundled(handoffPath);
+  }
+
   if (!std::filesystem::exists(configPath) && !copyDefaultConfig(configPath)) {
     return static_cast<int>(Err::FILE_IO);
   }
@@ -57,32 +149,32 @@ int magenta::run() {
     return static_cast<int>(Err::FILE_IO);
   }
 
-  auto maybeConfig = validateAndLoadConfiguration(configPath);
-  if (!maybeConfig) {
+  auto maybeSite = loadSite(configPath);
+  if (!maybeSite) {
     return static_cast<int>(Err::FILE_IO);
   }
 
-  auto maybeTemplateText = fetchFileContents(maybeConfig->templatePath);
-  if (!maybeTemplateText) {
-    std::cerr << "failed to load template from template file: '"
-              << maybeConfig->templatePath.string() << "'" << std::endl;
-    return static_cast<int>(Err::FILE_IO);
+  const auto &config = maybeSite->config;
+  auto templateName = maybeSite->layout.path().empty()
+                          ? std::string{"builtin template"}
+                          : "template file '" + config.templatePath.string() +
+                                "'";
+  std::cout << "Listening for connections on port " << config.port
+            << ", with document root at '" << config.docRoot.string()
+            << "' and " << templateName << " ..." << std::endl;
+  for (const auto &host : config.hosts) {
+    std::cout << "Serving document root at '" << host.docRoot.string()
+              << "' and template file '" << host.templatePath.string()
+              << "' to";
+    for (const auto &name : host.names) {
+      std::cout << " " << name;
+    }
+    std::cout << std::endl;
   }
 
-  auto maybeNotFoundHtml =
-      load404Page(maybeConfig->docRoot, *maybeTemplateText);
-  if (!maybeNotFoundHtml) {
-    std::cerr << "failed to load 404 page content" << std::endl;
-    return static_cast<int>(Err::FILE_IO);
-  }
-
-  std::cout << "Listening for connections on port " << maybeConfig->port
-            << ", with document root at '" << maybeConfig->docRoot.string()
-            << "' and template file '" << maybeConfig->templatePath.string()
-            << "' ..." << std::endl;
-
-  startWebServer(maybeConfig->docRoot, std::move(*maybeTemplateText),
-                 std::move(*maybeNotFoundHtml), maybeConfig->port);
+  startWebServer(
+      std::move(*maybeSite),
+      [configPath = configPath] { return loadSite(configPath); }, handoffPath);
 
   std::cout << "No longer listening for connections." << std::endl;
   return static_cast<int>(Err::NONE);
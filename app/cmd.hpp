@@ -14,12 +14,17 @@ struct magenta {
   }
 
   std::filesystem::path configPath;
+  std::filesystem::path handoffPath;
   magenta() : configPath(std::filesystem::current_path() / "config.json") {}
 
   template <class F> void parse(F f) {
     f(configPath, "--config-path", "-c",
       args::help(
           "Path to configuration file (`$PWD/config.json` if not specified"));
+    f(handoffPath, "--handoff-socket", "-s",
+      args::help("Path of a Unix domain socket over which to take over the "
+                 "listening socket of an older process, and to hand it to a "
+                 "newer one (none if not specified)"));
   }
 
   int run();
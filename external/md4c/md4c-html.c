@@ -54,6 +54,7 @@ struct MD_HTML_tag {
     unsigned flags;
     int image_nesting_level;
     char escape_map[256];
+    int (*should_abort)(void*);
 };
 
 #define NEED_HTML_ESC_FLAG   0x1
@@ -520,6 +521,53 @@ text_callback(MD_TEXTTYPE type, const MD_CHAR* text, MD_SIZE size, void* userdat
     return 0;
 }
 
+static int
+abortable_enter_block_callback(MD_BLOCKTYPE type, void* detail, void* userdata)
+{
+    MD_HTML* r = (MD_HTML*) userdata;
+    int ret = r->should_abort(r->userdata);
+    return (ret != 0) ? ret : enter_block_callback(type, detail, userdata);
+}
+
+static int
+abortable_leave_block_callback(MD_BLOCKTYPE type, void* detail, void* userdata)
+{
+    MD_HTML* r = (MD_HTML*) userdata;
+    int ret = r->should_abort(r->userdata);
+    return (ret != 0) ? ret : leave_block_callback(type, detail, userdata);
+}
+
+static int
+abortable_enter_span_callback(MD_SPANTYPE type, void* detail, void* userdata)
+{
+    MD_HTML* r = (MD_HTML*) userdata;
+    int ret = r->should_abort(r->userdata);
+    return (ret != 0) ? ret : enter_span_callback(type, detail, userdata);
+}
+
+static int
+abortable_leave_span_callback(MD_SPANTYPE type, void* detail, void* userdata)
+{
+    MD_HTML* r = (MD_HTML*) userdata;
+    int ret = r->should_abort(r->userdata);
+    return (ret != 0) ? ret : leave_span_callback(type, detail, userdata);
+}
+
+static int
+abortable_text_callback(MD_TEXTTYPE type, const MD_CHAR* text, MD_SIZE size, void* userdata)
+{
+    MD_HTML* r = (MD_HTML*) userdata;
+    int ret = r->should_abort(r->userdata);
+    return (ret != 0) ? ret : text_callback(type, text, size, userdata);
+}
+
+static int
+abortable_line_callback(void* userdata)
+{
+    MD_HTML* r = (MD_HTML*) userdata;
+    return r->should_abort(r->userdata);
+}
+
 static void
 debug_log_callback(const char* msg, void* userdata)
 {
@@ -533,7 +581,17 @@ md_html(const MD_CHAR* input, MD_SIZE input_size,
         void (*process_output)(const MD_CHAR*, MD_SIZE, void*),
         void* userdata, unsigned parser_flags, unsigned renderer_flags)
 {
-    MD_HTML render = { process_output, userdata, renderer_flags, 0, { 0 } };
+    return md_html_abortable(input, input_size, process_output, NULL,
+                             userdata, parser_flags, renderer_flags);
+}
+
+int
+md_html_abortable(const MD_CHAR* input, MD_SIZE input_size,
+        void (*process_output)(const MD_CHAR*, MD_SIZE, void*),
+        int (*should_abort)(void*),
+        void* userdata, unsigned parser_flags, unsigned renderer_flags)
+{
+    MD_HTML render = { process_output, userdata, renderer_flags, 0, { 0 }, should_abort };
     int i;
 
     MD_PARSER parser = {
@@ -545,9 +603,19 @@ md_html(const MD_CHAR* input, MD_SIZE input_size,
         leave_span_callback,
         text_callback,
         debug_log_callback,
+        NULL,
         NULL
     };
 
+    if(should_abort != NULL) {
+        parser.enter_block = abortable_enter_block_callback;
+        parser.leave_block = abortable_leave_block_callback;
+        parser.enter_span = abortable_enter_span_callback;
+        parser.leave_span = abortable_leave_span_callback;
+        parser.text = abortable_text_callback;
+        parser.should_abort = abortable_line_callback;
+    }
+
     /* Build map of characters which need escaping. */
     for(i = 0; i < 256; i++) {
         unsigned char ch = (unsigned char) i;
@@ -60,6 +60,16 @@ int md_html(const MD_CHAR* input, MD_SIZE input_size,
             void (*process_output)(const MD_CHAR*, MD_SIZE, void*),
             void* userdata, unsigned parser_flags, unsigned renderer_flags);
 
+/* Same as md_html(), except that should_abort() is called with userdata
+ * before each line is parsed and before each block, span and piece of text
+ * is rendered.  As soon as it returns non-zero, rendering stops and
+ * md_html_abortable() returns that value.
+ */
+int md_html_abortable(const MD_CHAR* input, MD_SIZE input_size,
+            void (*process_output)(const MD_CHAR*, MD_SIZE, void*),
+            int (*should_abort)(void*),
+            void* userdata, unsigned parser_flags, unsigned renderer_flags);
+
 
 #ifdef __cplusplus
     }  /* extern "C" { */
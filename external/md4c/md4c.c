@@ -6318,6 +6318,12 @@ md_process_doc(MD_CTX *ctx)
         if(line == pivot_line)
             line = (line == &line_buf[0] ? &line_buf[1] : &line_buf[0]);
 
+        if(ctx->parser.should_abort != NULL) {
+            ret = ctx->parser.should_abort(ctx->userdata);
+            if(ret != 0)
+                goto abort;
+        }
+
         MD_CHECK(md_analyze_line(ctx, off, &off, pivot_line, line));
         MD_CHECK(md_process_line(ctx, &pivot_line, line));
     }
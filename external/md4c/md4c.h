@@ -378,6 +378,15 @@ typedef struct MD_PARSER {
     /* Reserved. Set to NULL.
      */
     void (*syntax)(void);
+
+    /* Optional (may be NULL).
+     *
+     * If provided, it gets called before each line of the document is
+     * analyzed, which happens before any rendering callback of the blocks the
+     * line belongs to.  As soon as it returns non-zero, parsing stops and
+     * md_parse() returns that value.
+     */
+    int (*should_abort)(void* /*userdata*/);
 } MD_PARSER;
 
 
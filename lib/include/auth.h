@@ -0,0 +1,151 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "config.h"
+
+struct mg_mgr;
+
+/// HMAC-SHA-256 of `message` under `key`, as in RFC 2104.
+std::array<uint8_t, 32> hmacSha256(std::string_view key,
+                                   std::string_view message);
+
+/// Whether sign-in may send the browser back to `uri`, which must be a path on
+/// this site.  Browsers read backslashes as slashes and drop tabs and line
+/// breaks, so `uri` may hold none of them, lest it lead to another site or
+/// break out of the `Location` header.
+bool isLocalReturnUri(std::string_view uri);
+
+/// Trades the authorization code that an OAuth provider hands to the browser
+/// for the login of the user who signed in.  The server talks to GitHub
+/// through `makeGithubExchange()`, and tests stand in for GitHub with their
+/// own exchange.
+class tokenExchange {
+public:
+  /// Login of the user, or none if the exchange failed.
+  using callback = std::function<void(std::optional<std::string> login)>;
+
+  virtual ~tokenExchange() = default;
+
+  /// Trade `code`, which the provider at index `provider` of the auth
+  /// configuration issued, and call `done` exactly once with the result,
+  /// possibly before returning.
+  virtual void exchange(size_t provider, std::string_view code,
+                        callback done) = 0;
+};
+
+/// Exchange codes with GitHub over HTTPS, through client connections in
+/// `mgr`, so that the event loop never waits for GitHub.  Returns null if the
+/// client ID or the secret of a provider is missing from the environment, if
+/// the certificates in `caBundlePath` cannot be loaded, or if the build has
+/// no TLS, and does not print errors on the console if `silent` is true.
+std::unique_ptr<tokenExchange>
+makeGithubExchange(struct mg_mgr &mgr, const struct authConfig &auth,
+                   bool silent = false);
+
+/// Sign-in through OAuth providers, with stateless sessions: a session is a
+/// cookie that carries the login, the provider and the expiry time, signed
+/// with HMAC-SHA-256, so that checking it needs no session store.  Recently
+/// verified cookies are kept in a small direct-mapped table, so that most
+/// requests cost a hash and a string comparison rather than an HMAC.  Allow
+/// and block lists are compiled into hash sets of lowercase logins.  The
+/// table takes no locks, since the event loop is its only user.  Not
+/// thread-safe.
+class sessionAuth {
+public:
+  /// Where a sign-in started, from a verified state parameter.
+  struct loginState {
+    size_t provider;
+    std::string returnUri;
+  };
+
+  /// Sign in through `exchange`, and sign sessions with the key in the
+  /// environment variable that `auth` names, or with a random key if it is
+  /// unset.  Returns null if `auth` has no providers, and does not print
+  /// errors on the console if `silent` is true.
+  static std::shared_ptr<sessionAuth>
+  create(const struct authConfig &auth,
+         std::unique_ptr<tokenExchange> exchange, bool silent = false);
+
+  /// Session token for `login`, signed in through `provider` at `now` (in
+  /// seconds since the Unix epoch).  Returns an empty string if `login` holds
+  /// characters other than letters, digits, '-' and '_'.
+  std::string issue(size_t provider, std::string_view login,
+                    int64_t now) const;
+
+  /// Login of the session in `token`, if its signature holds, it has not
+  /// expired at `now`, and its provider still admits the login.  The view
+  /// remains valid until the next call.
+  std::optional<std::string_view> verify(std::string_view token, int64_t now);
+
+  /// Whether `provider` lets `login` sign in.
+  bool admits(size_t provider, std::string_view login) const;
+
+  /// Signed OAuth state parameter for a sign-in through `provider` that
+  /// returns to `returnUri`, bound to the browser by `nonce`, which the
+  /// browser keeps in a cookie.  It expires ten minutes after `now`.  The
+  /// sign-in returns to the home page instead if `returnUri` is not a local
+  /// return URI, or if it is too long for `checkState()` to accept the state.
+  std::string signState(size_t provider, std::string_view returnUri,
+                        std::string_view nonce, int64_t now) const;
+
+  /// Where the sign-in with the OAuth state parameter `state` started, if its
+  /// signature holds, it matches `nonce` and it has not expired at `now`.
+  std::optional<loginState> checkState(std::string_view state,
+                                       std::string_view nonce,
+                                       int64_t now) const;
+
+  /// Page of `provider` where users sign in and are sent back with a code.
+  std::string authorizeUrl(size_t provider, std::string_view state) const;
+
+  /// Trade `code` through the exchange, and call `done` with a session token
+  /// if the provider admits the login, or with none.  The caller must keep
+  /// the object alive until `done` is called.
+  void finishLogin(size_t provider, std::string_view code, int64_t now,
+                   std::function<void(std::optional<std::string> token)> done);
+
+  size_t providerCount() const { return providers.size(); }
+  const std::string &providerName(size_t provider) const {
+    return providers[provider].name;
+  }
+
+  /// Lifetime of a session, in seconds.
+  uint32_t sessionSeconds() const { return lifetime; }
+
+private:
+  struct provider {
+    std::string name;
+    std::string clientId;
+    std::unordered_set<std::string> allow;
+    std::unordered_set<std::string> block;
+  };
+
+  struct verifiedToken {
+    std::string token;
+    size_t loginBegin;
+    size_t loginLength;
+    int64_t expires;
+  };
+
+  static constexpr size_t verifiedSlots = 256;
+
+  sessionAuth(std::string key, uint32_t lifetime,
+              std::vector<provider> providers,
+              std::unique_ptr<tokenExchange> exchange);
+
+  std::string sign(std::string_view purpose, std::string_view payload) const;
+
+  const std::string key;
+  const uint32_t lifetime;
+  const std::vector<provider> providers;
+  std::unique_ptr<tokenExchange> exchange;
+  std::array<verifiedToken, verifiedSlots> verified;
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <optional>
+#include <string_view>
+
+/// Files that were packed into the executable at build time (see the
+/// `MAGENTA_BUNDLE` CMake option).  The bundle holds the configuration in
+/// `/config.json`, the template (with partials inlined) in `/template.html`,
+/// the rendered 404 page in `/404.html`, pages that were rendered at build
+/// time in `/pages/<uri>`, and the remaining document root files in
+/// `/root/<uri>`.  Mongoose serves the bundle through `mg_fs_packed`.
+
+/// Whether this executable carries a bundle.
+bool hasBundle();
+
+/// Contents of the file at `path` in the bundle.  Returns none if there is no
+/// such file.  The contents live as long as the program.
+std::optional<std::string_view> fetchBundledFile(const char *path);
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// Approximate access counts in a count-min sketch whose counters saturate at
+/// 15.  Once the sketch has recorded ten times as many accesses as it has
+/// counters per row, all counters are halved, so that pages that were popular
+/// long ago gradually lose their standing.
+class frequencySketch {
+public:
+  /// Size the sketch for about `expectedEntries` distinct keys.
+  explicit frequencySketch(size_t expectedEntries);
+
+  void record(uint64_t hash);
+  uint32_t estimate(uint64_t hash) const;
+
+private:
+  static constexpr size_t rows = 4;
+  static constexpr uint8_t maxCount = 15;
+
+  size_t slot(uint64_t hash, size_t row) const;
+
+  std::vector<uint8_t> counters;
+  size_t width;
+  size_t samples = 0;
+  size_t sampleLimit;
+};
+
+/// Counters of a page cache.  `admissions` counts pages that moved from the
+/// admission window into the main cache, and `rejections` counts pages that
+/// the admission policy turned away instead.
+struct cacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t admissions = 0;
+  uint64_t rejections = 0;
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+  uint64_t maxBytes = 0;
+
+  double hitRatio() const;
+};
+
+/// Rendered pages, bounded by a memory budget, with the W-TinyLFU policy: new
+/// pages enter a small LRU window, and leave it for the main cache only if a
+/// frequency sketch says that they are requested more often than the page
+/// that they would evict.  A crawler that reads every page once therefore
+/// churns the window but leaves the pages that people read over and over
+/// alone.  The main cache is a segmented LRU, whose protected segment holds
+/// pages that were hit while on probation.  Not thread-safe.
+class pageCache {
+public:
+  using version = std::filesystem::file_time_type;
+
+  explicit pageCache(uint64_t maxBytes);
+
+  /// Return the page cached under `key`, if it was rendered from the same
+  /// `source` version.  The page remains valid until the cache changes next.
+  std::optional<std::string_view> lookup(std::string_view key, version source);
+
+  /// Offer a page that was just rendered (after a missed lookup).
+  void insert(std::string_view key, version source, std::string_view html);
+
+  /// Drop the page cached under `key`, if any, for instance because a page
+  /// that it shows changed.
+  void invalidate(std::string_view key);
+
+  /// Drop all pages, for instance because the layout changed.  Keeps the
+  /// counters and the frequency sketch.
+  void clear();
+
+  cacheStats stats() const;
+
+private:
+  enum class segment : uint8_t { WINDOW, PROBATION, PROTECTED };
+
+  struct entry {
+    std::string key;
+    std::string html;
+    version source;
+    uint64_t hash;
+    segment where;
+
+    uint64_t bytes() const { return key.length() + html.length(); }
+  };
+
+  using entryList = std::list<entry>;
+
+  entryList &listOf(segment where);
+  uint64_t &bytesOf(segment where);
+  void move(entryList::iterator it, segment to);
+  void erase(entryList::iterator it);
+  void evictWindow();
+
+  const uint64_t maxBytes;
+  const uint64_t windowMaxBytes;
+  const uint64_t protectedMaxBytes;
+
+  entryList window;
+  entryList probation;
+  entryList protectedList;
+  uint64_t windowBytes = 0;
+  uint64_t probationBytes = 0;
+  uint64_t protectedBytes = 0;
+
+  std::unordered_map<std::string_view, entryList::iterator> index;
+  frequencySketch sketch;
+  cacheStats counters;
+};
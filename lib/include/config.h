@@ -2,13 +2,107 @@
 
 #include <filesystem>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "json.hpp"
 
+struct logConfig {
+  std::filesystem::path accessLogPath;
+  uint64_t maxFileBytes;
+  uint32_t maxFiles;
+};
+
+struct traceConfig {
+  std::filesystem::path path;
+  bool enabled;
+  uint32_t maxSeconds;
+};
+
+struct limitConfig {
+  // Each client earns this many requests for rendered pages and directory
+  // listings per second, and can save up to `burst` of them.
+  uint32_t requestsPerSecond;
+  uint32_t burst;
+
+  // Most pages that may be streamed at once, or zero for no limit.
+  uint32_t maxStreams;
+};
+
+struct providerConfig {
+  // Only "github" for now.
+  std::string name;
+  std::string clientIdEnvVar;
+  std::string clientSecretEnvVar;
+
+  // Logins that may sign in through this provider, or empty to admit every
+  // login that is not in `block`.  Matching ignores case.
+  std::vector<std::string> allow;
+  std::vector<std::string> block;
+};
+
+struct authConfig {
+  std::vector<struct providerConfig> providers;
+
+  // Variable that holds the key that session cookies are signed with.  If it
+  // is unset, each process signs with a random key of its own.
+  std::string sessionSecretEnvVar;
+  uint32_t sessionSeconds;
+
+  // Certificates that the provider's servers are verified against.
+  std::filesystem::path caBundlePath;
+};
+
+/// A site that shares the server with the main site, and is selected by the
+/// `Host` header of requests.
+struct hostConfig {
+  // Host names, without ports, that select the site.  Matching ignores case.
+  std::vector<std::string> names;
+  std::filesystem::path docRoot;
+  std::filesystem::path templatePath;
+  uint64_t cacheBytes;
+};
+
 struct config {
   uint32_t port;
   std::filesystem::path docRoot;
   std::filesystem::path templatePath;
+  uint64_t streamThresholdBytes;
+
+  // Whether pages may subscribe to changes to their Markdown files over a
+  // WebSocket.  Bundled files never change, so bundles ignore this.
+  bool liveReload;
+
+  // Memory budget for rendered pages, or zero to render every request.
+  uint64_t cacheBytes;
+
+  // Whether `/_stats` reports the server's counters.
+  bool stats;
+
+  // Most entries in the Atom feed of a directory, or zero to serve no feeds.
+  uint32_t feedEntries;
+
+  // Most CPU time and HTML that rendering one page may take, or zero for no
+  // limit.  Pages that go over are served as plain Markdown instead.
+  uint32_t maxRenderMillis;
+  uint64_t maxRenderBytes;
+
+  std::optional<struct logConfig> log;
+  std::optional<struct traceConfig> trace;
+  std::optional<struct limitConfig> limits;
+
+  // Requests need a signed session cookie, if configured.  Sessions hold for
+  // all sites.
+  std::optional<struct authConfig> auth;
+
+  // Further sites, each with its own document root, template and cache.
+  // Requests whose `Host` header matches none of them go to the main site.
+  std::vector<struct hostConfig> hosts;
+
+  // Whether the configuration, document root and template are bundled into
+  // the executable, in which case `docRoot` and `templatePath` are unused.
+  bool bundled;
 };
 
 bool validateConfiguration(const nlohmann::json &configJson,
@@ -16,3 +110,14 @@ bool validateConfiguration(const nlohmann::json &configJson,
 
 std::optional<struct config>
 validateAndLoadConfiguration(const std::filesystem::path &configPath);
+
+/// Configuration of the site that `host` selects: the same as `config`, except
+/// for the document root, the template and the cache budget.
+struct config configForHost(const struct config &config,
+                            const struct hostConfig &host);
+
+/// Load the configuration in `configText`, which was bundled into the
+/// executable.  Unlike `validateAndLoadConfiguration()`, this does not require
+/// the document root and the template to exist on disk.
+std::optional<struct config>
+loadBundledConfiguration(std::string_view configText);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "meta.h"
+#include "template.h"
+
+/// Atom feeds of directories, such as `/j/feed.xml` for the journal in `/j/`.
+/// A feed holds the most recent Markdown files under its directory, at any
+/// depth, each with its first paragraph rendered as a summary.  Feeds are
+/// generated from a metadata index when first requested and kept until a
+/// file under their directory changes, so polling an unchanged feed costs one
+/// hash lookup.  Summaries are kept per file, so a change renders just the
+/// file that changed.  Not thread-safe.
+class feedStore {
+public:
+  struct feed {
+    std::string xml;
+
+    /// Strong entity tag of `xml`, quotes included.
+    std::string etag;
+  };
+
+  /// Feeds hold at most `maxEntries` files each.
+  explicit feedStore(size_t maxEntries);
+
+  /// Return the feed of the directory served under `dirUri`, which ends in a
+  /// '/', generating it from `index` if needed.  Returns null if no Markdown
+  /// file lies under the directory.  The feed remains valid until the store
+  /// changes next.
+  const feed *find(std::string_view dirUri, const metadataIndex &index);
+
+  /// Drop the feeds that include the file served under `uri`, along with its
+  /// summary.
+  void invalidate(std::string_view uri);
+
+  /// Drop all feeds and summaries.
+  void clear();
+
+private:
+  struct summary {
+    metadataIndex::version modified;
+    std::string html;
+  };
+
+  const std::string &summarize(const metadataIndex::page &page,
+                               const metadataIndex &index);
+
+  const size_t maxEntries;
+  compiledTemplate bodyOnly;
+  std::unordered_map<std::string, feed> feeds;
+  std::unordered_map<std::string, summary> summaries;
+};
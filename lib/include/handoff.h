@@ -0,0 +1,38 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+/// Unix domain socket over which a running magenta process hands its listening
+/// socket to a newer magenta process (for instance, after a binary upgrade),
+/// so that the port never goes without a listener.  Only POSIX systems support
+/// handoffs.
+class handoffSocket {
+public:
+  /// Listen for handoff requests at `path`, replacing any socket file that is
+  /// already there.  Returns none on failure and does not print errors on the
+  /// console if `silent` is true.
+  static std::optional<handoffSocket> open(const std::filesystem::path &path,
+                                           bool silent = false);
+
+  handoffSocket(handoffSocket &&other) noexcept;
+  handoffSocket &operator=(handoffSocket &&other) noexcept;
+  ~handoffSocket();
+
+  /// If a newer process is waiting for a handoff, send it `listener`.  Never
+  /// blocks.  Returns true if the listener was handed off, in which case the
+  /// socket file now belongs to the newer process.
+  bool serve(int listener);
+
+private:
+  handoffSocket(int fd, std::filesystem::path path)
+      : fd(fd), path(std::move(path)) {}
+
+  int fd = -1;
+  std::filesystem::path path;
+};
+
+/// Ask the process that listens for handoff requests at `path` for its
+/// listening socket.  Returns none if no process listens at `path`, or if it
+/// does not send a socket within a few seconds.
+std::optional<int> takeOverListener(const std::filesystem::path &path);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+/// Append `code`, the HTML-escaped text of a fenced code block whose info
+/// string names `language`, to `html`, with keywords, literals, strings,
+/// numbers, comments, preprocessor directives and shell variables wrapped in
+/// `<span class="hl-...">`.  C, C++, Python, shell and JSON are supported.
+/// Returns false, leaving `html` unchanged, for any other language.
+///
+/// Highlighted blocks are cached by a hash of `language` and `code`, so that
+/// blocks that did not change since their page was last rendered are never
+/// lexed again.
+bool appendHighlightedCode(std::pmr::string &html, std::string_view language,
+                           std::string_view code);
@@ -1,8 +1,55 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "meta.h"
+#include "template.h"
+
+/// Limits on the work of one render, with zero for no limit.
+struct renderBudget {
+  // CPU time of the rendering thread.
+  std::chrono::milliseconds cpuTime{0};
+
+  // Size of the HTML that the Markdown text turns into, which also caps the
+  // size of the Markdown text.
+  uint64_t outputBytes = 0;
+};
+
+/// Holds the renders on the current thread to `budget` while it lives, so
+/// that pathological Markdown cannot pin a core: md4c checks the thread's CPU
+/// time and the size of the HTML before each line it parses and each callback
+/// it makes, and stops the render once either goes over, in which case the
+/// render fails.  md4c works out the inlines of a block in one go, so a single
+/// block is held back only by the cap on the size of the text.  Watchdogs
+/// nest.  Streams run on threads of their own, so they take their budget when
+/// they open instead.
+class renderWatchdog {
+public:
+  explicit renderWatchdog(renderBudget budget) noexcept;
+  ~renderWatchdog();
+
+  renderWatchdog(const renderWatchdog &) = delete;
+  renderWatchdog &operator=(const renderWatchdog &) = delete;
+
+  /// Whether a render went over the budget.
+  bool tripped() const noexcept { return exceeded; }
+
+private:
+  friend class budgetMeter;
+
+  const renderBudget budget;
+  renderWatchdog *const outer;
+  bool exceeded = false;
+};
 
 /// Given some markdown text and an HTML body template, translate the markdown
 /// text into HTML and embed it into the template.  Returns none on failure and
@@ -11,6 +58,22 @@ std::optional<std::string> renderText(const std::string &markDownText,
                                       const std::string &templateText,
                                       bool silent = false);
 
+/// Same as `renderText()` above, except that the template has already been
+/// compiled, and that all temporaries and the returned page are allocated
+/// from `arena`.
+std::optional<std::pmr::string> renderText(std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent = false);
+
+/// Same as `renderText()` above, except that `uri` (the URI under which the
+/// text is served) fills the path and breadcrumb slots.
+std::optional<std::pmr::string> renderText(std::string_view uri,
+                                           std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent = false);
+
 /// Given a path to a file that contains markdown text and an HTML body
 /// template, translate the markdown text into HTML and embed it into the
 /// template.  Returns none on failure and does not print errors on the console
@@ -19,9 +82,175 @@ std::optional<std::string> renderFile(const std::filesystem::path &path,
                                       const std::string &templateText,
                                       bool silent = false);
 
+/// Same as `renderFile()` above, except that the template has already been
+/// compiled, that `uri` (the URI under which the file is served) fills the
+/// path and breadcrumb slots, and that the file contents, all temporaries and
+/// the returned page are allocated from `arena`.
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent = false);
+
+/// Same as `renderFile()` above, except that the contents of the file were
+/// already read into `markDownText`, for instance asynchronously.
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent = false);
+
+/// Same as `renderFile()` above, except that the pages in `index` that link
+/// to the file fill the backlinks slot.
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           const compiledTemplate &layout,
+                                           const metadataIndex &index,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent = false);
+
+/// Same as `renderFile()` above, except that the contents of the file were
+/// already read into `markDownText`.
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           const metadataIndex &index,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent = false);
+
+/// Called with the position of a file in the batch and its page, or none if
+/// the file could not be rendered.  The page is only valid during the call.
+using batchCallback =
+    std::function<void(size_t index, std::optional<std::string_view> html)>;
+
+/// Render each of the Markdown files in `paths` into `layout` on `threads`
+/// worker threads (as many as the hardware runs at once, if zero), and hand
+/// each page to `done` as soon as it is ready.  Pages arrive in the order in
+/// which they finish, and calls to `done` never overlap.  Each thread reuses
+/// one arena for all of its files, so that rendering a batch allocates little
+/// beyond the pages that `done` keeps.  A file whose rendering throws is
+/// handed to `done` as none, like any other file that cannot be rendered.
+/// Returns once every file has been handed to `done`, and does not print
+/// errors on the console if `silent` is true.
+void renderFiles(const std::vector<std::filesystem::path> &paths,
+                 const compiledTemplate &layout, const batchCallback &done,
+                 unsigned threads = 0, bool silent = false);
+
+/// Same as `renderFiles()` above, except that the pages are returned in the
+/// order of `paths`.
+std::vector<std::optional<std::string>>
+renderFiles(const std::vector<std::filesystem::path> &paths,
+            const compiledTemplate &layout, unsigned threads = 0,
+            bool silent = false);
+
+/// Render the page that is served for URIs that do not exist: either the
+/// `404.md` file in `docRoot`, or a generic page.  Returns none on failure and
+/// does not print errors on the console if `silent` is true.
+std::optional<std::string>
+renderNotFoundPage(const std::filesystem::path &docRoot,
+                   const compiledTemplate &layout, bool silent = false);
+
 /// Render the directory contents as an HTML page.  Returns none on failure and
 /// does not print errors on the console if `silent` is true.
 std::optional<std::string> renderDirectory(const std::string &uri,
                                            const std::filesystem::path &path,
                                            const std::string &templateText,
                                            bool silent = false);
+
+/// Same as `renderDirectory()` above, except that the template has already
+/// been compiled, and that the directory listing, all temporaries and the
+/// returned page are allocated from `arena`.
+std::optional<std::pmr::string>
+renderDirectory(std::string_view uri, const std::filesystem::path &path,
+                const compiledTemplate &layout,
+                std::pmr::memory_resource &arena, bool silent = false);
+
+/// Same as `renderDirectory()` above, except that Markdown files in `index`
+/// are listed along with their titles and dates.
+std::optional<std::pmr::string>
+renderDirectory(std::string_view uri, const std::filesystem::path &path,
+                const compiledTemplate &layout, const metadataIndex &index,
+                std::pmr::memory_resource &arena, bool silent = false);
+
+/// Render the pages in `index` that carry `tag`, newest first, or all tags if
+/// `tag` is empty.  Nothing is read from disk.  Returns none if no page
+/// carries `tag`, and does not print errors on the console if `silent` is
+/// true.
+std::optional<std::pmr::string> renderTagPage(std::string_view uri,
+                                              std::string_view tag,
+                                              const metadataIndex &index,
+                                              const compiledTemplate &layout,
+                                              std::pmr::memory_resource &arena,
+                                              bool silent = false);
+
+/// Render the links in `index` whose targets are missing, along with the
+/// pages that hold them.  Only targets that are not Markdown files are looked
+/// up on disk.  Returns none on failure and does not print errors on the
+/// console if `silent` is true.
+std::optional<std::pmr::string>
+renderBrokenLinksPage(std::string_view uri, const metadataIndex &index,
+                      const compiledTemplate &layout,
+                      std::pmr::memory_resource &arena, bool silent = false);
+
+/// Renders a Markdown file on a background thread and hands out the page in
+/// chunks, so that very large files can be sent without holding the Markdown
+/// source, the rendered HTML or the filled template in memory all at once.
+/// The source file is memory-mapped, and the renderer stalls whenever more
+/// than `windowBytes` of rendered HTML are waiting to be picked up.
+class renderStream {
+public:
+  /// Start rendering the file at `path`, served under `uri`, into `layout`.
+  /// The layout must use the body slot exactly once.  If given, the rendering
+  /// thread calls `onReady` whenever a piece of the page becomes ready, and
+  /// once rendering ends.  Rendering stops, and the stream fails, once it
+  /// goes over `budget`.  Returns null on failure and does not print errors
+  /// on the console if `silent` is true.
+  static std::unique_ptr<renderStream>
+  open(std::string_view uri, const std::filesystem::path &path,
+       const compiledTemplate &layout, size_t windowBytes,
+       std::function<void()> onReady = nullptr, renderBudget budget = {},
+       bool silent = false);
+
+  /// Same as `open()` above, except that the backlinks of the page come from
+  /// `index`, which is only read before this returns.
+  static std::unique_ptr<renderStream>
+  open(std::string_view uri, const std::filesystem::path &path,
+       const compiledTemplate &layout, const metadataIndex &index,
+       size_t windowBytes, std::function<void()> onReady = nullptr,
+       renderBudget budget = {}, bool silent = false);
+
+  /// Stops the renderer if the page was not completely handed out.
+  ~renderStream();
+
+  renderStream(const renderStream &) = delete;
+  renderStream &operator=(const renderStream &) = delete;
+
+  /// Replace the contents of `chunk` with the next piece of the page.  The
+  /// first piece is the part of the template before the body, and the last
+  /// piece is the part after the body.  The table of contents is known only
+  /// once the body is rendered, so it is filled in only after the body.
+  /// Returns false if no piece is ready yet, or if the page has been
+  /// completely handed out.
+  bool next(std::string &chunk);
+
+  /// Whether the page has been completely handed out.
+  bool done();
+
+  /// Whether rendering failed, in which case the page is incomplete.
+  bool failed();
+
+private:
+  struct producer;
+
+  explicit renderStream(std::shared_ptr<producer> state);
+
+  static std::unique_ptr<renderStream>
+  openImpl(std::string_view uri, const std::filesystem::path &path,
+           const compiledTemplate &layout, const metadataIndex *index,
+           size_t windowBytes, std::function<void()> onReady,
+           renderBudget budget, bool silent);
+
+  std::shared_ptr<producer> state;
+};
@@ -1,12 +1,44 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <optional>
 #include <string>
+#include <vector>
+
+#include "config.h"
+#include "template.h"
+
+/// Everything that pages are rendered from.  Reloading the configuration
+/// replaces the whole snapshot at once.
+struct siteSnapshot {
+  struct config config;
+  compiledTemplate layout;
+  std::string notFoundHtml;
+
+  /// Sites that the `Host` header selects, one for each entry of
+  /// `config.hosts`, in the same order.  Their own `hosts` are empty.
+  std::vector<siteSnapshot> hosts;
+};
+
+/// Loads a fresh snapshot, or returns none (after printing why) if the server
+/// should keep its current snapshot.
+using siteLoader = std::function<std::optional<siteSnapshot>()>;
 
 /// Entry point into the wikiweb library.  Start servicing HTTP connections
-/// that arrive on port `portNumber` to render pages at the `docRoot` document
-/// root using the HTML body template in `templateText`.  Show `notFoundHtml`
-/// for 404 pages.
-void startWebServer(const std::filesystem::path &docRoot,
-                    std::string templateText, std::string notFoundHtml,
-                    uint32_t portNumber);
+/// that arrive on the port in the configuration of `site` to render pages at
+/// its document root using its compiled HTML layout, showing its
+/// `notFoundHtml` for 404 pages.  When any of the layout's files change, the
+/// layout is recompiled and the 404 page is rendered again.  On SIGHUP,
+/// `reload` (if set) replaces the snapshot; responses in progress finish with
+/// the old one.  If the configuration has a log section, each response is
+/// recorded in the access log.  Requests whose `Host` header names one of
+/// the snapshot's `hosts` are served from that site instead.
+///
+/// If `handoffPath` is set, the server first tries to take over the listening
+/// socket of an older process that listens for handoff requests there, and
+/// then listens for handoff requests there itself.  After handing off its own
+/// listening socket, the server waits for its open connections to finish (for
+/// up to 30 seconds) and returns.
+void startWebServer(siteSnapshot site, siteLoader reload,
+                    const std::filesystem::path &handoffPath = {});
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+/// Token buckets that limit how often each client may request pages that are
+/// expensive to produce.  The buckets live in a fixed-size, open-addressing
+/// hash table, so memory use stays bounded however many clients show up: when
+/// every slot near a new client's home slot is taken, the bucket that was used
+/// least recently gives way.  Not thread-safe.
+class rateLimiter {
+public:
+  /// Client address, with IPv4 addresses in the first four bytes.
+  using clientKey = std::array<uint8_t, 16>;
+  using clock = std::chrono::steady_clock;
+
+  /// Key of the bucket that the client at `address` draws from.  A single
+  /// IPv6 host usually holds a whole /64, so IPv6 clients are keyed on their
+  /// /64 prefix, tagged with 6 in the last byte, except that IPv4-mapped
+  /// addresses are keyed on their IPv4 address.  IPv4 clients are keyed on
+  /// their own address.
+  static clientKey keyOf(const clientKey &address, bool ipv6);
+
+  /// Clients earn `requestsPerSecond` tokens per second and hold at most
+  /// `burst` of them (but at least one).  `capacity` is rounded up to a power
+  /// of two.
+  rateLimiter(uint32_t requestsPerSecond, uint32_t burst,
+              size_t capacity = 4096);
+
+  /// Take a token from the bucket of `client`.  Returns none if the request is
+  /// admitted, and otherwise how long the client should wait before trying
+  /// again.
+  std::optional<std::chrono::seconds> admit(const clientKey &client,
+                                            clock::time_point now);
+
+private:
+  // Slots past the home slot of a client that are searched for its bucket.
+  static constexpr size_t probeLength = 8;
+
+  struct bucket {
+    clientKey client;
+    bool used = false;
+    float tokens;
+    clock::time_point lastSeen;
+  };
+
+  bucket &find(const clientKey &client);
+
+  const float rate;
+  const float burst;
+  std::vector<bucket> buckets;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "html.h"
+
+/// Split `html`, as rendered from Markdown, into its top-level blocks (such as
+/// paragraphs, headings, lists and code blocks).  Each block keeps the text
+/// that follows it up to the next block.
+std::vector<std::string> splitHtmlBlocks(std::string_view html);
+
+/// Smallest change that turns one list of blocks into another: `removed`
+/// blocks at index `start` give way to `inserted`.
+struct blockChange {
+  size_t start;
+  size_t removed;
+  std::vector<std::string_view> inserted;
+};
+
+/// Compute the change that turns `before` into `after`.  The blocks that
+/// `inserted` refers to belong to `after`.
+blockChange diffBlocks(const std::vector<std::string> &before,
+                       const std::vector<std::string> &after);
+
+/// Format `change` as the JSON message that live reload clients expect, as in
+/// `{"start":1,"remove":1,"insert":["<p>New.</p>\n"]}`.
+std::string formatBlockChange(const blockChange &change);
+
+/// Script that pages load from `/_live.js` to receive changes to their blocks.
+/// It expects to be the last child of the element that holds the page body.
+extern const std::string_view liveReloadScript;
+
+/// A Markdown file that live reload clients are watching.  The rendered blocks
+/// of the file are kept, so that changes to the file can be sent as just the
+/// blocks that changed.
+class livePage {
+public:
+  /// Render the file at `path`, holding this and every later render to
+  /// `budget`.  Returns none on failure.
+  static std::optional<livePage> open(const std::filesystem::path &path,
+                                      renderBudget budget = {});
+
+  /// If the file changed since it was last rendered, render it again and
+  /// return the change as a message for clients.  Returns none if the file did
+  /// not change, if no block changed, or if the file cannot be rendered.  A
+  /// version of the file that goes over the budget is not rendered again until
+  /// the file changes.
+  std::optional<std::string> refresh();
+
+private:
+  livePage() = default;
+
+  bool render(std::vector<std::string> &rendered, bool &overBudget) const;
+
+  std::filesystem::path path;
+  renderBudget budget;
+  std::filesystem::file_time_type modified;
+  std::vector<std::string> blocks;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+/// Whether a response was served out of a cache.  `NONE` means that the
+/// response did not go through any cache at all.
+enum class cacheOutcome : uint8_t {
+  NONE = 0,
+  HIT,
+  MISS,
+};
+
+/// One line of the access log.  The record has a fixed size, so that pushing
+/// it into the log's ring buffer never allocates; URIs longer than
+/// `maxUriLength` are truncated.
+struct accessRecord {
+  static constexpr size_t maxMethodLength = 8;
+  static constexpr size_t maxUriLength = 224;
+
+  int64_t timestampUs;
+  uint64_t bytes;
+  uint64_t renderNs;
+  uint16_t status;
+  uint16_t uriLength;
+  uint8_t methodLength;
+  cacheOutcome cache;
+  char method[maxMethodLength];
+  char uri[maxUriLength];
+};
+
+/// Build an access record for a request that completed just now.
+accessRecord makeAccessRecord(std::string_view method, std::string_view uri,
+                              int status, uint64_t bytes,
+                              std::chrono::nanoseconds renderTime,
+                              cacheOutcome cache);
+
+/// Asynchronous access log.  Producers push records into a bounded, lock-free,
+/// multi-producer single-consumer ring buffer; a background thread drains the
+/// ring, formats records as JSON lines and writes each batch with a single
+/// `fwrite()`.  When the ring is full, records are dropped and counted rather
+/// than blocking the producer, and the drain thread notes the number of
+/// dropped records in the log.  The file is rotated to `<path>.1`, `<path>.2`,
+/// ... once it grows beyond `maxFileBytes`, keeping at most `maxFiles` rotated
+/// files.
+class accessLog {
+public:
+  /// Open (or append to) the log file at `path`.  `capacity` is rounded up to
+  /// a power of two.  Returns null on failure and does not print errors on the
+  /// console if `silent` is true.
+  static std::unique_ptr<accessLog> open(const std::filesystem::path &path,
+                                         uint64_t maxFileBytes,
+                                         uint32_t maxFiles,
+                                         size_t capacity = 8192,
+                                         bool silent = false);
+
+  /// Drains all pending records before closing the file.
+  ~accessLog();
+
+  accessLog(const accessLog &) = delete;
+  accessLog &operator=(const accessLog &) = delete;
+
+  /// Enqueue `record` without blocking.  Returns false if the ring is full, in
+  /// which case the record is dropped.
+  bool push(const accessRecord &record) noexcept;
+
+  /// Number of records dropped so far because the ring was full.
+  uint64_t droppedCount() const noexcept {
+    return dropped.load(std::memory_order_relaxed);
+  }
+
+  /// Number of records written to the log file so far.
+  uint64_t writtenCount() const noexcept {
+    return written.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct slot;
+
+  accessLog(std::FILE *file, const std::filesystem::path &path,
+            uint64_t maxFileBytes, uint32_t maxFiles, size_t capacity);
+
+  void drainLoop();
+  size_t drainInto(std::string &buffer);
+  void writeBatch(const std::string &buffer);
+  void rotate();
+
+  std::unique_ptr<slot[]> slots;
+  const uint64_t mask;
+
+  // Producers contend on `enqueuePos`, so keep it on its own cache line,
+  // away from the consumer-only `dequeuePos`.
+  alignas(64) std::atomic<uint64_t> enqueuePos{0};
+  alignas(64) uint64_t dequeuePos = 0;
+
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<bool> stopping{false};
+
+  std::FILE *file;
+  const std::filesystem::path path;
+  const uint64_t maxFileBytes;
+  const uint32_t maxFiles;
+  uint64_t fileBytes;
+  uint64_t reportedDrops = 0;
+
+  std::thread drainer;
+};
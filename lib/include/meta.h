@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/// Fields of the front matter block at the top of a Markdown file:
+///
+///     ---
+///     title: Notes on caching
+///     date: 2024-03-01
+///     tags: [performance, memory]
+///     ---
+///
+/// Other fields are ignored.  Values are raw views into the Markdown text,
+/// with surrounding quotes removed.
+struct frontMatter {
+  std::string_view title;
+  std::string_view date;
+
+  /// Tags, either as a flow list (`[a, b]`), as comma-separated text, or as
+  /// a block list of `- a` lines.  Use `forEachTag()` to split them.
+  std::string_view tags;
+
+  /// Length of the block, including both fences, which renderers skip.
+  size_t length = 0;
+};
+
+/// Parse the front matter block at the very start of `markDownText`.  Returns
+/// none if the text does not start with a complete block.
+std::optional<frontMatter> parseFrontMatter(std::string_view markDownText);
+
+/// Call `fn` with each non-empty tag in the `tags` field of a front matter
+/// block, with whitespace and quotes removed.
+template <class Fn> void forEachTag(std::string_view tags, Fn fn) {
+  auto isTrimmed = [](char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '-' ||
+           ch == '[' || ch == ']' || ch == '"' || ch == '\'';
+  };
+
+  for (auto begin = size_t{0}; begin < tags.length();) {
+    auto end = std::min(tags.find_first_of(",\n", begin), tags.length());
+    auto tag = tags.substr(begin, end - begin);
+    begin = end + 1;
+
+    while (!tag.empty() && isTrimmed(tag.front())) {
+      tag.remove_prefix(1);
+    }
+    while (!tag.empty() && isTrimmed(tag.back())) {
+      tag.remove_suffix(1);
+    }
+    if (!tag.empty()) {
+      fn(tag);
+    }
+  }
+}
+
+/// Text of the first level-one ATX heading (as in "# Title") in
+/// `markDownText` that is not inside a fenced code block, or an empty string.
+std::string_view findTitle(std::string_view markDownText);
+
+/// Parser flags of the Markdown dialect that magenta serves, shared by the
+/// renderer and by link extraction so that both see the same links.
+extern const unsigned markDownFlags;
+
+/// URIs on the site that the links in `markDownText` point to, resolved
+/// against `uri`, where the text is served.  Links to other sites and to
+/// fragments of the same page are skipped, queries and fragments are dropped,
+/// percent escapes are decoded and "." and ".." segments are removed.  Each
+/// target appears once, in order of first appearance.  Indexes call this
+/// when they scan a changed file, apart from rendering it, but text without
+/// a '[' cannot hold such links and is not parsed at all.
+std::vector<std::string> findLinks(std::string_view uri,
+                                   std::string_view markDownText);
+
+/// Metadata of one Markdown file, as an index keeps it.
+struct indexedPage {
+  std::string uri;
+  std::filesystem::file_time_type modified;
+  std::string title;
+  std::string date;
+  std::vector<std::string> tags;
+  std::vector<std::string> links;
+};
+
+/// Metadata of the Markdown text of the file served under `uri`, as of
+/// `modified`.
+indexedPage parseIndexedPage(std::string_view uri,
+                             std::filesystem::file_time_type modified,
+                             std::string_view markDownText);
+
+/// Markdown files under a document root that changed since an earlier scan.
+struct indexChanges {
+  // Files that appeared or changed.
+  std::vector<indexedPage> updated;
+
+  // URIs of files that disappeared.
+  std::vector<std::string> removed;
+};
+
+/// Walks a document root for the Markdown files that changed since its last
+/// scan, and reads and parses them.  Scanners work apart from any index, so
+/// that the walk can run on a thread other than the one that uses the index,
+/// which only has to apply the changes.  Not thread-safe.
+class indexScanner {
+public:
+  using version = std::filesystem::file_time_type;
+
+  /// Scanner that takes the files in `known`, from URIs to versions, to be
+  /// indexed already.
+  explicit indexScanner(std::filesystem::path docRoot,
+                        std::unordered_map<std::string, version> known = {});
+
+  /// Changes since the last scan.  Hidden directories, such as `.git`, are
+  /// skipped, and no file counts as removed if the walk fails part-way.
+  indexChanges scan();
+
+private:
+  std::filesystem::path docRoot;
+  std::unordered_map<std::string, version> known;
+};
+
+/// Metadata of the Markdown files under a document root, kept in columns (one
+/// vector per field, indexed by row) so that listings scan only the fields
+/// they show.  Tags are interned, and each tag keeps the rows that carry it,
+/// so a tag view never scans the whole index.  Links between pages are kept
+/// as a reverse graph, from each target to the rows that link to it, so that
+/// backlinks cost one lookup.  `refresh()` only reads files that are new or
+/// changed since the last refresh, and only `brokenLinks()` touches the disk,
+/// to look up targets that are not Markdown files.  Servers instead keep an
+/// `indexScanner` on another thread and `apply()` its changes.  Not
+/// thread-safe.
+class metadataIndex {
+public:
+  using version = std::filesystem::file_time_type;
+
+  /// Metadata of one page.  The views remain valid until the index changes.
+  struct page {
+    std::string_view uri;
+    std::string_view title;
+    std::string_view date;
+    version modified;
+  };
+
+  /// A link from the page served under `from` to the URI `to`.  The views
+  /// remain valid until the index changes.
+  struct link {
+    std::string_view from;
+    std::string_view to;
+  };
+
+  /// Called with the URI of each file that a refresh added, changed or
+  /// dropped, and of each indexed file whose backlinks changed, including
+  /// the titles that they show.
+  using changeHandler = std::function<void(std::string_view uri)>;
+
+  explicit metadataIndex(std::filesystem::path docRoot);
+
+  /// Walk the document root, index the Markdown files that appeared or
+  /// changed, and drop the ones that disappeared.  Hidden directories, such
+  /// as `.git`, are skipped.  Returns the number of files that were read.
+  size_t refresh(const changeHandler &changed = nullptr);
+
+  /// Index the files that `changes` updated and drop the ones that it
+  /// removed.  Returns the number of files that were updated.
+  size_t apply(indexChanges changes, const changeHandler &changed = nullptr);
+
+  /// Index the Markdown text of the file served under `uri`, as of
+  /// `modified`.
+  void update(std::string_view uri, version modified,
+              std::string_view markDownText);
+
+  /// Drop the file served under `uri`, if it is indexed.
+  void remove(std::string_view uri);
+
+  /// Metadata of the file served under `uri`, if it is indexed.
+  std::optional<page> find(std::string_view uri) const;
+
+  /// Pages that carry `tag`, newest first, and then by title.
+  std::vector<page> tagged(std::string_view tag) const;
+
+  /// Pages whose URIs start with `prefix`, in no particular order.
+  std::vector<page> under(std::string_view prefix) const;
+
+  /// Pages that link to the page served under `uri`, or to its directory if
+  /// it is an `index.md` file, in the order of their URIs.
+  std::vector<page> linking(std::string_view uri) const;
+
+  /// Links to Markdown files that are not indexed, and to other files that do
+  /// not exist under the document root, ordered by target and then by page.
+  std::vector<link> brokenLinks() const;
+
+  /// Each tag that some page carries, in alphabetical order, along with the
+  /// number of pages that carry it.
+  std::vector<std::pair<std::string_view, size_t>> tags() const;
+
+  /// Number of indexed pages.
+  size_t size() const { return uris.size(); }
+
+  const std::filesystem::path &root() const { return docRoot; }
+
+private:
+  uint32_t internTag(std::string_view tag);
+  void unlinkTags(uint32_t row);
+  void unlinkTargets(uint32_t row);
+  void store(indexedPage &&page);
+  void reportLinked(std::string_view target,
+                    const changeHandler &changed) const;
+  void reportLinksChanged(const std::vector<std::string> &before,
+                          const std::vector<std::string> &after,
+                          const changeHandler &changed) const;
+  page pageAt(uint32_t row) const;
+
+  std::filesystem::path docRoot;
+
+  // One entry per row.
+  std::vector<std::string> uris;
+  std::vector<std::string> titles;
+  std::vector<std::string> dates;
+  std::vector<version> versions;
+  std::vector<std::vector<uint32_t>> tagIds;
+  std::vector<std::vector<std::string>> linkTargets;
+
+  // One entry per interned tag.  Tags that no page carries any more keep
+  // their ID, with no rows.
+  std::vector<std::string> tagNames;
+  std::vector<std::vector<uint32_t>> tagRows;
+
+  std::unordered_map<std::string, uint32_t> rowOfUri;
+  std::unordered_map<std::string, uint32_t> idOfTag;
+
+  // Rows that link to each target, including targets that are not indexed.
+  std::unordered_map<std::string, std::vector<uint32_t>> linkingRows;
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "util.h"
+
+/// Bytes `first` through `last` (inclusive) of a file.
+struct byteRange {
+  uint64_t first;
+  uint64_t last;
+
+  uint64_t length() const { return last - first + 1; }
+};
+
+/// Most ranges that one request may ask for.  Requests for more get the whole
+/// file, since a flood of tiny or overlapping ranges costs more to send than
+/// the file itself.
+static constexpr size_t maxByteRanges = 16;
+
+/// Ranges of a file of `size` bytes that the `Range` header value `header`
+/// asks for, in the order requested.  Suffix ranges ("-500") and open ranges
+/// ("9500-") are resolved, and ranges that run past the end of the file are
+/// cut short.  Returns none if the header is to be ignored, because it is
+/// malformed, counts in a unit other than bytes or asks for more than
+/// `maxByteRanges` ranges, and an empty list if no range is satisfiable.
+std::optional<std::vector<byteRange>> parseRangeHeader(std::string_view header,
+                                                       uint64_t size);
+
+/// `unixSeconds` as an HTTP date, as in "Sun, 06 Nov 1994 08:49:37 GMT".
+std::string formatHttpDate(int64_t unixSeconds);
+
+/// Media type of the file at `path`, from its extension, with the same types
+/// that mongoose's `mg_http_serve_file()` knows.
+std::string_view guessContentType(const std::filesystem::path &path);
+
+/// Body of a response with ranges of a file: a single range as it is, or
+/// several as a `multipart/byteranges` body whose parts are separated by
+/// `boundary`.  The file is memory-mapped and the body is handed out in
+/// pieces that point into the mapping, so that only the requested parts of
+/// the file are ever read, and only as fast as the client takes them.
+class rangeBody {
+public:
+  /// Body with `ranges` of the file at `path`, which holds `size` bytes of
+  /// `contentType`.  Returns none if the file cannot be mapped.
+  static std::optional<rangeBody> open(const std::filesystem::path &path,
+                                       uint64_t size,
+                                       const std::vector<byteRange> &ranges,
+                                       std::string_view contentType,
+                                       std::string_view boundary);
+
+  /// Size of the whole body, for the `Content-Length` header.
+  uint64_t length() const { return total; }
+
+  /// Next piece of the body, at most `maxBytes` long, or an empty view once
+  /// the whole body has been handed out.  The view remains valid until the
+  /// next call.
+  std::string_view next(size_t maxBytes);
+
+  /// Whether the whole body has been handed out.
+  bool done() const { return current == pieces.size(); }
+
+private:
+  /// Bytes of the body, either from the file or from the part headers.
+  struct piece {
+    bool inFile;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  rangeBody(mappedFile file, std::string framing, std::vector<piece> pieces);
+
+  mappedFile file;
+  std::string framing;
+  std::vector<piece> pieces;
+  size_t current = 0;
+  uint64_t offset = 0;
+  uint64_t total = 0;
+};
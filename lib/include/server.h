@@ -2,7 +2,21 @@
 
 // Export library functions.  TODO: Separate public and private headers.
 
+#include "auth.h"
+#include "bundle.h"
+#include "cache.h"
 #include "config.h"
+#include "feed.h"
+#include "handoff.h"
 #include "html.h"
 #include "http.h"
+#include "limit.h"
+#include "live.h"
+#include "log.h"
+#include "meta.h"
+#include "range.h"
+#include "template.h"
+#include "trace.h"
+#include "uring.h"
 #include "util.h"
+#include "wakeup.h"
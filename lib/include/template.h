@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/// Values that a layout can refer to by name, as in `{{ title }}`.
+enum class templateSlot : uint8_t {
+  BODY = 0,
+  TITLE,
+  PATH,
+  BREADCRUMBS,
+  TOC,
+  MTIME,
+  DATE,
+  TAGS,
+  BACKLINKS,
+};
+
+static constexpr size_t templateSlotCount = 9;
+
+/// Values for the slots of one page.  Slots that are not set are empty.
+class slotValues {
+public:
+  std::string_view &operator[](templateSlot slot) {
+    return values[static_cast<size_t>(slot)];
+  }
+
+  std::string_view operator[](templateSlot slot) const {
+    return values[static_cast<size_t>(slot)];
+  }
+
+private:
+  std::array<std::string_view, templateSlotCount> values;
+};
+
+/// An HTML layout that has been resolved into a flat list of literal text and
+/// slots.  Layouts may include partials with `{{> name }}`, which refers to
+/// the file `name` (or `name.html`, if `name` has no extension) in the
+/// directory of the including file, and may use any of the slots in
+/// `templateSlot`, each any number of times.  Placeholders with unknown names
+/// are kept verbatim.  Filling a compiled layout never re-parses it, and the
+/// length of the page is known before any text is copied.
+class compiledTemplate {
+public:
+  /// Either literal text, which is a range of the flattened layout text, or a
+  /// slot.
+  struct segment {
+    size_t offset;
+    size_t length;
+    std::optional<templateSlot> slot;
+  };
+
+  using stringFill = void (*)(const slotValues &values, std::string &page);
+  using pmrStringFill = void (*)(const slotValues &values,
+                                 std::pmr::string &page);
+
+  /// Compile the layout in the file at `path`, along with all the partials
+  /// that it includes.  Returns none on failure and does not print errors on
+  /// the console if `silent` is true.
+  static std::optional<compiledTemplate>
+  load(const std::filesystem::path &path, bool silent = false);
+
+  /// Compile the layout in `text`.  Partials are looked up in `partialDir`.
+  /// Returns none on failure and does not print errors on the console if
+  /// `silent` is true.
+  static std::optional<compiledTemplate>
+  parse(std::string_view text, const std::filesystem::path &partialDir = {},
+        bool silent = false);
+
+  /// Wrap a layout that was compiled ahead of time into C++ (see
+  /// `tools/template.cc`).  `text` holds the literal text that `segments`
+  /// refer to, and `fill` and `pmrFill` fill the whole layout.  Nothing is
+  /// parsed.
+  static compiledTemplate precompiled(std::string_view text,
+                                      const segment *segments, size_t count,
+                                      stringFill fill, pmrStringFill pmrFill);
+
+  /// Whether any of the files that the layout was compiled from has changed
+  /// or disappeared since the layout was compiled.
+  bool isStale() const;
+
+  /// Template text that compiles to this layout, with all partials inlined.
+  std::string source() const;
+
+  /// Path of the file that the layout was loaded from, if any.
+  const std::filesystem::path &path() const { return sourcePath; }
+
+  const std::vector<segment> &segments() const { return pieces; }
+
+  /// Literal text of the layout, which literal segments refer to.
+  std::string_view literals() const { return text; }
+
+  /// Number of times that the layout refers to `slot`.
+  size_t uses(templateSlot slot) const {
+    return slotUses[static_cast<size_t>(slot)];
+  }
+
+  /// Append the segments in the range [`first`, `last`) to `page`, filling in
+  /// slots from `values`.
+  template <class String>
+  void fill(const slotValues &values, String &page, size_t first = 0,
+            size_t last = SIZE_MAX) const {
+    last = std::min(last, pieces.size());
+    if (first == 0 && last == pieces.size()) {
+      if constexpr (std::is_same_v<String, std::string>) {
+        if (precompiledFill != nullptr) {
+          precompiledFill(values, page);
+          return;
+        }
+      } else if constexpr (std::is_same_v<String, std::pmr::string>) {
+        if (precompiledPmrFill != nullptr) {
+          precompiledPmrFill(values, page);
+          return;
+        }
+      }
+    }
+
+    auto length = page.length();
+    for (auto index = first; index < last; ++index) {
+      const auto &piece = pieces[index];
+      length += piece.slot ? values[*piece.slot].length() : piece.length;
+    }
+    page.reserve(length);
+
+    for (auto index = first; index < last; ++index) {
+      const auto &piece = pieces[index];
+      if (piece.slot) {
+        page.append(values[*piece.slot]);
+      } else {
+        page.append(text, piece.offset, piece.length);
+      }
+    }
+  }
+
+private:
+  compiledTemplate() = default;
+
+  bool compileInto(std::string_view source,
+                   const std::filesystem::path &partialDir, size_t depth,
+                   bool silent);
+  void appendLiteral(std::string_view literal);
+
+  std::string text;
+  std::vector<segment> pieces;
+  std::array<size_t, templateSlotCount> slotUses{};
+  stringFill precompiledFill = nullptr;
+  pmrStringFill precompiledPmrFill = nullptr;
+
+  std::filesystem::path sourcePath;
+  std::vector<std::pair<std::filesystem::path, std::filesystem::file_time_type>>
+      dependencies;
+};
+
+/// The layout that the `MAGENTA_BUILTIN_TEMPLATE` CMake option compiles into
+/// the executable.  Only executables built with that option define it.
+compiledTemplate builtinTemplate();
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+
+/// Start recording trace spans.  Any spans recorded during an earlier
+/// tracing session that was never flushed are discarded.
+void startTracing();
+
+/// Stop recording trace spans and write all recorded spans, from all threads,
+/// to `path` in the Chrome trace-event JSON format, which Perfetto and
+/// chrome://tracing can load.  Returns false on failure and does not print
+/// errors on the console if `silent` is true.
+bool stopTracing(const std::filesystem::path &path, bool silent = false);
+
+/// Whether spans are currently being recorded.
+bool isTracing() noexcept;
+
+/// Current time on the trace clock, in nanoseconds.
+uint64_t traceNow() noexcept;
+
+/// Record a span called `name` that started at `startNs` and ended at `endNs`
+/// (both on the trace clock).  `name` must point to a string with static
+/// storage duration, since only the pointer is recorded.  `detail` (for
+/// instance, the request URI) is truncated to a small fixed length, without
+/// splitting UTF-8 sequences.  Events that cannot be stored are skipped.
+void traceComplete(const char *name, uint64_t startNs, uint64_t endNs,
+                   std::string_view detail = {}) noexcept;
+
+/// Record a zero-length event called `name` at the current time.
+void traceInstant(const char *name) noexcept;
+
+/// Scoped span that records the time between its construction and its
+/// destruction.  When tracing is off, constructing a span costs a single
+/// relaxed atomic load.
+class traceSpan {
+public:
+  explicit traceSpan(const char *name, std::string_view detail = {}) noexcept
+      : name(name), detail(detail), startNs(isTracing() ? traceNow() : 0) {}
+
+  ~traceSpan() {
+    if (startNs != 0) {
+      traceComplete(name, startNs, traceNow(), detail);
+    }
+  }
+
+  traceSpan(const traceSpan &) = delete;
+  traceSpan &operator=(const traceSpan &) = delete;
+
+private:
+  const char *name;
+  std::string_view detail;
+  uint64_t startNs;
+};
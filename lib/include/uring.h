@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+/// Reads whole files through io_uring, so that a slow disk never blocks the
+/// event loop.  Each read is a `statx` and an `openat`, followed by as many
+/// `read` requests as the file needs, and every step ends with a `send` of one
+/// byte to `wakeFd`, which the kernel issues on its own, so that the event
+/// loop wakes up to collect the result with `poll()`.  Only Linux builds with
+/// `MAGENTA_IO_URING` support the ring; elsewhere, `open()` always fails and
+/// callers read files the blocking way.  Not thread-safe.
+class ioRing {
+public:
+  /// Contents of the file, or none if it could not be read.
+  using callback = std::function<void(std::optional<std::string> contents)>;
+
+  /// Set up a ring that holds `entries` requests.  Returns null on failure and
+  /// does not print errors on the console if `silent` is true.
+  static std::unique_ptr<ioRing> open(int wakeFd, uint32_t entries = 64,
+                                      bool silent = false);
+
+  ioRing(const ioRing &) = delete;
+  ioRing &operator=(const ioRing &) = delete;
+  ~ioRing();
+
+  /// Start reading the file at `path`.  `poll()` calls `done` once the read
+  /// completes.  Returns false if the ring is full, in which case `done` is
+  /// never called.
+  bool readFile(const std::filesystem::path &path, callback done);
+
+  /// Advance the reads whose requests completed, and call the callbacks of
+  /// the reads that finished.  Never blocks.
+  void poll();
+
+  /// Number of reads in progress.
+  size_t pending() const;
+
+private:
+  struct state;
+  struct readOp;
+
+  explicit ioRing(std::unique_ptr<state> ring);
+
+  std::unique_ptr<state> ring;
+};
@@ -2,10 +2,13 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
 #include <filesystem>
 #include <locale>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
 
 /// Enum class that holds possible error values.
 enum class Err {
@@ -19,6 +22,49 @@ enum class Err {
 /// Read contents of file located at `path`.  Returns none on failure.
 std::optional<std::string> fetchFileContents(const std::filesystem::path &path);
 
+/// Same as `fetchFileContents()` above, except that the contents are allocated
+/// from `arena`.
+std::optional<std::pmr::string>
+fetchFileContents(const std::filesystem::path &path,
+                  std::pmr::memory_resource &arena);
+
+/// Read-only memory mapping of an entire file.
+class mappedFile {
+public:
+  /// Map the file at `path`.  Returns none on failure.
+  static std::optional<mappedFile> open(const std::filesystem::path &path);
+
+  mappedFile(mappedFile &&other) noexcept;
+  mappedFile &operator=(mappedFile &&other) noexcept;
+  ~mappedFile();
+
+  std::string_view contents() const { return {data, size}; }
+
+private:
+  mappedFile(const char *data, size_t size) : data(data), size(size) {}
+
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
+/// UTC calendar date and time of day.
+struct civilTime {
+  int64_t year;
+  int month;
+  int day;
+  int hour;
+  int minute;
+  int second;
+  int microsecond;
+};
+
+/// Convert `timestampUs` (microseconds since the Unix epoch) into a UTC date
+/// and time.  Unlike `std::gmtime()`, this is reentrant.
+civilTime toCivilTime(int64_t timestampUs);
+
+/// Append `text` to `buffer`, escaped for use inside a JSON string literal.
+void appendJsonEscaped(std::string &buffer, std::string_view text);
+
 static inline void lTrim(std::string &s) {
   s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](unsigned char ch) {
             return !std::isspace(ch);
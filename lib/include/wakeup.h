@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+struct mg_mgr;
+
+/// Wakes an event loop that is blocked in `mg_mgr_poll()`, so that the loop
+/// can keep a long idle timeout and still react right away to signals and to
+/// work that other threads complete.  The waker is a datagram socket pair,
+/// whose reading end the event manager watches like any other connection.
+/// Only POSIX systems support wakers.
+class loopWaker {
+public:
+  /// Register a waker with `mgr`.  Returns null on failure and does not print
+  /// errors on the console if `silent` is true.
+  static std::shared_ptr<loopWaker> open(struct mg_mgr &mgr,
+                                         bool silent = false);
+
+  loopWaker(const loopWaker &) = delete;
+  loopWaker &operator=(const loopWaker &) = delete;
+  ~loopWaker();
+
+  /// Make the current or the next poll of the event loop return.  Wakeups
+  /// that arrive before the loop gets to them are coalesced.  Safe to call
+  /// from any thread and from signal handlers, even once the event manager
+  /// is gone.
+  void wake();
+
+  /// Whether the loop was woken up since the last call.  If so, the loop
+  /// should poll again without waiting, since the poll may have visited some
+  /// connections before the work that the wakeup announced was done.
+  bool woken() { return wokenUp.exchange(false); }
+
+  /// Socket to which sending a byte wakes the loop, for wakeups that the
+  /// kernel sends on its own, as linked io_uring requests do.  Such wakeups are
+  /// not coalesced.
+  int descriptor() const { return fd; }
+
+private:
+  explicit loopWaker(int fd) : fd(fd) {}
+
+  static void handler(struct mg_connection *connection, int ev, void *evData,
+                      void *fnData);
+
+  int fd;
+  std::atomic<bool> pending{false};
+  std::atomic<bool> wokenUp{false};
+};
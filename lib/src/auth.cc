@@ -0,0 +1,662 @@
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include "auth.h"
+#include "json.hpp"
+#include "mongoose.h"
+#include "util.h"
+
+// Session tokens and states hold at most this many characters, which bounds
+// the memory of the table of verified tokens.
+static const auto maxTokenLength = size_t{256};
+
+static const auto stateSeconds = int64_t{10 * 60};
+static const auto providerTimeout = std::chrono::seconds{10};
+
+namespace {
+
+/// SHA-256, as in FIPS 180-4.
+class sha256 {
+public:
+  void update(std::string_view data) {
+    for (auto ch : data) {
+      block[blockLength++] = static_cast<uint8_t>(ch);
+      if (blockLength == block.size()) {
+        compress();
+        blockLength = 0;
+      }
+    }
+    totalLength += data.length();
+  }
+
+  std::array<uint8_t, 32> finish() {
+    auto bits = totalLength * 8;
+    auto padding = std::string(
+        (blockLength < 56 ? 56 : 120) - blockLength, '\0');
+    padding.front() = static_cast<char>(0x80);
+    update(padding);
+    for (auto shift = 56; shift >= 0; shift -= 8) {
+      block[blockLength++] = static_cast<uint8_t>(bits >> shift);
+    }
+    compress();
+
+    auto digest = std::array<uint8_t, 32>{};
+    for (auto index = size_t{0}; index < digest.size(); ++index) {
+      digest[index] =
+          static_cast<uint8_t>(state[index / 4] >> (24 - 8 * (index % 4)));
+    }
+    return digest;
+  }
+
+private:
+  static uint32_t rotate(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+  }
+
+  void compress() {
+    static const uint32_t rounds[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    uint32_t words[64];
+    for (auto index = 0; index < 16; ++index) {
+      words[index] = uint32_t{block[4 * index]} << 24 |
+                     uint32_t{block[4 * index + 1]} << 16 |
+                     uint32_t{block[4 * index + 2]} << 8 |
+                     uint32_t{block[4 * index + 3]};
+    }
+    for (auto index = 16; index < 64; ++index) {
+      auto low = words[index - 15];
+      auto high = words[index - 2];
+      words[index] = words[index - 16] +
+                     (rotate(low, 7) ^ rotate(low, 18) ^ (low >> 3)) +
+                     words[index - 7] +
+                     (rotate(high, 17) ^ rotate(high, 19) ^ (high >> 10));
+    }
+
+    auto [a, b, c, d, e, f, g, h] = state;
+    for (auto index = 0; index < 64; ++index) {
+      auto choice = (e & f) ^ (~e & g);
+      auto majority = (a & b) ^ (a & c) ^ (b & c);
+      auto first = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) +
+                   choice + rounds[index] + words[index];
+      auto second = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + majority;
+      h = g;
+      g = f;
+      f = e;
+      e = d + first;
+      d = c;
+      c = b;
+      b = a;
+      a = first + second;
+    }
+
+    auto next = std::array<uint32_t, 8>{a, b, c, d, e, f, g, h};
+    for (auto index = size_t{0}; index < state.size(); ++index) {
+      state[index] += next[index];
+    }
+  }
+
+  std::array<uint32_t, 8> state = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19};
+  std::array<uint8_t, 64> block{};
+  size_t blockLength = 0;
+  uint64_t totalLength = 0;
+};
+
+/// Client credentials of a provider.
+struct client {
+  std::string id;
+  std::string secret;
+};
+
+/// TLS context (certificates to verify providers with) that mongoose builds
+/// with `mg_tls_ctx_init()`.  Mongoose keeps one context in the manager, but
+/// the manager never owns this one: connections install it only while they
+/// set up TLS, so that a reload that fails to load new certificates leaves
+/// the context of the running exchange alone.
+using tlsContext = std::shared_ptr<void>;
+
+/// One HTTP request to a provider, over a client connection of its own.
+struct providerRequest {
+  std::string url;
+  std::string text;
+  std::function<void(int status, std::string_view body)> done;
+  std::chrono::steady_clock::time_point deadline;
+  tlsContext tls;
+  bool finished = false;
+};
+
+class githubExchange : public tokenExchange {
+public:
+  githubExchange(struct mg_mgr &mgr, std::vector<client> clients,
+                 tlsContext tls)
+      : mgr(mgr), clients(std::move(clients)), tls(std::move(tls)) {}
+
+  void exchange(size_t provider, std::string_view code,
+                callback done) override;
+
+private:
+  struct mg_mgr &mgr;
+  const std::vector<client> clients;
+  const tlsContext tls;
+};
+
+} // namespace
+
+bool isLocalReturnUri(std::string_view uri) {
+  if (uri.empty() || uri[0] != '/' || uri.compare(0, 2, "//") == 0) {
+    return false;
+  }
+  return std::none_of(uri.begin(), uri.end(), [](char ch) {
+    auto byte = static_cast<unsigned char>(ch);
+    return byte < 0x20 || byte == 0x7f || ch == '\\';
+  });
+}
+
+std::array<uint8_t, 32> hmacSha256(std::string_view key,
+                                   std::string_view message) {
+  auto block = std::string(64, '\0');
+  if (key.length() > block.length()) {
+    auto hashed = sha256{};
+    hashed.update(key);
+    auto digest = hashed.finish();
+    std::copy(digest.begin(), digest.end(), block.begin());
+  } else {
+    std::copy(key.begin(), key.end(), block.begin());
+  }
+
+  auto pad = [&block](char mask) {
+    auto padded = block;
+    for (auto &ch : padded) {
+      ch = static_cast<char>(ch ^ mask);
+    }
+    return padded;
+  };
+
+  auto inner = sha256{};
+  inner.update(pad(0x36));
+  inner.update(message);
+  auto innerDigest = inner.finish();
+
+  auto outer = sha256{};
+  outer.update(pad(0x5c));
+  outer.update({reinterpret_cast<const char *>(innerDigest.data()),
+                innerDigest.size()});
+  return outer.finish();
+}
+
+static const char base64UrlDigits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+/// Append `data` to `text` in unpadded base64url (RFC 4648), which is safe in
+/// URLs and in cookies.
+static void appendBase64Url(std::string &text, std::string_view data) {
+  auto bits = uint32_t{0};
+  auto bitCount = 0;
+  for (auto ch : data) {
+    bits = (bits << 8) | static_cast<uint8_t>(ch);
+    bitCount += 8;
+    while (bitCount >= 6) {
+      bitCount -= 6;
+      text += base64UrlDigits[(bits >> bitCount) & 0x3f];
+    }
+  }
+  if (bitCount > 0) {
+    text += base64UrlDigits[(bits << (6 - bitCount)) & 0x3f];
+  }
+}
+
+static std::optional<std::string> decodeBase64Url(std::string_view text) {
+  auto data = std::string{};
+  auto bits = uint32_t{0};
+  auto bitCount = 0;
+  for (auto ch : text) {
+    auto digit = std::string_view{base64UrlDigits}.find(ch);
+    if (digit == std::string_view::npos) {
+      return {};
+    }
+    bits = (bits << 6) | static_cast<uint32_t>(digit);
+    bitCount += 6;
+    if (bitCount >= 8) {
+      bitCount -= 8;
+      data += static_cast<char>((bits >> bitCount) & 0xff);
+    }
+  }
+  return data;
+}
+
+/// Compare in time that depends only on the lengths, so that the time of a
+/// failed check does not tell how much of a forged signature was right.
+static bool equalInConstantTime(std::string_view lhs, std::string_view rhs) {
+  if (lhs.length() != rhs.length()) {
+    return false;
+  }
+  auto difference = 0;
+  for (auto index = size_t{0}; index < lhs.length(); ++index) {
+    difference |= lhs[index] ^ rhs[index];
+  }
+  return difference == 0;
+}
+
+static bool isLogin(std::string_view login) {
+  return !login.empty() && login.length() <= 64 &&
+         std::all_of(login.begin(), login.end(), [](char ch) {
+           return std::isalnum(static_cast<unsigned char>(ch)) || ch == '-' ||
+                  ch == '_';
+         });
+}
+
+static std::string toLower(std::string_view text) {
+  auto lower = std::string{text};
+  for (auto &ch : lower) {
+    ch = static_cast<char>(std::tolower(static_cast<unsigned char>(ch)));
+  }
+  return lower;
+}
+
+/// Split `text` at its first '.' into the field before it, which is returned,
+/// and the rest, which is left in `text`.
+static std::string_view nextField(std::string_view &text) {
+  auto end = std::min(text.find('.'), text.length());
+  auto field = text.substr(0, end);
+  text.remove_prefix(std::min(end + 1, text.length()));
+  return field;
+}
+
+template <class Number>
+static std::optional<Number> parseNumber(std::string_view text) {
+  auto number = Number{};
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.length(), number);
+  if (error != std::errc{} || end != text.data() + text.length()) {
+    return {};
+  }
+  return number;
+}
+
+static void appendFormEncoded(std::string &text, std::string_view value) {
+  static const char hexDigits[] = "0123456789ABCDEF";
+  for (auto ch : value) {
+    if (std::isalnum(static_cast<unsigned char>(ch)) || ch == '-' ||
+        ch == '_' || ch == '.' || ch == '~') {
+      text += ch;
+    } else {
+      text += '%';
+      text += hexDigits[static_cast<uint8_t>(ch) >> 4];
+      text += hexDigits[static_cast<uint8_t>(ch) & 0xf];
+    }
+  }
+}
+
+static void providerRequestFn(struct mg_connection *connection, int ev,
+                              void *evData, void *fnData) {
+  auto request = static_cast<providerRequest *>(fnData);
+  if (ev == MG_EV_CONNECT) {
+    if (mg_url_is_ssl(request->url.c_str())) {
+      auto &mgr = *connection->mgr;
+      auto shared = mgr.tls_ctx;
+      mgr.tls_ctx = request->tls.get();
+      mg_tls_init(connection, mg_url_host(request->url.c_str()));
+      mgr.tls_ctx = shared;
+    }
+    mg_send(connection, request->text.data(), request->text.length());
+  } else if (ev == MG_EV_POLL &&
+             std::chrono::steady_clock::now() > request->deadline) {
+    connection->is_closing = 1;
+  } else if (ev == MG_EV_HTTP_MSG && !request->finished) {
+    auto message = static_cast<struct mg_http_message *>(evData);
+    request->finished = true;
+    request->done(mg_http_status(message),
+                  {message->body.ptr, message->body.len});
+    connection->is_closing = 1;
+  } else if (ev == MG_EV_CLOSE) {
+    if (!request->finished) {
+      request->done(0, {});
+    }
+    delete request;
+  }
+}
+
+/// Send an HTTP request to `url`, verifying the server against `tls` if the
+/// URL is HTTPS, and call `done` with the status and the body of the
+/// response, or with a zero status if the request failed or timed out.
+static void startRequest(
+    struct mg_mgr &mgr, const tlsContext &tls, const char *method,
+    const std::string &url, std::string_view headers, std::string_view body,
+    std::function<void(int status, std::string_view body)> done) {
+  auto host = mg_url_host(url.c_str());
+  auto request = new providerRequest{url, {}, std::move(done), {}, tls};
+  request->deadline = std::chrono::steady_clock::now() + providerTimeout;
+  request->text.append(method)
+      .append(" ")
+      .append(mg_url_uri(url.c_str()))
+      .append(" HTTP/1.1\r\nHost: ")
+      .append(host.ptr, host.len)
+      .append("\r\nUser-Agent: magenta\r\nConnection: close\r\n")
+      .append(headers)
+      .append("Content-Length: ")
+      .append(std::to_string(body.length()))
+      .append("\r\n\r\n")
+      .append(body);
+
+  if (mg_http_connect(&mgr, url.c_str(), providerRequestFn, request) ==
+      nullptr) {
+    request->done(0, {});
+    delete request;
+  }
+}
+
+/// Field `name` of the JSON object in `body`, if it is a string.
+static std::optional<std::string> jsonString(std::string_view body,
+                                             const char *name) {
+  auto json = nlohmann::json::parse(body, nullptr, /* allow_exceptions */
+                                    false);
+  if (!json.is_object() || !json.contains(name) || !json[name].is_string()) {
+    return {};
+  }
+  return json[name].template get<std::string>();
+}
+
+void githubExchange::exchange(size_t provider, std::string_view code,
+                              callback done) {
+  const auto &credentials = clients.at(provider);
+  auto form = std::string{"client_id="};
+  appendFormEncoded(form, credentials.id);
+  form += "&client_secret=";
+  appendFormEncoded(form, credentials.secret);
+  form += "&code=";
+  appendFormEncoded(form, code);
+
+  // The access token only serves to look up the login, and is then dropped.
+  auto &loop = mgr;
+  startRequest(
+      mgr, tls, "POST", "https://github.com/login/oauth/access_token",
+      "Accept: application/json\r\n"
+      "Content-Type: application/x-www-form-urlencoded\r\n",
+      form, [&loop, tls = tls, done](int status, std::string_view body) {
+        auto maybeToken = jsonString(body, "access_token");
+        if (status != 200 || !maybeToken) {
+          done({});
+          return;
+        }
+
+        auto headers = "Accept: application/vnd.github+json\r\n"
+                       "Authorization: Bearer " +
+                       *maybeToken + "\r\n";
+        startRequest(loop, tls, "GET", "https://api.github.com/user", headers,
+                     {}, [done](int status, std::string_view body) {
+                       auto maybeLogin = jsonString(body, "login");
+                       done(status == 200 ? maybeLogin : std::nullopt);
+                     });
+      });
+}
+
+std::unique_ptr<tokenExchange>
+makeGithubExchange(struct mg_mgr &mgr, const struct authConfig &auth,
+                   bool silent) {
+#if MG_TLS == MG_TLS_NONE
+  (void)mgr;
+  (void)auth;
+  if (!silent) {
+    std::cerr << "signing in through GitHub needs a build with TLS (see the "
+                 "`MAGENTA_TLS` CMake option)"
+              << std::endl;
+  }
+  return nullptr;
+#else
+  auto clients = std::vector<client>{};
+  for (const auto &provider : auth.providers) {
+    auto id = std::getenv(provider.clientIdEnvVar.c_str());
+    auto secret = std::getenv(provider.clientSecretEnvVar.c_str());
+    if (id == nullptr || secret == nullptr) {
+      if (!silent) {
+        std::cerr << "`" << provider.clientIdEnvVar << "` and `"
+                  << provider.clientSecretEnvVar
+                  << "` must hold the client ID and secret of the OAuth app"
+                  << std::endl;
+      }
+      return nullptr;
+    }
+    clients.push_back(client{id, secret});
+  }
+
+  auto maybeCertificates = fetchFileContents(auth.caBundlePath);
+  if (!maybeCertificates) {
+    if (!silent) {
+      std::cerr << "failed to read certificates from '"
+                << auth.caBundlePath.string() << "'" << std::endl;
+    }
+    return nullptr;
+  }
+
+  // Connections to providers verify their certificates against the bundle.
+  // The context is built in a manager of its own, so that `mgr` keeps the
+  // context of the current exchange if loading fails.
+  auto opts = mg_tls_opts{};
+  opts.client_ca = mg_str_n(maybeCertificates->data(),
+                            maybeCertificates->length());
+  auto scratch = mg_mgr{};
+  mg_tls_ctx_init(&scratch, &opts);
+  if (scratch.tls_ctx == nullptr) {
+    if (!silent) {
+      std::cerr << "failed to load certificates from '"
+                << auth.caBundlePath.string() << "'" << std::endl;
+    }
+    return nullptr;
+  }
+
+  auto tls = tlsContext{scratch.tls_ctx, [](void *context) {
+                          auto owner = mg_mgr{};
+                          owner.tls_ctx = context;
+                          mg_tls_ctx_free(&owner);
+                        }};
+  return std::make_unique<githubExchange>(mgr, std::move(clients),
+                                          std::move(tls));
+#endif
+}
+
+sessionAuth::sessionAuth(std::string key, uint32_t lifetime,
+                         std::vector<provider> providers,
+                         std::unique_ptr<tokenExchange> exchange)
+    : key(std::move(key)), lifetime(lifetime),
+      providers(std::move(providers)), exchange(std::move(exchange)),
+      verified() {}
+
+std::shared_ptr<sessionAuth>
+sessionAuth::create(const struct authConfig &auth,
+                    std::unique_ptr<tokenExchange> exchange, bool silent) {
+  if (auth.providers.empty() || !exchange) {
+    return nullptr;
+  }
+
+  auto providers = std::vector<provider>{};
+  for (const auto &config : auth.providers) {
+    auto clientId = std::getenv(config.clientIdEnvVar.c_str());
+    auto compiled = provider{config.name, clientId ? clientId : "", {}, {}};
+    for (const auto &login : config.allow) {
+      compiled.allow.insert(toLower(login));
+    }
+    for (const auto &login : config.block) {
+      compiled.block.insert(toLower(login));
+    }
+    providers.push_back(std::move(compiled));
+  }
+
+  auto secret = std::getenv(auth.sessionSecretEnvVar.c_str());
+  auto key = std::string{secret ? secret : ""};
+  if (key.empty()) {
+    if (!silent) {
+      std::cerr << "`" << auth.sessionSecretEnvVar
+                << "` is not set, so sessions end when the server restarts"
+                << std::endl;
+    }
+    key.resize(32);
+    mg_random(key.data(), key.length());
+  }
+
+  return std::shared_ptr<sessionAuth>{new sessionAuth{
+      std::move(key), auth.sessionSeconds, std::move(providers),
+      std::move(exchange)}};
+}
+
+std::string sessionAuth::sign(std::string_view purpose,
+                              std::string_view payload) const {
+  auto message = std::string{purpose};
+  message += '.';
+  message += payload;
+  auto mac = hmacSha256(key, message);
+
+  auto signature = std::string{};
+  appendBase64Url(signature,
+                  {reinterpret_cast<const char *>(mac.data()), mac.size()});
+  return signature;
+}
+
+std::string sessionAuth::issue(size_t provider, std::string_view login,
+                               int64_t now) const {
+  if (!isLogin(login)) {
+    return {};
+  }
+
+  auto token = std::to_string(now + lifetime) + "." +
+               std::to_string(provider) + "." + std::string{login};
+  token += "." + sign("session", token);
+  return token;
+}
+
+std::optional<std::string_view> sessionAuth::verify(std::string_view token,
+                                                    int64_t now) {
+  auto hash = uint64_t{14695981039346656037ull};
+  for (auto ch : token) {
+    hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ull;
+  }
+
+  // Cached tokens skip the MAC, so they must not give away how much of a
+  // guess matches either.
+  auto &slot = verified[hash % verifiedSlots];
+  if (slot.expires > now && equalInConstantTime(slot.token, token)) {
+    return std::string_view{slot.token}.substr(slot.loginBegin,
+                                               slot.loginLength);
+  }
+
+  auto signatureBegin = token.rfind('.');
+  if (token.length() > maxTokenLength ||
+      signatureBegin == std::string_view::npos ||
+      !equalInConstantTime(token.substr(signatureBegin + 1),
+                           sign("session", token.substr(0, signatureBegin)))) {
+    return {};
+  }
+
+  auto fields = token.substr(0, signatureBegin);
+  auto maybeExpires = parseNumber<int64_t>(nextField(fields));
+  auto maybeProvider = parseNumber<size_t>(nextField(fields));
+  auto login = fields;
+  if (!maybeExpires || *maybeExpires <= now || !maybeProvider ||
+      *maybeProvider >= providers.size() || !isLogin(login) ||
+      !admits(*maybeProvider, login)) {
+    return {};
+  }
+
+  slot.token.assign(token);
+  slot.loginBegin = static_cast<size_t>(login.data() - token.data());
+  slot.loginLength = login.length();
+  slot.expires = *maybeExpires;
+  return std::string_view{slot.token}.substr(slot.loginBegin,
+                                             slot.loginLength);
+}
+
+bool sessionAuth::admits(size_t provider, std::string_view login) const {
+  const auto &lists = providers.at(provider);
+  auto lower = toLower(login);
+  if (lists.block.count(lower) != 0) {
+    return false;
+  }
+  return lists.allow.empty() || lists.allow.count(lower) != 0;
+}
+
+std::string sessionAuth::signState(size_t provider, std::string_view returnUri,
+                                   std::string_view nonce, int64_t now) const {
+  if (!isLocalReturnUri(returnUri)) {
+    returnUri = "/";
+  }
+
+  auto state = std::to_string(now + stateSeconds) + "." +
+               std::to_string(provider) + "." + std::string{nonce} + ".";
+  appendBase64Url(state, returnUri);
+  state += "." + sign("state", state);
+
+  // `checkState()` turns down long states, so long URIs give way to the home
+  // page.
+  if (state.length() > maxTokenLength && returnUri != "/") {
+    return signState(provider, "/", nonce, now);
+  }
+  return state;
+}
+
+std::optional<sessionAuth::loginState>
+sessionAuth::checkState(std::string_view state, std::string_view nonce,
+                        int64_t now) const {
+  auto signatureBegin = state.rfind('.');
+  if (state.length() > maxTokenLength ||
+      signatureBegin == std::string_view::npos ||
+      !equalInConstantTime(state.substr(signatureBegin + 1),
+                           sign("state", state.substr(0, signatureBegin)))) {
+    return {};
+  }
+
+  auto fields = state.substr(0, signatureBegin);
+  auto maybeExpires = parseNumber<int64_t>(nextField(fields));
+  auto maybeProvider = parseNumber<size_t>(nextField(fields));
+  auto stateNonce = nextField(fields);
+  auto maybeReturnUri = decodeBase64Url(fields);
+  if (!maybeExpires || *maybeExpires <= now || !maybeProvider ||
+      *maybeProvider >= providers.size() || nonce.empty() ||
+      !equalInConstantTime(stateNonce, nonce) || !maybeReturnUri ||
+      !isLocalReturnUri(*maybeReturnUri)) {
+    return {};
+  }
+  return loginState{*maybeProvider, std::move(*maybeReturnUri)};
+}
+
+std::string sessionAuth::authorizeUrl(size_t provider,
+                                      std::string_view state) const {
+  auto url = std::string{"https://github.com/login/oauth/authorize?client_id="};
+  appendFormEncoded(url, providers.at(provider).clientId);
+  url += "&state=";
+  appendFormEncoded(url, state);
+  return url;
+}
+
+void sessionAuth::finishLogin(
+    size_t provider, std::string_view code, int64_t now,
+    std::function<void(std::optional<std::string> token)> done) {
+  if (provider >= providers.size()) {
+    done({});
+    return;
+  }
+
+  exchange->exchange(
+      provider, code,
+      [this, provider, now, done](std::optional<std::string> login) {
+        if (!login || !admits(provider, *login)) {
+          done({});
+          return;
+        }
+
+        auto token = issue(provider, *login, now);
+        done(token.empty() ? std::nullopt : std::optional{std::move(token)});
+      });
+}
@@ -0,0 +1,15 @@
+#include "bundle.h"
+#include "mongoose.h"
+
+bool hasBundle() { return fetchBundledFile("/template.html").has_value(); }
+
+std::optional<std::string_view> fetchBundledFile(const char *path) {
+  auto size = size_t{0};
+  auto mtime = time_t{0};
+  auto data = mg_unpack(path, &size, &mtime);
+  if (data == nullptr) {
+    return {};
+  }
+
+  return std::string_view{data, size};
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <functional>
+
+#include "cache.h"
+
+frequencySketch::frequencySketch(size_t expectedEntries) {
+  width = 64;
+  while (width < expectedEntries) {
+    width *= 2;
+  }
+  counters.resize(rows * width);
+  sampleLimit = 10 * width;
+}
+
+size_t frequencySketch::slot(uint64_t hash, size_t row) const {
+  // Derive an independent-enough hash per row from the key's hash.
+  auto mixed = (hash + row * 0x9e3779b97f4a7c15u) * 0xbf58476d1ce4e5b9u;
+  mixed ^= mixed >> 31;
+  return row * width + (mixed & (width - 1));
+}
+
+void frequencySketch::record(uint64_t hash) {
+  for (auto row = size_t{0}; row < rows; ++row) {
+    auto &counter = counters[slot(hash, row)];
+    counter = std::min<uint8_t>(counter + 1, maxCount);
+  }
+
+  samples += 1;
+  if (samples >= sampleLimit) {
+    for (auto &counter : counters) {
+      counter /= 2;
+    }
+    samples /= 2;
+  }
+}
+
+uint32_t frequencySketch::estimate(uint64_t hash) const {
+  auto count = uint32_t{maxCount};
+  for (auto row = size_t{0}; row < rows; ++row) {
+    count = std::min<uint32_t>(count, counters[slot(hash, row)]);
+  }
+  return count;
+}
+
+double cacheStats::hitRatio() const {
+  auto lookups = hits + misses;
+  return lookups == 0 ? 0.0 : static_cast<double>(hits) / lookups;
+}
+
+// Pages are about this large on average, which sizes the frequency sketch.
+static const auto typicalPageBytes = uint64_t{16} << 10;
+
+pageCache::pageCache(uint64_t maxBytes)
+    : maxBytes(maxBytes), windowMaxBytes(maxBytes / 100),
+      protectedMaxBytes((maxBytes - windowMaxBytes) / 5 * 4),
+      sketch(static_cast<size_t>(maxBytes / typicalPageBytes)) {
+  counters.maxBytes = maxBytes;
+}
+
+pageCache::entryList &pageCache::listOf(segment where) {
+  switch (where) {
+  case segment::WINDOW:
+    return window;
+  case segment::PROBATION:
+    return probation;
+  default:
+    return protectedList;
+  }
+}
+
+uint64_t &pageCache::bytesOf(segment where) {
+  switch (where) {
+  case segment::WINDOW:
+    return windowBytes;
+  case segment::PROBATION:
+    return probationBytes;
+  default:
+    return protectedBytes;
+  }
+}
+
+void pageCache::move(entryList::iterator it, segment to) {
+  bytesOf(it->where) -= it->bytes();
+  bytesOf(to) += it->bytes();
+  listOf(to).splice(listOf(to).begin(), listOf(it->where), it);
+  it->where = to;
+}
+
+void pageCache::erase(entryList::iterator it) {
+  bytesOf(it->where) -= it->bytes();
+  index.erase(it->key);
+  listOf(it->where).erase(it);
+}
+
+std::optional<std::string_view> pageCache::lookup(std::string_view key,
+                                                  version source) {
+  auto hash = static_cast<uint64_t>(std::hash<std::string_view>{}(key));
+  sketch.record(hash);
+
+  auto found = index.find(key);
+  if (found == index.end() || found->second->source != source) {
+    if (found != index.end()) {
+      erase(found->second);
+    }
+    counters.misses += 1;
+    return {};
+  }
+
+  counters.hits += 1;
+  auto it = found->second;
+  switch (it->where) {
+  case segment::WINDOW:
+    move(it, segment::WINDOW);
+    break;
+  case segment::PROBATION:
+    // A second hit proves the page worth protecting.  Pages that no longer
+    // fit into the protected segment go back on probation.
+    move(it, segment::PROTECTED);
+    while (protectedBytes > protectedMaxBytes) {
+      move(std::prev(protectedList.end()), segment::PROBATION);
+    }
+    break;
+  case segment::PROTECTED:
+    move(it, segment::PROTECTED);
+    break;
+  }
+  return std::string_view{it->html};
+}
+
+void pageCache::insert(std::string_view key, version source,
+                       std::string_view html) {
+  if (auto found = index.find(key); found != index.end()) {
+    erase(found->second);
+  }
+
+  auto hash = static_cast<uint64_t>(std::hash<std::string_view>{}(key));
+  window.push_front(entry{std::string{key}, std::string{html}, source, hash,
+                          segment::WINDOW});
+  windowBytes += window.front().bytes();
+  index.emplace(window.front().key, window.begin());
+
+  evictWindow();
+}
+
+void pageCache::evictWindow() {
+  const auto mainMaxBytes = maxBytes - windowMaxBytes;
+  while (windowBytes > windowMaxBytes) {
+    auto candidate = std::prev(window.end());
+    auto admitted = candidate->bytes() <= mainMaxBytes;
+
+    // Make room in the main cache only by evicting pages that are requested
+    // less often than the candidate.
+    auto frequency = sketch.estimate(candidate->hash);
+    while (admitted &&
+           probationBytes + protectedBytes + candidate->bytes() >
+               mainMaxBytes) {
+      auto victim = probation.empty() ? std::prev(protectedList.end())
+                                      : std::prev(probation.end());
+      if (frequency <= sketch.estimate(victim->hash)) {
+        admitted = false;
+        break;
+      }
+      erase(victim);
+      counters.evictions += 1;
+    }
+
+    if (admitted) {
+      move(candidate, segment::PROBATION);
+      counters.admissions += 1;
+    } else {
+      erase(candidate);
+      counters.rejections += 1;
+    }
+  }
+}
+
+void pageCache::invalidate(std::string_view key) {
+  auto found = index.find(key);
+  if (found != index.end()) {
+    erase(found->second);
+  }
+}
+
+void pageCache::clear() {
+  index.clear();
+  window.clear();
+  probation.clear();
+  protectedList.clear();
+  windowBytes = 0;
+  probationBytes = 0;
+  protectedBytes = 0;
+}
+
+cacheStats pageCache::stats() const {
+  auto result = counters;
+  result.entries = index.size();
+  result.bytes = windowBytes + probationBytes + protectedBytes;
+  return result;
+}
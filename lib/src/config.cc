@@ -1,36 +1,102 @@
+#include <algorithm>
 #include <iostream>
 
 #include "config.h"
 #include "util.h"
 
-bool validateCoreConfiguration(const nlohmann::json &core,
-                               bool silent = false) {
-  if (!core.contains("port")) {
+/// Validate the optional settings in the core configuration, which apply to
+/// bundled and unbundled configurations alike.
+bool validateCoreOptions(const nlohmann::json &core, bool silent = false) {
+  if (core.contains("streamThresholdBytes") &&
+      !core["streamThresholdBytes"].is_number_unsigned()) {
     if (!silent) {
-      std::cerr << "`port` value missing from core configuration" << std::endl;
+      std::cerr << "`streamThresholdBytes` in core configuration must be a "
+                   "non-negative integer"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (core.contains("liveReload") && !core["liveReload"].is_boolean()) {
+    if (!silent) {
+      std::cerr << "`liveReload` in core configuration must be a boolean"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (core.contains("cacheBytes") && !core["cacheBytes"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr << "`cacheBytes` in core configuration must be a non-negative "
+                   "integer"
+                << std::endl;
     }
     return false;
   }
 
-  if (!core.contains("docRoot")) {
+  if (core.contains("stats") && !core["stats"].is_boolean()) {
     if (!silent) {
-      std::cerr << "`docRoot` value missing from core configuration"
+      std::cerr << "`stats` in core configuration must be a boolean"
                 << std::endl;
     }
     return false;
   }
 
-  if (!core.contains("templatePath")) {
+  if (core.contains("feedEntries") &&
+      !core["feedEntries"].is_number_unsigned()) {
     if (!silent) {
-      std::cerr << "`templatePath` value missing from core configuration"
+      std::cerr << "`feedEntries` in core configuration must be a "
+                   "non-negative integer"
                 << std::endl;
     }
     return false;
   }
 
-  auto docRoot = core["docRoot"].template get<std::filesystem::path>();
+  if (core.contains("maxRenderMillis") &&
+      !core["maxRenderMillis"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr << "`maxRenderMillis` in core configuration must be a "
+                   "non-negative integer"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (core.contains("maxRenderBytes") &&
+      !core["maxRenderBytes"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr << "`maxRenderBytes` in core configuration must be a "
+                   "non-negative integer"
+                << std::endl;
+    }
+    return false;
+  }
+
+  return true;
+}
+
+/// Validate the document root and the template of a site, which `section`
+/// (such as "core configuration") describes.
+static bool validateSitePaths(const nlohmann::json &site,
+                              std::string_view section, bool silent) {
+  if (!site.contains("docRoot")) {
+    if (!silent) {
+      std::cerr << "`docRoot` value missing from " << section << std::endl;
+    }
+    return false;
+  }
+
+  if (!site.contains("templatePath")) {
+    if (!silent) {
+      std::cerr << "`templatePath` value missing from " << section
+                << std::endl;
+    }
+    return false;
+  }
+
+  auto docRoot = site["docRoot"].template get<std::filesystem::path>();
   auto templatePath =
-      core["templatePath"].template get<std::filesystem::path>();
+      site["templatePath"].template get<std::filesystem::path>();
 
   if (!std::filesystem::exists(docRoot)) {
     if (!silent) {
@@ -69,6 +135,82 @@ bool validateCoreConfiguration(const nlohmann::json &core,
   return true;
 }
 
+/// Validate one entry of `hosts` in the core configuration.
+static bool validateHostConfiguration(const nlohmann::json &host,
+                                      bool silent) {
+  const auto &names = host.contains("names") ? host["names"] : nlohmann::json{};
+  auto validNames = names.is_array() && !names.empty() &&
+                    std::all_of(names.begin(), names.end(),
+                                [](const nlohmann::json &name) {
+                                  return name.is_string();
+                                });
+  if (!validNames) {
+    if (!silent) {
+      std::cerr << "`names` in host configuration must be a non-empty array "
+                   "of strings"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (host.contains("cacheBytes") && !host["cacheBytes"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr << "`cacheBytes` in host configuration must be a non-negative "
+                   "integer"
+                << std::endl;
+    }
+    return false;
+  }
+
+  return validateSitePaths(host, "host configuration", silent);
+}
+
+bool validateCoreConfiguration(const nlohmann::json &core, bool bundled,
+                               bool silent = false) {
+  if (!core.contains("port")) {
+    if (!silent) {
+      std::cerr << "`port` value missing from core configuration" << std::endl;
+    }
+    return false;
+  }
+
+  // The document root and the template of a bundled configuration are part
+  // of the bundle, so there is nothing on disk to check.
+  if (bundled) {
+    if (core.contains("hosts")) {
+      if (!silent) {
+        std::cerr << "`hosts` in core configuration is not supported in "
+                     "bundles"
+                  << std::endl;
+      }
+      return false;
+    }
+    return validateCoreOptions(core, silent);
+  }
+
+  if (!validateSitePaths(core, "core configuration", silent)) {
+    return false;
+  }
+
+  if (core.contains("hosts")) {
+    if (!core["hosts"].is_array()) {
+      if (!silent) {
+        std::cerr << "`hosts` in core configuration must be an array"
+                  << std::endl;
+      }
+      return false;
+    }
+
+    for (const auto &host : core["hosts"]) {
+      if (!validateHostConfiguration(host, silent)) {
+        return false;
+      }
+    }
+  }
+
+  return validateCoreOptions(core, silent);
+}
+
 bool validateAuthConfiguration(const nlohmann::json &auth,
                                bool silent = false) {
   if (!auth.contains("kind")) {
@@ -129,12 +271,173 @@ bool validateAuthConfiguration(const nlohmann::json &auth,
       }
       return false;
     }
+
+    for (const auto *field : {"allow", "block"}) {
+      if (!provider.contains(field)) {
+        continue;
+      }
+
+      const auto &logins = provider[field];
+      auto valid = logins.is_array() &&
+                   std::all_of(logins.begin(), logins.end(),
+                               [](const nlohmann::json &login) {
+                                 return login.is_string();
+                               });
+      if (!valid) {
+        if (!silent) {
+          std::cerr << "`" << field
+                    << "` in provider configuration must be an array of "
+                       "strings"
+                    << std::endl;
+        }
+        return false;
+      }
+    }
+  }
+
+  if (auth.contains("sessionSecretEnvVar") &&
+      !auth["sessionSecretEnvVar"].is_string()) {
+    if (!silent) {
+      std::cerr << "`sessionSecretEnvVar` in auth configuration must be a "
+                   "string"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (auth.contains("sessionSeconds") &&
+      (!auth["sessionSeconds"].is_number_unsigned() ||
+       auth["sessionSeconds"] == 0)) {
+    if (!silent) {
+      std::cerr << "`sessionSeconds` in auth configuration must be a positive "
+                   "integer"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (auth.contains("caBundlePath") && !auth["caBundlePath"].is_string()) {
+    if (!silent) {
+      std::cerr << "`caBundlePath` in auth configuration must be a string"
+                << std::endl;
+    }
+    return false;
   }
 
   return true;
 }
 
-bool validateConfiguration(const nlohmann::json &configJson, bool silent) {
+bool validateLogConfiguration(const nlohmann::json &log, bool silent = false) {
+  if (!log.contains("accessLogPath")) {
+    if (!silent) {
+      std::cerr << "missing `accessLogPath` field for log configuration"
+                << std::endl;
+    }
+    return false;
+  }
+
+  auto accessLogPath =
+      log["accessLogPath"].template get<std::filesystem::path>();
+  auto parentPath = std::filesystem::absolute(accessLogPath).parent_path();
+  if (!std::filesystem::is_directory(parentPath)) {
+    if (!silent) {
+      std::cerr << "access log path does not point into a directory: '"
+                << accessLogPath.string() << "'" << std::endl;
+    }
+    return false;
+  }
+
+  if (log.contains("maxFileBytes") &&
+      !log["maxFileBytes"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr << "`maxFileBytes` in log configuration must be a non-negative "
+                   "integer"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (log.contains("maxFiles") && !log["maxFiles"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr
+          << "`maxFiles` in log configuration must be a non-negative integer"
+          << std::endl;
+    }
+    return false;
+  }
+
+  return true;
+}
+
+bool validateTraceConfiguration(const nlohmann::json &trace,
+                                bool silent = false) {
+  if (!trace.contains("path")) {
+    if (!silent) {
+      std::cerr << "missing `path` field for trace configuration" << std::endl;
+    }
+    return false;
+  }
+
+  auto path = trace["path"].template get<std::filesystem::path>();
+  auto parentPath = std::filesystem::absolute(path).parent_path();
+  if (!std::filesystem::is_directory(parentPath)) {
+    if (!silent) {
+      std::cerr << "trace path does not point into a directory: '"
+                << path.string() << "'" << std::endl;
+    }
+    return false;
+  }
+
+  if (trace.contains("enabled") && !trace["enabled"].is_boolean()) {
+    if (!silent) {
+      std::cerr << "`enabled` in trace configuration must be a boolean"
+                << std::endl;
+    }
+    return false;
+  }
+
+  if (trace.contains("maxSeconds") &&
+      !trace["maxSeconds"].is_number_unsigned()) {
+    if (!silent) {
+      std::cerr
+          << "`maxSeconds` in trace configuration must be a non-negative "
+             "integer"
+          << std::endl;
+    }
+    return false;
+  }
+
+  return true;
+}
+
+bool validateLimitConfiguration(const nlohmann::json &limits,
+                                bool silent = false) {
+  for (const auto *field : {"requestsPerSecond", "burst", "maxStreams"}) {
+    if (limits.contains(field) && !limits[field].is_number_unsigned()) {
+      if (!silent) {
+        std::cerr << "`" << field
+                  << "` in limits configuration must be a non-negative "
+                     "integer"
+                  << std::endl;
+      }
+      return false;
+    }
+  }
+
+  if (limits.value("requestsPerSecond", 1) == 0) {
+    if (!silent) {
+      std::cerr << "`requestsPerSecond` in limits configuration must be "
+                   "positive"
+                << std::endl;
+    }
+    return false;
+  }
+
+  return true;
+}
+
+static bool validateConfigurationImpl(const nlohmann::json &configJson,
+                                      bool bundled, bool silent) {
   if (!configJson.contains("core")) {
     if (!silent) {
       std::cerr << "core configuration missing in the configuration file"
@@ -143,7 +446,7 @@ bool validateConfiguration(const nlohmann::json &configJson, bool silent) {
     return false;
   }
 
-  if (!validateCoreConfiguration(configJson["core"], silent)) {
+  if (!validateCoreConfiguration(configJson["core"], bundled, silent)) {
     return false;
   }
 
@@ -152,9 +455,150 @@ bool validateConfiguration(const nlohmann::json &configJson, bool silent) {
     return false;
   }
 
+  if (configJson.contains("log") &&
+      !validateLogConfiguration(configJson["log"], silent)) {
+    return false;
+  }
+
+  if (configJson.contains("trace") &&
+      !validateTraceConfiguration(configJson["trace"], silent)) {
+    return false;
+  }
+
+  if (configJson.contains("limits") &&
+      !validateLimitConfiguration(configJson["limits"], silent)) {
+    return false;
+  }
+
   return true;
 }
 
+bool validateConfiguration(const nlohmann::json &configJson, bool silent) {
+  return validateConfigurationImpl(configJson, /* bundled */ false, silent);
+}
+
+static std::optional<struct config>
+loadConfiguration(std::string_view configText, const std::string &origin,
+                  bool bundled) {
+  auto parseJson =
+      [](std::string_view config) -> std::optional<nlohmann::json> {
+    try {
+      return nlohmann::json::parse(config);
+    } catch (...) {
+      return std::nullopt;
+    }
+  };
+
+  auto maybeConfigJson = parseJson(configText);
+  if (!maybeConfigJson) {
+    std::cerr << "invalid JSON in configuration file: '" << origin << "'"
+              << std::endl;
+    return std::nullopt;
+  }
+
+  auto configJson = *maybeConfigJson;
+  if (!validateConfigurationImpl(configJson, bundled, /* silent */ false)) {
+    return std::nullopt;
+  }
+
+  auto log = std::optional<struct logConfig>{};
+  if (configJson.contains("log")) {
+    const auto &logJson = configJson["log"];
+    log = logConfig{
+        logJson["accessLogPath"].template get<std::filesystem::path>(),
+        logJson.value("maxFileBytes", uint64_t{64} << 20),
+        logJson.value("maxFiles", uint32_t{4}),
+    };
+  }
+
+  auto trace = std::optional<struct traceConfig>{};
+  if (configJson.contains("trace")) {
+    const auto &traceJson = configJson["trace"];
+    trace = traceConfig{
+        traceJson["path"].template get<std::filesystem::path>(),
+        traceJson.value("enabled", false),
+        traceJson.value("maxSeconds", uint32_t{60}),
+    };
+  }
+
+  auto limits = std::optional<struct limitConfig>{};
+  if (configJson.contains("limits")) {
+    const auto &limitsJson = configJson["limits"];
+    limits = limitConfig{
+        limitsJson.value("requestsPerSecond", uint32_t{10}),
+        limitsJson.value("burst", uint32_t{20}),
+        limitsJson.value("maxStreams", uint32_t{16}),
+    };
+  }
+
+  auto auth = std::optional<struct authConfig>{};
+  if (configJson.contains("auth")) {
+    const auto &authJson = configJson["auth"];
+    auto providers = std::vector<struct providerConfig>{};
+    for (const auto &providerJson : authJson["providers"]) {
+      providers.push_back(providerConfig{
+          providerJson["name"],
+          providerJson["clientIdEnvVar"],
+          providerJson["clientSecretEnvVar"],
+          providerJson.value("allow", std::vector<std::string>{}),
+          providerJson.value("block", std::vector<std::string>{}),
+      });
+    }
+    auth = authConfig{
+        std::move(providers),
+        authJson.value("sessionSecretEnvVar",
+                       std::string{"MAGENTA_SESSION_SECRET"}),
+        authJson.value("sessionSeconds", uint32_t{7 * 24 * 60 * 60}),
+        authJson.value("caBundlePath",
+                       std::filesystem::path{
+                           "/etc/ssl/certs/ca-certificates.crt"}),
+    };
+  }
+
+  const auto &core = configJson["core"];
+  auto cacheBytes = core.value("cacheBytes", uint64_t{64} << 20);
+  auto hosts = std::vector<struct hostConfig>{};
+  if (core.contains("hosts")) {
+    for (const auto &hostJson : core["hosts"]) {
+      hosts.push_back(hostConfig{
+          hostJson["names"].template get<std::vector<std::string>>(),
+          hostJson["docRoot"].template get<std::filesystem::path>(),
+          hostJson["templatePath"].template get<std::filesystem::path>(),
+          hostJson.value("cacheBytes", cacheBytes),
+      });
+    }
+  }
+
+  return config{
+      core["port"],
+      core.value("docRoot", std::filesystem::path{}),
+      core.value("templatePath", std::filesystem::path{}),
+      core.value("streamThresholdBytes", uint64_t{16} << 20),
+      core.value("liveReload", false) && !bundled,
+      cacheBytes,
+      core.value("stats", false),
+      core.value("feedEntries", uint32_t{20}),
+      core.value("maxRenderMillis", uint32_t{1000}),
+      core.value("maxRenderBytes", uint64_t{64} << 20),
+      log,
+      trace,
+      limits,
+      std::move(auth),
+      std::move(hosts),
+      bundled,
+  };
+}
+
+struct config configForHost(const struct config &config,
+                            const struct hostConfig &host) {
+  auto site = config;
+  site.docRoot = host.docRoot;
+  site.templatePath = host.templatePath;
+  site.cacheBytes = host.cacheBytes;
+  site.hosts.clear();
+  return site;
+}
+
 std::optional<struct config>
 validateAndLoadConfiguration(const std::filesystem::path &configPath) {
   if (!std::filesystem::exists(configPath)) {
@@ -178,30 +622,11 @@ validateAndLoadConfiguration(const std::filesystem::path &configPath) {
     return std::nullopt;
   }
 
-  auto parseJson =
-      [](const std::string &config) -> std::optional<nlohmann::json> {
-    try {
-      return nlohmann::json::parse(config);
-    } catch (...) {
-      return std::nullopt;
-    }
-  };
-
-  auto maybeConfigJson = parseJson(*maybeConfig);
-  if (!maybeConfigJson) {
-    std::cerr << "invalid JSON in configuration file: '" << configPath.string()
-              << "'" << std::endl;
-    return std::nullopt;
-  }
-
-  auto configJson = *maybeConfigJson;
-  if (!validateConfiguration(configJson)) {
-    return std::nullopt;
-  }
+  return loadConfiguration(*maybeConfig, configPath.string(),
+                           /* bundled */ false);
+}
 
-  return config{
-      configJson["core"]["port"],
-      configJson["core"]["docRoot"].template get<std::filesystem::path>(),
-      configJson["core"]["templatePath"].template get<std::filesystem::path>(),
-  };
+std::optional<struct config>
+loadBundledConfiguration(std::string_view configText) {
+  return loadConfiguration(configText, "<bundle>", /* bundled */ true);
 }
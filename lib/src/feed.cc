@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+#include "feed.h"
+#include "html.h"
+#include "live.h"
+#include "util.h"
+
+static void appendXmlEscaped(std::string &xml, std::string_view text) {
+  for (auto ch : text) {
+    switch (ch) {
+    case '&':
+      xml += "&amp;";
+      break;
+    case '<':
+      xml += "&lt;";
+      break;
+    case '>':
+      xml += "&gt;";
+      break;
+    case '"':
+      xml += "&quot;";
+      break;
+    default:
+      xml += ch;
+    }
+  }
+}
+
+/// RFC 3339 timestamp of an entry: its front matter date, if it starts with a
+/// `YYYY-MM-DD` date, or else the modification time of its file.
+static std::string entryTimestamp(const metadataIndex::page &page) {
+  auto isDate = page.date.length() >= 10 && page.date[4] == '-' &&
+                page.date[7] == '-' &&
+                std::all_of(page.date.begin(), page.date.begin() + 4,
+                            [](char ch) { return ch >= '0' && ch <= '9'; });
+  if (isDate) {
+    return std::string{page.date.substr(0, 10)} + "T00:00:00Z";
+  }
+
+  // C++17 has no conversion between the file clock and the system clock, so
+  // translate the time through the current time on both clocks.
+  auto sinceEpoch = std::chrono::duration_cast<std::chrono::microseconds>(
+      page.modified - std::filesystem::file_time_type::clock::now() +
+      std::chrono::system_clock::now().time_since_epoch());
+  auto time = toCivilTime(sinceEpoch.count());
+
+  char text[32];
+  auto length = std::snprintf(
+      text, sizeof(text), "%04lld-%02d-%02dT%02d:%02d:%02dZ",
+      static_cast<long long>(time.year), time.month, time.day, time.hour,
+      time.minute, time.second);
+  return {text, static_cast<size_t>(length)};
+}
+
+/// FNV-1a hash of `text`, as a quoted entity tag.
+static std::string makeEtag(std::string_view text) {
+  auto hash = uint64_t{14695981039346656037ull};
+  for (auto ch : text) {
+    hash = (hash ^ static_cast<unsigned char>(ch)) * 1099511628211ull;
+  }
+
+  char etag[24];
+  auto length = std::snprintf(etag, sizeof(etag), "\"%016llx\"",
+                              static_cast<unsigned long long>(hash));
+  return {etag, static_cast<size_t>(length)};
+}
+
+feedStore::feedStore(size_t maxEntries)
+    : maxEntries(maxEntries),
+      bodyOnly(*compiledTemplate::parse("{{ body }}")) {}
+
+const feedStore::feed *feedStore::find(std::string_view dirUri,
+                                       const metadataIndex &index) {
+  auto key = std::string{dirUri};
+  if (auto found = feeds.find(key); found != feeds.end()) {
+    return &found->second;
+  }
+
+  // The page of the directory itself describes the feed rather than being an
+  // entry of it.
+  auto indexUri = key + "index.md";
+  auto entries = std::vector<std::pair<std::string, metadataIndex::page>>{};
+  for (const auto &page : index.under(dirUri)) {
+    if (page.uri != indexUri) {
+      entries.emplace_back(entryTimestamp(page), page);
+    }
+  }
+  if (entries.empty()) {
+    return nullptr;
+  }
+
+  auto newest = std::min(entries.size(), maxEntries);
+  std::partial_sort(entries.begin(), entries.begin() + newest, entries.end(),
+                    [](const auto &lhs, const auto &rhs) {
+                      return lhs.first != rhs.first
+                                 ? lhs.first > rhs.first
+                                 : lhs.second.uri < rhs.second.uri;
+                    });
+  entries.resize(newest);
+
+  auto title = std::string_view{dirUri};
+  auto dirPage = index.find(indexUri);
+  if (dirPage && !dirPage->title.empty()) {
+    title = dirPage->title;
+  }
+
+  auto xml = std::string{"<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                         "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"};
+  xml += "  <title>";
+  appendXmlEscaped(xml, title);
+  xml += "</title>\n  <id>urn:magenta:";
+  appendXmlEscaped(xml, dirUri);
+  xml += "</id>\n  <link rel=\"self\" href=\"";
+  appendXmlEscaped(xml, dirUri);
+  xml += "feed.xml\"/>\n  <updated>";
+  xml += entries.front().first;
+  xml += "</updated>\n";
+
+  for (const auto &[updated, page] : entries) {
+    xml += "  <entry>\n    <title>";
+    appendXmlEscaped(xml, page.title.empty() ? page.uri : page.title);
+    xml += "</title>\n    <id>urn:magenta:";
+    appendXmlEscaped(xml, page.uri);
+    xml += "</id>\n    <link href=\"";
+    appendXmlEscaped(xml, page.uri);
+    xml += "\"/>\n    <updated>";
+    xml += updated;
+    xml += "</updated>\n    <summary type=\"html\">";
+    appendXmlEscaped(xml, summarize(page, index));
+    xml += "</summary>\n  </entry>\n";
+  }
+  xml += "</feed>\n";
+
+  auto etag = makeEtag(xml);
+  auto inserted =
+      feeds.emplace(std::move(key), feed{std::move(xml), std::move(etag)});
+  return &inserted.first->second;
+}
+
+const std::string &feedStore::summarize(const metadataIndex::page &page,
+                                        const metadataIndex &index) {
+  auto &entry = summaries[std::string{page.uri}];
+  if (entry.modified == page.modified) {
+    return entry.html;
+  }
+
+  entry.modified = page.modified;
+  entry.html.clear();
+
+  auto path = index.root();
+  path += page.uri;
+  path.make_preferred();
+
+  auto arena = std::pmr::monotonic_buffer_resource{};
+  auto maybeHtml = renderFile(page.uri, path, bodyOnly, arena,
+                              /* silent */ true);
+  if (!maybeHtml) {
+    return entry.html;
+  }
+
+  // The summary is the first paragraph.
+  for (auto &block : splitHtmlBlocks(*maybeHtml)) {
+    if (block.compare(0, 3, "<p>") == 0) {
+      entry.html = std::move(block);
+      while (!entry.html.empty() && entry.html.back() == '\n') {
+        entry.html.pop_back();
+      }
+      break;
+    }
+  }
+  return entry.html;
+}
+
+void feedStore::invalidate(std::string_view uri) {
+  summaries.erase(std::string{uri});
+  for (auto it = feeds.begin(); it != feeds.end();) {
+    if (uri.compare(0, it->first.length(), it->first) == 0) {
+      it = feeds.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void feedStore::clear() {
+  feeds.clear();
+  summaries.clear();
+}
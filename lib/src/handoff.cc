@@ -0,0 +1,182 @@
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "handoff.h"
+
+#ifndef _WIN32
+/// Fill in the address of the Unix domain socket at `path`.  Returns false if
+/// `path` is too long for a socket address.
+static bool makeAddress(const std::filesystem::path &path,
+                        struct sockaddr_un &address) {
+  address = sockaddr_un{};
+  address.sun_family = AF_UNIX;
+
+  const auto &native = path.native();
+  if (native.length() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  std::memcpy(address.sun_path, native.c_str(), native.length() + 1);
+  return true;
+}
+
+std::optional<handoffSocket>
+handoffSocket::open(const std::filesystem::path &path, bool silent) {
+  auto address = sockaddr_un{};
+  if (!makeAddress(path, address)) {
+    if (!silent) {
+      std::cerr << "handoff socket path is too long: " << path << std::endl;
+    }
+    return {};
+  }
+
+  auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    if (!silent) {
+      std::cerr << "failed to create handoff socket" << std::endl;
+    }
+    return {};
+  }
+
+  // The socket file of an earlier process is either stale, or that process
+  // already handed off its listener.
+  ::unlink(path.c_str());
+  if (::bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+             sizeof(address)) != 0 ||
+      ::listen(fd, 1) != 0 ||
+      ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+    if (!silent) {
+      std::cerr << "failed to listen on handoff socket: " << path << std::endl;
+    }
+    ::close(fd);
+    return {};
+  }
+
+  return handoffSocket{fd, path};
+}
+
+handoffSocket::~handoffSocket() {
+  if (fd >= 0) {
+    ::close(fd);
+    ::unlink(path.c_str());
+  }
+}
+
+bool handoffSocket::serve(int listener) {
+  if (fd < 0) {
+    return false;
+  }
+
+  auto peer = ::accept(fd, nullptr, nullptr);
+  if (peer < 0) {
+    return false;
+  }
+
+  // The socket travels in the ancillary data of a one-byte message.
+  auto byte = 'm';
+  auto chunk = iovec{&byte, 1};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+  auto message = msghdr{};
+  message.msg_iov = &chunk;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  auto header = CMSG_FIRSTHDR(&message);
+  header->cmsg_level = SOL_SOCKET;
+  header->cmsg_type = SCM_RIGHTS;
+  header->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(header), &listener, sizeof(int));
+
+  auto sent = ::sendmsg(peer, &message, 0) == 1;
+  ::close(peer);
+  if (!sent) {
+    return false;
+  }
+
+  // The newer process replaces the socket file with its own, so leave the
+  // file alone from now on.
+  ::close(fd);
+  fd = -1;
+  return true;
+}
+
+std::optional<int> takeOverListener(const std::filesystem::path &path) {
+  auto address = sockaddr_un{};
+  if (!makeAddress(path, address)) {
+    return {};
+  }
+
+  auto fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return {};
+  }
+
+  // The older process only checks for handoff requests between polls.
+  auto timeout = timeval{5, 0};
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (::connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+                sizeof(address)) != 0) {
+    ::close(fd);
+    return {};
+  }
+
+  auto byte = char{};
+  auto chunk = iovec{&byte, 1};
+  alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+  auto message = msghdr{};
+  message.msg_iov = &chunk;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  auto received = ::recvmsg(fd, &message, 0);
+  ::close(fd);
+
+  auto header = CMSG_FIRSTHDR(&message);
+  if (received != 1 || header == nullptr || header->cmsg_level != SOL_SOCKET ||
+      header->cmsg_type != SCM_RIGHTS) {
+    return {};
+  }
+
+  auto listener = -1;
+  std::memcpy(&listener, CMSG_DATA(header), sizeof(int));
+  return listener;
+}
+#else
+std::optional<handoffSocket>
+handoffSocket::open(const std::filesystem::path &path, bool silent) {
+  if (!silent) {
+    std::cerr << "socket handoff is not supported on this platform: " << path
+              << std::endl;
+  }
+  return {};
+}
+
+handoffSocket::~handoffSocket() {}
+
+bool handoffSocket::serve(int) { return false; }
+
+std::optional<int> takeOverListener(const std::filesystem::path &) {
+  return {};
+}
+#endif
+
+handoffSocket::handoffSocket(handoffSocket &&other) noexcept
+    : fd(std::exchange(other.fd, -1)), path(std::move(other.path)) {}
+
+handoffSocket &handoffSocket::operator=(handoffSocket &&other) noexcept {
+  std::swap(fd, other.fd);
+  std::swap(path, other.path);
+  return *this;
+}
@@ -0,0 +1,424 @@
+#include <algorithm>
+#include <cctype>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "highlight.h"
+
+/// Lexical rules of one language.
+struct lexerRules {
+  /// Names that fenced code blocks use for the language.
+  std::vector<std::string_view> names;
+
+  /// Words that are highlighted as keywords or as literals.  Both lists are
+  /// sorted, so that they can be searched by bisection.
+  std::vector<std::string_view> keywords;
+  std::vector<std::string_view> literals;
+
+  std::string_view lineComment;
+  std::string_view blockCommentOpen;
+  std::string_view blockCommentClose;
+
+  /// Characters that open (and close) strings.
+  std::string_view quotes;
+
+  /// Whether '#' at the start of a line begins a preprocessor directive.
+  bool preprocessor;
+
+  /// Whether `"""` and `'''` begin strings.
+  bool tripleQuotes;
+
+  /// Whether strings may span lines.
+  bool multilineStrings;
+
+  /// Whether '$' begins a variable.
+  bool variables;
+};
+
+static std::vector<std::string_view>
+sortedWords(std::vector<std::string_view> words) {
+  std::sort(words.begin(), words.end());
+  return words;
+}
+
+static const std::vector<std::string_view> cKeywords = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do",
+    "double", "else", "enum", "extern", "float", "for", "goto", "if", "inline",
+    "int", "long", "register", "restrict", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned",
+    "void", "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Bool",
+    "_Generic", "_Noreturn", "_Static_assert", "_Thread_local",
+};
+
+static std::vector<std::string_view> cppKeywords() {
+  auto keywords = cKeywords;
+  keywords.insert(
+      keywords.end(),
+      {
+          "alignas", "alignof", "and", "asm", "bool", "catch", "char16_t",
+          "char32_t", "char8_t", "class", "co_await", "co_return", "co_yield",
+          "concept", "const_cast", "consteval", "constexpr", "constinit",
+          "decltype", "delete", "dynamic_cast", "explicit", "export", "final",
+          "friend", "mutable", "namespace", "new", "noexcept", "not",
+          "operator", "or", "override", "private", "protected", "public",
+          "reinterpret_cast", "requires", "static_assert", "static_cast",
+          "template", "this", "thread_local", "throw", "try", "typeid",
+          "typename", "using", "virtual", "wchar_t", "xor",
+      });
+  return sortedWords(std::move(keywords));
+}
+
+static const lexerRules languages[] = {
+    {
+        {"c", "h"},
+        sortedWords(cKeywords),
+        sortedWords({"NULL", "false", "true"}),
+        "//",
+        "/*",
+        "*/",
+        "\"'",
+        /* preprocessor */ true,
+        /* tripleQuotes */ false,
+        /* multilineStrings */ false,
+        /* variables */ false,
+    },
+    {
+        {"cpp", "c++", "cc", "cxx", "hpp", "hxx"},
+        cppKeywords(),
+        sortedWords({"NULL", "false", "nullptr", "true"}),
+        "//",
+        "/*",
+        "*/",
+        "\"'",
+        /* preprocessor */ true,
+        /* tripleQuotes */ false,
+        /* multilineStrings */ false,
+        /* variables */ false,
+    },
+    {
+        {"python", "py", "python3"},
+        sortedWords({
+            "and", "as", "assert", "async", "await", "break", "case", "class",
+            "continue", "def", "del", "elif", "else", "except", "finally",
+            "for", "from", "global", "if", "import", "in", "is", "lambda",
+            "match", "nonlocal", "not", "or", "pass", "raise", "return", "try",
+            "while", "with", "yield",
+        }),
+        sortedWords({"False", "None", "True"}),
+        "#",
+        {},
+        {},
+        "\"'",
+        /* preprocessor */ false,
+        /* tripleQuotes */ true,
+        /* multilineStrings */ false,
+        /* variables */ false,
+    },
+    {
+        {"sh", "bash", "shell", "zsh"},
+        sortedWords({
+            "break", "case", "continue", "declare", "do", "done", "elif",
+            "else", "esac", "exit", "export", "fi", "for", "function", "if",
+            "in", "local", "readonly", "return", "select", "then", "time",
+            "unset", "until", "while",
+        }),
+        {},
+        "#",
+        {},
+        {},
+        "\"'",
+        /* preprocessor */ false,
+        /* tripleQuotes */ false,
+        /* multilineStrings */ true,
+        /* variables */ true,
+    },
+    {
+        {"json"},
+        {},
+        sortedWords({"false", "null", "true"}),
+        {},
+        {},
+        {},
+        "\"",
+        /* preprocessor */ false,
+        /* tripleQuotes */ false,
+        /* multilineStrings */ false,
+        /* variables */ false,
+    },
+};
+
+static const lexerRules *findRules(std::string_view language) {
+  auto equalsIgnoringCase = [language](std::string_view name) {
+    return std::equal(language.begin(), language.end(), name.begin(),
+                      name.end(), [](char lhs, char rhs) {
+                        return std::tolower(static_cast<unsigned char>(lhs)) ==
+                               rhs;
+                      });
+  };
+
+  for (const auto &rules : languages) {
+    if (std::any_of(rules.names.begin(), rules.names.end(),
+                    equalsIgnoringCase)) {
+      return &rules;
+    }
+  }
+  return nullptr;
+}
+
+/// Undo the escaping that md4c applies to the text of code blocks.
+static std::string unescapeHtml(std::string_view text) {
+  static const std::pair<std::string_view, char> entities[] = {
+      {"&amp;", '&'}, {"&lt;", '<'}, {"&gt;", '>'}, {"&quot;", '"'}};
+
+  auto result = std::string{};
+  result.reserve(text.length());
+  while (!text.empty()) {
+    auto ampersand = text.find('&');
+    result.append(text.substr(0, ampersand));
+    if (ampersand == std::string_view::npos) {
+      break;
+    }
+
+    text.remove_prefix(ampersand);
+    auto entity = std::find_if(std::begin(entities), std::end(entities),
+                               [text](const auto &pair) {
+                                 return text.substr(0, pair.first.length()) ==
+                                        pair.first;
+                               });
+    if (entity == std::end(entities)) {
+      result += '&';
+      text.remove_prefix(1);
+    } else {
+      result += entity->second;
+      text.remove_prefix(entity->first.length());
+    }
+  }
+  return result;
+}
+
+static void appendEscaped(std::string &html, std::string_view text) {
+  for (auto ch : text) {
+    switch (ch) {
+    case '&':
+      html += "&amp;";
+      break;
+    case '<':
+      html += "&lt;";
+      break;
+    case '>':
+      html += "&gt;";
+      break;
+    case '"':
+      html += "&quot;";
+      break;
+    default:
+      html += ch;
+    }
+  }
+}
+
+static bool isWordChar(char ch) {
+  return std::isalnum(static_cast<unsigned char>(ch)) != 0 || ch == '_';
+}
+
+static bool isSpace(char ch) {
+  return std::isspace(static_cast<unsigned char>(ch)) != 0;
+}
+
+/// Find the end of the token that starts at `at` in `code`, along with its
+/// class (or null, if the token is not highlighted).
+static std::pair<size_t, const char *>
+scanToken(const lexerRules &rules, std::string_view code, size_t at,
+          bool lineStart) {
+  auto startsWith = [code, at](std::string_view prefix) {
+    return !prefix.empty() && code.substr(at, prefix.length()) == prefix;
+  };
+  auto endOfLine = [code](size_t from) {
+    return std::min(code.find('\n', from), code.length());
+  };
+  auto until = [code](std::string_view close, size_t from) {
+    auto end = code.find(close, from);
+    return end == std::string_view::npos ? code.length()
+                                         : end + close.length();
+  };
+
+  auto ch = code[at];
+  auto previous = at == 0 ? '\n' : code[at - 1];
+
+  // In shell scripts, '#' only starts a comment at the start of a word.
+  if (startsWith(rules.lineComment) &&
+      (!rules.variables || isSpace(previous))) {
+    return {endOfLine(at), "com"};
+  }
+
+  if (startsWith(rules.blockCommentOpen)) {
+    return {until(rules.blockCommentClose,
+                  at + rules.blockCommentOpen.length()),
+            "com"};
+  }
+
+  if (rules.preprocessor && lineStart && ch == '#') {
+    auto end = endOfLine(at);
+    while (end < code.length() && code[end - 1] == '\\') {
+      end = endOfLine(end + 1);
+    }
+    return {end, "pp"};
+  }
+
+  if (rules.tripleQuotes && (startsWith("\"\"\"") || startsWith("'''"))) {
+    return {until(code.substr(at, 3), at + 3), "str"};
+  }
+
+  if (rules.quotes.find(ch) != std::string_view::npos) {
+    auto end = at + 1;
+    while (end < code.length() && code[end] != ch &&
+           (rules.multilineStrings || code[end] != '\n')) {
+      end += code[end] == '\\' ? 2 : 1;
+    }
+    return {std::min(end + 1, code.length()), "str"};
+  }
+
+  auto isDigit = [](char digit) {
+    return std::isdigit(static_cast<unsigned char>(digit)) != 0;
+  };
+  if (!isWordChar(previous) &&
+      (isDigit(ch) ||
+       (ch == '.' && at + 1 < code.length() && isDigit(code[at + 1])))) {
+    auto end = at + 1;
+    while (end < code.length() &&
+           (isWordChar(code[end]) || code[end] == '.' || code[end] == '\'' ||
+            ((code[end] == '+' || code[end] == '-') &&
+             std::string_view{"eEpP"}.find(code[end - 1]) !=
+                 std::string_view::npos))) {
+      end += 1;
+    }
+    return {end, "num"};
+  }
+
+  if (rules.variables && ch == '$' && at + 1 < code.length()) {
+    auto next = code[at + 1];
+    if (next == '{') {
+      return {std::min(until("}", at + 2), endOfLine(at)), "var"};
+    }
+    if (isWordChar(next)) {
+      auto end = at + 1;
+      while (end < code.length() && isWordChar(code[end])) {
+        end += 1;
+      }
+      return {end, "var"};
+    }
+    if (std::string_view{"#?@*!$-"}.find(next) != std::string_view::npos) {
+      return {at + 2, "var"};
+    }
+  }
+
+  if (isWordChar(ch)) {
+    auto end = at;
+    while (end < code.length() && isWordChar(code[end])) {
+      end += 1;
+    }
+
+    auto word = code.substr(at, end - at);
+    if (std::binary_search(rules.keywords.begin(), rules.keywords.end(),
+                           word)) {
+      return {end, "kw"};
+    }
+    if (std::binary_search(rules.literals.begin(), rules.literals.end(),
+                           word)) {
+      return {end, "lit"};
+    }
+    return {end, nullptr};
+  }
+
+  return {at + 1, nullptr};
+}
+
+static std::string highlight(const lexerRules &rules, std::string_view code) {
+  auto html = std::string{};
+  html.reserve(2 * code.length());
+
+  // Runs of text that is not highlighted are escaped in one go.
+  auto plainBegin = size_t{0};
+  auto lineStart = true;
+  for (auto at = size_t{0}; at < code.length();) {
+    auto [end, tokenClass] = scanToken(rules, code, at, lineStart);
+    if (tokenClass != nullptr) {
+      appendEscaped(html, code.substr(plainBegin, at - plainBegin));
+      html += "<span class=\"hl-";
+      html += tokenClass;
+      html += "\">";
+      appendEscaped(html, code.substr(at, end - at));
+      html += "</span>";
+      plainBegin = end;
+    }
+
+    if (code[at] == '\n') {
+      lineStart = true;
+    } else if (tokenClass != nullptr || !isSpace(code[at])) {
+      lineStart = false;
+    }
+    at = end;
+  }
+
+  appendEscaped(html, code.substr(plainBegin));
+  return html;
+}
+
+struct cachedBlock {
+  std::string language;
+  std::string code;
+  std::string html;
+};
+
+// Blocks are small and rarely change, so instead of evicting blocks one at a
+// time, the cache is emptied whenever it outgrows its budget.
+static const auto maxCacheBytes = size_t{16} << 20;
+static std::mutex cacheLock;
+static std::unordered_map<size_t, cachedBlock> cache;
+static size_t cacheBytes = 0;
+
+bool appendHighlightedCode(std::pmr::string &html, std::string_view language,
+                           std::string_view code) {
+  const auto *rules = findRules(language);
+  if (rules == nullptr) {
+    return false;
+  }
+
+  auto hasher = std::hash<std::string_view>{};
+  auto languageHash = hasher(language);
+  auto key = hasher(code) ^
+             (languageHash + 0x9e3779b9 + (languageHash << 6) +
+              (languageHash >> 2));
+
+  {
+    auto guard = std::lock_guard<std::mutex>{cacheLock};
+    auto found = cache.find(key);
+    if (found != cache.end() && found->second.language == language &&
+        found->second.code == code) {
+      html.append(found->second.html);
+      return true;
+    }
+  }
+
+  auto block = cachedBlock{std::string{language}, std::string{code},
+                           highlight(*rules, unescapeHtml(code))};
+  html.append(block.html);
+
+  auto blockBytes = block.language.length() + block.code.length() +
+                    block.html.length();
+  auto guard = std::lock_guard<std::mutex>{cacheLock};
+  if (cacheBytes + blockBytes > maxCacheBytes) {
+    cache.clear();
+    cacheBytes = 0;
+  }
+
+  // A block whose hash collides with that of another block replaces it.
+  auto &entry = cache[key];
+  cacheBytes -= entry.language.length() + entry.code.length() +
+                entry.html.length();
+  cacheBytes += blockBytes;
+  entry = std::move(block);
+  return true;
+}
@@ -1,121 +1,637 @@
 #include <algorithm>
-#include <cstdlib>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <deque>
 #include <iostream>
-#include <numeric>
-#include <regex>
-#include <sstream>
-#include <unordered_map>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
+#include "highlight.h"
 #include "html.h"
 #include "md4c-html.h"
+#include "meta.h"
+#include "trace.h"
 #include "util.h"
 
-struct replaceInfo {
-  long long position;
-  long long length;
-  std::string value;
+/// Strings that hold rendered output: either `std::string` for the plain API,
+/// or `std::pmr::string` for the arena-backed API.
+template <class String>
+static String makeString(std::pmr::memory_resource *arena) {
+  if constexpr (std::is_same_v<String, std::pmr::string>) {
+    return String{arena};
+  } else {
+    (void)arena;
+    return String{};
+  }
+}
+
+static std::string_view trimView(std::string_view text) {
+  auto isSpace = [](unsigned char ch) { return std::isspace(ch) != 0; };
+  while (!text.empty() && isSpace(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isSpace(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+static void appendHtmlEscaped(std::pmr::string &html, std::string_view text) {
+  for (auto ch : text) {
+    switch (ch) {
+    case '&':
+      html += "&amp;";
+      break;
+    case '<':
+      html += "&lt;";
+      break;
+    case '>':
+      html += "&gt;";
+      break;
+    case '"':
+      html += "&quot;";
+      break;
+    default:
+      html += ch;
+    }
+  }
+}
+
+/// Where the page that is being rendered comes from.  Pages rendered from text
+/// have neither a URI nor a path, and only pages of indexed sites have an
+/// index to look up backlinks in.
+struct pageSource {
+  std::string_view uri;
+  const std::filesystem::path *path;
+  const metadataIndex *index = nullptr;
 };
 
-static std::vector<replaceInfo> computeReplacements(
-    const std::string &templateText,
-    const std::unordered_map<std::string, const char *> &values) {
-  auto foldFn = [&values](std::vector<replaceInfo> replacements,
-                          std::smatch match) {
-    auto key = copyAndTrim(std::string{match[1]});
-    if (auto search = values.find(key); search != values.end()) {
-      replacements.emplace_back(
-          replaceInfo{static_cast<long long>(match.position()),
-                      static_cast<long long>(match.length()), search->second});
-      return replacements;
-    }
-    return replacements;
-  };
+/// Values of the layout slots of one page, along with the strings that back
+/// them.  Only the slots that the layout uses are filled in.
+struct pageSlots {
+  explicit pageSlots(std::pmr::memory_resource *arena)
+      : title(arena), path(arena), breadcrumbs(arena), toc(arena),
+        mtime(arena), date(arena), tags(arena), backlinks(arena) {}
 
-  auto placeHolderRegex = std::regex{R"(\{\{([^\}]*)\}\})"};
-  auto begin = std::sregex_iterator(templateText.begin(), templateText.end(),
-                                    placeHolderRegex);
+  pageSlots(const pageSlots &) = delete;
+  pageSlots &operator=(const pageSlots &) = delete;
+
+  slotValues values;
+  std::pmr::string title;
+  std::pmr::string path;
+  std::pmr::string breadcrumbs;
+  std::pmr::string toc;
+  std::pmr::string mtime;
+  std::pmr::string date;
+  std::pmr::string tags;
+  std::pmr::string backlinks;
+};
 
-  return std::accumulate(begin, std::sregex_iterator(),
-                         std::vector<replaceInfo>{}, foldFn);
+/// Links to each of the directories above `uri`, followed by the name of the
+/// last segment of `uri`.
+static void appendBreadcrumbs(std::pmr::string &html, std::string_view uri) {
+  if (uri.empty()) {
+    return;
+  }
+
+  html += "<a href=\"/\">home</a>";
+  for (auto begin = uri.find_first_not_of('/'); begin < uri.length();) {
+    auto end = std::min(uri.find('/', begin), uri.length());
+    auto name = uri.substr(begin, end - begin);
+
+    html += " / ";
+    if (end == uri.length() || end + 1 == uri.length()) {
+      appendHtmlEscaped(html, name);
+      break;
+    }
+
+    html += "<a href=\"";
+    appendHtmlEscaped(html, uri.substr(0, end + 1));
+    html += "\">";
+    appendHtmlEscaped(html, name);
+    html += "</a>";
+    begin = end + 1;
+  }
 }
 
-static std::optional<std::string>
-fillTemplate(const std::string &templateText,
-             const std::unordered_map<std::string, const char *> &values) {
+static void appendModificationDate(std::pmr::string &html,
+                                   const std::filesystem::path &path) {
+  auto errCode = std::error_code{};
+  auto modified = std::filesystem::last_write_time(path, errCode);
+  if (errCode) {
+    return;
+  }
 
-  auto cursor = 0LL;
-  auto stream = std::stringstream{};
-  for (const auto &info : computeReplacements(templateText, values)) {
-    // First, add characters from the last cursor to info.position.
-    stream << templateText.substr(cursor, info.position - cursor);
-    cursor = info.position;
+  // C++17 has no conversion between the file clock and the system clock, so
+  // translate the time through the current time on both clocks.
+  auto sinceEpoch = std::chrono::duration_cast<std::chrono::microseconds>(
+      modified - std::filesystem::file_time_type::clock::now() +
+      std::chrono::system_clock::now().time_since_epoch());
+  auto time = toCivilTime(sinceEpoch.count());
 
-    // Then add the replacement string.
-    stream << info.value;
+  char text[24];
+  auto length =
+      std::snprintf(text, sizeof(text), "%04lld-%02d-%02d",
+                    static_cast<long long>(time.year), time.month, time.day);
+  html.append(text, static_cast<size_t>(length));
+}
 
-    // Finally, skip the cursor ahead based on placeholder string.
-    cursor += info.length;
+/// Append `text` percent-encoded for use in a URI path segment.
+static void appendUriEncoded(std::pmr::string &uri, std::string_view text) {
+  static const char hexDigits[] = "0123456789ABCDEF";
+  for (auto ch : text) {
+    auto byte = static_cast<unsigned char>(ch);
+    if (std::isalnum(byte) != 0 || ch == '-' || ch == '.' || ch == '_' ||
+        ch == '~') {
+      uri += ch;
+    } else {
+      uri += '%';
+      uri += hexDigits[byte >> 4];
+      uri += hexDigits[byte & 0xf];
+    }
   }
+}
 
-  // Lastly, add all characters from the last matched placeholder to the end of
-  // the string.
-  stream << templateText.substr(cursor, std::string::npos);
-  return stream.str();
+/// Links to the `/_tags/<tag>` view of each tag.
+static void appendTagLinks(std::pmr::string &html, std::string_view tags) {
+  forEachTag(tags, [&html](std::string_view tag) {
+    if (!html.empty()) {
+      html += ' ';
+    }
+    html += "<a class=\"tag\" href=\"/_tags/";
+    appendUriEncoded(html, tag);
+    html += "\">";
+    appendHtmlEscaped(html, tag);
+    html += "</a>";
+  });
 }
 
-static std::optional<std::string>
-translateMarkDownToHtml(const std::string &text) {
-  auto processOutput = [](const MD_CHAR *text, MD_SIZE size, void *userData) {
-    auto stream = static_cast<std::stringstream *>(userData);
-    *stream << std::string{text, size};
-  };
+/// A list of links to `pages`, or nothing if there are none.
+static void appendBacklinks(std::pmr::string &html,
+                            const std::vector<metadataIndex::page> &pages) {
+  if (pages.empty()) {
+    return;
+  }
 
-  auto flags = MD_FLAG_COLLAPSEWHITESPACE | MD_FLAG_TABLES | MD_FLAG_TASKLISTS |
-               MD_FLAG_STRIKETHROUGH | MD_FLAG_NOHTMLSPANS |
-               MD_FLAG_NOHTMLBLOCKS | MD_FLAG_NOINDENTEDCODEBLOCKS;
+  html += "<ul class=\"backlinks\">";
+  for (const auto &page : pages) {
+    html += "<li><a href=\"";
+    appendHtmlEscaped(html, page.uri);
+    html += "\">";
+    appendHtmlEscaped(html, page.title.empty() ? page.uri : page.title);
+    html += "</a></li>";
+  }
+  html += "</ul>";
+}
+
+/// Compute the values of the slots, other than the body, that `layout` uses.
+/// `markDownText` excludes the front matter, whose fields are in `fields`.
+static void deriveSlots(std::string_view markDownText,
+                        const frontMatter &fields, const pageSource &source,
+                        const compiledTemplate &layout, pageSlots &slots) {
+  auto &values = slots.values;
+  if (layout.uses(templateSlot::TITLE) != 0) {
+    auto title = fields.title;
+    if (title.empty()) {
+      title = findTitle(markDownText);
+    }
+    if (title.empty()) {
+      // Fall back to the name of the file or directory.
+      auto uri = trimView(source.uri);
+      while (!uri.empty() && uri.back() == '/') {
+        uri.remove_suffix(1);
+      }
+      title = uri.substr(uri.rfind('/') + 1);
+    }
+    appendHtmlEscaped(slots.title, title);
+    values[templateSlot::TITLE] = slots.title;
+  }
+
+  if (layout.uses(templateSlot::PATH) != 0) {
+    appendHtmlEscaped(slots.path, source.uri);
+    values[templateSlot::PATH] = slots.path;
+  }
 
-  auto stream = std::stringstream{};
-  auto status =
-      md_html(text.c_str(), static_cast<MD_SIZE>(text.length()), processOutput,
-              static_cast<void *>(&stream), flags, MD_HTML_FLAG_XHTML);
+  if (layout.uses(templateSlot::BREADCRUMBS) != 0) {
+    appendBreadcrumbs(slots.breadcrumbs, source.uri);
+    values[templateSlot::BREADCRUMBS] = slots.breadcrumbs;
+  }
+
+  if (layout.uses(templateSlot::MTIME) != 0 && source.path != nullptr) {
+    appendModificationDate(slots.mtime, *source.path);
+    values[templateSlot::MTIME] = slots.mtime;
+  }
+
+  if (layout.uses(templateSlot::DATE) != 0) {
+    appendHtmlEscaped(slots.date, fields.date);
+    values[templateSlot::DATE] = slots.date;
+  }
+
+  if (layout.uses(templateSlot::TAGS) != 0) {
+    appendTagLinks(slots.tags, fields.tags);
+    values[templateSlot::TAGS] = slots.tags;
+  }
+
+  if (layout.uses(templateSlot::BACKLINKS) != 0 && source.index != nullptr) {
+    appendBacklinks(slots.backlinks, source.index->linking(source.uri));
+    values[templateSlot::BACKLINKS] = slots.backlinks;
+  }
+}
+
+/// Watchdog that holds the renders on the current thread to a budget, if any.
+static thread_local renderWatchdog *currentWatchdog = nullptr;
+
+renderWatchdog::renderWatchdog(renderBudget budget) noexcept
+    : budget(budget), outer(currentWatchdog) {
+  currentWatchdog = this;
+}
+
+renderWatchdog::~renderWatchdog() { currentWatchdog = outer; }
+
+/// CPU time that the current thread has used so far.
+static std::chrono::nanoseconds threadCpuTime() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  auto now = timespec{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return std::chrono::seconds{now.tv_sec} +
+         std::chrono::nanoseconds{now.tv_nsec};
+#else
+  return std::chrono::steady_clock::now().time_since_epoch();
+#endif
+}
+
+/// Measures one render against the budget of the watchdog on its thread.
+class budgetMeter {
+public:
+  budgetMeter()
+      : watchdog(currentWatchdog),
+        start(watchdog != nullptr ? threadCpuTime()
+                                  : std::chrono::nanoseconds{}) {}
+
+  /// Whether the render is held to a budget at all.
+  bool active() const { return watchdog != nullptr; }
+
+  /// Whether the render went over its budget.
+  bool tripped() const { return over; }
+
+  /// Check Markdown text of `inputBytes` before the render starts.  md4c
+  /// works out all the inlines of a block before it calls back for any of
+  /// them, so text that is larger than the HTML budget, which it would almost
+  /// surely go over anyway, is turned down without being parsed.
+  bool oversized(uint64_t inputBytes) {
+    const auto &budget = watchdog->budget;
+    over = over || (budget.outputBytes != 0 && inputBytes > budget.outputBytes);
+    watchdog->exceeded = watchdog->exceeded || over;
+    return over;
+  }
+
+  /// Check the render, which turned out `outputBytes` of HTML so far.
+  /// Reading the CPU clock takes a system call, so only every so many checks
+  /// do.
+  bool exceeded(uint64_t outputBytes) {
+    const auto &budget = watchdog->budget;
+    over = over ||
+           (budget.outputBytes != 0 && outputBytes > budget.outputBytes) ||
+           (budget.cpuTime.count() != 0 && ++checks % clockInterval == 0 &&
+            threadCpuTime() - start > budget.cpuTime);
+    watchdog->exceeded = watchdog->exceeded || over;
+    return over;
+  }
+
+private:
+  static constexpr uint32_t clockInterval = 64;
+
+  renderWatchdog *watchdog;
+  std::chrono::nanoseconds start;
+  uint32_t checks = 0;
+  bool over = false;
+};
+
+/// Gives each heading of a page an id that is unique within the page, made from
+/// the text of the heading as GitHub does, and lists the headings in a nested
+/// table of contents if there is one to fill.
+class headingOutline {
+public:
+  headingOutline(std::pmr::string *toc, std::pmr::memory_resource *arena)
+      : toc(toc), ids(arena), levels(arena), label(arena), id(arena) {}
+
+  /// Id of the next heading, of `level` and with `html` as its content.  The
+  /// id remains valid until the next call.
+  std::string_view add(int level, std::string_view html) {
+    // The label is the text of the heading, which is still escaped.
+    label.clear();
+    auto inTag = false;
+    for (auto ch : html) {
+      if (ch == '<' || ch == '>') {
+        inTag = ch == '<';
+      } else if (!inTag) {
+        label += ch;
+      }
+    }
+
+    id.clear();
+    for (size_t i = 0; i < label.length(); ++i) {
+      auto ch = static_cast<unsigned char>(label[i]);
+      if (ch == '&') {
+        // Entities stand for punctuation, mostly, which slugs leave out.
+        i = std::min(label.find(';', i), label.length());
+      } else if (ch >= 0x80 || ch == '_' || (ch >= '0' && ch <= '9') ||
+                 (ch >= 'a' && ch <= 'z')) {
+        id += static_cast<char>(ch);
+      } else if (ch >= 'A' && ch <= 'Z') {
+        id += static_cast<char>(ch - 'A' + 'a');
+      } else if (ch == ' ' || ch == '\n' || ch == '-') {
+        id += '-';
+      }
+    }
+    if (id.empty()) {
+      id = "section";
+    }
+
+    // Repeated headings get a numeric suffix, which must not clash with the
+    // id of a later heading either.
+    auto &next = ids.try_emplace(id, 0).first->second;
+    if (next == 0) {
+      next = 1;
+    } else {
+      auto base = id;
+      do {
+        id.assign(base).append("-").append(std::to_string(next++));
+      } while (!ids.try_emplace(id, 1).second);
+    }
+
+    if (toc != nullptr) {
+      appendEntry(level);
+    }
+    return id;
+  }
+
+  /// Close the lists of the table of contents.
+  void finish() {
+    for (; !levels.empty(); levels.pop_back()) {
+      toc->append("</li>\n</ul>\n");
+    }
+  }
+
+private:
+  /// Open a list for headings below the previous one, or close the lists of
+  /// headings below this one, and add an item that links to this heading.
+  void appendEntry(int level) {
+    if (levels.empty()) {
+      toc->append("<ul class=\"toc\">\n<li>");
+      levels.push_back(level);
+    } else if (level > levels.back()) {
+      toc->append("\n<ul>\n<li>");
+      levels.push_back(level);
+    } else {
+      while (levels.size() > 1 && level <= levels[levels.size() - 2]) {
+        toc->append("</li>\n</ul>\n");
+        levels.pop_back();
+      }
+      toc->append("</li>\n<li>");
+      levels.back() = level;
+    }
+
+    toc->append("<a href=\"#").append(id).append("\">");
+    toc->append(label).append("</a>");
+  }
+
+  std::pmr::string *toc;
+  std::pmr::map<std::pmr::string, uint32_t, std::less<>> ids;
+  std::pmr::vector<int> levels;
+  std::pmr::string label;
+  std::pmr::string id;
+};
+
+/// Forwards the output of `md_html()` to `sink`, except that the text of
+/// fenced code blocks is held back and forwarded with syntax highlighting.
+/// `md_html()` emits markup and text in separate calls, and always escapes
+/// text, so the markup that opens and closes a code block arrives in calls of
+/// its own.  Headings are held back too, until their content is known, and
+/// forwarded with an id, which also goes into the table of contents in `toc`
+/// if there is one.
+template <class Sink> class highlightingOutput {
+public:
+  highlightingOutput(Sink sink, std::pmr::memory_resource *arena,
+                     budgetMeter *meter = nullptr,
+                     std::pmr::string *toc = nullptr)
+      : sink(std::move(sink)), language(arena), code(arena), heading(arena),
+        html(arena), outline(toc, arena), meter(meter) {}
+
+  static void process(const MD_CHAR *text, MD_SIZE size, void *userData) {
+    static_cast<highlightingOutput *>(userData)->write({text, size});
+  }
+
+  /// Close the table of contents once all of the output went through.
+  void finish() { outline.finish(); }
+
+  /// Whether `md_html_abortable()` should stop, because the render went over
+  /// its budget.
+  static int abort(void *userData) {
+    auto output = static_cast<highlightingOutput *>(userData);
+    return output->meter->exceeded(output->written) ? 1 : 0;
+  }
+
+private:
+  /// Tags that open and close a heading, for each level.
+  static constexpr std::string_view headingOpenings =
+      "<h1><h2><h3><h4><h5><h6>";
+  static constexpr std::string_view headingClosings =
+      "</h1>\n</h2>\n</h3>\n</h4>\n</h5>\n</h6>\n";
+
+  void write(std::string_view text) {
+    written += text.length();
+    switch (state) {
+    case OUTSIDE:
+      if (text == "<pre><code") {
+        state = OPENING;
+        language.clear();
+        code.clear();
+      } else if (text.length() == 4 && text.substr(0, 2) == "<h" &&
+                 text[2] >= '1' && text[2] <= '6' && text[3] == '>') {
+        state = HEADING;
+        level = text[2] - '0';
+        heading.clear();
+      } else {
+        sink(text);
+      }
+      break;
+
+    case HEADING:
+      if (text == headingClosings.substr(static_cast<size_t>(level - 1) * 6,
+                                         6)) {
+        state = OUTSIDE;
+        flushHeading();
+      } else {
+        heading.append(text);
+      }
+      break;
+
+    case OPENING:
+      if (text == ">") {
+        state = INSIDE;
+      } else if (text != " class=\"language-" && text != "\"") {
+        language.append(text);
+      }
+      break;
+
+    case INSIDE:
+      if (text == "</code></pre>\n") {
+        state = OUTSIDE;
+        flush();
+      } else {
+        code.append(text);
+      }
+      break;
+    }
+  }
+
+  void flush() {
+    html.assign("<pre><code");
+    if (!language.empty()) {
+      html.append(" class=\"language-").append(language).append("\"");
+    }
+    html.append(">");
+
+    if (!appendHighlightedCode(html, language, code)) {
+      html.append(code);
+    }
+    html.append("</code></pre>\n");
+    sink(html);
+  }
+
+  void flushHeading() {
+    auto index = static_cast<size_t>(level - 1);
+    html.assign(headingOpenings.substr(index * 4, 3));
+    html.append(" id=\"").append(outline.add(level, heading)).append("\">");
+    html.append(heading).append(headingClosings.substr(index * 6, 6));
+    sink(html);
+  }
+
+  enum { OUTSIDE, OPENING, INSIDE, HEADING } state = OUTSIDE;
+  Sink sink;
+  std::pmr::string language;
+  std::pmr::string code;
+  std::pmr::string heading;
+  std::pmr::string html;
+  headingOutline outline;
+  int level = 0;
+  budgetMeter *meter;
+  uint64_t written = 0;
+};
+
+/// HTML for the Markdown in `text`, whose table of contents goes into `toc`
+/// unless that is null.
+static std::optional<std::pmr::string>
+translateMarkDownToHtml(std::string_view text, budgetMeter &meter,
+                        std::pmr::string *toc,
+                        std::pmr::memory_resource *arena) {
+  if (meter.active() && meter.oversized(text.length())) {
+    return {};
+  }
+
+  // HTML output is usually somewhat larger than its Markdown source.
+  auto html = std::pmr::string{arena};
+  html.reserve(text.length() + text.length() / 2);
+
+  auto output = highlightingOutput{
+      [&html](std::string_view chunk) { html.append(chunk); }, arena, &meter,
+      toc};
+  auto status = md_html_abortable(
+      text.data(), static_cast<MD_SIZE>(text.length()),
+      decltype(output)::process,
+      meter.active() ? decltype(output)::abort : nullptr,
+      static_cast<void *>(&output), markDownFlags, MD_HTML_FLAG_XHTML);
   if (status == 0) {
-    return stream.str();
+    output.finish();
+    return html;
   }
 
   return {};
 }
 
-std::optional<std::string> renderText(const std::string &markDownText,
-                                      const std::string &templateText,
-                                      bool silent) {
-  auto maybeHtml = translateMarkDownToHtml(markDownText);
+template <class String>
+static std::optional<String> renderTextImpl(std::string_view markDownText,
+                                            const compiledTemplate &layout,
+                                            const pageSource &source,
+                                            std::pmr::memory_resource *arena,
+                                            bool silent) {
+  // Front matter feeds the slots instead of showing up in the body.
+  auto fields = parseFrontMatter(markDownText).value_or(frontMatter{});
+  markDownText.remove_prefix(fields.length);
+
+  // The table of contents comes out of the same pass as the body.
+  auto slots = pageSlots{arena};
+  auto toc = layout.uses(templateSlot::TOC) != 0 ? &slots.toc : nullptr;
+  auto meter = budgetMeter{};
+  auto maybeHtml = [markDownText, &meter, toc, arena] {
+    auto span = traceSpan{"md4c"};
+    return translateMarkDownToHtml(markDownText, meter, toc, arena);
+  }();
   if (!maybeHtml) {
-    if (!silent) {
+    if (!silent && meter.tripped()) {
+      std::cerr << "rendering went over its budget for: " << source.uri
+                << std::endl;
+    } else if (!silent) {
       std::cerr << "failed to convert markdown to HTML for file: <stdin>"
                 << std::endl;
     }
     return {};
   }
 
-  auto values = std::unordered_map<std::string, const char *>{
-      {"body", maybeHtml->c_str()},
-  };
+  auto span = traceSpan{"fill"};
+  deriveSlots(markDownText, fields, source, layout, slots);
+  slots.values[templateSlot::TOC] = slots.toc;
+  slots.values[templateSlot::BODY] = *maybeHtml;
 
-  auto maybeFilled = fillTemplate(templateText, values);
-  if (!maybeFilled) {
-    if (!silent) {
-      std::cerr << "failed to populate HTML template for file: <stdin>"
-                << std::endl;
-    }
+  auto page = makeString<String>(arena);
+  layout.fill(slots.values, page);
+  return page;
+}
+
+std::optional<std::string> renderText(const std::string &markDownText,
+                                      const std::string &templateText,
+                                      bool silent) {
+  auto maybeLayout = compiledTemplate::parse(templateText, {}, silent);
+  if (!maybeLayout) {
     return {};
   }
 
-  return *maybeFilled;
+  return renderTextImpl<std::string>(markDownText, *maybeLayout, {},
+                                     std::pmr::new_delete_resource(), silent);
 }
 
-std::optional<std::string> renderFile(const std::filesystem::path &path,
-                                      const std::string &templateText,
-                                      bool silent) {
+std::optional<std::pmr::string> renderText(std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent) {
+  return renderTextImpl<std::pmr::string>(markDownText, layout, {}, &arena,
+                                          silent);
+}
+
+std::optional<std::pmr::string> renderText(std::string_view uri,
+                                           std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent) {
+  return renderTextImpl<std::pmr::string>(markDownText, layout, {uri, nullptr},
+                                          &arena, silent);
+}
+
+template <class String>
+static std::optional<String> renderFileImpl(const pageSource &source,
+                                            const compiledTemplate &layout,
+                                            std::pmr::memory_resource *arena,
+                                            bool silent) {
+  const auto &path = *source.path;
+  auto span = traceSpan{"renderFile"};
   if (std::filesystem::status(path).type() !=
           std::filesystem::file_type::regular &&
       std::filesystem::status(path).type() !=
@@ -126,7 +642,10 @@ std::optional<std::string> renderFile(const std::filesystem::path &path,
     return {};
   }
 
-  auto maybeContent = fetchFileContents(path);
+  auto maybeContent = [&path, arena] {
+    auto span = traceSpan{"read"};
+    return fetchFileContents(path, *arena);
+  }();
   if (!maybeContent) {
     if (!silent) {
       std::cerr << "failed to read file: " << path << std::endl;
@@ -134,28 +653,191 @@ std::optional<std::string> renderFile(const std::filesystem::path &path,
     return {};
   }
 
-  return renderText(*maybeContent, templateText);
+  return renderTextImpl<String>(*maybeContent, layout, source, arena, silent);
+}
+
+std::optional<std::string> renderFile(const std::filesystem::path &path,
+                                      const std::string &templateText,
+                                      bool silent) {
+  auto maybeLayout = compiledTemplate::parse(templateText, {}, silent);
+  if (!maybeLayout) {
+    return {};
+  }
+
+  return renderFileImpl<std::string>({{}, &path}, *maybeLayout,
+                                     std::pmr::new_delete_resource(), silent);
+}
+
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent) {
+  return renderFileImpl<std::pmr::string>({uri, &path}, layout, &arena, silent);
+}
+
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent) {
+  return renderTextImpl<std::pmr::string>(markDownText, layout, {uri, &path},
+                                          &arena, silent);
+}
+
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           const compiledTemplate &layout,
+                                           const metadataIndex &index,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent) {
+  return renderFileImpl<std::pmr::string>({uri, &path, &index}, layout, &arena,
+                                          silent);
+}
+
+std::optional<std::pmr::string> renderFile(std::string_view uri,
+                                           const std::filesystem::path &path,
+                                           std::string_view markDownText,
+                                           const compiledTemplate &layout,
+                                           const metadataIndex &index,
+                                           std::pmr::memory_resource &arena,
+                                           bool silent) {
+  return renderTextImpl<std::pmr::string>(
+      markDownText, layout, {uri, &path, &index}, &arena, silent);
+}
+
+void renderFiles(const std::vector<std::filesystem::path> &paths,
+                 const compiledTemplate &layout, const batchCallback &done,
+                 unsigned threads, bool silent) {
+  // Most pages fit in the initial buffer of an arena, which is then reused
+  // for the next page without going back to the heap.
+  static const auto arenaBytes = size_t{256} << 10;
+
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  auto files = std::max(paths.size(), size_t{1});
+  threads = static_cast<unsigned>(std::min(size_t{threads}, files));
+
+  auto next = std::atomic<size_t>{0};
+  auto doneLock = std::mutex{};
+  auto work = [&] {
+    auto buffer = std::vector<std::byte>(arenaBytes);
+    auto arena =
+        std::pmr::monotonic_buffer_resource{buffer.data(), buffer.size()};
+    for (auto index = next++; index < paths.size(); index = next++) {
+      // An exception would end the whole process on a worker thread, so a
+      // file that throws counts as one that could not be rendered.
+      auto maybeHtml = std::optional<std::pmr::string>{};
+      try {
+        maybeHtml = renderFileImpl<std::pmr::string>({{}, &paths[index]},
+                                                     layout, &arena, silent);
+      } catch (const std::exception &error) {
+        if (!silent) {
+          std::cerr << "failed to render " << paths[index] << ": "
+                    << error.what() << std::endl;
+        }
+      }
+
+      {
+        auto guard = std::lock_guard<std::mutex>{doneLock};
+        done(index, maybeHtml ? std::optional<std::string_view>{*maybeHtml}
+                              : std::nullopt);
+      }
+      maybeHtml.reset();
+      arena.release();
+    }
+  };
+
+  // The calling thread is one of the workers.
+  auto workers = std::vector<std::thread>{};
+  for (auto count = 1u; count < threads; ++count) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+}
+
+std::vector<std::optional<std::string>>
+renderFiles(const std::vector<std::filesystem::path> &paths,
+            const compiledTemplate &layout, unsigned threads, bool silent) {
+  auto pages = std::vector<std::optional<std::string>>(paths.size());
+  renderFiles(
+      paths, layout,
+      [&pages](size_t index, std::optional<std::string_view> html) {
+        if (html) {
+          pages[index].emplace(*html);
+        }
+      },
+      threads, silent);
+  return pages;
+}
+
+std::optional<std::string>
+renderNotFoundPage(const std::filesystem::path &docRoot,
+                   const compiledTemplate &layout, bool silent) {
+  auto path = docRoot / "404.md";
+  if (!docRoot.empty() && std::filesystem::exists(path)) {
+    return renderFileImpl<std::string>({"/404.md", &path}, layout,
+                                       std::pmr::new_delete_resource(), silent);
+  }
+
+  return renderTextImpl<std::string>("# 404 Not Found", layout, {},
+                                     std::pmr::new_delete_resource(), silent);
 }
 
 struct dirEntry {
-  std::string uri;
-  std::string name;
+  std::pmr::string name;
   bool isDirectory;
 };
 
-std::ostream &operator<<(std::ostream &os, const dirEntry &entry) {
-  // Since entry.uri points to a directory, the 302 redirect in `responseFn()`
+/// Append `text` with every ASCII punctuation character backslash-escaped, so
+/// that Markdown shows it verbatim, even inside table cells and link text.
+static void appendMarkDownEscaped(std::pmr::string &markDown,
+                                  std::string_view text) {
+  for (auto ch : text) {
+    if (std::ispunct(static_cast<unsigned char>(ch)) != 0) {
+      markDown += '\\';
+    }
+    markDown += ch;
+  }
+}
+
+static void appendDirEntry(std::pmr::string &markDown, std::string_view uri,
+                           std::string_view name,
+                           const metadataIndex *index) {
+  // Since `uri` points to a directory, the 302 redirect in `responseFn()`
   // ensures that the URI ends in a '/', so we don't need to introduce an
   // additional '/' character between the URI and the entry name.
-  os << "| [" << entry.name << "](" << entry.uri << entry.name << ") | "
-     << "|" << std::endl;
-  return os;
+  markDown.append("| [").append(name).append("](");
+  markDown.append(uri).append(name).append(") |");
+  if (index == nullptr) {
+    markDown.append(" |\n");
+    return;
+  }
+
+  auto entryUri = std::pmr::string{uri, markDown.get_allocator()};
+  entryUri.append(name);
+  if (auto meta = index->find(entryUri)) {
+    markDown += ' ';
+    appendMarkDownEscaped(markDown, meta->title);
+    markDown.append(" | ");
+    appendMarkDownEscaped(markDown, meta->date);
+    markDown.append(" |\n");
+  } else {
+    markDown.append(" | |\n");
+  }
 }
 
-std::optional<std::string> renderDirectory(const std::string &uri,
-                                           const std::filesystem::path &path,
-                                           const std::string &templateText,
-                                           bool silent) {
+template <class String>
+static std::optional<String> renderDirectoryImpl(
+    std::string_view uri, const std::filesystem::path &path,
+    const compiledTemplate &layout, const metadataIndex *index,
+    std::pmr::memory_resource *arena, bool silent) {
+  auto span = traceSpan{"renderDirectory", uri};
   if (std::filesystem::status(path).type() !=
       std::filesystem::file_type::directory) {
     if (!silent) {
@@ -172,17 +854,16 @@ std::optional<std::string> renderDirectory(const std::string &uri,
     return {};
   }
 
-  auto foldFn = [&uri](std::vector<dirEntry> acc,
-                       const std::filesystem::directory_entry &entry) {
-    acc.emplace_back(
-        dirEntry{uri, entry.path().filename().string(), entry.is_directory()});
-    return acc;
-  };
-
-  auto it = std::filesystem::directory_iterator(path);
-  auto entries =
-      std::accumulate(std::filesystem::begin(it), std::filesystem::end(it),
-                      std::vector<dirEntry>{}, foldFn);
+  auto entries = [&path, arena] {
+    auto span = traceSpan{"list"};
+    auto result = std::pmr::vector<dirEntry>{arena};
+    for (const auto &entry : std::filesystem::directory_iterator(path)) {
+      result.emplace_back(
+          dirEntry{std::pmr::string{entry.path().filename().string(), arena},
+                   entry.is_directory()});
+    }
+    return result;
+  }();
 
   std::sort(entries.begin(), entries.end(),
             [](const dirEntry &left, const dirEntry &right) {
@@ -192,15 +873,350 @@ std::optional<std::string> renderDirectory(const std::string &uri,
                          : left.name < right.name;
             });
 
-  auto stream = std::stringstream{};
-  stream << "# " << uri << std::endl;
-  stream << "| |" << std::endl;
-  stream << "|----------|" << std::endl;
+  auto markDown = std::pmr::string{arena};
+  markDown.append("# ").append(uri).append("\n");
+  if (index == nullptr) {
+    markDown.append("| |\n");
+    markDown.append("|----------|\n");
+  } else {
+    markDown.append("| | | |\n");
+    markDown.append("|----------|----------|----------|\n");
+  }
 
-  stream << dirEntry{uri, "..", /* isDirectory */ true};
+  appendDirEntry(markDown, uri, "..", index);
   for (const auto &entry : entries) {
-    stream << entry;
+    appendDirEntry(markDown, uri, entry.name, index);
+  }
+
+  return renderTextImpl<String>(markDown, layout, {uri, &path}, arena, silent);
+}
+
+std::optional<std::string> renderDirectory(const std::string &uri,
+                                           const std::filesystem::path &path,
+                                           const std::string &templateText,
+                                           bool silent) {
+  auto maybeLayout = compiledTemplate::parse(templateText, {}, silent);
+  if (!maybeLayout) {
+    return {};
+  }
+
+  return renderDirectoryImpl<std::string>(uri, path, *maybeLayout, nullptr,
+                                          std::pmr::new_delete_resource(),
+                                          silent);
+}
+
+std::optional<std::pmr::string>
+renderDirectory(std::string_view uri, const std::filesystem::path &path,
+                const compiledTemplate &layout,
+                std::pmr::memory_resource &arena, bool silent) {
+  return renderDirectoryImpl<std::pmr::string>(uri, path, layout, nullptr,
+                                               &arena, silent);
+}
+
+std::optional<std::pmr::string>
+renderDirectory(std::string_view uri, const std::filesystem::path &path,
+                const compiledTemplate &layout, const metadataIndex &index,
+                std::pmr::memory_resource &arena, bool silent) {
+  return renderDirectoryImpl<std::pmr::string>(uri, path, layout, &index,
+                                               &arena, silent);
+}
+
+std::optional<std::pmr::string> renderTagPage(std::string_view uri,
+                                              std::string_view tag,
+                                              const metadataIndex &index,
+                                              const compiledTemplate &layout,
+                                              std::pmr::memory_resource &arena,
+                                              bool silent) {
+  auto span = traceSpan{"renderTagPage", uri};
+  auto markDown = std::pmr::string{&arena};
+  if (tag.empty()) {
+    markDown.append("# Tags\n\n");
+    for (const auto &[name, count] : index.tags()) {
+      markDown.append("- [");
+      appendMarkDownEscaped(markDown, name);
+      markDown.append("](/_tags/");
+      appendUriEncoded(markDown, name);
+      markDown.append(") (").append(std::to_string(count)).append(")\n");
+    }
+  } else {
+    auto pages = index.tagged(tag);
+    if (pages.empty()) {
+      if (!silent) {
+        std::cerr << "no pages are tagged: " << tag << std::endl;
+      }
+      return {};
+    }
+
+    markDown.append("# ");
+    appendMarkDownEscaped(markDown, tag);
+    markDown.append("\n\n| | |\n|----------|----------|\n");
+    for (const auto &page : pages) {
+      markDown.append("| [");
+      auto title = page.title.empty() ? page.uri : page.title;
+      appendMarkDownEscaped(markDown, title);
+      markDown.append("](").append(page.uri).append(") | ");
+      appendMarkDownEscaped(markDown, page.date);
+      markDown.append(" |\n");
+    }
+  }
+
+  return renderTextImpl<std::pmr::string>(markDown, layout, {uri, nullptr},
+                                          &arena, silent);
+}
+
+std::optional<std::pmr::string>
+renderBrokenLinksPage(std::string_view uri, const metadataIndex &index,
+                      const compiledTemplate &layout,
+                      std::pmr::memory_resource &arena, bool silent) {
+  auto span = traceSpan{"renderBrokenLinksPage", uri};
+  auto markDown = std::pmr::string{"# Broken links\n\n", &arena};
+  auto links = index.brokenLinks();
+  if (links.empty()) {
+    markDown.append("No page links to a missing file.\n");
+  } else {
+    markDown.append("| Page | Link |\n|----------|----------|\n");
+    for (const auto &link : links) {
+      markDown.append("| [");
+      auto title = index.find(link.from)->title;
+      appendMarkDownEscaped(markDown, title.empty() ? link.from : title);
+      markDown.append("](").append(link.from).append(") | ");
+      appendMarkDownEscaped(markDown, link.to);
+      markDown.append(" |\n");
+    }
+  }
+
+  return renderTextImpl<std::pmr::string>(markDown, layout, {uri, nullptr},
+                                          &arena, silent);
+}
+
+struct renderStream::producer {
+  static constexpr size_t chunkBytes = 64 * 1024;
+
+  producer(mappedFile source, size_t bodyOffset, std::string prefix,
+           std::string suffix, std::vector<size_t> tocOffsets,
+           size_t windowBytes, std::function<void()> onReady,
+           renderBudget budget)
+      : source(std::move(source)), bodyOffset(bodyOffset),
+        prefix(std::move(prefix)), suffix(std::move(suffix)),
+        tocOffsets(std::move(tocOffsets)), windowBytes(windowBytes),
+        onReady(std::move(onReady)), budget(budget) {}
+
+  /// Wait until the window has room for `chunk` and queue it.  Returns false
+  /// if the consumer went away in the meantime.
+  bool push(std::string chunk) {
+    auto guard = std::unique_lock<std::mutex>{lock};
+    drained.wait(guard,
+                 [this] { return cancelled || queuedBytes < windowBytes; });
+    if (cancelled) {
+      return false;
+    }
+
+    queuedBytes += chunk.length();
+    chunks.push_back(std::move(chunk));
+    guard.unlock();
+
+    if (onReady) {
+      onReady();
+    }
+    return true;
+  }
+
+  void run() {
+    auto watchdog = renderWatchdog{budget};
+    auto meter = budgetMeter{};
+    auto toc = std::pmr::string{std::pmr::new_delete_resource()};
+    auto output = highlightingOutput{
+        [this](std::string_view chunk) {
+          if (abandoned) {
+            return;
+          }
+
+          pending.append(chunk);
+          if (pending.length() >= chunkBytes) {
+            abandoned = !push(std::move(pending));
+            pending = std::string{};
+            pending.reserve(chunkBytes);
+          }
+        },
+        std::pmr::new_delete_resource(), &meter,
+        tocOffsets.empty() ? nullptr : &toc};
+
+    pending.reserve(chunkBytes);
+    auto text = source.contents().substr(bodyOffset);
+    auto status = md_html_abortable(
+        text.data(), static_cast<MD_SIZE>(text.length()),
+        decltype(output)::process, decltype(output)::abort,
+        static_cast<void *>(&output), markDownFlags, MD_HTML_FLAG_XHTML);
+
+    if (!abandoned && !pending.empty()) {
+      abandoned = !push(std::move(pending));
+    }
+    if (!abandoned && status == 0) {
+      output.finish();
+      for (auto offset = tocOffsets.rbegin(); offset != tocOffsets.rend();
+           ++offset) {
+        suffix.insert(*offset, std::string_view{toc});
+      }
+      push(std::move(suffix));
+    }
+
+    {
+      auto guard = std::lock_guard<std::mutex>{lock};
+      failed = status != 0;
+      finished = true;
+    }
+
+    if (onReady) {
+      onReady();
+    }
+  }
+
+  const mappedFile source;
+  const size_t bodyOffset;
+  std::string prefix;
+  std::string suffix;
+
+  // Where the table of contents goes in `suffix`, in ascending order.  It is
+  // known only once the body is rendered.
+  const std::vector<size_t> tocOffsets;
+
+  const size_t windowBytes;
+  const std::function<void()> onReady;
+  const renderBudget budget;
+
+  std::mutex lock;
+  std::condition_variable drained;
+  std::deque<std::string> chunks;
+  size_t queuedBytes = 0;
+  bool prefixTaken = false;
+  bool finished = false;
+  bool failed = false;
+  bool cancelled = false;
+
+  // Only touched by the rendering thread.
+  std::string pending;
+  bool abandoned = false;
+};
+
+std::unique_ptr<renderStream>
+renderStream::open(std::string_view uri, const std::filesystem::path &path,
+                   const compiledTemplate &layout, size_t windowBytes,
+                   std::function<void()> onReady, renderBudget budget,
+                   bool silent) {
+  return openImpl(uri, path, layout, nullptr, windowBytes, std::move(onReady),
+                  budget, silent);
+}
+
+std::unique_ptr<renderStream>
+renderStream::open(std::string_view uri, const std::filesystem::path &path,
+                   const compiledTemplate &layout, const metadataIndex &index,
+                   size_t windowBytes, std::function<void()> onReady,
+                   renderBudget budget, bool silent) {
+  return openImpl(uri, path, layout, &index, windowBytes, std::move(onReady),
+                  budget, silent);
+}
+
+std::unique_ptr<renderStream> renderStream::openImpl(
+    std::string_view uri, const std::filesystem::path &path,
+    const compiledTemplate &layout, const metadataIndex *index,
+    size_t windowBytes, std::function<void()> onReady, renderBudget budget,
+    bool silent) {
+  if (layout.uses(templateSlot::BODY) != 1) {
+    if (!silent) {
+      std::cerr << "cannot stream page, since the template does not have "
+                   "exactly one body placeholder: "
+                << path << std::endl;
+    }
+    return nullptr;
+  }
+
+  auto maybeSource = mappedFile::open(path);
+  if (!maybeSource) {
+    if (!silent) {
+      std::cerr << "failed to map file: " << path << std::endl;
+    }
+    return nullptr;
+  }
+
+  const auto &segments = layout.segments();
+  auto body = static_cast<size_t>(
+      std::find_if(segments.begin(), segments.end(),
+                   [](const compiledTemplate::segment &piece) {
+                     return piece.slot == templateSlot::BODY;
+                   }) -
+      segments.begin());
+
+  // Everything but the body and the table of contents is known up front.
+  // The title comes from a scan of the source, which is cheap compared to
+  // rendering it.  The part before the body goes out before any heading is
+  // known, so a table of contents there stays empty, but the one in the part
+  // after the body is filled in once the body is rendered.
+  auto text = maybeSource->contents();
+  auto fields = parseFrontMatter(text).value_or(frontMatter{});
+  auto slots = pageSlots{std::pmr::new_delete_resource()};
+  deriveSlots(text.substr(fields.length), fields, {uri, &path, index}, layout,
+              slots);
+
+  auto prefix = std::string{};
+  auto suffix = std::string{};
+  auto tocOffsets = std::vector<size_t>{};
+  layout.fill(slots.values, prefix, 0, body);
+  for (auto piece = body + 1; piece < segments.size(); ++piece) {
+    if (segments[piece].slot == templateSlot::TOC) {
+      tocOffsets.push_back(suffix.length());
+    } else {
+      layout.fill(slots.values, suffix, piece, piece + 1);
+    }
   }
 
-  return renderText(stream.str(), templateText);
+  auto state = std::make_shared<producer>(
+      std::move(*maybeSource), fields.length, std::move(prefix),
+      std::move(suffix), std::move(tocOffsets), windowBytes,
+      std::move(onReady), budget);
+
+  // The rendering thread shares ownership of its state, so that it can run to
+  // completion on its own if the stream is destroyed early, discarding the
+  // rest of its output, for no longer than its budget allows.
+  std::thread{[state] { state->run(); }}.detach();
+  return std::unique_ptr<renderStream>(new renderStream(std::move(state)));
+}
+
+renderStream::renderStream(std::shared_ptr<producer> state)
+    : state(std::move(state)) {}
+
+renderStream::~renderStream() {
+  {
+    auto guard = std::lock_guard<std::mutex>{state->lock};
+    state->cancelled = true;
+  }
+  state->drained.notify_one();
+}
+
+bool renderStream::next(std::string &chunk) {
+  auto guard = std::lock_guard<std::mutex>{state->lock};
+  if (!state->prefixTaken) {
+    state->prefixTaken = true;
+    chunk = std::move(state->prefix);
+    return true;
+  }
+
+  if (state->chunks.empty()) {
+    return false;
+  }
+
+  chunk = std::move(state->chunks.front());
+  state->chunks.pop_front();
+  state->queuedBytes -= chunk.length();
+  state->drained.notify_one();
+  return true;
+}
+
+bool renderStream::done() {
+  auto guard = std::lock_guard<std::mutex>{state->lock};
+  return state->prefixTaken && state->finished && state->chunks.empty();
+}
+
+bool renderStream::failed() {
+  auto guard = std::lock_guard<std::mutex>{state->lock};
+  return state->failed;
 }
@@ -1,30 +1,763 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <csignal>
+#include <cstddef>
+#include <cstring>
 #include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "auth.h"
+#include "bundle.h"
+#include "cache.h"
+#include "feed.h"
+#include "handoff.h"
 #include "html.h"
 #include "http.h"
+#include "limit.h"
+#include "live.h"
+#include "log.h"
+#include "meta.h"
 #include "mongoose.h"
+#include "range.h"
+#include "trace.h"
+#include "uring.h"
 #include "util.h"
+#include "wakeup.h"
+
+/// Scans of the document root of a site for changes to its index.  Walking
+/// the document root stats every file, so scans run on threads of their own,
+/// and the event loop only applies the changes that they find.
+struct indexRefresh {
+  explicit indexRefresh(std::filesystem::path docRoot)
+      : scanner(std::move(docRoot)) {}
+
+  // Only used by the scanning thread, of which there is one at a time.
+  indexScanner scanner;
+
+  // Changes that the last scan found, until the event loop applies them.
+  std::mutex lock;
+  std::optional<indexChanges> changes;
+
+  // Whether a scan runs or waits to be applied.  Only the event loop uses
+  // this.
+  bool running = false;
+};
+
+/// State that the server keeps for each site.
+struct siteState {
+  // Rendered pages, if the configuration gives them a memory budget.  Pages
+  // depend on the layout, so the cache is cleared whenever the layout of the
+  // site changes.
+  std::unique_ptr<pageCache> cache;
+
+  // Front matter of the Markdown files under the document root, which
+  // directory listings and tag views are rendered from, and the scans that
+  // keep it up to date.  Bundled sites have no index.
+  std::unique_ptr<metadataIndex> index;
+  std::shared_ptr<indexRefresh> refresh;
+
+  // Atom feeds of directories, generated from the index, if feeds are
+  // enabled.  Refreshing the index drops the feeds that a change affects.
+  std::unique_ptr<feedStore> feeds;
+
+  // Versions of the Markdown files whose pages went over the render budget,
+  // by URI, so that they are served as plain text until they change rather
+  // than rendered again on every request.
+  std::map<std::string, pageCache::version, std::less<>> overBudget;
+};
 
 struct auxInfo {
-  std::filesystem::path docRoot;
-  std::string templateText;
-  std::string notFoundHtml;
+  // Replaced as a whole when the configuration or the layout is reloaded.
+  // Requests hold on to the snapshot that they started with.
+  std::shared_ptr<const siteSnapshot> site;
+
+  std::unique_ptr<accessLog> log;
+
+  // Number of connections with a streamed response in progress.
+  size_t activeStreams;
+
+  // Markdown files that live reload clients watch, by path.
+  std::map<std::string, livePage> livePages;
+
+  // Interrupts the poll of the event loop, if the platform supports it.
+  std::shared_ptr<loopWaker> waker;
+
+  // Limits how often each client may request rendered pages, if configured.
+  std::unique_ptr<rateLimiter> limiter;
+
+  // State of the main site, followed by the state of each of the sites in
+  // the snapshot's `hosts`, in the same order.
+  std::vector<siteState> sites;
+
+  // Reads Markdown files without blocking the event loop, if the platform
+  // supports it.
+  std::unique_ptr<ioRing> ring;
+
+  // Checks session cookies and signs users in, if the configuration has an
+  // auth section.  Sign-ins in progress hold on to the object that they
+  // started with.
+  std::shared_ptr<sessionAuth> auth;
 };
 
 static const auto codeOk = 200;
+static const auto codePartialContent = 206;
 static const auto codeRedirect = 302;
+static const auto codeNotModified = 304;
+static const auto codeForbidden = 403;
 static const auto codeNotFound = 404;
+static const auto codeRangeNotSatisfiable = 416;
+static const auto codeTooManyRequests = 429;
 static const auto codeInternalError = 500;
+static const auto codeUnavailable = 503;
+
+// Streamed pages may have this much rendered HTML waiting in the renderer, and
+// this much queued in the connection's send buffer.
+static const auto streamWindowBytes = size_t{1} << 20;
+static const auto sendWindowBytes = size_t{256} << 10;
+
+/// State that lives as long as a client connection.  It is created when the
+/// connection first needs it, a pointer to it is kept at the start of the
+/// connection's `data` field, and it is destroyed when the connection closes.
+/// (Mongoose uses the tail end of `data` while serving static files.)
+struct connectionState {
+  static constexpr size_t initialArenaBytes = 16 * 1024;
+
+  connectionState() : arena(initialBuffer, sizeof(initialBuffer)) {}
+
+  // Per-request temporaries come from `arena`, which is reset after every
+  // response, so that typical requests never touch the global heap for them.
+  alignas(std::max_align_t) std::byte initialBuffer[initialArenaBytes];
+  std::pmr::monotonic_buffer_resource arena;
+
+  uint64_t readStartNs = 0;
+
+  // Site that the `Host` header of the current request selected, as an index
+  // into `auxInfo::sites`.
+  size_t siteIndex = 0;
+
+  // Whether the current response came out of the page cache.
+  cacheOutcome cache = cacheOutcome::NONE;
+
+  // Response that is being streamed to the client, if any.
+  std::unique_ptr<renderStream> stream;
+  std::string streamChunk;
+
+  // Ranges of a static file that are being sent to the client, if any.
+  std::optional<rangeBody> ranges;
+
+  // Whether the response waits for the Markdown file to be read through the
+  // ring, in which case the page is rendered once the read completes, or for
+  // a sign-in to complete.
+  bool waiting = false;
+
+  // Access log record of a streamed response, or of a response that waits,
+  // which gets written once the response completes.
+  accessRecord pendingRecord;
+  std::chrono::steady_clock::time_point pendingStartTime;
+
+  // Path of the Markdown file that a live reload client watches, if any.
+  std::string livePath;
+};
+
+static connectionState *
+peekConnectionState(struct mg_connection *connection) {
+  connectionState *state = nullptr;
+  std::memcpy(&state, connection->data, sizeof(state));
+  return state;
+}
+
+static connectionState *getConnectionState(struct mg_connection *connection) {
+  auto state = peekConnectionState(connection);
+  if (state == nullptr) {
+    state = new connectionState{};
+    std::memcpy(connection->data, &state, sizeof(state));
+  }
+  return state;
+}
+
+static void freeConnectionState(struct mg_connection *connection) {
+  connectionState *state = nullptr;
+  std::memcpy(&state, connection->data, sizeof(state));
+  delete state;
+  std::memset(connection->data, 0, sizeof(state));
+}
+
+static const char *statusText(int status) {
+  switch (status) {
+  case codeOk:
+    return "OK";
+  case codePartialContent:
+    return "Partial Content";
+  case codeRedirect:
+    return "Found";
+  case codeForbidden:
+    return "Forbidden";
+  case codeNotFound:
+    return "Not Found";
+  case codeNotModified:
+    return "Not Modified";
+  case codeRangeNotSatisfiable:
+    return "Range Not Satisfiable";
+  case codeTooManyRequests:
+    return "Too Many Requests";
+  case codeUnavailable:
+    return "Service Unavailable";
+  default:
+    return "Internal Server Error";
+  }
+}
+
+/// Queue a complete response.  Unlike `mg_http_reply()`, this copies the body
+/// verbatim instead of interpreting it as a format string.
+static void replyBody(struct mg_connection *connection, int status,
+                      const char *contentType, std::string_view body) {
+  mg_printf(connection,
+            "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+            "Content-Length: %lu\r\n\r\n",
+            status, statusText(status), contentType,
+            static_cast<unsigned long>(body.length()));
+  mg_send(connection, body.data(), body.length());
+  connection->is_resp = 0;
+}
+
+static void replyHtml(struct mg_connection *connection, int status,
+                      std::string_view body) {
+  replyBody(connection, status, "text/html", body);
+}
+
+/// Turn a request away, and tell the client when to try again.
+static void replyRetryLater(struct mg_connection *connection, int status,
+                            std::chrono::seconds retryAfter) {
+  auto body = std::string_view{statusText(status)};
+  mg_printf(connection,
+            "HTTP/1.1 %d %s\r\nContent-Type: text/plain\r\n"
+            "Retry-After: %lu\r\nContent-Length: %lu\r\n\r\n",
+            status, statusText(status),
+            static_cast<unsigned long>(retryAfter.count()),
+            static_cast<unsigned long>(body.length()));
+  mg_send(connection, body.data(), body.length());
+  connection->is_resp = 0;
+}
+
+static void replyRenderError(struct mg_connection *connection,
+                             std::string_view uri) {
+  mg_http_reply(connection, codeInternalError, "Content-Type: text/html\r\n",
+                "failed to render page for URI: %.*s",
+                static_cast<int>(uri.length()), uri.data());
+}
+
+/// Remove empty, "." and ".." segments from `uri`, in the same way as
+/// `std::filesystem::path::lexically_normal()`, but allocating the result from
+/// `arena`.  ".." segments never climb above the root.
+static std::pmr::string normalizeUri(std::string_view uri,
+                                     std::pmr::memory_resource *arena) {
+#ifdef _WIN32
+  const auto separators = std::string_view{"/\\"};
+#else
+  const auto separators = std::string_view{"/"};
+#endif
+
+  auto normal = std::pmr::string{arena};
+  normal.reserve(uri.length() + 1);
+
+  auto endsInDirectory = false;
+  for (auto begin = size_t{0}; begin <= uri.length();) {
+    auto end = std::min(uri.find_first_of(separators, begin), uri.length());
+    auto segment = uri.substr(begin, end - begin);
+    begin = end + 1;
+
+    endsInDirectory = segment.empty() || segment == "." || segment == "..";
+    if (segment == "..") {
+      normal.resize(std::min(normal.rfind('/'), normal.length()));
+    } else if (!endsInDirectory) {
+      normal.append("/").append(segment);
+    }
+  }
+
+  if (normal.empty() || endsInDirectory) {
+    normal += '/';
+  }
+  return normal;
+}
+
+/// Server state, which every client connection carries as its handler data.
+static auxInfo &getAuxInfo(struct mg_connection *connection) {
+  return *static_cast<auxInfo *>(connection->fn_data);
+}
+
+/// The main site for index zero, and otherwise the site in `site.hosts` that
+/// the index refers to.  Indexes that a reload made obsolete select the main
+/// site.
+static const siteSnapshot &siteAt(const siteSnapshot &site, size_t index) {
+  return index == 0 || index > site.hosts.size() ? site
+                                                 : site.hosts[index - 1];
+}
+
+/// Index of the site that the `Host` header of `message` selects, or zero for
+/// the main site.
+static size_t selectSite(const siteSnapshot &site,
+                         struct mg_http_message *message) {
+  auto header = mg_http_get_header(message, "Host");
+  if (site.hosts.empty() || header == nullptr) {
+    return 0;
+  }
+
+  // Drop the port, if any, keeping the brackets of IPv6 addresses.
+  auto host = std::string_view{header->ptr, header->len};
+  auto portBegin = host.rfind(':');
+  if (portBegin != std::string_view::npos &&
+      host.find(']', portBegin) == std::string_view::npos) {
+    host = host.substr(0, portBegin);
+  }
+
+  auto sameName = [host](const std::string &name) {
+    return name.length() == host.length() &&
+           std::equal(name.begin(), name.end(), host.begin(),
+                      [](char lhs, char rhs) {
+                        return std::tolower(static_cast<unsigned char>(lhs)) ==
+                               std::tolower(static_cast<unsigned char>(rhs));
+                      });
+  };
+
+  auto count = std::min(site.hosts.size(), site.config.hosts.size());
+  for (auto index = size_t{0}; index < count; ++index) {
+    const auto &names = site.config.hosts[index].names;
+    if (std::any_of(names.begin(), names.end(), sameName)) {
+      return index + 1;
+    }
+  }
+  return 0;
+}
+
+/// State of the site that the current request of `connection` is for.
+static siteState &getSiteState(struct mg_connection *connection) {
+  auto &sites = getAuxInfo(connection).sites;
+  auto index = getConnectionState(connection)->siteIndex;
+  return sites[index < sites.size() ? index : 0];
+}
+
+/// Check that the client may have another page rendered, and turn the request
+/// away with 429 if it may not.  Static files and cached pages never go
+/// through this, so that clients that are throttled still get the rest of a
+/// page that they have.
+static bool admitRender(struct mg_connection *connection) {
+  auto &limiter = getAuxInfo(connection).limiter;
+  if (!limiter) {
+    return true;
+  }
+
+  auto address = rateLimiter::clientKey{};
+  std::memcpy(address.data(), connection->rem.ip, address.size());
+  auto client = rateLimiter::keyOf(address, connection->rem.is_ip6);
+  auto maybeRetryAfter =
+      limiter->admit(client, std::chrono::steady_clock::now());
+  if (maybeRetryAfter) {
+    replyRetryLater(connection, codeTooManyRequests, *maybeRetryAfter);
+    return false;
+  }
+  return true;
+}
+
+/// Check that another page may be streamed, and turn the request away with
+/// 503 if it may not.  Every stream keeps a rendering thread busy, so capping
+/// the number of streams caps the threads that compete for the CPU.
+static bool admitStream(struct mg_connection *connection,
+                        const siteSnapshot &site) {
+  const auto &limits = site.config.limits;
+  if (!limits || limits->maxStreams == 0 ||
+      getAuxInfo(connection).activeStreams < limits->maxStreams) {
+    return true;
+  }
+
+  replyRetryLater(connection, codeUnavailable, std::chrono::seconds{1});
+  return false;
+}
+
+/// Move rendered chunks of the connection's streamed page into its send
+/// buffer, until the send buffer holds `sendWindowBytes`.  Returns true once
+/// the page is complete.
+static bool pumpStream(struct mg_connection *connection,
+                       connectionState &state) {
+  auto &chunk = state.streamChunk;
+  while (connection->send.len < sendWindowBytes && state.stream->next(chunk)) {
+    // An empty chunk would terminate the chunked response.
+    if (!chunk.empty()) {
+      mg_http_write_chunk(connection, chunk.data(), chunk.length());
+      state.pendingRecord.bytes += chunk.length();
+    }
+  }
+
+  auto done = state.stream->done();
+  if (done && state.stream->failed()) {
+    // The status line is long gone, so signal the failure by closing the
+    // connection without sending the terminating chunk.
+    connection->is_draining = 1;
+  } else if (done) {
+    mg_http_write_chunk(connection, "", 0);
+  }
+  return done;
+}
+
+/// Move the next pieces of the connection's range response into its send
+/// buffer, until the send buffer holds `sendWindowBytes`.  Returns true once
+/// the response is complete.
+static bool pumpRanges(struct mg_connection *connection,
+                       connectionState &state) {
+  auto &body = *state.ranges;
+  while (connection->send.len < sendWindowBytes && !body.done()) {
+    auto piece = body.next(sendWindowBytes - connection->send.len);
+    mg_send(connection, piece.data(), piece.length());
+  }
+
+  // Requests that arrive meanwhile would be answered in the middle of the
+  // body, so hold them back until it is complete.
+  connection->is_full = !body.done();
+  if (body.done()) {
+    connection->is_resp = 0;
+  }
+  return body.done();
+}
+
+/// Start streaming the page for the Markdown file at `path`.  Sends the
+/// response headers and the template prefix right away; the rest of the page
+/// follows as the renderer produces it.  Returns false if the page cannot be
+/// streamed.
+static bool startStream(std::string_view uri,
+                        const std::filesystem::path &path,
+                        const siteSnapshot &site,
+                        struct mg_connection *connection,
+                        connectionState &state) {
+  // Have the renderer wake the event loop whenever a chunk is ready, instead
+  // of polling the stream.  The renderer holds on to the waker, since it may
+  // outlive the connection and even the event loop.
+  auto onReady = std::function<void()>{};
+  if (auto waker = getAuxInfo(connection).waker) {
+    onReady = [waker] { waker->wake(); };
+  }
+
+  // Streams hold only a window of the page in memory, so only their CPU time
+  // is limited.
+  auto budget =
+      renderBudget{std::chrono::milliseconds{site.config.maxRenderMillis}, 0};
+  const auto &index = getSiteState(connection).index;
+  state.stream =
+      index ? renderStream::open(uri, path, site.layout, *index,
+                                 streamWindowBytes, std::move(onReady), budget,
+                                 /* silent */ true)
+            : renderStream::open(uri, path, site.layout, streamWindowBytes,
+                                 std::move(onReady), budget,
+                                 /* silent */ true);
+  if (!state.stream) {
+    return false;
+  }
+
+  mg_printf(connection, "HTTP/1.1 %d %s\r\nContent-Type: text/html\r\n"
+                        "Transfer-Encoding: chunked\r\n\r\n",
+            codeOk, statusText(codeOk));
+
+  // The log counts the bytes of the page, but not the chunk framing.
+  state.pendingRecord.bytes = 0;
+  pumpStream(connection, state);
+  return true;
+}
+
+/// Recover the status code and the size of the body from the response
+/// headers that the request handler queued at `offset` in the connection's
+/// send buffer.  This works uniformly for replies that we build and for files
+/// that mongoose serves on our behalf, which announce their length but queue
+/// their body later.  Replies to HEAD requests have only the body that was
+/// queued along with the headers, if any.
+static std::pair<int, uint64_t> inspectResponse(const struct mg_iobuf &send,
+                                                size_t offset,
+                                                bool headRequest) {
+  auto head = mg_http_message{};
+  auto queued = send.len - offset;
+  auto headLength = mg_http_parse(reinterpret_cast<const char *>(send.buf) +
+                                      offset,
+                                  queued, &head);
+  if (headLength <= 0) {
+    return {0, queued};
+  }
+
+  auto status = mg_http_status(&head);
+  auto queuedBody = queued - static_cast<size_t>(headLength);
+  auto hasLength = head.body.len != static_cast<size_t>(~0);
+  return {status, hasLength && !headRequest ? head.body.len : queuedBody};
+}
+
+/// Log a response that waited for a read or a sign-in, once it is queued from
+/// `sendOffset` on in the send buffer.
+static void logWaitingResponse(struct mg_connection *connection,
+                               connectionState &state, size_t sendOffset) {
+  auto &auxData = getAuxInfo(connection);
+  if (!auxData.log) {
+    return;
+  }
+
+  const auto &record = state.pendingRecord;
+  auto headRequest =
+      std::string_view{record.method, record.methodLength} == "HEAD";
+  auto [status, bytes] =
+      inspectResponse(connection->send, sendOffset, headRequest);
+  auto renderTime = std::chrono::steady_clock::now() - state.pendingStartTime;
+  state.pendingRecord.status = static_cast<uint16_t>(status);
+  state.pendingRecord.bytes = bytes;
+  state.pendingRecord.renderNs = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(renderTime)
+          .count());
+  auxData.log->push(state.pendingRecord);
+}
+
+/// Render the Markdown file at `path`, from `contents` if it was already
+/// read, within the render budget of the site.  Sets `overBudget` if the
+/// render was stopped for going over the budget.
+static std::optional<std::pmr::string>
+renderMarkDownFile(struct mg_connection *connection, const siteSnapshot &site,
+                   std::string_view uri, const std::filesystem::path &path,
+                   const std::optional<std::string> &contents,
+                   std::pmr::memory_resource &arena, bool &overBudget) {
+  auto watchdog = renderWatchdog{{
+      std::chrono::milliseconds{site.config.maxRenderMillis},
+      site.config.maxRenderBytes,
+  }};
+
+  const auto &index = getSiteState(connection).index;
+  auto maybeHtml = std::optional<std::pmr::string>{};
+  if (index) {
+    maybeHtml =
+        contents ? renderFile(uri, path, *contents, site.layout, *index, arena)
+                 : renderFile(uri, path, site.layout, *index, arena);
+  } else {
+    maybeHtml = contents ? renderFile(uri, path, *contents, site.layout, arena)
+                         : renderFile(uri, path, site.layout, arena);
+  }
+  overBudget = watchdog.tripped();
+  return maybeHtml;
+}
+
+/// Send the Markdown source of a page that went over its render budget as
+/// plain text, from `contents` if the file was already read.
+static void replyOverBudget(struct mg_connection *connection,
+                            std::string_view uri,
+                            const std::filesystem::path &path,
+                            const std::optional<std::string> &contents,
+                            std::pmr::memory_resource &arena) {
+  const auto contentType = "text/plain; charset=utf-8";
+  if (contents) {
+    replyBody(connection, codeOk, contentType, *contents);
+    return;
+  }
+
+  auto maybeContents = fetchFileContents(path, arena);
+  if (!maybeContents) {
+    replyRenderError(connection, uri);
+    return;
+  }
+  replyBody(connection, codeOk, contentType, *maybeContents);
+}
 
-static bool handleFileRequest(const std::string &uri,
+/// Render and send the page for a request whose Markdown file was read
+/// through the ring, and log the response.  If the read failed, read the file
+/// the blocking way instead, which also reports errors.
+static void finishRead(struct mg_connection *connection,
+                       const siteSnapshot &site, std::string_view uri,
+                       const std::filesystem::path &path,
+                       std::optional<pageCache::version> version,
+                       std::optional<std::string> contents) {
+  auto state = getConnectionState(connection);
+  auto &auxData = getAuxInfo(connection);
+  state->waiting = false;
+
+  auto sendOffset = connection->send.len;
+  auto &arena = state->arena;
+  auto overBudget = false;
+  auto maybeHtml = renderMarkDownFile(connection, site, uri, path, contents,
+                                      arena, overBudget);
+
+  // Pages rendered with a snapshot that was replaced in the meantime would
+  // not match the cache.
+  auto &siteData = getSiteState(connection);
+  auto current = &siteAt(*auxData.site, state->siteIndex) == &site;
+  auto span = traceSpan{"send"};
+  if (!maybeHtml && overBudget) {
+    if (version && current) {
+      siteData.overBudget.insert_or_assign(std::string{uri}, *version);
+    }
+    replyOverBudget(connection, uri, path, contents, arena);
+  } else if (!maybeHtml) {
+    replyRenderError(connection, uri);
+  } else {
+    if (version && siteData.cache && current) {
+      siteData.cache->insert(uri, *version, *maybeHtml);
+    }
+    replyHtml(connection, codeOk, *maybeHtml);
+  }
+
+  logWaitingResponse(connection, *state, sendOffset);
+  state->arena.release();
+}
+
+/// Start reading the Markdown file at `path` through the ring, and finish the
+/// response once the read completes.  Returns false if there is no ring or if
+/// the ring is full, in which case the caller reads the file itself.
+static bool readAsync(std::string_view uri, const std::filesystem::path &path,
+                      std::optional<pageCache::version> version,
+                      struct mg_connection *connection,
+                      connectionState &state) {
+  auto &auxData = getAuxInfo(connection);
+  if (!auxData.ring) {
+    return false;
+  }
+
+  // The connection may close before the read completes, so look it up again
+  // by its ID.  The page is rendered with the snapshot that the request
+  // started with.
+  auto done = [mgr = connection->mgr, id = connection->id,
+               snapshot = auxData.site, siteIndex = state.siteIndex,
+               uri = std::string{uri}, path,
+               version](std::optional<std::string> contents) {
+    for (auto other = mgr->conns; other != nullptr; other = other->next) {
+      if (other->id == id && !other->is_closing) {
+        finishRead(other, siteAt(*snapshot, siteIndex), uri, path, version,
+                   std::move(contents));
+        return;
+      }
+    }
+  };
+
+  if (!auxData.ring->readFile(path, std::move(done))) {
+    return false;
+  }
+  state.waiting = true;
+  return true;
+}
+
+/// Serve the static file at `path`.  Requests with a `Range` header get the
+/// ranges that they ask for, or the whole file if `If-Range` names another
+/// version of it, with bytes that come out of a memory mapping a window at a
+/// time, so that seeking in a long video never reads the whole file.  Other
+/// requests are left to mongoose.
+static void serveStaticFile(struct mg_connection *connection,
+                            struct mg_http_message *message,
+                            const std::filesystem::path &path,
+                            const siteSnapshot &site, connectionState &state) {
+  auto pathString = path.string();
+  struct stat info {};
+  if (::stat(pathString.c_str(), &info) != 0) {
+    replyHtml(connection, codeNotFound, site.notFoundHtml);
+    return;
+  }
+
+  // The same validator as mongoose's, so that both kinds of responses agree.
+  auto size = static_cast<uint64_t>(info.st_size);
+  char etag[64];
+  std::snprintf(etag, sizeof(etag), "\"%lld.%lld\"",
+                static_cast<long long>(info.st_mtime),
+                static_cast<long long>(size));
+  auto lastModified = formatHttpDate(static_cast<int64_t>(info.st_mtime));
+  auto headers = std::string{"Accept-Ranges: bytes\r\nLast-Modified: "};
+  headers.append(lastModified).append("\r\n");
+
+  auto rangeHeader = mg_http_get_header(message, "Range");
+  auto noneMatch = mg_http_get_header(message, "If-None-Match");
+  if (rangeHeader == nullptr ||
+      (noneMatch != nullptr && mg_vcasecmp(noneMatch, etag) == 0)) {
+    auto docRootString = site.config.docRoot.string();
+    auto opts = mg_http_serve_opts{};
+    opts.root_dir = docRootString.c_str();
+    opts.extra_headers = headers.c_str();
+    mg_http_serve_file(connection, message, pathString.c_str(), &opts);
+    return;
+  }
+
+  // A range of a version of the file other than the one that the client
+  // holds would be garbage, so such requests get the whole file instead.
+  auto ifRange = mg_http_get_header(message, "If-Range");
+  auto current = ifRange == nullptr ||
+                 std::string_view{ifRange->ptr, ifRange->len} == etag ||
+                 std::string_view{ifRange->ptr, ifRange->len} == lastModified;
+  auto ranges = parseRangeHeader({rangeHeader->ptr, rangeHeader->len}, size);
+  auto partial = current && ranges;
+  if (!partial) {
+    ranges = std::vector<byteRange>{};
+    if (size != 0) {
+      ranges->push_back({0, size - 1});
+    }
+  } else if (ranges->empty()) {
+    mg_printf(connection,
+              "HTTP/1.1 %d %s\r\nContent-Range: bytes */%llu\r\n"
+              "Content-Length: 0\r\n\r\n",
+              codeRangeNotSatisfiable, statusText(codeRangeNotSatisfiable),
+              static_cast<unsigned long long>(size));
+    connection->is_resp = 0;
+    return;
+  }
+
+  char boundary[33];
+  mg_random_str(boundary, sizeof(boundary));
+  auto contentType = guessContentType(path);
+  auto body = rangeBody::open(path, size, *ranges, contentType, boundary);
+  if (!body) {
+    replyHtml(connection, codeNotFound, site.notFoundHtml);
+    return;
+  }
+
+  auto status = partial ? codePartialContent : codeOk;
+  if (partial && ranges->size() > 1) {
+    headers.append("Content-Type: multipart/byteranges; boundary=")
+        .append(boundary)
+        .append("\r\n");
+  } else {
+    headers.append("Content-Type: ").append(contentType).append("\r\n");
+  }
+  if (partial && ranges->size() == 1) {
+    const auto &range = ranges->front();
+    char contentRange[100];
+    std::snprintf(contentRange, sizeof(contentRange),
+                  "Content-Range: bytes %llu-%llu/%llu\r\n",
+                  static_cast<unsigned long long>(range.first),
+                  static_cast<unsigned long long>(range.last),
+                  static_cast<unsigned long long>(size));
+    headers.append(contentRange);
+  }
+
+  mg_printf(connection,
+            "HTTP/1.1 %d %s\r\nEtag: %s\r\n%sContent-Length: %llu\r\n\r\n",
+            status, statusText(status), etag, headers.c_str(),
+            static_cast<unsigned long long>(body->length()));
+  if (mg_vcasecmp(&message->method, "HEAD") == 0) {
+    connection->is_resp = 0;
+    return;
+  }
+
+  state.ranges = std::move(body);
+  if (pumpRanges(connection, state)) {
+    state.ranges.reset();
+  }
+}
+
+static bool handleFileRequest(std::string_view uri,
                               const std::filesystem::path &path,
-                              const struct auxInfo &auxData,
+                              const siteSnapshot &site,
                               struct mg_connection *connection,
-                              struct mg_http_message *message) {
+                              struct mg_http_message *message,
+                              connectionState &state) {
+  auto arena = &state.arena;
   switch (std::filesystem::status(path).type()) {
   case std::filesystem::file_type::regular:
   case std::filesystem::file_type::symlink:
@@ -35,32 +768,90 @@ static bool handleFileRequest(const std::string &uri,
 
   // Non-Markdown files pass through without any rendering.
   if (path.extension() != ".md") {
-    auto pathString = path.string();
-    auto docRootString = auxData.docRoot.string();
+    auto span = traceSpan{"send"};
+    serveStaticFile(connection, message, path, site, state);
+    return true;
+  }
 
-    auto opts = mg_http_serve_opts{};
-    opts.root_dir = docRootString.c_str();
-    mg_http_serve_file(connection, message, pathString.c_str(), &opts);
+  // Stream very large pages rather than rendering them in one go, so that
+  // the first bytes go out right away and memory use stays bounded.  If the
+  // page cannot be streamed, render it in one go anyway.
+  auto errCode = std::error_code{};
+  auto fileSize = std::filesystem::file_size(path, errCode);
+  auto streamed = !errCode && site.config.streamThresholdBytes != 0 &&
+                  fileSize >= site.config.streamThresholdBytes;
+
+  // Other pages come out of the cache, unless the file changed since the page
+  // was cached.  Hits skip the rate limits, since they cost next to nothing.
+  auto &siteData = getSiteState(connection);
+  auto &cache = siteData.cache;
+  auto modified = std::filesystem::last_write_time(path, errCode);
+  auto cacheable = cache != nullptr && !streamed && !errCode;
+  if (cacheable) {
+    if (auto maybeHtml = cache->lookup(uri, modified)) {
+      auto span = traceSpan{"send"};
+      state.cache = cacheOutcome::HIT;
+      replyHtml(connection, codeOk, *maybeHtml);
+      return true;
+    }
+    state.cache = cacheOutcome::MISS;
+  }
+
+  // Pages that went over the render budget are not rendered again until
+  // their files change.
+  auto failed = siteData.overBudget.find(uri);
+  if (failed != siteData.overBudget.end()) {
+    if (!errCode && failed->second == modified) {
+      auto span = traceSpan{"send"};
+      replyOverBudget(connection, uri, path, std::nullopt, *arena);
+      return true;
+    }
+    siteData.overBudget.erase(failed);
+  }
+
+  if (!admitRender(connection) ||
+      (streamed && (!admitStream(connection, site) ||
+                    startStream(uri, path, site, connection, state)))) {
+    return true;
+  }
+
+  // Keep the event loop going while the file is read, if possible.
+  auto version =
+      errCode ? std::nullopt : std::optional<pageCache::version>{modified};
+  if (!streamed && readAsync(uri, path, version, connection, state)) {
+    return true;
+  }
+
+  auto overBudget = false;
+  auto maybeHtml = renderMarkDownFile(connection, site, uri, path,
+                                      std::nullopt, *arena, overBudget);
+
+  auto span = traceSpan{"send"};
+  if (!maybeHtml && overBudget) {
+    if (version) {
+      siteData.overBudget.insert_or_assign(std::string{uri}, *version);
+    }
+    replyOverBudget(connection, uri, path, std::nullopt, *arena);
     return true;
   }
 
-  auto maybeHtml = renderFile(path, auxData.templateText);
   if (!maybeHtml) {
-    mg_http_reply(connection, codeInternalError, "Content-Type: text/html\r\n",
-                  "failed to render page for URI: %.*s", uri.length(),
-                  uri.c_str());
+    replyRenderError(connection, uri);
     return false;
   }
 
-  mg_http_reply(connection, codeOk, "Content-Type: text/html\r\n",
-                maybeHtml->c_str(), maybeHtml->length());
+  if (cacheable) {
+    cache->insert(uri, modified, *maybeHtml);
+  }
+  replyHtml(connection, codeOk, *maybeHtml);
   return true;
 }
 
-static bool handleDirectoryRequest(const std::string &uri,
+static bool handleDirectoryRequest(std::string_view uri,
                                    const std::filesystem::path &path,
-                                   const struct auxInfo &auxData,
-                                   struct mg_connection *connection) {
+                                   const siteSnapshot &site,
+                                   struct mg_connection *connection,
+                                   std::pmr::memory_resource *arena) {
   switch (std::filesystem::status(path).type()) {
   case std::filesystem::file_type::directory:
     break;
@@ -68,97 +859,1324 @@ static bool handleDirectoryRequest(const std::string &uri,
     assert(false && "Invalid request, expected directory");
   }
 
-  auto maybeHtml = renderDirectory(uri, path, auxData.templateText);
+  const auto &index = getSiteState(connection).index;
+  auto maybeHtml =
+      index ? renderDirectory(uri, path, site.layout, *index, *arena)
+            : renderDirectory(uri, path, site.layout, *arena);
+
+  auto span = traceSpan{"send"};
   if (!maybeHtml) {
-    mg_http_reply(connection, codeInternalError, "Content-Type: text/html\r\n",
-                  "failed to render page for URI: %.*s", uri.length(),
-                  uri.c_str());
+    replyRenderError(connection, uri);
     return false;
   }
 
-  mg_http_reply(connection, codeOk, "Content-Type: text/html\r\n",
-                maybeHtml->c_str(), maybeHtml->length());
+  replyHtml(connection, codeOk, *maybeHtml);
   return true;
 }
 
-static void responseFn(struct mg_connection *connection, int ev, void *evData,
-                       void *fnData) {
-  if (ev != MG_EV_HTTP_MSG) {
+/// Serve `/_tags/<tag>`, which lists the pages that carry the tag, or
+/// `/_tags/`, which lists all tags.  Both come from the index, so no file is
+/// read.
+static void serveTagRequest(struct mg_connection *connection,
+                            std::string_view normalUri,
+                            const siteSnapshot &site,
+                            std::pmr::memory_resource *arena) {
+  auto encoded = normalUri.substr(std::min(normalUri.length(), size_t{7}));
+  while (!encoded.empty() && encoded.back() == '/') {
+    encoded.remove_suffix(1);
+  }
+
+  auto tag = std::pmr::string(encoded.length() + 1, '\0', arena);
+  auto length = mg_url_decode(encoded.data(), encoded.length(), tag.data(),
+                              tag.length(), 0);
+  if (length < 0) {
+    replyHtml(connection, codeNotFound, site.notFoundHtml);
     return;
   }
+  tag.resize(static_cast<size_t>(length));
 
-  struct mg_http_message *message =
-      static_cast<struct mg_http_message *>(evData);
-  auto uri = std::string{message->uri.ptr, message->uri.len};
-  auto uriPath = std::filesystem::path{uri}.lexically_normal();
-  auto normalUri = uriPath.string();
+  if (!admitRender(connection)) {
+    return;
+  }
 
-  auto auxData = static_cast<auxInfo *>(fnData);
-  auto fsPath = auxData->docRoot;
-  fsPath += uriPath.make_preferred();
+  const auto &index = *getSiteState(connection).index;
+  auto maybeHtml = renderTagPage(normalUri, tag, index, site.layout, *arena,
+                                 /* silent */ true);
 
-  if (!std::filesystem::exists(fsPath)) {
-    std::cerr << "file not found " << fsPath << std::endl;
-    mg_http_reply(connection, codeNotFound, "Content-Type: text/html\r\n",
-                  auxData->notFoundHtml.c_str(),
-                  auxData->notFoundHtml.length());
+  auto span = traceSpan{"send"};
+  if (!maybeHtml) {
+    replyHtml(connection, codeNotFound, site.notFoundHtml);
     return;
   }
+  replyHtml(connection, codeOk, *maybeHtml);
+}
 
-  // If this URI points to a directory, then make sure it always ends in a '/',
-  // so that relative paths always refer to the URI directory instead of the
-  // parent directory.
-  if (normalUri.length() > 0 && normalUri.back() != '/' &&
-      std::filesystem::is_directory(fsPath)) {
-    auto redirectMsg = std::string{"Location: "} + normalUri + "/\r\n";
-    mg_http_reply(connection, codeRedirect, redirectMsg.c_str(), "");
+/// Serve `/_links/broken`, which lists the links to missing files, from the
+/// link graph in the index.
+static void serveBrokenLinksRequest(struct mg_connection *connection,
+                                    std::string_view normalUri,
+                                    const siteSnapshot &site,
+                                    std::pmr::memory_resource *arena) {
+  if (!admitRender(connection)) {
     return;
   }
 
-  if (std::filesystem::is_directory(fsPath)) {
-    if (std::filesystem::exists(fsPath / "index.md")) {
-      fsPath /= "index.md";
-    } else {
-      handleDirectoryRequest(normalUri, fsPath, *auxData, connection);
-      return;
-    }
+  const auto &index = *getSiteState(connection).index;
+  auto maybeHtml = renderBrokenLinksPage(normalUri, index, site.layout, *arena,
+                                         /* silent */ true);
+
+  auto span = traceSpan{"send"};
+  if (!maybeHtml) {
+    replyRenderError(connection, normalUri);
+    return;
+  }
+  replyHtml(connection, codeOk, *maybeHtml);
+}
+
+/// Serve the Atom feed of the directory whose `feed.xml` is requested, or
+/// reply with 304 if the client's copy, named by `If-None-Match`, is current.
+/// Returns false if there is no such feed.
+static bool serveFeedRequest(struct mg_connection *connection,
+                             struct mg_http_message *message,
+                             std::string_view normalUri) {
+  const auto suffix = std::string_view{"/feed.xml"};
+  auto &siteData = getSiteState(connection);
+  if (!siteData.feeds || normalUri.length() < suffix.length() ||
+      normalUri.substr(normalUri.length() - suffix.length()) != suffix) {
+    return false;
+  }
+
+  auto dirUri = normalUri.substr(0, normalUri.length() - suffix.length() + 1);
+  auto feed = siteData.feeds->find(dirUri, *siteData.index);
+  if (feed == nullptr) {
+    return false;
   }
 
-  handleFileRequest(uri, fsPath, *auxData, connection, message);
+  auto span = traceSpan{"send"};
+  auto ifNoneMatch = mg_http_get_header(message, "If-None-Match");
+  if (ifNoneMatch != nullptr &&
+      std::string_view{ifNoneMatch->ptr, ifNoneMatch->len}.find(feed->etag) !=
+          std::string_view::npos) {
+    mg_printf(connection, "HTTP/1.1 %d %s\r\nETag: %s\r\n\r\n",
+              codeNotModified, statusText(codeNotModified),
+              feed->etag.c_str());
+    connection->is_resp = 0;
+    return true;
+  }
+
+  mg_printf(connection,
+            "HTTP/1.1 %d %s\r\nContent-Type: application/atom+xml\r\n"
+            "ETag: %s\r\nContent-Length: %lu\r\n\r\n",
+            codeOk, statusText(codeOk), feed->etag.c_str(),
+            static_cast<unsigned long>(feed->xml.length()));
+  mg_send(connection, feed->xml.data(), feed->xml.length());
+  connection->is_resp = 0;
+  return true;
 }
 
-class signalHandler {
-private:
-  static inline std::function<void(int)> handlerFunc = nullptr;
+/// Report the server's counters as JSON, so that the cache budget can be sized
+/// from its hit ratio.  The cache counters are those of the requested site.
+static void replyStats(struct mg_connection *connection) {
+  const auto &auxData = getAuxInfo(connection);
+  const auto &siteData = getSiteState(connection);
 
-  static void handler(int signal) { handlerFunc(signal); }
+  auto stats = nlohmann::json::object();
+  stats["activeStreams"] = auxData.activeStreams;
+  stats["liveClients"] = auxData.livePages.size();
+  if (siteData.cache) {
+    auto cache = siteData.cache->stats();
+    stats["cache"] = {
+        {"hits", cache.hits},
+        {"misses", cache.misses},
+        {"hitRatio", cache.hitRatio()},
+        {"admissions", cache.admissions},
+        {"rejections", cache.rejections},
+        {"evictions", cache.evictions},
+        {"entries", cache.entries},
+        {"bytes", cache.bytes},
+        {"maxBytes", cache.maxBytes},
+    };
+  }
 
-public:
-  static void init(std::function<void(int)> func) {
-    handlerFunc = func;
-    std::signal(SIGINT, handler);
-    std::signal(SIGTERM, handler);
+  replyBody(connection, codeOk, "application/json", stats.dump());
+}
+
+/// Redirect a URI that points to a directory to the same URI with a trailing
+/// '/', so that relative paths always refer to the URI directory instead of
+/// the parent directory.
+static void replyDirectoryRedirect(struct mg_connection *connection,
+                                   std::string_view normalUri,
+                                   std::pmr::memory_resource *arena) {
+  auto redirectMsg = std::pmr::string{"Location: ", arena};
+  redirectMsg.append(normalUri).append("/\r\n");
+  mg_http_reply(connection, codeRedirect, redirectMsg.c_str(), "");
+}
+
+static const auto sessionCookie = std::string_view{"magenta_session"};
+static const auto loginCookie = std::string_view{"magenta_login"};
+
+static int64_t unixSeconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Value of the cookie `name` in `message`, or an empty view.
+static std::string_view findCookie(struct mg_http_message *message,
+                                   std::string_view name) {
+  auto header = mg_http_get_header(message, "Cookie");
+  if (header == nullptr) {
+    return {};
   }
-};
+  auto value =
+      mg_http_get_header_var(*header, mg_str_n(name.data(), name.length()));
+  return {value.ptr, value.len};
+}
 
-void startWebServer(const std::filesystem::path &docRoot,
-                    std::string templateText, std::string notFoundHtml,
-                    uint32_t portNumber) {
-  // Handle interrupts, like Ctrl-C
-  auto sigNo = 0;
-  signalHandler::init([&sigNo](int number) { sigNo = number; });
+/// Decoded value of the query variable `name` in `message`, or an empty
+/// string.
+static std::pmr::string findQueryVar(struct mg_http_message *message,
+                                     const char *name,
+                                     std::pmr::memory_resource *arena) {
+  auto value = std::pmr::string(message->query.len + 1, '\0', arena);
+  auto length =
+      mg_http_get_var(&message->query, name, value.data(), value.length());
+  value.resize(length > 0 ? static_cast<size_t>(length) : 0);
+  return value;
+}
 
-  auto mgr = mg_mgr{};
-  mg_mgr_init(&mgr);
+static void appendUrlEncoded(std::pmr::string &text, std::string_view value) {
+  auto begin = text.length();
+  text.resize(begin + 3 * value.length() + 1);
+  auto length = mg_url_encode(value.data(), value.length(), text.data() + begin,
+                              text.length() - begin);
+  text.resize(begin + length);
+}
 
-  auto auxData =
-      auxInfo{docRoot, std::move(templateText), std::move(notFoundHtml)};
-  auto endPoint = std::string{"http://0.0.0.0:"} + std::to_string(portNumber);
-  mg_http_listen(&mgr, endPoint.c_str(), responseFn, &auxData);
+/// Redirect to `location`, with `headers` (complete header lines) added.
+static void replyRedirect(struct mg_connection *connection,
+                          std::string_view location, std::string_view headers) {
+  mg_printf(connection,
+            "HTTP/1.1 %d %s\r\nLocation: %.*s\r\n%.*sContent-Length: 0\r\n\r\n",
+            codeRedirect, statusText(codeRedirect),
+            static_cast<int>(location.length()), location.data(),
+            static_cast<int>(headers.length()), headers.data());
+  connection->is_resp = 0;
+}
 
-  const auto timeoutMs = 1000;
-  while (sigNo == 0)
-    mg_mgr_poll(&mgr, timeoutMs);
+/// Send a client without a valid session to sign in, and then back to the
+/// URI of `message`.
+static void replyLoginRedirect(struct mg_connection *connection,
+                               struct mg_http_message *message,
+                               std::pmr::memory_resource *arena) {
+  auto uri = std::pmr::string{{message->uri.ptr, message->uri.len}, arena};
+  if (message->query.len > 0) {
+    uri.append("?").append(message->query.ptr, message->query.len);
+  }
+
+  auto location = std::pmr::string{"/_auth/login?to=", arena};
+  appendUrlEncoded(location, uri);
+  replyRedirect(connection, location, {});
+}
+
+/// Send the client to the sign-in page of the provider in the `provider`
+/// query variable, to come back to `/_auth/callback` and then to the URI in
+/// `to`.  With several providers and none chosen, list the providers instead.
+/// The state parameter of the sign-in is bound to the browser by a nonce in a
+/// short-lived cookie.
+static void serveLoginRequest(struct mg_connection *connection,
+                              struct mg_http_message *message,
+                              const sessionAuth &auth,
+                              std::pmr::memory_resource *arena) {
+  // Only return to paths on this site.
+  auto to = findQueryVar(message, "to", arena);
+  auto returnUri = std::pmr::string{
+      isLocalReturnUri(to) ? std::string_view{to} : std::string_view{"/"},
+      arena};
+
+  auto providerText = findQueryVar(message, "provider", arena);
+  if (providerText.empty() && auth.providerCount() > 1) {
+    auto html = std::pmr::string{"<!DOCTYPE html>\n<title>Sign in</title>\n"
+                                 "<ul>\n",
+                                 arena};
+    for (auto provider = size_t{0}; provider < auth.providerCount();
+         ++provider) {
+      html.append("<li><a href=\"/_auth/login?provider=")
+          .append(std::to_string(provider))
+          .append("&amp;to=");
+      appendUrlEncoded(html, returnUri);
+      html.append("\">Sign in with ")
+          .append(auth.providerName(provider))
+          .append(" (")
+          .append(std::to_string(provider + 1))
+          .append(")</a></li>\n");
+    }
+    html.append("</ul>\n");
+    replyHtml(connection, codeOk, html);
+    return;
+  }
+
+  auto provider = providerText.empty() ? size_t{0}
+                                       : std::strtoul(providerText.c_str(),
+                                                      nullptr, 10);
+  if (provider >= auth.providerCount()) {
+    replyBody(connection, codeForbidden, "text/plain", "Unknown provider");
+    return;
+  }
+
+  char nonce[33];
+  mg_random_str(nonce, sizeof(nonce));
+  auto state = auth.signState(provider, returnUri, nonce, unixSeconds());
+
+  auto cookie = std::pmr::string{"Set-Cookie: ", arena};
+  cookie.append(loginCookie)
+      .append("=")
+      .append(nonce)
+      .append("; Path=/_auth; Max-Age=600; HttpOnly; SameSite=Lax\r\n");
+  replyRedirect(connection, auth.authorizeUrl(provider, state), cookie);
+}
+
+/// Finish the sign-in that the provider sent the client back from: check the
+/// state parameter against the client's nonce, trade the code for a login,
+/// and hand out a session cookie if the provider admits the login.  The
+/// response waits until the provider answers.
+static void serveCallbackRequest(struct mg_connection *connection,
+                                 struct mg_http_message *message,
+                                 connectionState &state) {
+  auto &auxData = getAuxInfo(connection);
+  auto arena = &state.arena;
+  auto now = unixSeconds();
+  auto code = findQueryVar(message, "code", arena);
+  auto maybeLogin =
+      auxData.auth->checkState(findQueryVar(message, "state", arena),
+                               findCookie(message, loginCookie), now);
+  if (!maybeLogin || code.empty()) {
+    replyBody(connection, codeForbidden, "text/plain", "Sign-in failed");
+    return;
+  }
+
+  // The connection may close before the provider answers, so look it up again
+  // by its ID.  If the answer comes right away, `responseFn()` logs the
+  // response as usual.
+  auto answered = std::make_shared<bool>(false);
+  auto done = [mgr = connection->mgr, id = connection->id, answered,
+               auth = auxData.auth,
+               returnUri = std::move(maybeLogin->returnUri)](
+                  std::optional<std::string> token) {
+    for (auto other = mgr->conns; other != nullptr; other = other->next) {
+      if (other->id != id || other->is_closing) {
+        continue;
+      }
+
+      auto otherState = getConnectionState(other);
+      auto sendOffset = other->send.len;
+      otherState->waiting = false;
+      if (!token) {
+        replyBody(other, codeForbidden, "text/plain", "Sign-in failed");
+      } else {
+        auto cookies = std::string{"Set-Cookie: "};
+        cookies.append(sessionCookie)
+            .append("=")
+            .append(*token)
+            .append("; Path=/; Max-Age=")
+            .append(std::to_string(auth->sessionSeconds()))
+            .append("; HttpOnly; SameSite=Lax\r\nSet-Cookie: ")
+            .append(loginCookie)
+            .append("=; Path=/_auth; Max-Age=0\r\n");
+        replyRedirect(other, returnUri, cookies);
+      }
+
+      if (*answered) {
+        logWaitingResponse(other, *otherState, sendOffset);
+      }
+      return;
+    }
+  };
+
+  state.waiting = true;
+  auxData.auth->finishLogin(maybeLogin->provider, code, now, std::move(done));
+  *answered = true;
+}
+
+/// Serve the sign-in pages under `/_auth/`.
+static void serveAuthRequest(struct mg_connection *connection,
+                             struct mg_http_message *message,
+                             std::string_view normalUri,
+                             connectionState &state) {
+  const auto &auth = *getAuxInfo(connection).auth;
+  if (normalUri == "/_auth/login") {
+    serveLoginRequest(connection, message, auth, &state.arena);
+  } else if (normalUri == "/_auth/callback") {
+    serveCallbackRequest(connection, message, state);
+  } else if (normalUri == "/_auth/logout") {
+    // Sessions are stateless, so signing out only drops the cookie.
+    auto cookie = std::pmr::string{"Set-Cookie: ", &state.arena};
+    cookie.append(sessionCookie).append("=; Path=/; Max-Age=0\r\n");
+    mg_printf(connection,
+              "HTTP/1.1 %d %s\r\n%sContent-Type: text/plain\r\n"
+              "Content-Length: 10\r\n\r\nSigned out",
+              codeOk, statusText(codeOk), cookie.c_str());
+    connection->is_resp = 0;
+  } else {
+    replyBody(connection, codeNotFound, "text/plain", "Not Found");
+  }
+}
+
+/// Serve a request from the bundle instead of the disk.  Pages rendered at
+/// build time go out as they are, Markdown files are rendered from memory, and
+/// all other files are served by mongoose through `mg_fs_packed`.
+static void serveBundledRequest(std::string_view normalUri,
+                                const siteSnapshot &site,
+                                struct mg_connection *connection,
+                                struct mg_http_message *message,
+                                std::pmr::memory_resource *arena) {
+  auto bundlePath = [normalUri, arena](std::string_view prefix,
+                                       std::string_view suffix = {}) {
+    auto path = std::pmr::string{prefix, arena};
+    path.append(normalUri).append(suffix);
+    return path;
+  };
+
+  if (auto page = fetchBundledFile(bundlePath("/pages").c_str())) {
+    replyHtml(connection, codeOk, *page);
+    return;
+  }
+
+  auto path = bundlePath("/root");
+  auto size = size_t{0};
+  auto mtime = time_t{0};
+  auto type = mg_fs_packed.st(path.c_str(), &size, &mtime);
+
+  auto isDirectory = type == MG_FS_DIR ||
+                     fetchBundledFile(bundlePath("/pages", "/").c_str());
+  if (isDirectory && normalUri.back() != '/') {
+    replyDirectoryRedirect(connection, normalUri, arena);
+    return;
+  }
+
+  if (isDirectory) {
+    path.append("index.md");
+    type = mg_fs_packed.st(path.c_str(), &size, &mtime);
+  }
+
+  if (type != MG_FS_READ) {
+    replyHtml(connection, codeNotFound, site.notFoundHtml);
+    return;
+  }
+
+  auto extension = std::string_view{".md"};
+  if (path.length() < extension.length() ||
+      path.compare(path.length() - extension.length(), extension.length(),
+                   extension) != 0) {
+    auto opts = mg_http_serve_opts{};
+    opts.root_dir = "/root";
+    opts.fs = &mg_fs_packed;
+
+    auto span = traceSpan{"send"};
+    mg_http_serve_file(connection, message, path.c_str(), &opts);
+    return;
+  }
+
+  if (!admitRender(connection)) {
+    return;
+  }
+
+  auto maybeHtml = renderText(normalUri, *fetchBundledFile(path.c_str()),
+                              site.layout, *arena);
+
+  auto span = traceSpan{"send"};
+  if (!maybeHtml) {
+    replyRenderError(connection, normalUri);
+    return;
+  }
+
+  replyHtml(connection, codeOk, *maybeHtml);
+}
+
+static void serveRequest(struct mg_connection *connection,
+                         struct mg_http_message *message,
+                         const siteSnapshot &site,
+                         connectionState &state) {
+  auto arena = &state.arena;
+  auto uri = std::pmr::string{{message->uri.ptr, message->uri.len}, arena};
+  auto span = traceSpan{"request", uri};
+
+  auto resolveSpan = std::optional<traceSpan>{std::in_place, "resolve"};
+  auto normalUri = normalizeUri(uri, arena);
+
+  // Everything but the sign-in pages needs a session, and pages that are
+  // requested without one send the client to sign in.
+  const auto &auth = getAuxInfo(connection).auth;
+  if (auth && normalUri.rfind("/_auth/", 0) == 0) {
+    resolveSpan.reset();
+    serveAuthRequest(connection, message, normalUri, state);
+    return;
+  }
+
+  if (auth &&
+      !auth->verify(findCookie(message, sessionCookie), unixSeconds())) {
+    resolveSpan.reset();
+    replyLoginRedirect(connection, message, arena);
+    return;
+  }
+
+  if (site.config.liveReload && normalUri == "/_live") {
+    resolveSpan.reset();
+    mg_ws_upgrade(connection, message, nullptr);
+    return;
+  }
+
+  if (site.config.liveReload && normalUri == "/_live.js") {
+    resolveSpan.reset();
+    replyBody(connection, codeOk, "text/javascript", liveReloadScript);
+    return;
+  }
+
+  if (site.config.stats && normalUri == "/_stats") {
+    resolveSpan.reset();
+    replyStats(connection);
+    return;
+  }
+
+  auto isTagView = normalUri == "/_tags" || normalUri.rfind("/_tags/", 0) == 0;
+  if (isTagView && getSiteState(connection).index) {
+    resolveSpan.reset();
+    serveTagRequest(connection, normalUri, site, arena);
+    return;
+  }
+
+  if (normalUri == "/_links/broken" && getSiteState(connection).index) {
+    resolveSpan.reset();
+    serveBrokenLinksRequest(connection, normalUri, site, arena);
+    return;
+  }
+
+  if (site.config.bundled) {
+    resolveSpan.reset();
+    serveBundledRequest(normalUri, site, connection, message, arena);
+    return;
+  }
+
+  // `std::filesystem::path` cannot allocate from the arena, so this is the one
+  // per-request string that still comes from the global heap.
+  auto fsPath = site.config.docRoot;
+  fsPath += std::string_view{normalUri};
+  fsPath.make_preferred();
+
+  // Feeds are generated, unless the directory has a `feed.xml` file of its
+  // own.
+  if (!std::filesystem::exists(fsPath)) {
+    resolveSpan.reset();
+    if (!serveFeedRequest(connection, message, normalUri)) {
+      replyHtml(connection, codeNotFound, site.notFoundHtml);
+    }
+    return;
+  }
+
+  // If this URI points to a directory, then make sure it always ends in a '/',
+  // so that relative paths always refer to the URI directory instead of the
+  // parent directory.
+  if (normalUri.back() != '/' && std::filesystem::is_directory(fsPath)) {
+    resolveSpan.reset();
+    replyDirectoryRedirect(connection, normalUri, arena);
+    return;
+  }
+
+  if (std::filesystem::is_directory(fsPath)) {
+    if (std::filesystem::exists(fsPath / "index.md")) {
+      fsPath /= "index.md";
+    } else {
+      resolveSpan.reset();
+      if (admitRender(connection)) {
+        handleDirectoryRequest(normalUri, fsPath, site, connection, arena);
+      }
+      return;
+    }
+  }
+
+  resolveSpan.reset();
+  handleFileRequest(normalUri, fsPath, site, connection, message, state);
+}
+
+/// Record trace events for the connection-level stages that happen before a
+/// request reaches `serveRequest()`: accepting the connection, and reading and
+/// parsing the request.  The time at which the first bytes of the pending
+/// request arrived is kept in the connection state.
+static void traceConnectionEvent(struct mg_connection *connection, int ev) {
+  if (ev == MG_EV_ACCEPT) {
+    traceInstant("accept");
+    return;
+  }
+
+  if (ev != MG_EV_READ && ev != MG_EV_HTTP_MSG) {
+    return;
+  }
+
+  auto state = getConnectionState(connection);
+  if (ev == MG_EV_READ && state->readStartNs == 0) {
+    state->readStartNs = traceNow();
+  } else if (ev == MG_EV_HTTP_MSG && state->readStartNs != 0) {
+    traceComplete("parse", state->readStartNs, traceNow());
+    state->readStartNs = 0;
+  }
+}
+
+/// Log a completed (or abandoned) streamed response and release the stream.
+static void finishStream(connectionState &state, struct auxInfo &auxData) {
+  if (auxData.log) {
+    auto renderTime =
+        std::chrono::steady_clock::now() - state.pendingStartTime;
+    state.pendingRecord.renderNs = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(renderTime)
+            .count());
+    auxData.log->push(state.pendingRecord);
+  }
+
+  state.stream.reset();
+  state.streamChunk = std::string{};
+  auxData.activeStreams -= 1;
+}
+
+/// Subscribe a live reload client to changes to the Markdown file that is
+/// served for the page URI in `message`.
+static void subscribeLivePage(struct mg_connection *connection,
+                              const struct mg_ws_message &message,
+                              struct auxInfo &auxData) {
+  auto state = getConnectionState(connection);
+  const auto &config = siteAt(*auxData.site, state->siteIndex).config;
+  auto path = config.docRoot;
+  path += std::string_view{
+      normalizeUri({message.data.ptr, message.data.len}, &state->arena)};
+  path.make_preferred();
+  state->arena.release();
+
+  if (std::filesystem::is_directory(path)) {
+    path /= "index.md";
+  }
+  if (path.extension() != ".md") {
+    return;
+  }
+
+  auto key = path.string();
+  if (auxData.livePages.count(key) == 0) {
+    auto maybePage = livePage::open(
+        path, {std::chrono::milliseconds{config.maxRenderMillis},
+               config.maxRenderBytes});
+    if (!maybePage) {
+      return;
+    }
+    auxData.livePages.emplace(key, std::move(*maybePage));
+  }
+  state->livePath = std::move(key);
+}
+
+/// Send the blocks that changed in watched Markdown files to the live reload
+/// clients that watch them, and stop watching files that no client watches.
+static void refreshLivePages(struct mg_mgr &mgr, struct auxInfo &auxData) {
+  auto forEachWatcher = [&mgr](const std::string &path, auto fn) {
+    for (auto connection = mgr.conns; connection != nullptr;
+         connection = connection->next) {
+      auto state = peekConnectionState(connection);
+      if (connection->is_websocket && state != nullptr &&
+          state->livePath == path) {
+        fn(connection);
+      }
+    }
+  };
+
+  for (auto page = auxData.livePages.begin();
+       page != auxData.livePages.end();) {
+    auto watched = false;
+    forEachWatcher(page->first, [&watched](auto) { watched = true; });
+    if (!watched) {
+      page = auxData.livePages.erase(page);
+      continue;
+    }
+
+    if (auto maybeMessage = page->second.refresh()) {
+      forEachWatcher(page->first, [&maybeMessage](auto connection) {
+        mg_ws_send(connection, maybeMessage->data(), maybeMessage->length(),
+                   WEBSOCKET_OP_TEXT);
+      });
+    }
+    ++page;
+  }
+}
+
+static void responseFn(struct mg_connection *connection, int ev, void *evData,
+                       void *fnData) {
+  if (isTracing()) {
+    traceConnectionEvent(connection, ev);
+  }
+
+  if (ev == MG_EV_POLL || ev == MG_EV_WRITE || ev == MG_EV_CLOSE) {
+    auto state = peekConnectionState(connection);
+    if (state != nullptr && state->stream &&
+        (pumpStream(connection, *state) || ev == MG_EV_CLOSE)) {
+      finishStream(*state, *static_cast<auxInfo *>(fnData));
+    }
+    if (state != nullptr && state->ranges &&
+        (pumpRanges(connection, *state) || ev == MG_EV_CLOSE)) {
+      state->ranges.reset();
+    }
+  }
+
+  if (ev == MG_EV_CLOSE) {
+    freeConnectionState(connection);
+    return;
+  }
+
+  if (ev == MG_EV_WS_MSG) {
+    subscribeLivePage(connection, *static_cast<struct mg_ws_message *>(evData),
+                      *static_cast<auxInfo *>(fnData));
+    return;
+  }
+
+  if (ev != MG_EV_HTTP_MSG) {
+    return;
+  }
+
+  auto message = static_cast<struct mg_http_message *>(evData);
+  auto auxData = static_cast<auxInfo *>(fnData);
+  auto state = getConnectionState(connection);
+
+  auto startTime = std::chrono::steady_clock::now();
+  auto sendOffset = connection->send.len;
+
+  // Keep the snapshot alive until the request is done, even if a reload
+  // replaces it in the meantime.
+  auto site = auxData->site;
+  state->siteIndex = selectSite(*site, message);
+  serveRequest(connection, message, siteAt(*site, state->siteIndex), *state);
+
+  auto renderTime = std::chrono::steady_clock::now() - startTime;
+  auto headRequest = mg_vcasecmp(&message->method, "HEAD") == 0;
+  auto [status, bytes] =
+      inspectResponse(connection->send, sendOffset, headRequest);
+  auto record = makeAccessRecord({message->method.ptr, message->method.len},
+                                 {message->uri.ptr, message->uri.len}, status,
+                                 bytes, renderTime, state->cache);
+  state->cache = cacheOutcome::NONE;
+
+  if (state->stream) {
+    // Log streamed responses once they complete, along with the bytes of
+    // the page that went out so far.
+    auxData->activeStreams += 1;
+    record.bytes = state->pendingRecord.bytes;
+    state->pendingRecord = record;
+    state->pendingStartTime = startTime;
+  } else if (state->waiting) {
+    // Log responses that wait for a read or a sign-in once they are sent.
+    state->pendingRecord = record;
+    state->pendingStartTime = startTime;
+  } else if (auxData->log) {
+    auxData->log->push(record);
+  }
+
+  state->arena.release();
+}
+
+#ifdef SIGUSR1
+static const auto signalToggleTrace = SIGUSR1;
+#else
+static const auto signalToggleTrace = 0;
+#endif
+
+#ifdef SIGHUP
+static const auto signalReload = SIGHUP;
+#else
+static const auto signalReload = 0;
+#endif
+
+class signalHandler {
+private:
+  static inline std::function<void(int)> handlerFunc = nullptr;
+
+  static void handler(int signal) { handlerFunc(signal); }
+
+public:
+  static void init(std::function<void(int)> func) {
+    handlerFunc = func;
+    std::signal(SIGINT, handler);
+    std::signal(SIGTERM, handler);
+    if (signalToggleTrace != 0) {
+      std::signal(signalToggleTrace, handler);
+    }
+    if (signalReload != 0) {
+      std::signal(signalReload, handler);
+    }
+  }
+};
+
+/// Start tracing if it is off, or stop tracing and write the trace file if it
+/// is on.  Tracing stops on its own once `deadline` passes.
+static void toggleTracing(const std::optional<struct traceConfig> &trace,
+                          std::chrono::steady_clock::time_point &deadline) {
+  if (!trace) {
+    std::cerr << "ignoring request to toggle tracing, since the configuration "
+                 "has no trace section"
+              << std::endl;
+    return;
+  }
+
+  if (isTracing()) {
+    if (stopTracing(trace->path)) {
+      std::cout << "Wrote trace to '" << trace->path.string() << "'"
+                << std::endl;
+    }
+    return;
+  }
+
+  deadline = std::chrono::steady_clock::now() +
+             std::chrono::seconds{trace->maxSeconds};
+  startTracing();
+}
+
+/// Recompile the layout of `site` if any of its files changed, and render the
+/// 404 page with the new layout.  Returns none if the layout did not change,
+/// or if either step fails, in which case the old layout stays.  The result
+/// has no hosts.
+static std::optional<siteSnapshot> refreshSiteLayout(const siteSnapshot &site) {
+  if (!site.layout.isStale()) {
+    return {};
+  }
+
+  auto maybeLayout = compiledTemplate::load(site.layout.path());
+  if (!maybeLayout) {
+    return {};
+  }
+
+  auto maybeNotFoundHtml =
+      renderNotFoundPage(site.config.docRoot, *maybeLayout);
+  if (!maybeNotFoundHtml) {
+    std::cerr << "failed to load 404 page content" << std::endl;
+    return {};
+  }
+
+  std::cout << "Reloaded template file '" << maybeLayout->path().string()
+            << "'" << std::endl;
+  return siteSnapshot{site.config, std::move(*maybeLayout),
+                      std::move(*maybeNotFoundHtml), {}};
+}
+
+/// Recompile the layouts of all sites whose layout files changed, and drop
+/// the pages that were cached with the old layouts.
+static void refreshLayout(struct auxInfo &auxData) {
+  const auto &site = *auxData.site;
+  auto refreshed = std::vector<std::optional<siteSnapshot>>{};
+  auto changed = false;
+  for (auto index = size_t{0}; index <= site.hosts.size(); ++index) {
+    refreshed.push_back(refreshSiteLayout(siteAt(site, index)));
+    changed |= refreshed.back().has_value();
+  }
+  if (!changed) {
+    return;
+  }
+
+  for (auto index = size_t{0}; index < refreshed.size(); ++index) {
+    const auto &cache = auxData.sites[index].cache;
+    if (refreshed[index] && cache) {
+      cache->clear();
+    }
+    if (!refreshed[index]) {
+      const auto &old = siteAt(site, index);
+      refreshed[index] = siteSnapshot{old.config, old.layout, old.notFoundHtml,
+                                      {}};
+    }
+  }
+
+  auto next = std::move(*refreshed.front());
+  for (auto index = size_t{1}; index < refreshed.size(); ++index) {
+    next.hosts.push_back(std::move(*refreshed[index]));
+  }
+  auxData.site = std::make_shared<const siteSnapshot>(std::move(next));
+}
+
+static std::unique_ptr<accessLog>
+openAccessLog(const std::optional<struct logConfig> &log) {
+  if (!log) {
+    return nullptr;
+  }
+  return accessLog::open(log->accessLogPath, log->maxFileBytes, log->maxFiles);
+}
+
+static std::unique_ptr<rateLimiter>
+makeRateLimiter(const std::optional<struct limitConfig> &limits) {
+  if (!limits) {
+    return nullptr;
+  }
+  return std::make_unique<rateLimiter>(limits->requestsPerSecond,
+                                       limits->burst);
+}
+
+static std::unique_ptr<pageCache> makePageCache(uint64_t cacheBytes) {
+  if (cacheBytes == 0) {
+    return nullptr;
+  }
+  return std::make_unique<pageCache>(cacheBytes);
+}
+
+static std::unique_ptr<metadataIndex> makeIndex(const struct config &config) {
+  if (config.bundled) {
+    return nullptr;
+  }
+
+  return std::make_unique<metadataIndex>(config.docRoot);
+}
+
+static std::shared_ptr<indexRefresh>
+makeIndexRefresh(const std::unique_ptr<metadataIndex> &index) {
+  if (!index) {
+    return nullptr;
+  }
+  return std::make_shared<indexRefresh>(index->root());
+}
+
+static std::unique_ptr<feedStore> makeFeedStore(const struct config &config) {
+  if (config.bundled || config.feedEntries == 0) {
+    return nullptr;
+  }
+  return std::make_unique<feedStore>(config.feedEntries);
+}
+
+static siteState makeSiteState(const struct config &config) {
+  auto index = makeIndex(config);
+  auto refresh = makeIndexRefresh(index);
+  return siteState{makePageCache(config.cacheBytes), std::move(index),
+                   std::move(refresh), makeFeedStore(config), {}};
+}
+
+/// Whether `lhs` and `rhs` render the same pages from the same files, so that
+/// pages cached for one can be served for the other.
+static bool sameRendering(const siteSnapshot &lhs, const siteSnapshot &rhs) {
+  const auto &left = lhs.config;
+  const auto &right = rhs.config;
+  return left.docRoot == right.docRoot && left.bundled == right.bundled &&
+         left.streamThresholdBytes == right.streamThresholdBytes &&
+         left.maxRenderMillis == right.maxRenderMillis &&
+         left.maxRenderBytes == right.maxRenderBytes &&
+         lhs.layout.source() == rhs.layout.source();
+}
+
+/// State of each site of `next`, reusing the index of an old site with the
+/// same document root and the cache of the old site in the same position.
+/// Reused caches are cleared only if the site renders its pages differently
+/// now, and pages that went over the render budget stay plain text until
+/// then.
+static std::vector<siteState> reuseSiteStates(std::vector<siteState> &old,
+                                              const siteSnapshot &oldSite,
+                                              const siteSnapshot &next) {
+  auto sites = std::vector<siteState>{};
+  for (auto index = size_t{0}; index <= next.hosts.size(); ++index) {
+    const auto &config = siteAt(next, index).config;
+    auto state = siteState{};
+
+    for (auto other = size_t{0}; other < old.size(); ++other) {
+      const auto &oldConfig = siteAt(oldSite, other).config;
+      if (old[other].index && oldConfig.docRoot == config.docRoot &&
+          oldConfig.bundled == config.bundled) {
+        state.index = std::move(old[other].index);
+        state.refresh = std::move(old[other].refresh);
+        if (oldConfig.feedEntries == config.feedEntries) {
+          state.feeds = std::move(old[other].feeds);
+        }
+        break;
+      }
+    }
+    if (!state.index) {
+      state.index = makeIndex(config);
+      state.refresh = makeIndexRefresh(state.index);
+    }
+    if (!state.feeds) {
+      state.feeds = makeFeedStore(config);
+    }
+
+    auto unchanged =
+        index < old.size() && sameRendering(siteAt(oldSite, index),
+                                            siteAt(next, index));
+    if (index < old.size() && old[index].cache &&
+        siteAt(oldSite, index).config.cacheBytes == config.cacheBytes) {
+      state.cache = std::move(old[index].cache);
+      if (!unchanged) {
+        state.cache->clear();
+      }
+    } else {
+      state.cache = makePageCache(config.cacheBytes);
+    }
+    if (unchanged) {
+      state.overBudget = std::move(old[index].overBudget);
+    }
+    sites.push_back(std::move(state));
+  }
+  return sites;
+}
+
+/// Sign-in as `config` asks for, or null if it has no auth section.  Returns
+/// none if sign-in cannot be set up, in which case the server must not serve
+/// the configuration.
+static std::optional<std::shared_ptr<sessionAuth>>
+makeAuth(struct mg_mgr &mgr, const struct config &config) {
+  if (!config.auth) {
+    return std::shared_ptr<sessionAuth>{};
+  }
+
+  auto auth = sessionAuth::create(*config.auth,
+                                  makeGithubExchange(mgr, *config.auth));
+  if (!auth) {
+    std::cerr << "failed to set up signing in" << std::endl;
+    return {};
+  }
+  return auth;
+}
+
+static bool sameLogConfig(const std::optional<struct logConfig> &lhs,
+                          const std::optional<struct logConfig> &rhs) {
+  if (!lhs || !rhs) {
+    return !lhs && !rhs;
+  }
+  return lhs->accessLogPath == rhs->accessLogPath &&
+         lhs->maxFileBytes == rhs->maxFileBytes &&
+         lhs->maxFiles == rhs->maxFiles;
+}
+
+/// Load the configuration and the layout again, and swap them in.  The access
+/// log is reopened, rate limits are reset, live reload clients are dropped and
+/// metadata is indexed again and cached pages are dropped only if their
+/// settings changed.  Sign-in is set up again, and sessions stay valid as
+/// long as their key does.  If loading fails, keep serving the old snapshot.
+static void reloadSite(const siteLoader &reload, struct mg_mgr &mgr,
+                       struct auxInfo &auxData) {
+  if (!reload) {
+    std::cerr << "ignoring request to reload, since there is nothing to "
+                 "reload from"
+              << std::endl;
+    return;
+  }
+
+  auto maybeSite = reload();
+  auto maybeAuth = maybeSite ? makeAuth(mgr, maybeSite->config) : std::nullopt;
+  if (!maybeSite || !maybeAuth) {
+    std::cerr << "failed to reload configuration, keeping the old one"
+              << std::endl;
+    return;
+  }
+  auxData.auth = std::move(*maybeAuth);
+
+  const auto &oldConfig = auxData.site->config;
+  const auto &newConfig = maybeSite->config;
+  if (newConfig.port != oldConfig.port) {
+    std::cerr << "ignoring new port " << newConfig.port
+              << " until the next restart" << std::endl;
+    maybeSite->config.port = oldConfig.port;
+  }
+
+  if (!sameLogConfig(newConfig.log, oldConfig.log)) {
+    auxData.log = openAccessLog(newConfig.log);
+  }
+
+  // Clients keep their buckets unless the rates change.
+  const auto &newLimits = newConfig.limits;
+  const auto &oldLimits = oldConfig.limits;
+  if (!newLimits || !oldLimits ||
+      newLimits->requestsPerSecond != oldLimits->requestsPerSecond ||
+      newLimits->burst != oldLimits->burst) {
+    auxData.limiter = makeRateLimiter(newLimits);
+  }
+
+  // Live pages are watched by path, under the document root of their site.
+  auto sameRoots = maybeSite->hosts.size() == auxData.site->hosts.size();
+  for (auto index = size_t{0}; sameRoots && index <= maybeSite->hosts.size();
+       ++index) {
+    sameRoots = siteAt(*maybeSite, index).config.docRoot ==
+                siteAt(*auxData.site, index).config.docRoot;
+  }
+  if (!newConfig.liveReload || !sameRoots) {
+    auxData.livePages.clear();
+  }
+
+  auxData.sites = reuseSiteStates(auxData.sites, *auxData.site, *maybeSite);
+
+  auxData.site = std::make_shared<const siteSnapshot>(std::move(*maybeSite));
+  std::cout << "Reloaded configuration" << std::endl;
+}
+
+/// Listen for HTTP connections on `listener`, a listening socket that another
+/// process handed over.  Mongoose only creates HTTP listeners itself, so this
+/// opens one on an ephemeral loopback port and swaps in `listener`.
+static struct mg_connection *adoptListener(struct mg_mgr &mgr, int listener,
+                                           void *fnData) {
+  auto connection =
+      mg_http_listen(&mgr, "http://127.0.0.1:0", responseFn, fnData);
+  if (connection == nullptr) {
+    return nullptr;
+  }
+
+#ifndef _WIN32
+  // Closing the ephemeral socket also drops it from the epoll set, if any, so
+  // register the inherited socket in its place.
+  ::close(static_cast<int>(reinterpret_cast<size_t>(connection->fd)));
+#endif
+  connection->fd = reinterpret_cast<void *>(static_cast<size_t>(listener));
+  MG_EPOLL_ADD(connection);
+  return connection;
+}
+
+/// Start a scan of the document root of each indexed site, unless one is
+/// still running.  The scanning thread wakes the event loop once it is done.
+static void startIndexScans(struct auxInfo &auxData) {
+  for (auto &siteData : auxData.sites) {
+    if (!siteData.refresh || siteData.refresh->running) {
+      continue;
+    }
+
+    siteData.refresh->running = true;
+    std::thread{[refresh = siteData.refresh, waker = auxData.waker] {
+      auto changes = indexChanges{};
+      try {
+        changes = refresh->scanner.scan();
+      } catch (const std::exception &) {
+        // Try again with the next scan.
+      }
+
+      {
+        auto guard = std::lock_guard<std::mutex>{refresh->lock};
+        refresh->changes = std::move(changes);
+      }
+      if (waker) {
+        waker->wake();
+      }
+    }}.detach();
+  }
+}
+
+/// Apply the changes of the scans that finished to the indexes of their
+/// sites, and drop whatever the changes make stale.
+static void applyIndexChanges(struct auxInfo &auxData) {
+  for (auto &siteData : auxData.sites) {
+    if (!siteData.refresh || !siteData.refresh->running) {
+      continue;
+    }
+
+    auto changes = std::optional<indexChanges>{};
+    {
+      auto guard = std::lock_guard<std::mutex>{siteData.refresh->lock};
+      changes.swap(siteData.refresh->changes);
+    }
+    if (!changes) {
+      continue;
+    }
+
+    siteData.refresh->running = false;
+    auto changed = [&siteData](std::string_view uri) {
+      if (siteData.feeds) {
+        siteData.feeds->invalidate(uri);
+      }
+
+      auto failed = siteData.overBudget.find(uri);
+      if (failed != siteData.overBudget.end()) {
+        siteData.overBudget.erase(failed);
+      }
+
+      // Backlinks change without touching the file, so its cached page
+      // would otherwise stay.
+      if (siteData.cache) {
+        siteData.cache->invalidate(uri);
+        auto indexName = std::string_view{"index.md"};
+        if (uri.length() > indexName.length() &&
+            uri.substr(uri.length() - indexName.length()) == indexName) {
+          siteData.cache->invalidate(
+              uri.substr(0, uri.length() - indexName.length()));
+        }
+      }
+    };
+    siteData.index->apply(std::move(*changes), changed);
+  }
+}
+
+/// Number of client connections, which leaves out listeners and the waker.
+static size_t countOpenConnections(const struct mg_mgr &mgr) {
+  auto count = size_t{0};
+  for (auto connection = mgr.conns; connection != nullptr;
+       connection = connection->next) {
+    auto isClient = !connection->is_listening && connection->fn == responseFn;
+    count += isClient ? 1 : 0;
+  }
+  return count;
+}
+
+void startWebServer(siteSnapshot site, siteLoader reload,
+                    const std::filesystem::path &handoffPath) {
+  auto mgr = mg_mgr{};
+  mg_mgr_init(&mgr);
+  auto waker = loopWaker::open(mgr);
+
+  // Handle interrupts, like Ctrl-C, and requests to toggle tracing or to
+  // reload the configuration.  Waking the event loop lets it act on signals
+  // right away.
+  auto sigNo = 0;
+  auto traceToggled = std::atomic<bool>{false};
+  auto reloadRequested = std::atomic<bool>{false};
+  signalHandler::init(
+      [&sigNo, &traceToggled, &reloadRequested, waker](int number) {
+        if (number == signalToggleTrace) {
+          traceToggled = true;
+        } else if (number == signalReload) {
+          reloadRequested = true;
+        } else {
+          sigNo = number;
+        }
+
+        if (waker) {
+          waker->wake();
+        }
+      });
+
+  auto traceDeadline = std::chrono::steady_clock::time_point{};
+  if (site.config.trace && site.config.trace->enabled) {
+    toggleTracing(site.config.trace, traceDeadline);
+  }
+
+  auto log = openAccessLog(site.config.log);
+  auto limiter = makeRateLimiter(site.config.limits);
+  auto sites = std::vector<siteState>{};
+  for (auto index = size_t{0}; index <= site.hosts.size(); ++index) {
+    sites.push_back(makeSiteState(siteAt(site, index).config));
+  }
+  auto ring = std::unique_ptr<ioRing>{};
+  if (waker) {
+    ring = ioRing::open(waker->descriptor(), 64, /* silent */ true);
+  }
+  auto maybeAuth = makeAuth(mgr, site.config);
+  if (!maybeAuth) {
+    mg_mgr_free(&mgr);
+    return;
+  }
+  auto auxData = auxInfo{std::make_shared<const siteSnapshot>(std::move(site)),
+                         std::move(log),
+                         0,
+                         {},
+                         waker,
+                         std::move(limiter),
+                         std::move(sites),
+                         std::move(ring),
+                         std::move(*maybeAuth)};
+
+  // Take over the listening socket of an older process, if there is one, so
+  // that the port never goes without a listener.
+  struct mg_connection *listener = nullptr;
+  if (!handoffPath.empty()) {
+    if (auto maybeListener = takeOverListener(handoffPath)) {
+      listener = adoptListener(mgr, *maybeListener, &auxData);
+      std::cout << "Took over the listening socket of the previous process"
+                << std::endl;
+    }
+  }
+
+  if (listener == nullptr) {
+    auto endPoint = std::string{"http://0.0.0.0:"} +
+                    std::to_string(auxData.site->config.port);
+    listener = mg_http_listen(&mgr, endPoint.c_str(), responseFn, &auxData);
+  }
+
+  if (listener == nullptr) {
+    std::cerr << "failed to listen on port " << auxData.site->config.port
+              << std::endl;
+    mg_mgr_free(&mgr);
+    return;
+  }
+
+  auto handoff = std::optional<handoffSocket>{};
+  if (!handoffPath.empty()) {
+    handoff = handoffSocket::open(handoffPath);
+  }
+
+  // Once the listener is handed off, connections that are still open get
+  // this long to finish.
+  const auto drainInterval = std::chrono::seconds{30};
+  auto drainDeadline = std::optional<std::chrono::steady_clock::time_point>{};
+
+  // Signals and renderers wake the event loop when they need it, so the loop
+  // otherwise sleeps for a long time.  Without a waker, poll more often while
+  // pages are being streamed, so that rendered chunks are picked up promptly
+  // even when the client's socket is idle.  While live reload clients are
+  // connected, poll often enough to notice changes to the files that they
+  // watch right away.
+  const auto timeoutMs = 1000;
+  const auto streamingTimeoutMs = 5;
+  const auto liveTimeoutMs = 250;
+
+  // Checking the layout's files costs a few system calls, so check at most
+  // once per interval rather than on every request.
+  const auto layoutCheckInterval = std::chrono::seconds{1};
+  auto nextLayoutCheck = std::chrono::steady_clock::now() + layoutCheckInterval;
+  auto nextLiveCheck = std::chrono::steady_clock::now();
+
+  // Walking the document root stats every file, so only pick up new, changed
+  // and deleted Markdown files every few seconds, starting right away.
+  const auto indexCheckInterval = std::chrono::seconds{5};
+  auto nextIndexCheck = std::chrono::steady_clock::now();
+
+  while (sigNo == 0) {
+    auto pollMs = timeoutMs;
+    if (waker && waker->woken()) {
+      pollMs = 0;
+    } else if (!waker && auxData.activeStreams > 0) {
+      pollMs = streamingTimeoutMs;
+    } else if (!auxData.livePages.empty()) {
+      pollMs = liveTimeoutMs;
+    }
+    mg_mgr_poll(&mgr, pollMs);
+    if (auxData.ring) {
+      auxData.ring->poll();
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (drainDeadline &&
+        (now >= *drainDeadline || countOpenConnections(mgr) == 0)) {
+      break;
+    }
+
+    auto listenerFd = static_cast<int>(reinterpret_cast<size_t>(listener->fd));
+    if (!drainDeadline && handoff && handoff->serve(listenerFd)) {
+      // The other process accepts new connections from now on.  Closing the
+      // listener only closes this process's copy of the socket.
+      listener->is_closing = 1;
+      drainDeadline = now + drainInterval;
+      std::cout << "Handed off the listening socket, draining "
+                << countOpenConnections(mgr) << " connections ..."
+                << std::endl;
+    }
+    if (now >= nextLiveCheck) {
+      nextLiveCheck = now + std::chrono::milliseconds{liveTimeoutMs};
+      refreshLivePages(mgr, auxData);
+    }
+
+    if (now >= nextLayoutCheck) {
+      nextLayoutCheck = now + layoutCheckInterval;
+      refreshLayout(auxData);
+    }
+
+    if (now >= nextIndexCheck) {
+      nextIndexCheck = now + indexCheckInterval;
+      startIndexScans(auxData);
+    }
+    applyIndexChanges(auxData);
+
+    if (reloadRequested.exchange(false)) {
+      reloadSite(reload, mgr, auxData);
+    }
+
+    // Tracing follows the trace settings of the current snapshot.
+    const auto &trace = auxData.site->config.trace;
+    auto traceExpired = isTracing() && now >= traceDeadline;
+    if (traceToggled.exchange(false) || traceExpired) {
+      toggleTracing(trace, traceDeadline);
+    }
+  }
+
+  if (isTracing()) {
+    toggleTracing(auxData.site->config.trace, traceDeadline);
+  }
 
   mg_mgr_free(&mgr);
 }
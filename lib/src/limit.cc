@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cmath>
+
+#include "limit.h"
+
+rateLimiter::rateLimiter(uint32_t requestsPerSecond, uint32_t burst,
+                         size_t capacity)
+    : rate(static_cast<float>(requestsPerSecond)),
+      burst(static_cast<float>(std::max(burst, uint32_t{1}))) {
+  auto size = size_t{probeLength};
+  while (size < capacity) {
+    size *= 2;
+  }
+  buckets.resize(size);
+}
+
+rateLimiter::clientKey rateLimiter::keyOf(const clientKey &address,
+                                          bool ipv6) {
+  auto key = clientKey{};
+  if (!ipv6) {
+    std::copy_n(address.begin(), 4, key.begin());
+    return key;
+  }
+
+  static const auto mappedPrefix =
+      std::array<uint8_t, 12>{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+  if (std::equal(mappedPrefix.begin(), mappedPrefix.end(), address.begin())) {
+    std::copy_n(address.begin() + mappedPrefix.size(), 4, key.begin());
+  } else {
+    // The tag keeps /64 prefixes apart from IPv4 addresses, whose keys are
+    // zero past their fourth byte.
+    std::copy_n(address.begin(), 8, key.begin());
+    key[15] = 6;
+  }
+  return key;
+}
+
+rateLimiter::bucket &rateLimiter::find(const clientKey &client) {
+  // FNV-1a, which is plenty for spreading addresses over the table.
+  auto hash = uint64_t{14695981039346656037u};
+  for (auto byte : client) {
+    hash = (hash ^ byte) * 1099511628211u;
+  }
+
+  auto mask = buckets.size() - 1;
+  auto victim = &buckets[hash & mask];
+  for (auto probe = size_t{0}; probe < probeLength; ++probe) {
+    auto &slot = buckets[(hash + probe) & mask];
+    if (!slot.used || slot.client == client) {
+      return slot;
+    }
+    if (slot.lastSeen < victim->lastSeen) {
+      victim = &slot;
+    }
+  }
+
+  victim->used = false;
+  return *victim;
+}
+
+std::optional<std::chrono::seconds>
+rateLimiter::admit(const clientKey &client, clock::time_point now) {
+  auto &slot = find(client);
+  if (!slot.used) {
+    slot = bucket{client, true, burst, now};
+  }
+
+  auto elapsed = std::chrono::duration<float>(now - slot.lastSeen).count();
+  slot.tokens = std::min(burst, slot.tokens + std::max(elapsed, 0.0f) * rate);
+  slot.lastSeen = now;
+
+  if (slot.tokens >= 1.0f) {
+    slot.tokens -= 1.0f;
+    return {};
+  }
+
+  auto wait = std::ceil((1.0f - slot.tokens) / rate);
+  return std::chrono::seconds{static_cast<int64_t>(std::max(wait, 1.0f))};
+}
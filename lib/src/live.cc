@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <memory_resource>
+
+#include "html.h"
+#include "live.h"
+#include "util.h"
+
+std::vector<std::string> splitHtmlBlocks(std::string_view html) {
+  auto blocks = std::vector<std::string>{};
+
+  // md4c escapes '<' and '>' in text and attributes, so every '<' starts a
+  // tag.  With `MD_HTML_FLAG_XHTML`, void elements are self-closing, so tags
+  // nest properly.
+  auto depth = 0;
+  auto begin = size_t{0};
+  for (auto at = html.find('<'); at != std::string_view::npos;
+       at = html.find('<', at)) {
+    auto end = html.find('>', at);
+    if (end == std::string_view::npos) {
+      break;
+    }
+
+    if (html[at + 1] == '/') {
+      depth = std::max(depth - 1, 0);
+    } else if (html[end - 1] != '/') {
+      depth += 1;
+    }
+
+    at = end + 1;
+    if (depth == 0) {
+      at = std::min(html.find('<', at), html.length());
+      blocks.emplace_back(html.substr(begin, at - begin));
+      begin = at;
+    }
+  }
+
+  if (begin < html.length()) {
+    blocks.emplace_back(html.substr(begin));
+  }
+  return blocks;
+}
+
+blockChange diffBlocks(const std::vector<std::string> &before,
+                       const std::vector<std::string> &after) {
+  auto common = std::min(before.size(), after.size());
+
+  auto prefix = size_t{0};
+  while (prefix < common && before[prefix] == after[prefix]) {
+    prefix += 1;
+  }
+
+  auto suffix = size_t{0};
+  while (suffix < common - prefix && before[before.size() - suffix - 1] ==
+                                        after[after.size() - suffix - 1]) {
+    suffix += 1;
+  }
+
+  auto change = blockChange{prefix, before.size() - prefix - suffix, {}};
+  for (auto index = prefix; index < after.size() - suffix; ++index) {
+    change.inserted.emplace_back(after[index]);
+  }
+  return change;
+}
+
+std::string formatBlockChange(const blockChange &change) {
+  auto message = std::string{"{\"start\":"};
+  message += std::to_string(change.start);
+  message += ",\"remove\":";
+  message += std::to_string(change.removed);
+  message += ",\"insert\":[";
+  for (const auto &block : change.inserted) {
+    message += message.back() == '[' ? "\"" : ",\"";
+    appendJsonEscaped(message, block);
+    message += '"';
+  }
+  message += "]}";
+  return message;
+}
+
+const std::string_view liveReloadScript = R"((function () {
+  var script = document.currentScript;
+  var body = script.parentElement;
+  var scheme = location.protocol === "https:" ? "wss://" : "ws://";
+  var socket = new WebSocket(scheme + location.host + "/_live");
+  socket.onopen = function () { socket.send(location.pathname); };
+  socket.onmessage = function (event) {
+    var change = JSON.parse(event.data);
+    var blocks = Array.prototype.filter.call(body.children, function (node) {
+      return node !== script;
+    });
+    for (var i = 0; i < change.remove; i++) {
+      body.removeChild(blocks[change.start + i]);
+    }
+    var fragment = document.createElement("template");
+    fragment.innerHTML = change.insert.join("");
+    body.insertBefore(fragment.content,
+                      blocks[change.start + change.remove] || script);
+  };
+})();
+)";
+
+std::optional<livePage> livePage::open(const std::filesystem::path &path,
+                                       renderBudget budget) {
+  auto page = livePage{};
+  page.path = path;
+  page.budget = budget;
+
+  auto errCode = std::error_code{};
+  page.modified = std::filesystem::last_write_time(path, errCode);
+  auto overBudget = false;
+  if (errCode || !page.render(page.blocks, overBudget)) {
+    return {};
+  }
+  return page;
+}
+
+bool livePage::render(std::vector<std::string> &rendered,
+                      bool &overBudget) const {
+  static const auto bodyOnly = *compiledTemplate::parse("{{ body }}");
+
+  auto arena = std::pmr::monotonic_buffer_resource{};
+  auto maybeText = fetchFileContents(path, arena);
+  if (!maybeText) {
+    return false;
+  }
+
+  // Pages rerender on the event loop, so they are held to the budget of the
+  // site like any other render there.
+  auto watchdog = renderWatchdog{budget};
+  auto maybeHtml = renderText(*maybeText, bodyOnly, arena, /* silent */ true);
+  overBudget = watchdog.tripped();
+  if (!maybeHtml) {
+    return false;
+  }
+
+  rendered = splitHtmlBlocks(*maybeHtml);
+  return true;
+}
+
+std::optional<std::string> livePage::refresh() {
+  auto errCode = std::error_code{};
+  auto lastModified = std::filesystem::last_write_time(path, errCode);
+  if (errCode || lastModified == modified) {
+    return {};
+  }
+
+  auto rendered = std::vector<std::string>{};
+  auto overBudget = false;
+  if (!render(rendered, overBudget)) {
+    // Rendering the same text again would only go over again.
+    if (overBudget) {
+      modified = lastModified;
+    }
+    return {};
+  }
+
+  modified = lastModified;
+  auto change = diffBlocks(blocks, rendered);
+  if (change.removed == 0 && change.inserted.empty()) {
+    return {};
+  }
+
+  auto message = formatBlockChange(change);
+  blocks = std::move(rendered);
+  return message;
+}
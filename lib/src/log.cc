@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "log.h"
+#include "util.h"
+
+struct accessLog::slot {
+  std::atomic<uint64_t> sequence;
+  accessRecord record;
+};
+
+accessRecord makeAccessRecord(std::string_view method, std::string_view uri,
+                              int status, uint64_t bytes,
+                              std::chrono::nanoseconds renderTime,
+                              cacheOutcome cache) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+
+  auto record = accessRecord{};
+  record.timestampUs =
+      std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+  record.bytes = bytes;
+  record.renderNs = static_cast<uint64_t>(renderTime.count());
+  record.status = static_cast<uint16_t>(status);
+  record.cache = cache;
+
+  record.methodLength = static_cast<uint8_t>(
+      std::min(method.length(), accessRecord::maxMethodLength));
+  std::memcpy(record.method, method.data(), record.methodLength);
+
+  record.uriLength = static_cast<uint16_t>(
+      std::min(uri.length(), accessRecord::maxUriLength));
+  std::memcpy(record.uri, uri.data(), record.uriLength);
+  return record;
+}
+
+/// Append `timestampUs` (microseconds since the Unix epoch) as an ISO 8601 UTC
+/// timestamp.
+static void appendTimestamp(std::string &buffer, int64_t timestampUs) {
+  auto time = toCivilTime(timestampUs);
+  char text[40];
+  auto length = std::snprintf(text, sizeof(text),
+                              "%04lld-%02d-%02dT%02d:%02d:%02d.%06dZ",
+                              static_cast<long long>(time.year), time.month,
+                              time.day, time.hour, time.minute, time.second,
+                              time.microsecond);
+  buffer.append(text, static_cast<size_t>(length));
+}
+
+static void appendRecord(std::string &buffer, const accessRecord &record) {
+  static const char *cacheNames[] = {"-", "hit", "miss"};
+
+  buffer += R"({"ts":")";
+  appendTimestamp(buffer, record.timestampUs);
+  buffer += R"(","method":")";
+  appendJsonEscaped(buffer, {record.method, record.methodLength});
+  buffer += R"(","uri":")";
+  appendJsonEscaped(buffer, {record.uri, record.uriLength});
+  buffer += R"(","status":)";
+  buffer += std::to_string(record.status);
+  buffer += R"(,"bytes":)";
+  buffer += std::to_string(record.bytes);
+  buffer += R"(,"renderUs":)";
+  buffer += std::to_string(record.renderNs / 1000);
+  buffer += R"(,"cache":")";
+  buffer += cacheNames[static_cast<size_t>(record.cache)];
+  buffer += "\"}\n";
+}
+
+std::unique_ptr<accessLog> accessLog::open(const std::filesystem::path &path,
+                                           uint64_t maxFileBytes,
+                                           uint32_t maxFiles, size_t capacity,
+                                           bool silent) {
+  auto file = std::fopen(path.string().c_str(), "ab");
+  if (file == nullptr) {
+    if (!silent) {
+      std::cerr << "failed to open access log: " << path << std::endl;
+    }
+    return nullptr;
+  }
+
+  // Round the capacity up to a power of two, so that slot indices can be
+  // computed with a mask.
+  auto roundedCapacity = size_t{2};
+  while (roundedCapacity < capacity) {
+    roundedCapacity <<= 1;
+  }
+
+  return std::unique_ptr<accessLog>(
+      new accessLog(file, path, maxFileBytes, maxFiles, roundedCapacity));
+}
+
+accessLog::accessLog(std::FILE *file, const std::filesystem::path &path,
+                     uint64_t maxFileBytes, uint32_t maxFiles, size_t capacity)
+    : slots(new slot[capacity]), mask(capacity - 1), file(file), path(path),
+      maxFileBytes(maxFileBytes), maxFiles(maxFiles) {
+  for (size_t i = 0; i < capacity; ++i) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  std::fseek(file, 0, SEEK_END);
+  fileBytes = static_cast<uint64_t>(std::max(std::ftell(file), 0L));
+  drainer = std::thread{[this] { drainLoop(); }};
+}
+
+accessLog::~accessLog() {
+  stopping.store(true, std::memory_order_release);
+  drainer.join();
+  if (file != nullptr) {
+    std::fclose(file);
+  }
+}
+
+bool accessLog::push(const accessRecord &record) noexcept {
+  // This is Dmitry Vyukov's bounded queue: each slot carries a sequence number
+  // that tells producers whether the slot is free for position `pos`, and
+  // tells the consumer whether the slot has been published.
+  auto pos = enqueuePos.load(std::memory_order_relaxed);
+  slot *target = nullptr;
+  for (;;) {
+    target = &slots[pos & mask];
+    auto sequence = target->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<int64_t>(sequence) - static_cast<int64_t>(pos);
+    if (diff == 0) {
+      if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      pos = enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  target->record = record;
+  target->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+size_t accessLog::drainInto(std::string &buffer) {
+  auto count = size_t{0};
+  for (;;) {
+    auto &source = slots[dequeuePos & mask];
+    if (source.sequence.load(std::memory_order_acquire) != dequeuePos + 1) {
+      break;
+    }
+
+    appendRecord(buffer, source.record);
+    source.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+    dequeuePos += 1;
+    count += 1;
+  }
+
+  auto droppedNow = dropped.load(std::memory_order_relaxed);
+  if (droppedNow != reportedDrops) {
+    buffer += R"({"dropped":)";
+    buffer += std::to_string(droppedNow - reportedDrops);
+    buffer += "}\n";
+    reportedDrops = droppedNow;
+  }
+
+  return count;
+}
+
+void accessLog::writeBatch(const std::string &buffer) {
+  std::fwrite(buffer.data(), 1, buffer.length(), file);
+  std::fflush(file);
+
+  fileBytes += buffer.length();
+  if (maxFileBytes != 0 && fileBytes >= maxFileBytes) {
+    rotate();
+  }
+}
+
+void accessLog::rotate() {
+  std::fclose(file);
+
+  auto rotatedPath = [this](uint32_t index) {
+    auto rotated = path;
+    rotated += "." + std::to_string(index);
+    return rotated;
+  };
+
+  auto errCode = std::error_code{};
+  if (maxFiles == 0) {
+    std::filesystem::remove(path, errCode);
+  } else {
+    std::filesystem::remove(rotatedPath(maxFiles), errCode);
+    for (auto index = maxFiles - 1; index > 0; --index) {
+      std::filesystem::rename(rotatedPath(index), rotatedPath(index + 1),
+                              errCode);
+    }
+    std::filesystem::rename(path, rotatedPath(1), errCode);
+  }
+
+  // If reopening fails, keep appending to the old file name on the next
+  // attempt rather than losing the log entirely.
+  file = std::fopen(path.string().c_str(), "ab");
+  if (file == nullptr) {
+    file = std::fopen(rotatedPath(1).string().c_str(), "ab");
+  }
+  fileBytes = 0;
+}
+
+void accessLog::drainLoop() {
+  const auto idleDelay = std::chrono::milliseconds{20};
+
+  auto buffer = std::string{};
+  for (;;) {
+    // Read the flag before draining, so that the final drain after the flag
+    // is set observes every record pushed before destruction began.
+    auto done = stopping.load(std::memory_order_acquire);
+
+    buffer.clear();
+    auto count = drainInto(buffer);
+    if (!buffer.empty() && file != nullptr) {
+      writeBatch(buffer);
+      written.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    if (done) {
+      return;
+    }
+
+    if (count == 0) {
+      std::this_thread::sleep_for(idleDelay);
+    }
+  }
+}
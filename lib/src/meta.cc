@@ -0,0 +1,674 @@
+#include <algorithm>
+#include <cctype>
+
+#include "md4c.h"
+#include "meta.h"
+#include "util.h"
+
+const unsigned markDownFlags =
+    MD_FLAG_COLLAPSEWHITESPACE | MD_FLAG_TABLES | MD_FLAG_TASKLISTS |
+    MD_FLAG_STRIKETHROUGH | MD_FLAG_NOHTMLSPANS | MD_FLAG_NOHTMLBLOCKS |
+    MD_FLAG_NOINDENTEDCODEBLOCKS;
+
+static std::string_view trimView(std::string_view text) {
+  auto isSpace = [](unsigned char ch) { return std::isspace(ch) != 0; };
+  while (!text.empty() && isSpace(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isSpace(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+static std::string_view unquote(std::string_view value) {
+  if (value.length() >= 2 && (value.front() == '"' || value.front() == '\'') &&
+      value.back() == value.front()) {
+    return value.substr(1, value.length() - 2);
+  }
+  return value;
+}
+
+std::optional<frontMatter> parseFrontMatter(std::string_view markDownText) {
+  auto nextLine = [markDownText](size_t &begin) {
+    auto end = std::min(markDownText.find('\n', begin), markDownText.length());
+    auto line = markDownText.substr(begin, end - begin);
+    begin = std::min(end + 1, markDownText.length());
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    return line;
+  };
+
+  auto begin = size_t{0};
+  if (nextLine(begin) != "---") {
+    return {};
+  }
+
+  auto fields = frontMatter{};
+  auto inTags = false;
+  while (begin < markDownText.length()) {
+    auto lineBegin = begin;
+    auto line = nextLine(begin);
+    if (line == "---" || line == "...") {
+      fields.length = begin;
+      return fields;
+    }
+
+    // Indented lines and list items after `tags:` continue its value, so that
+    // block lists stay in one view.
+    if (!line.empty() && (line.front() == ' ' || line.front() == '\t' ||
+                          line.front() == '-')) {
+      if (inTags) {
+        auto valueBegin =
+            fields.tags.empty()
+                ? lineBegin
+                : static_cast<size_t>(fields.tags.data() - markDownText.data());
+        fields.tags = markDownText.substr(
+            valueBegin, lineBegin + line.length() - valueBegin);
+      }
+      continue;
+    }
+
+    inTags = false;
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+
+    auto key = trimView(line.substr(0, colon));
+    auto value = unquote(trimView(line.substr(colon + 1)));
+    if (key == "title") {
+      fields.title = value;
+    } else if (key == "date") {
+      fields.date = value;
+    } else if (key == "tags") {
+      fields.tags = value;
+      inTags = true;
+    }
+  }
+
+  return {};
+}
+
+std::string_view findTitle(std::string_view markDownText) {
+  auto fence = std::string_view{};
+  for (auto begin = size_t{0}; begin < markDownText.length();) {
+    auto end = std::min(markDownText.find('\n', begin), markDownText.length());
+    auto line = markDownText.substr(begin, end - begin);
+    begin = end + 1;
+
+    auto indent = line.find_first_not_of(' ');
+    if (indent == std::string_view::npos || indent > 3) {
+      continue;
+    }
+    line = trimView(line.substr(indent));
+
+    auto marker = line.substr(0, 3);
+    if (marker == "```" || marker == "~~~") {
+      fence = fence.empty() ? marker : fence == marker ? "" : fence;
+      continue;
+    }
+
+    if (!fence.empty() || line.empty() || line.front() != '#' ||
+        (line.length() > 1 && line[1] != ' ' && line[1] != '\t')) {
+      continue;
+    }
+
+    // Drop the optional closing sequence of '#' characters.
+    auto title = trimView(line.substr(1));
+    auto closing = title.find_last_not_of('#');
+    if (closing == std::string_view::npos) {
+      return {};
+    }
+    if (closing + 1 != title.length() &&
+        (title[closing] == ' ' || title[closing] == '\t')) {
+      title = trimView(title.substr(0, closing));
+    }
+    return title;
+  }
+
+  return {};
+}
+
+static int hexValue(char ch) {
+  if (ch >= '0' && ch <= '9') {
+    return ch - '0';
+  }
+  if (ch >= 'a' && ch <= 'f') {
+    return ch - 'a' + 10;
+  }
+  if (ch >= 'A' && ch <= 'F') {
+    return ch - 'A' + 10;
+  }
+  return -1;
+}
+
+/// Decode the percent escapes in `text`, keeping malformed ones as they are.
+static std::string percentDecoded(std::string_view text) {
+  auto decoded = std::string{};
+  decoded.reserve(text.length());
+  for (auto i = size_t{0}; i < text.length(); ++i) {
+    if (text[i] == '%' && i + 2 < text.length() &&
+        hexValue(text[i + 1]) >= 0 && hexValue(text[i + 2]) >= 0) {
+      decoded += static_cast<char>(hexValue(text[i + 1]) * 16 +
+                                   hexValue(text[i + 2]));
+      i += 2;
+    } else {
+      decoded += text[i];
+    }
+  }
+  return decoded;
+}
+
+/// URI on the site that `href`, in the page served under `uri`, points to, or
+/// an empty string if it points to another site or into the same page.
+static std::string resolveLink(std::string_view uri, std::string_view href) {
+  href = trimView(href);
+  auto delimiter = href.find_first_of(":/?#");
+  auto scheme = delimiter != std::string_view::npos && href[delimiter] == ':';
+  if (scheme || href.rfind("//", 0) == 0) {
+    return {};
+  }
+  href = href.substr(0, href.find_first_of("?#"));
+  if (href.empty()) {
+    return {};
+  }
+
+  auto path = std::string{};
+  if (href.front() != '/') {
+    path = uri.substr(0, uri.rfind('/') + 1);
+  }
+  path += percentDecoded(href);
+
+  auto segments = std::vector<std::string_view>{};
+  auto isDirectory = false;
+  auto view = std::string_view{path};
+  for (auto begin = size_t{0}; begin <= view.length();) {
+    auto end = std::min(view.find('/', begin), view.length());
+    auto segment = view.substr(begin, end - begin);
+    begin = end + 1;
+
+    isDirectory = segment.empty() || segment == "." || segment == "..";
+    if (segment == "..") {
+      if (!segments.empty()) {
+        segments.pop_back();
+      }
+    } else if (!isDirectory) {
+      segments.push_back(segment);
+    }
+  }
+
+  auto target = std::string{};
+  for (auto segment : segments) {
+    target += '/';
+    target += segment;
+  }
+  if (isDirectory || segments.empty()) {
+    target += '/';
+  }
+  return target;
+}
+
+std::vector<std::string> findLinks(std::string_view uri,
+                                   std::string_view markDownText) {
+  struct linkCollector {
+    std::string_view uri;
+    std::vector<std::string> targets;
+  };
+
+  // Links to the directory of an index page lead back to the page itself.
+  auto self = uri;
+  auto indexName = std::string_view{"/index.md"};
+  if (self.length() >= indexName.length() &&
+      self.substr(self.length() - indexName.length()) == indexName) {
+    self.remove_suffix(indexName.length() - 1);
+  }
+
+  auto collector = linkCollector{uri, {}};
+  auto parser = MD_PARSER{};
+  parser.flags = markDownFlags;
+  parser.enter_block = [](MD_BLOCKTYPE, void *, void *) { return 0; };
+  parser.leave_block = [](MD_BLOCKTYPE, void *, void *) { return 0; };
+  parser.enter_span = [](MD_SPANTYPE type, void *detail, void *userData) {
+    if (type == MD_SPAN_A) {
+      auto &href = static_cast<MD_SPAN_A_DETAIL *>(detail)->href;
+      auto &links = *static_cast<linkCollector *>(userData);
+      auto target = resolveLink(links.uri, {href.text, href.size});
+      if (!target.empty() && std::find(links.targets.begin(),
+                                       links.targets.end(),
+                                       target) == links.targets.end()) {
+        links.targets.push_back(std::move(target));
+      }
+    }
+    return 0;
+  };
+  parser.leave_span = [](MD_SPANTYPE, void *, void *) { return 0; };
+  parser.text = [](MD_TEXTTYPE, const MD_CHAR *, MD_SIZE, void *) {
+    return 0;
+  };
+
+  // Front matter is not part of the page, as in the renderer.  Links to
+  // pages on the site all take brackets, since raw HTML is off and autolinks
+  // need a scheme, so text without any needs no parse.
+  auto fields = parseFrontMatter(markDownText).value_or(frontMatter{});
+  markDownText.remove_prefix(fields.length);
+  if (markDownText.find('[') == std::string_view::npos) {
+    return {};
+  }
+  md_parse(markDownText.data(), static_cast<MD_SIZE>(markDownText.length()),
+           &parser, &collector);
+
+  auto &targets = collector.targets;
+  targets.erase(std::remove_if(targets.begin(), targets.end(),
+                               [uri, self](const std::string &target) {
+                                 return target == uri || target == self;
+                               }),
+                targets.end());
+  return std::move(targets);
+}
+
+metadataIndex::metadataIndex(std::filesystem::path docRoot)
+    : docRoot(std::move(docRoot)) {}
+
+indexedPage parseIndexedPage(std::string_view uri,
+                             std::filesystem::file_time_type modified,
+                             std::string_view markDownText) {
+  auto fields = parseFrontMatter(markDownText).value_or(frontMatter{});
+  auto title = fields.title;
+  if (title.empty()) {
+    title = findTitle(markDownText.substr(fields.length));
+  }
+
+  auto page = indexedPage{};
+  page.uri = uri;
+  page.modified = modified;
+  page.title = title;
+  page.date = fields.date;
+  page.links = findLinks(uri, markDownText);
+  forEachTag(fields.tags, [&page](std::string_view tag) {
+    page.tags.emplace_back(tag);
+  });
+  return page;
+}
+
+indexScanner::indexScanner(std::filesystem::path docRoot,
+                           std::unordered_map<std::string, version> known)
+    : docRoot(std::move(docRoot)), known(std::move(known)) {}
+
+indexChanges indexScanner::scan() {
+  namespace fs = std::filesystem;
+
+  auto changes = indexChanges{};
+  auto current = std::unordered_map<std::string, version>{};
+  current.reserve(known.size());
+
+  auto errCode = std::error_code{};
+  auto it = fs::recursive_directory_iterator{
+      docRoot, fs::directory_options::skip_permission_denied, errCode};
+  for (; !errCode && it != fs::recursive_directory_iterator{};
+       it.increment(errCode)) {
+    // Entries that vanish or cannot be inspected are skipped, while errors
+    // from the iterator itself end the walk.
+    auto entryErr = std::error_code{};
+    const auto &path = it->path();
+    if (it->is_directory(entryErr)) {
+      auto name = path.filename().string();
+      if (!name.empty() && name.front() == '.') {
+        it.disable_recursion_pending();
+      }
+      continue;
+    }
+
+    if (path.extension() != ".md" || !it->is_regular_file(entryErr)) {
+      continue;
+    }
+
+    auto modified = it->last_write_time(entryErr);
+    if (entryErr) {
+      continue;
+    }
+
+    auto uri = "/" + path.lexically_relative(docRoot).generic_string();
+    auto found = known.find(uri);
+    if (found != known.end() && found->second == modified) {
+      current.emplace(std::move(uri), modified);
+      continue;
+    }
+
+    auto maybeContents = fetchFileContents(path);
+    if (!maybeContents) {
+      continue;
+    }
+    changes.updated.push_back(parseIndexedPage(uri, modified, *maybeContents));
+    current.emplace(std::move(uri), modified);
+  }
+
+  // Files that the walk never reached may still exist.
+  if (errCode) {
+    for (auto &[uri, modified] : current) {
+      known.insert_or_assign(uri, modified);
+    }
+    return changes;
+  }
+
+  for (const auto &entry : known) {
+    if (current.count(entry.first) == 0) {
+      changes.removed.push_back(entry.first);
+    }
+  }
+  known = std::move(current);
+  return changes;
+}
+
+size_t metadataIndex::refresh(const changeHandler &changed) {
+  auto known = std::unordered_map<std::string, version>{};
+  known.reserve(uris.size());
+  for (auto row = size_t{0}; row < uris.size(); ++row) {
+    known.emplace(uris[row], versions[row]);
+  }
+  return apply(indexScanner{docRoot, std::move(known)}.scan(), changed);
+}
+
+size_t metadataIndex::apply(indexChanges changes,
+                            const changeHandler &changed) {
+  for (auto &page : changes.updated) {
+    auto before = std::vector<std::string>{};
+    auto title = std::optional<std::string>{};
+    auto row = rowOfUri.find(page.uri);
+    if (row != rowOfUri.end()) {
+      before = linkTargets[row->second];
+      title = titles[row->second];
+    }
+
+    auto uri = page.uri;
+    store(std::move(page));
+    if (!changed) {
+      continue;
+    }
+
+    changed(uri);
+    const auto &after = linkTargets[rowOfUri[uri]];
+    reportLinksChanged(before, after, changed);
+
+    // Backlinks show the titles of the pages that link, so a new title
+    // changes every page that this one links to.
+    if (title && *title != titles[rowOfUri[uri]]) {
+      for (const auto &target : after) {
+        if (std::find(before.begin(), before.end(), target) != before.end()) {
+          reportLinked(target, changed);
+        }
+      }
+    }
+  }
+
+  for (const auto &uri : changes.removed) {
+    auto row = rowOfUri.find(uri);
+    if (row == rowOfUri.end()) {
+      continue;
+    }
+
+    auto before = linkTargets[row->second];
+    remove(uri);
+    if (changed) {
+      changed(uri);
+      reportLinksChanged(before, {}, changed);
+    }
+  }
+  return changes.updated.size();
+}
+
+void metadataIndex::update(std::string_view uri, version modified,
+                           std::string_view markDownText) {
+  store(parseIndexedPage(uri, modified, markDownText));
+}
+
+void metadataIndex::store(indexedPage &&page) {
+  auto found = rowOfUri.find(page.uri);
+  auto row = uint32_t{0};
+  if (found != rowOfUri.end()) {
+    row = found->second;
+    unlinkTags(row);
+    tagIds[row].clear();
+    unlinkTargets(row);
+  } else {
+    row = static_cast<uint32_t>(uris.size());
+    uris.push_back(page.uri);
+    titles.emplace_back();
+    dates.emplace_back();
+    versions.emplace_back();
+    tagIds.emplace_back();
+    linkTargets.emplace_back();
+    rowOfUri.emplace(std::move(page.uri), row);
+  }
+
+  titles[row] = std::move(page.title);
+  dates[row] = std::move(page.date);
+  versions[row] = page.modified;
+  for (const auto &tag : page.tags) {
+    auto id = internTag(tag);
+    auto &ids = tagIds[row];
+    if (std::find(ids.begin(), ids.end(), id) == ids.end()) {
+      ids.push_back(id);
+      tagRows[id].push_back(row);
+    }
+  }
+
+  linkTargets[row] = std::move(page.links);
+  for (const auto &target : linkTargets[row]) {
+    linkingRows[target].push_back(row);
+  }
+}
+
+void metadataIndex::remove(std::string_view uri) {
+  auto found = rowOfUri.find(std::string{uri});
+  if (found == rowOfUri.end()) {
+    return;
+  }
+
+  auto row = found->second;
+  auto last = static_cast<uint32_t>(uris.size() - 1);
+  unlinkTags(row);
+  unlinkTargets(row);
+  rowOfUri.erase(found);
+
+  // Move the last row into the hole.
+  if (row != last) {
+    for (auto id : tagIds[last]) {
+      auto &rows = tagRows[id];
+      *std::find(rows.begin(), rows.end(), last) = row;
+    }
+    for (const auto &target : linkTargets[last]) {
+      auto &rows = linkingRows[target];
+      *std::find(rows.begin(), rows.end(), last) = row;
+    }
+    uris[row] = std::move(uris[last]);
+    titles[row] = std::move(titles[last]);
+    dates[row] = std::move(dates[last]);
+    versions[row] = versions[last];
+    tagIds[row] = std::move(tagIds[last]);
+    linkTargets[row] = std::move(linkTargets[last]);
+    rowOfUri[uris[row]] = row;
+  }
+
+  uris.pop_back();
+  titles.pop_back();
+  dates.pop_back();
+  versions.pop_back();
+  tagIds.pop_back();
+  linkTargets.pop_back();
+}
+
+std::optional<metadataIndex::page>
+metadataIndex::find(std::string_view uri) const {
+  auto found = rowOfUri.find(std::string{uri});
+  if (found == rowOfUri.end()) {
+    return {};
+  }
+  return pageAt(found->second);
+}
+
+std::vector<metadataIndex::page>
+metadataIndex::tagged(std::string_view tag) const {
+  auto found = idOfTag.find(std::string{tag});
+  if (found == idOfTag.end()) {
+    return {};
+  }
+
+  auto pages = std::vector<page>{};
+  for (auto row : tagRows[found->second]) {
+    pages.push_back(pageAt(row));
+  }
+
+  // ISO dates sort chronologically as text.
+  std::sort(pages.begin(), pages.end(), [](const page &lhs, const page &rhs) {
+    return lhs.date != rhs.date ? lhs.date > rhs.date : lhs.title < rhs.title;
+  });
+  return pages;
+}
+
+std::vector<metadataIndex::page>
+metadataIndex::under(std::string_view prefix) const {
+  auto pages = std::vector<page>{};
+  for (auto row = size_t{0}; row < uris.size(); ++row) {
+    if (uris[row].compare(0, prefix.length(), prefix) == 0) {
+      pages.push_back(pageAt(static_cast<uint32_t>(row)));
+    }
+  }
+  return pages;
+}
+
+std::vector<metadataIndex::page>
+metadataIndex::linking(std::string_view uri) const {
+  // A directory is served by its index page.
+  auto indexName = std::string_view{"index.md"};
+  auto pageUri = std::string{uri};
+  auto directory = std::string{};
+  if (!uri.empty() && uri.back() == '/') {
+    directory = uri;
+    pageUri += indexName;
+  } else if (uri.length() > indexName.length() &&
+             uri.substr(uri.length() - indexName.length()) == indexName &&
+             uri[uri.length() - indexName.length() - 1] == '/') {
+    directory = uri.substr(0, uri.length() - indexName.length());
+  }
+
+  auto rows = std::vector<uint32_t>{};
+  for (const auto &target : {pageUri, directory}) {
+    auto found = linkingRows.find(target);
+    if (!target.empty() && found != linkingRows.end()) {
+      rows.insert(rows.end(), found->second.begin(), found->second.end());
+    }
+  }
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+  auto pages = std::vector<page>{};
+  for (auto row : rows) {
+    pages.push_back(pageAt(row));
+  }
+  std::sort(pages.begin(), pages.end(), [](const page &lhs, const page &rhs) {
+    return lhs.uri < rhs.uri;
+  });
+  return pages;
+}
+
+std::vector<metadataIndex::link> metadataIndex::brokenLinks() const {
+  auto isBroken = [this](const std::string &target) {
+    auto extension = std::string_view{".md"};
+    if (target.length() > extension.length() &&
+        target.compare(target.length() - extension.length(),
+                       extension.length(), extension) == 0) {
+      return rowOfUri.count(target) == 0;
+    }
+
+    // Paths under "/_" that are not on disk are served by magenta itself.
+    auto errCode = std::error_code{};
+    auto path = docRoot / std::filesystem::path{target.substr(1)};
+    return !std::filesystem::exists(path, errCode) &&
+           target.rfind("/_", 0) != 0;
+  };
+
+  auto links = std::vector<link>{};
+  for (const auto &[target, rows] : linkingRows) {
+    if (isBroken(target)) {
+      for (auto row : rows) {
+        links.push_back({uris[row], target});
+      }
+    }
+  }
+  std::sort(links.begin(), links.end(), [](const link &lhs, const link &rhs) {
+    return lhs.to != rhs.to ? lhs.to < rhs.to : lhs.from < rhs.from;
+  });
+  return links;
+}
+
+std::vector<std::pair<std::string_view, size_t>> metadataIndex::tags() const {
+  auto result = std::vector<std::pair<std::string_view, size_t>>{};
+  for (auto id = size_t{0}; id < tagNames.size(); ++id) {
+    if (!tagRows[id].empty()) {
+      result.emplace_back(tagNames[id], tagRows[id].size());
+    }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+uint32_t metadataIndex::internTag(std::string_view tag) {
+  auto [found, inserted] = idOfTag.emplace(
+      std::string{tag}, static_cast<uint32_t>(tagNames.size()));
+  if (inserted) {
+    tagNames.emplace_back(tag);
+    tagRows.emplace_back();
+  }
+  return found->second;
+}
+
+void metadataIndex::unlinkTags(uint32_t row) {
+  for (auto id : tagIds[row]) {
+    auto &rows = tagRows[id];
+    rows.erase(std::find(rows.begin(), rows.end(), row));
+  }
+}
+
+void metadataIndex::unlinkTargets(uint32_t row) {
+  for (const auto &target : linkTargets[row]) {
+    auto found = linkingRows.find(target);
+    auto &rows = found->second;
+    rows.erase(std::find(rows.begin(), rows.end(), row));
+    if (rows.empty()) {
+      linkingRows.erase(found);
+    }
+  }
+}
+
+void metadataIndex::reportLinked(std::string_view target,
+                                 const changeHandler &changed) const {
+  auto uri = std::string{target};
+  if (!uri.empty() && uri.back() == '/') {
+    uri += "index.md";
+  }
+  if (rowOfUri.count(uri) != 0) {
+    changed(uri);
+  }
+}
+
+void metadataIndex::reportLinksChanged(const std::vector<std::string> &before,
+                                       const std::vector<std::string> &after,
+                                       const changeHandler &changed) const {
+  // Pages that gained or lost a backlink.
+  for (const auto &target : before) {
+    if (std::find(after.begin(), after.end(), target) == after.end()) {
+      reportLinked(target, changed);
+    }
+  }
+  for (const auto &target : after) {
+    if (std::find(before.begin(), before.end(), target) == before.end()) {
+      reportLinked(target, changed);
+    }
+  }
+}
+
+metadataIndex::page metadataIndex::pageAt(uint32_t row) const {
+  return {uris[row], titles[row], dates[row], versions[row]};
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <limits>
+
+#include "range.h"
+
+static std::string_view trimView(std::string_view text) {
+  auto isSpace = [](char ch) { return ch == ' ' || ch == '\t'; };
+  while (!text.empty() && isSpace(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isSpace(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+/// Value of the decimal digits in `text`, saturating at the largest value
+/// that fits.  Returns none unless `text` holds nothing but digits.
+static std::optional<uint64_t> parseDigits(std::string_view text) {
+  const auto maxValue = std::numeric_limits<uint64_t>::max();
+  if (text.empty()) {
+    return {};
+  }
+
+  auto value = uint64_t{0};
+  for (auto ch : text) {
+    if (ch < '0' || ch > '9') {
+      return {};
+    }
+    auto digit = static_cast<uint64_t>(ch - '0');
+    value = value > (maxValue - digit) / 10 ? maxValue : value * 10 + digit;
+  }
+  return value;
+}
+
+std::optional<std::vector<byteRange>> parseRangeHeader(std::string_view header,
+                                                       uint64_t size) {
+  auto equals = header.find('=');
+  if (equals == std::string_view::npos) {
+    return {};
+  }
+
+  auto unit = trimView(header.substr(0, equals));
+  auto isBytes = unit.length() == 5 &&
+                 std::equal(unit.begin(), unit.end(), "bytes",
+                            [](char lhs, char rhs) {
+                              return std::tolower(
+                                         static_cast<unsigned char>(lhs)) ==
+                                     rhs;
+                            });
+  if (!isBytes) {
+    return {};
+  }
+
+  auto ranges = std::vector<byteRange>{};
+  auto count = size_t{0};
+  auto list = header.substr(equals + 1);
+  for (auto begin = size_t{0}; begin <= list.length();) {
+    auto end = std::min(list.find(',', begin), list.length());
+    auto spec = trimView(list.substr(begin, end - begin));
+    begin = end + 1;
+
+    // Lists may have empty elements.
+    if (spec.empty()) {
+      continue;
+    }
+    count += 1;
+    auto dash = spec.find('-');
+    if (count > maxByteRanges || dash == std::string_view::npos) {
+      return {};
+    }
+
+    auto firstText = spec.substr(0, dash);
+    auto lastText = spec.substr(dash + 1);
+    if (firstText.empty()) {
+      // The last so many bytes.
+      auto suffix = parseDigits(lastText);
+      if (!suffix) {
+        return {};
+      }
+      if (*suffix != 0 && size != 0) {
+        ranges.push_back({size - std::min(*suffix, size), size - 1});
+      }
+      continue;
+    }
+
+    auto first = parseDigits(firstText);
+    auto last = lastText.empty() ? std::numeric_limits<uint64_t>::max()
+                                 : parseDigits(lastText);
+    if (!first || !last || *last < *first) {
+      return {};
+    }
+    if (*first < size) {
+      ranges.push_back({*first, std::min(*last, size - 1)});
+    }
+  }
+
+  if (count == 0) {
+    return {};
+  }
+  return ranges;
+}
+
+std::string formatHttpDate(int64_t unixSeconds) {
+  static const char *dayNames[] = {"Thu", "Fri", "Sat", "Sun",
+                                   "Mon", "Tue", "Wed"};
+  static const char *monthNames[] = {"Jan", "Feb", "Mar", "Apr",
+                                     "May", "Jun", "Jul", "Aug",
+                                     "Sep", "Oct", "Nov", "Dec"};
+
+  // The epoch fell on a Thursday.
+  auto days = unixSeconds / 86400 - (unixSeconds % 86400 < 0 ? 1 : 0);
+  auto weekday = static_cast<size_t>((days % 7 + 7) % 7);
+  auto time = toCivilTime(unixSeconds * 1000000);
+
+  char text[40];
+  auto length = std::snprintf(
+      text, sizeof(text), "%s, %02d %s %04lld %02d:%02d:%02d GMT",
+      dayNames[weekday], time.day, monthNames[time.month - 1],
+      static_cast<long long>(time.year), time.hour, time.minute, time.second);
+  return std::string(text, static_cast<size_t>(length));
+}
+
+std::string_view guessContentType(const std::filesystem::path &path) {
+  static const std::pair<std::string_view, std::string_view> knownTypes[] = {
+      {"html", "text/html; charset=utf-8"},
+      {"htm", "text/html; charset=utf-8"},
+      {"css", "text/css; charset=utf-8"},
+      {"js", "text/javascript; charset=utf-8"},
+      {"gif", "image/gif"},
+      {"png", "image/png"},
+      {"jpg", "image/jpeg"},
+      {"jpeg", "image/jpeg"},
+      {"woff", "font/woff"},
+      {"ttf", "font/ttf"},
+      {"svg", "image/svg+xml"},
+      {"txt", "text/plain; charset=utf-8"},
+      {"avi", "video/x-msvideo"},
+      {"csv", "text/csv"},
+      {"doc", "application/msword"},
+      {"exe", "application/octet-stream"},
+      {"gz", "application/gzip"},
+      {"ico", "image/x-icon"},
+      {"json", "application/json"},
+      {"mov", "video/quicktime"},
+      {"mp3", "audio/mpeg"},
+      {"mp4", "video/mp4"},
+      {"mpeg", "video/mpeg"},
+      {"pdf", "application/pdf"},
+      {"shtml", "text/html; charset=utf-8"},
+      {"tgz", "application/tar-gz"},
+      {"wav", "audio/wav"},
+      {"webp", "image/webp"},
+      {"zip", "application/zip"},
+      {"3gp", "video/3gpp"},
+  };
+
+  auto extension = path.extension().string();
+  if (!extension.empty()) {
+    extension.erase(0, 1);
+  }
+  for (const auto &[name, type] : knownTypes) {
+    if (name == extension) {
+      return type;
+    }
+  }
+  return "text/plain; charset=utf-8";
+}
+
+std::optional<rangeBody> rangeBody::open(const std::filesystem::path &path,
+                                         uint64_t size,
+                                         const std::vector<byteRange> &ranges,
+                                         std::string_view contentType,
+                                         std::string_view boundary) {
+  auto maybeFile = mappedFile::open(path);
+  if (!maybeFile || maybeFile->contents().length() < size) {
+    return {};
+  }
+
+  auto framing = std::string{};
+  auto pieces = std::vector<piece>{};
+  auto addFraming = [&framing, &pieces](std::string_view text) {
+    pieces.push_back({false, framing.length(), text.length()});
+    framing.append(text);
+  };
+
+  if (ranges.size() == 1) {
+    pieces.push_back({true, ranges[0].first, ranges[0].length()});
+  } else if (ranges.size() > 1) {
+    for (const auto &range : ranges) {
+      char contentRange[80];
+      auto length = std::snprintf(
+          contentRange, sizeof(contentRange), "bytes %llu-%llu/%llu",
+          static_cast<unsigned long long>(range.first),
+          static_cast<unsigned long long>(range.last),
+          static_cast<unsigned long long>(size));
+
+      auto header = std::string{"--"};
+      header.append(boundary).append("\r\nContent-Type: ");
+      header.append(contentType).append("\r\nContent-Range: ");
+      header.append(contentRange, static_cast<size_t>(length));
+      header.append("\r\n\r\n");
+      addFraming(header);
+      pieces.push_back({true, range.first, range.length()});
+      addFraming("\r\n");
+    }
+    addFraming(std::string{"--"}.append(boundary).append("--\r\n"));
+  }
+
+  return rangeBody{std::move(*maybeFile), std::move(framing),
+                   std::move(pieces)};
+}
+
+rangeBody::rangeBody(mappedFile file, std::string framing,
+                     std::vector<piece> pieces)
+    : file(std::move(file)), framing(std::move(framing)),
+      pieces(std::move(pieces)) {
+  for (const auto &piece : this->pieces) {
+    total += piece.length;
+  }
+}
+
+std::string_view rangeBody::next(size_t maxBytes) {
+  if (done() || maxBytes == 0) {
+    return {};
+  }
+
+  const auto &piece = pieces[current];
+  auto length = static_cast<size_t>(
+      std::min(piece.length - offset, static_cast<uint64_t>(maxBytes)));
+  auto source = piece.inFile ? file.contents() : std::string_view{framing};
+  auto result = source.substr(static_cast<size_t>(piece.offset + offset),
+                              length);
+
+  offset += length;
+  if (offset == piece.length) {
+    current += 1;
+    offset = 0;
+  }
+  return result;
+}
@@ -0,0 +1,202 @@
+#include <cctype>
+#include <iostream>
+
+#include "template.h"
+#include "util.h"
+
+// Partials that include each other would otherwise recurse forever.
+static const auto maxPartialDepth = size_t{16};
+
+static const std::pair<std::string_view, templateSlot> slotNames[] = {
+    {"body", templateSlot::BODY},
+    {"title", templateSlot::TITLE},
+    {"path", templateSlot::PATH},
+    {"breadcrumbs", templateSlot::BREADCRUMBS},
+    {"toc", templateSlot::TOC},
+    {"mtime", templateSlot::MTIME},
+    {"date", templateSlot::DATE},
+    {"tags", templateSlot::TAGS},
+    {"backlinks", templateSlot::BACKLINKS},
+};
+
+static std::string_view trimView(std::string_view text) {
+  auto isSpace = [](unsigned char ch) { return std::isspace(ch) != 0; };
+  while (!text.empty() && isSpace(text.front())) {
+    text.remove_prefix(1);
+  }
+  while (!text.empty() && isSpace(text.back())) {
+    text.remove_suffix(1);
+  }
+  return text;
+}
+
+static std::optional<templateSlot> findSlot(std::string_view name) {
+  for (const auto &[slotName, slot] : slotNames) {
+    if (slotName == name) {
+      return slot;
+    }
+  }
+  return {};
+}
+
+void compiledTemplate::appendLiteral(std::string_view literal) {
+  if (literal.empty()) {
+    return;
+  }
+
+  // Merge adjacent literals, such as the text around an included partial.
+  if (!pieces.empty() && !pieces.back().slot &&
+      pieces.back().offset + pieces.back().length == text.length()) {
+    pieces.back().length += literal.length();
+  } else {
+    pieces.push_back(segment{text.length(), literal.length(), std::nullopt});
+  }
+  text.append(literal);
+}
+
+/// Append the segments of `source` to the layout.  A placeholder is "{{",
+/// followed by any characters other than '}', followed by "}}".
+bool compiledTemplate::compileInto(std::string_view source,
+                                   const std::filesystem::path &partialDir,
+                                   size_t depth, bool silent) {
+  auto cursor = size_t{0};
+  for (auto begin = source.find("{{"); begin != std::string_view::npos;
+       begin = source.find("{{", begin)) {
+    auto end = source.find('}', begin + 2);
+    if (end == std::string_view::npos) {
+      break;
+    }
+
+    if (end + 1 == source.length() || source[end + 1] != '}') {
+      begin += 1;
+      continue;
+    }
+
+    auto key = trimView(source.substr(begin + 2, end - begin - 2));
+    auto slot = findSlot(key);
+    auto isPartial = !key.empty() && key.front() == '>';
+    if (slot || isPartial) {
+      appendLiteral(source.substr(cursor, begin - cursor));
+      cursor = end + 2;
+    }
+
+    if (slot) {
+      pieces.push_back(segment{text.length(), 0, slot});
+      slotUses[static_cast<size_t>(*slot)] += 1;
+    } else if (isPartial) {
+      auto partialPath = partialDir / trimView(key.substr(1));
+      if (!partialPath.has_extension()) {
+        partialPath += ".html";
+      }
+
+      if (depth == maxPartialDepth) {
+        if (!silent) {
+          std::cerr << "partials nested too deeply, at partial: "
+                    << partialPath << std::endl;
+        }
+        return false;
+      }
+
+      auto errCode = std::error_code{};
+      auto modified = std::filesystem::last_write_time(partialPath, errCode);
+      auto maybePartial = fetchFileContents(partialPath);
+      if (errCode || !maybePartial) {
+        if (!silent) {
+          std::cerr << "failed to read partial: " << partialPath << std::endl;
+        }
+        return false;
+      }
+
+      dependencies.emplace_back(partialPath, modified);
+      if (!compileInto(*maybePartial, partialPath.parent_path(), depth + 1,
+                       silent)) {
+        return false;
+      }
+    }
+
+    begin = end + 2;
+  }
+
+  appendLiteral(source.substr(cursor));
+  return true;
+}
+
+std::optional<compiledTemplate>
+compiledTemplate::load(const std::filesystem::path &path, bool silent) {
+  auto errCode = std::error_code{};
+  auto modified = std::filesystem::last_write_time(path, errCode);
+  auto maybeText = fetchFileContents(path);
+  if (errCode || !maybeText) {
+    if (!silent) {
+      std::cerr << "failed to load template from template file: " << path
+                << std::endl;
+    }
+    return {};
+  }
+
+  auto result = parse(*maybeText, path.parent_path(), silent);
+  if (result) {
+    result->sourcePath = path;
+    result->dependencies.emplace_back(path, modified);
+  }
+  return result;
+}
+
+std::optional<compiledTemplate>
+compiledTemplate::parse(std::string_view text,
+                        const std::filesystem::path &partialDir, bool silent) {
+  auto result = compiledTemplate{};
+  result.text.reserve(text.length());
+  if (!result.compileInto(text, partialDir, 0, silent)) {
+    return {};
+  }
+
+  result.text.shrink_to_fit();
+  return result;
+}
+
+compiledTemplate compiledTemplate::precompiled(std::string_view text,
+                                               const segment *segments,
+                                               size_t count, stringFill fill,
+                                               pmrStringFill pmrFill) {
+  auto result = compiledTemplate{};
+  result.text = text;
+  result.pieces.assign(segments, segments + count);
+  for (const auto &piece : result.pieces) {
+    if (piece.slot) {
+      result.slotUses[static_cast<size_t>(*piece.slot)] += 1;
+    }
+  }
+
+  result.precompiledFill = fill;
+  result.precompiledPmrFill = pmrFill;
+  return result;
+}
+
+std::string compiledTemplate::source() const {
+  auto result = std::string{};
+  for (const auto &piece : pieces) {
+    if (!piece.slot) {
+      result.append(text, piece.offset, piece.length);
+      continue;
+    }
+
+    for (const auto &[slotName, slot] : slotNames) {
+      if (slot == *piece.slot) {
+        result.append("{{ ").append(slotName).append(" }}");
+      }
+    }
+  }
+  return result;
+}
+
+bool compiledTemplate::isStale() const {
+  for (const auto &[path, modified] : dependencies) {
+    auto errCode = std::error_code{};
+    if (std::filesystem::last_write_time(path, errCode) != modified ||
+        errCode) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+#include "util.h"
+
+struct traceEvent {
+  static constexpr size_t maxDetailLength = 64;
+
+  const char *name;
+  uint64_t startNs;
+  uint64_t endNs;
+  uint8_t detailLength;
+  char detail[maxDetailLength];
+};
+
+/// Events recorded by one thread.  Only the owning thread appends to the
+/// buffer, so its lock is uncontended except while a trace is being flushed.
+struct threadBuffer {
+  static constexpr size_t maxEvents = size_t{1} << 19;
+
+  uint32_t threadId;
+  std::mutex lock;
+  std::vector<traceEvent> events;
+  uint64_t dropped = 0;
+};
+
+static std::atomic<bool> tracing{false};
+static std::atomic<uint64_t> sessionStartNs{0};
+
+// Buffers of all threads that ever recorded an event.  Buffers are shared with
+// the registry so that events from threads that have exited still get flushed.
+static std::mutex registryLock;
+static std::vector<std::shared_ptr<threadBuffer>> registry;
+
+static threadBuffer &localBuffer() {
+  thread_local auto buffer = [] {
+    auto guard = std::lock_guard<std::mutex>{registryLock};
+    auto result = std::make_shared<threadBuffer>();
+    result->threadId = static_cast<uint32_t>(registry.size() + 1);
+    registry.push_back(result);
+    return result;
+  }();
+  return *buffer;
+}
+
+bool isTracing() noexcept { return tracing.load(std::memory_order_relaxed); }
+
+uint64_t traceNow() noexcept {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void traceComplete(const char *name, uint64_t startNs, uint64_t endNs,
+                   std::string_view detail) noexcept {
+  if (!isTracing()) {
+    return;
+  }
+
+  // Cut the detail short at the start of a UTF-8 sequence, so that it stays
+  // valid text.
+  auto detailLength = std::min(detail.length(), traceEvent::maxDetailLength);
+  while (detailLength != 0 && detailLength < detail.length() &&
+         (static_cast<unsigned char>(detail[detailLength]) & 0xc0) == 0x80) {
+    detailLength -= 1;
+  }
+
+  // Spans are recorded from destructors, so running out of memory only loses
+  // the event.
+  try {
+    auto &buffer = localBuffer();
+    auto guard = std::lock_guard<std::mutex>{buffer.lock};
+    if (buffer.events.size() >= threadBuffer::maxEvents) {
+      buffer.dropped += 1;
+      return;
+    }
+
+    auto &event = buffer.events.emplace_back();
+    event.name = name;
+    event.startNs = startNs;
+    event.endNs = endNs;
+    event.detailLength = static_cast<uint8_t>(detailLength);
+    std::memcpy(event.detail, detail.data(), detailLength);
+  } catch (const std::exception &) {
+  }
+}
+
+void traceInstant(const char *name) noexcept {
+  if (isTracing()) {
+    auto now = traceNow();
+    traceComplete(name, now, now);
+  }
+}
+
+void startTracing() {
+  {
+    auto guard = std::lock_guard<std::mutex>{registryLock};
+    for (const auto &buffer : registry) {
+      auto bufferGuard = std::lock_guard<std::mutex>{buffer->lock};
+      buffer->events.clear();
+      buffer->dropped = 0;
+    }
+  }
+
+  sessionStartNs.store(traceNow(), std::memory_order_relaxed);
+  tracing.store(true, std::memory_order_release);
+}
+
+static void appendMicros(std::string &json, uint64_t ns) {
+  json += std::to_string(ns / 1000);
+  json += '.';
+  auto fraction = std::to_string(ns % 1000);
+  json.append(3 - fraction.length(), '0');
+  json += fraction;
+}
+
+static void appendEvent(std::string &json, const traceEvent &event,
+                        uint32_t threadId, uint64_t originNs) {
+  auto startNs = std::max(event.startNs, originNs) - originNs;
+
+  json += R"({"name":")";
+  json += event.name;
+  json += R"(","cat":"magenta","pid":1,"tid":)";
+  json += std::to_string(threadId);
+  json += R"(,"ts":)";
+  appendMicros(json, startNs);
+  if (event.endNs == event.startNs) {
+    json += R"(,"ph":"i","s":"t")";
+  } else {
+    json += R"(,"ph":"X","dur":)";
+    appendMicros(json, event.endNs - event.startNs);
+  }
+
+  if (event.detailLength != 0) {
+    json += R"(,"args":{"detail":")";
+    appendJsonEscaped(json, {event.detail, event.detailLength});
+    json += "\"}";
+  }
+  json += "},\n";
+}
+
+bool stopTracing(const std::filesystem::path &path, bool silent) {
+  tracing.store(false, std::memory_order_release);
+  auto originNs = sessionStartNs.load(std::memory_order_relaxed);
+
+  auto json = std::string{"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"};
+  auto dropped = uint64_t{0};
+  {
+    auto guard = std::lock_guard<std::mutex>{registryLock};
+    for (const auto &buffer : registry) {
+      auto bufferGuard = std::lock_guard<std::mutex>{buffer->lock};
+      if (buffer->events.empty()) {
+        continue;
+      }
+
+      json += R"({"name":"thread_name","ph":"M","pid":1,"tid":)";
+      json += std::to_string(buffer->threadId);
+      json += R"(,"args":{"name":"magenta-)";
+      json += std::to_string(buffer->threadId);
+      json += "\"}},\n";
+
+      for (const auto &event : buffer->events) {
+        appendEvent(json, event, buffer->threadId, originNs);
+      }
+
+      dropped += buffer->dropped;
+      buffer->events.clear();
+      buffer->events.shrink_to_fit();
+      buffer->dropped = 0;
+    }
+  }
+
+  // The trailing metadata record avoids having to special-case the comma
+  // after the last event.
+  json += R"({"name":"dropped_events","ph":"M","pid":1,"args":{"count":)";
+  json += std::to_string(dropped);
+  json += "}}\n]}\n";
+
+  auto stream = std::ofstream{path, std::ios::binary | std::ios::trunc};
+  stream.write(json.data(), static_cast<std::streamsize>(json.length()));
+  if (!stream) {
+    if (!silent) {
+      std::cerr << "failed to write trace file: " << path << std::endl;
+    }
+    return false;
+  }
+
+  return true;
+}
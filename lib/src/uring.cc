@@ -0,0 +1,384 @@
+#include <iostream>
+#include <utility>
+
+#include "uring.h"
+
+#ifdef MAGENTA_IO_URING
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/// A file that is being read.  Each step of the read has `outstanding`
+/// requests in flight, and the next step starts once all of them completed.
+struct ioRing::readOp {
+  std::string path;
+  callback done;
+  struct statx stx = {};
+  bool sized = false;
+  int fd = -1;
+  int error = 0;
+  int outstanding = 0;
+  std::string contents;
+  size_t offset = 0;
+};
+
+/// The memory-mapped rings that are shared with the kernel.
+struct ioRing::state {
+  // Requests carry the step that they belong to in the low bits of their
+  // user data, and the read in the remaining bits.  Zero marks wakeups.
+  enum step : uint64_t { STAT = 1, OPEN = 2, READ = 3 };
+  static constexpr uint64_t stepMask = 3;
+
+  ~state();
+
+  bool setup(uint32_t entries);
+  struct io_uring_sqe *nextSqe();
+  void queueWakeup();
+  void submit();
+  void start(readOp *op);
+  void advance(readOp *op);
+  void complete(uint64_t userData, int32_t result);
+  void finish(readOp *op);
+
+  int fd = -1;
+  int wakeFd = -1;
+
+  void *sqRing = MAP_FAILED;
+  void *cqRing = MAP_FAILED;
+  size_t sqRingBytes = 0;
+  size_t cqRingBytes = 0;
+  struct io_uring_sqe *sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+  size_t sqesBytes = 0;
+
+  unsigned *sqHead = nullptr;
+  unsigned *sqTail = nullptr;
+  unsigned *sqArray = nullptr;
+  unsigned sqMask = 0;
+  unsigned sqEntries = 0;
+  unsigned sqTailLocal = 0;
+
+  unsigned *cqHead = nullptr;
+  unsigned *cqTail = nullptr;
+  unsigned cqMask = 0;
+  struct io_uring_cqe *cqes = nullptr;
+
+  size_t pendingReads = 0;
+  size_t maxReads = 0;
+};
+
+static void *offsetBy(void *base, uint32_t offset) {
+  return static_cast<char *>(base) + offset;
+}
+
+bool ioRing::state::setup(uint32_t entries) {
+  auto params = io_uring_params{};
+  fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0) {
+    return false;
+  }
+
+  // Hard links, `statx`, `openat` and `send` all arrived before this feature.
+  if ((params.features & IORING_FEAT_NODROP) == 0) {
+    return false;
+  }
+
+  sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingBytes =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  auto singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMap) {
+    sqRingBytes = cqRingBytes = std::max(sqRingBytes, cqRingBytes);
+  }
+
+  sqRing = mmap(nullptr, sqRingBytes, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    return false;
+  }
+
+  cqRing = singleMap ? sqRing
+                     : mmap(nullptr, cqRingBytes, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  if (cqRing == MAP_FAILED) {
+    return false;
+  }
+
+  sqesBytes = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = static_cast<struct io_uring_sqe *>(
+      mmap(nullptr, sqesBytes, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+  if (sqes == MAP_FAILED) {
+    return false;
+  }
+
+  sqHead = static_cast<unsigned *>(offsetBy(sqRing, params.sq_off.head));
+  sqTail = static_cast<unsigned *>(offsetBy(sqRing, params.sq_off.tail));
+  sqArray = static_cast<unsigned *>(offsetBy(sqRing, params.sq_off.array));
+  sqMask = *static_cast<unsigned *>(offsetBy(sqRing, params.sq_off.ring_mask));
+  sqEntries = params.sq_entries;
+  sqTailLocal = *sqTail;
+
+  cqHead = static_cast<unsigned *>(offsetBy(cqRing, params.cq_off.head));
+  cqTail = static_cast<unsigned *>(offsetBy(cqRing, params.cq_off.tail));
+  cqMask = *static_cast<unsigned *>(offsetBy(cqRing, params.cq_off.ring_mask));
+  cqes = static_cast<struct io_uring_cqe *>(
+      offsetBy(cqRing, params.cq_off.cqes));
+
+  // A read never has more than three requests in flight at once, so this
+  // many reads never overflow the submission queue.
+  maxReads = sqEntries / 3;
+  return true;
+}
+
+ioRing::state::~state() {
+  // The kernel writes into the buffers of reads in progress, so wait for them
+  // before the buffers go away.  Their callbacks may refer to state that is
+  // gone by now, so they are dropped.
+  while (fd >= 0 && pendingReads > 0 &&
+         syscall(__NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS,
+                 nullptr, 0) >= 0) {
+    auto head = *cqHead;
+    auto tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      const auto &cqe = cqes[head & cqMask];
+      auto op = reinterpret_cast<readOp *>(cqe.user_data & ~stepMask);
+      if (op != nullptr && --op->outstanding == 0) {
+        op->done = nullptr;
+        finish(op);
+      }
+    }
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  if (sqes != MAP_FAILED) {
+    munmap(sqes, sqesBytes);
+  }
+  if (cqRing != MAP_FAILED && cqRing != sqRing) {
+    munmap(cqRing, cqRingBytes);
+  }
+  if (sqRing != MAP_FAILED) {
+    munmap(sqRing, sqRingBytes);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+struct io_uring_sqe *ioRing::state::nextSqe() {
+  auto head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  if (sqTailLocal - head >= sqEntries) {
+    return nullptr;
+  }
+
+  auto index = sqTailLocal & sqMask;
+  sqTailLocal += 1;
+  sqArray[index] = index;
+
+  auto sqe = &sqes[index];
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void ioRing::state::queueWakeup() {
+  static const char byte = 1;
+  auto sqe = nextSqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = wakeFd;
+  sqe->addr = reinterpret_cast<uint64_t>(&byte);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_DONTWAIT;
+  sqe->user_data = 0;
+}
+
+void ioRing::state::submit() {
+  __atomic_store_n(sqTail, sqTailLocal, __ATOMIC_RELEASE);
+  auto queued = sqTailLocal - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+  if (queued > 0) {
+    syscall(__NR_io_uring_enter, fd, queued, 0, 0, nullptr, 0);
+  }
+}
+
+void ioRing::state::start(readOp *op) {
+  // Hard links run the requests in order, even if an earlier one fails, so
+  // that the wakeup always follows the last of them.
+  auto stat = nextSqe();
+  stat->opcode = IORING_OP_STATX;
+  stat->flags = IOSQE_IO_HARDLINK;
+  stat->fd = AT_FDCWD;
+  stat->addr = reinterpret_cast<uint64_t>(op->path.c_str());
+  stat->len = STATX_SIZE;
+  stat->off = reinterpret_cast<uint64_t>(&op->stx);
+  stat->user_data = reinterpret_cast<uint64_t>(op) | STAT;
+
+  auto open = nextSqe();
+  open->opcode = IORING_OP_OPENAT;
+  open->flags = IOSQE_IO_HARDLINK;
+  open->fd = AT_FDCWD;
+  open->addr = reinterpret_cast<uint64_t>(op->path.c_str());
+  open->open_flags = O_RDONLY | O_CLOEXEC;
+  open->user_data = reinterpret_cast<uint64_t>(op) | OPEN;
+
+  queueWakeup();
+  op->outstanding = 2;
+  submit();
+}
+
+void ioRing::state::advance(readOp *op) {
+  if (op->error != 0 || op->fd < 0) {
+    finish(op);
+    return;
+  }
+
+  if (!op->sized) {
+    op->sized = true;
+    op->contents.resize(op->stx.stx_size);
+  }
+
+  if (op->offset >= op->contents.size()) {
+    finish(op);
+    return;
+  }
+
+  auto read = nextSqe();
+  read->opcode = IORING_OP_READ;
+  read->flags = IOSQE_IO_HARDLINK;
+  read->fd = op->fd;
+  read->addr = reinterpret_cast<uint64_t>(op->contents.data() + op->offset);
+  read->len = static_cast<uint32_t>(
+      std::min<size_t>(op->contents.size() - op->offset, size_t{1} << 30));
+  read->off = op->offset;
+  read->user_data = reinterpret_cast<uint64_t>(op) | READ;
+
+  queueWakeup();
+  op->outstanding = 1;
+  submit();
+}
+
+void ioRing::state::complete(uint64_t userData, int32_t result) {
+  auto op = reinterpret_cast<readOp *>(userData & ~stepMask);
+  if (op == nullptr) {
+    return;
+  }
+
+  switch (userData & stepMask) {
+  case STAT:
+    op->error = result < 0 ? -result : op->error;
+    break;
+  case OPEN:
+    if (result >= 0) {
+      op->fd = result;
+    } else {
+      op->error = -result;
+    }
+    break;
+  case READ:
+    if (result < 0) {
+      op->error = -result;
+    } else if (result == 0) {
+      // The file shrank since it was measured.
+      op->contents.resize(op->offset);
+    } else {
+      op->offset += static_cast<size_t>(result);
+    }
+    break;
+  }
+
+  if (--op->outstanding == 0) {
+    advance(op);
+  }
+}
+
+void ioRing::state::finish(readOp *op) {
+  if (op->fd >= 0) {
+    close(op->fd);
+  }
+
+  auto contents = std::optional<std::string>{};
+  if (op->error == 0 && op->sized) {
+    contents = std::move(op->contents);
+  }
+
+  auto done = std::move(op->done);
+  delete op;
+  pendingReads -= 1;
+  if (done) {
+    done(std::move(contents));
+  }
+}
+
+std::unique_ptr<ioRing> ioRing::open(int wakeFd, uint32_t entries,
+                                     bool silent) {
+  auto ring = std::make_unique<state>();
+  ring->wakeFd = wakeFd;
+  if (!ring->setup(entries)) {
+    if (!silent) {
+      std::cerr << "failed to set up io_uring, reading files the blocking way"
+                << std::endl;
+    }
+    return nullptr;
+  }
+  return std::unique_ptr<ioRing>(new ioRing(std::move(ring)));
+}
+
+bool ioRing::readFile(const std::filesystem::path &path, callback done) {
+  if (ring->pendingReads >= ring->maxReads) {
+    return false;
+  }
+
+  auto op = new readOp{};
+  op->path = path.string();
+  op->done = std::move(done);
+  ring->pendingReads += 1;
+  ring->start(op);
+  return true;
+}
+
+void ioRing::poll() {
+  // Copy the completions out first, since callbacks may start new reads.
+  auto completions = std::vector<std::pair<uint64_t, int32_t>>{};
+  auto head = *ring->cqHead;
+  auto tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const auto &cqe = ring->cqes[head & ring->cqMask];
+    completions.emplace_back(cqe.user_data, cqe.res);
+  }
+  __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+  for (auto [userData, result] : completions) {
+    ring->complete(userData, result);
+  }
+}
+
+size_t ioRing::pending() const { return ring->pendingReads; }
+#else
+struct ioRing::state {};
+
+std::unique_ptr<ioRing> ioRing::open(int, uint32_t, bool silent) {
+  if (!silent) {
+    std::cerr << "io_uring is not supported by this build, reading files the "
+                 "blocking way"
+              << std::endl;
+  }
+  return nullptr;
+}
+
+bool ioRing::readFile(const std::filesystem::path &, callback) {
+  return false;
+}
+
+void ioRing::poll() {}
+
+size_t ioRing::pending() const { return 0; }
+#endif
+
+ioRing::ioRing(std::unique_ptr<state> ring) : ring(std::move(ring)) {}
+
+ioRing::~ioRing() = default;
@@ -1,15 +1,182 @@
-#include <fstream>
-#include <streambuf>
+#include <cstdio>
+#include <memory>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "util.h"
 
+template <class String>
+static std::optional<String> readFile(const std::filesystem::path &path,
+                                      String contents) {
+  // Use stdio rather than `std::ifstream`, whose stream buffer costs an extra
+  // heap allocation and copy on every call, and size the result up front.
+  auto file = std::unique_ptr<std::FILE, int (*)(std::FILE *)>{
+      std::fopen(path.string().c_str(), "r"), &std::fclose};
+  if (!file) {
+    return {};
+  }
+
+  auto errCode = std::error_code{};
+  auto size = std::filesystem::file_size(path, errCode);
+  contents.resize(errCode ? 0 : size);
+
+  // Text-mode reads may return fewer bytes than the file size (for instance,
+  // when line endings get translated), and the file may change size while we
+  // read it, so read until end of file.
+  auto length = std::fread(contents.data(), 1, contents.size(), file.get());
+  for (char chunk[4096]; !std::feof(file.get()) && !std::ferror(file.get());) {
+    auto count = std::fread(chunk, 1, sizeof(chunk), file.get());
+    contents.resize(length);
+    contents.append(chunk, count);
+    length += count;
+  }
+
+  if (std::ferror(file.get())) {
+    return {};
+  }
+
+  contents.resize(length);
+  return contents;
+}
+
 std::optional<std::string>
 fetchFileContents(const std::filesystem::path &path) {
-  auto stream = std::ifstream{path};
-  if (!stream) {
+  return readFile(path, std::string{});
+}
+
+std::optional<std::pmr::string>
+fetchFileContents(const std::filesystem::path &path,
+                  std::pmr::memory_resource &arena) {
+  return readFile(path, std::pmr::string{&arena});
+}
+
+std::optional<mappedFile> mappedFile::open(const std::filesystem::path &path) {
+  auto errCode = std::error_code{};
+  auto size = std::filesystem::file_size(path, errCode);
+  if (errCode) {
+    return {};
+  }
+
+  // Mapping an empty file fails, but there is nothing to map anyway.
+  if (size == 0) {
+    return mappedFile{nullptr, 0};
+  }
+
+#ifdef _WIN32
+  auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                          OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return {};
+  }
+
+  auto mapping =
+      CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr) {
     return {};
   }
 
-  return std::string{(std::istreambuf_iterator<char>(stream)),
-                     std::istreambuf_iterator<char>()};
+  // The view keeps the mapping alive, so the handle can be closed right away.
+  auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (view == nullptr) {
+    return {};
+  }
+#else
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return {};
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  auto view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (view == MAP_FAILED) {
+    return {};
+  }
+
+  // Callers read mapped files front to back, so let the kernel read ahead
+  // aggressively and drop pages behind the reader.
+  madvise(view, size, MADV_SEQUENTIAL);
+#endif
+
+  return mappedFile{static_cast<const char *>(view), static_cast<size_t>(size)};
+}
+
+mappedFile::mappedFile(mappedFile &&other) noexcept
+    : data(std::exchange(other.data, nullptr)),
+      size(std::exchange(other.size, 0)) {}
+
+mappedFile &mappedFile::operator=(mappedFile &&other) noexcept {
+  std::swap(data, other.data);
+  std::swap(size, other.size);
+  return *this;
+}
+
+mappedFile::~mappedFile() {
+  if (data == nullptr) {
+    return;
+  }
+
+#ifdef _WIN32
+  UnmapViewOfFile(data);
+#else
+  munmap(const_cast<char *>(data), size);
+#endif
+}
+
+civilTime toCivilTime(int64_t timestampUs) {
+  // This is the days-to-civil conversion from Howard Hinnant's date
+  // algorithms.
+  const auto usPerDay = int64_t{86400} * 1000000;
+  auto days = timestampUs / usPerDay;
+  auto usOfDay = timestampUs % usPerDay;
+  if (usOfDay < 0) {
+    usOfDay += usPerDay;
+    days -= 1;
+  }
+
+  auto z = days + 719468;
+  auto era = (z >= 0 ? z : z - 146096) / 146097;
+  auto doe = z - era * 146097;
+  auto yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  auto doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  auto mp = (5 * doy + 2) / 153;
+  auto day = doy - (153 * mp + 2) / 5 + 1;
+  auto month = mp < 10 ? mp + 3 : mp - 9;
+
+  auto seconds = usOfDay / 1000000;
+  return civilTime{yoe + era * 400 + (month <= 2),
+                   static_cast<int>(month),
+                   static_cast<int>(day),
+                   static_cast<int>(seconds / 3600),
+                   static_cast<int>(seconds / 60 % 60),
+                   static_cast<int>(seconds % 60),
+                   static_cast<int>(usOfDay % 1000000)};
+}
+
+void appendJsonEscaped(std::string &buffer, std::string_view text) {
+  static const char hexDigits[] = "0123456789abcdef";
+  for (auto ch : text) {
+    auto byte = static_cast<unsigned char>(ch);
+    if (ch == '"' || ch == '\\') {
+      buffer += '\\';
+      buffer += ch;
+    } else if (byte < 0x20) {
+      buffer += "\\u00";
+      buffer += hexDigits[byte >> 4];
+      buffer += hexDigits[byte & 0xf];
+    } else {
+      buffer += ch;
+    }
+  }
 }
@@ -0,0 +1,80 @@
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "mongoose.h"
+#include "wakeup.h"
+
+#ifndef _WIN32
+std::shared_ptr<loopWaker> loopWaker::open(struct mg_mgr &mgr, bool silent) {
+  // Datagram sockets never raise SIGPIPE, even once the event manager closed
+  // the reading end.
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) != 0) {
+    if (!silent) {
+      std::cerr << "failed to create wakeup socket" << std::endl;
+    }
+    return nullptr;
+  }
+
+  for (auto fd : fds) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  auto waker = std::shared_ptr<loopWaker>(new loopWaker(fds[1]));
+  if (mg_wrapfd(&mgr, fds[0], handler, waker.get()) == nullptr) {
+    if (!silent) {
+      std::cerr << "failed to register wakeup socket" << std::endl;
+    }
+    ::close(fds[0]);
+    return nullptr;
+  }
+  return waker;
+}
+
+loopWaker::~loopWaker() { ::close(fd); }
+
+void loopWaker::wake() {
+  if (!pending.exchange(true)) {
+    auto byte = char{1};
+    ::send(fd, &byte, 1, 0);
+  }
+}
+
+void loopWaker::handler(struct mg_connection *connection, int ev, void *,
+                        void *fnData) {
+  if (ev != MG_EV_READ) {
+    return;
+  }
+
+  // Clear the flag first, so that a wakeup that arrives while the datagrams
+  // are drained sends another one.
+  auto waker = static_cast<loopWaker *>(fnData);
+  waker->pending = false;
+  connection->recv.len = 0;
+
+  char buffer[64];
+  auto fd = static_cast<int>(reinterpret_cast<size_t>(connection->fd));
+  while (::recv(fd, buffer, sizeof(buffer), 0) > 0) {
+  }
+  waker->wokenUp = true;
+}
+#else
+std::shared_ptr<loopWaker> loopWaker::open(struct mg_mgr &, bool silent) {
+  if (!silent) {
+    std::cerr << "event loop wakeups are not supported on this platform"
+              << std::endl;
+  }
+  return nullptr;
+}
+
+loopWaker::~loopWaker() {}
+
+void loopWaker::wake() {}
+
+void loopWaker::handler(struct mg_connection *, int, void *, void *) {}
+#endif
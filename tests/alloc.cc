@@ -0,0 +1,62 @@
+#include <cstdlib>
+#include <new>
+
+#include "alloc.h"
+
+// Per-thread counters, so that background threads (like the access log's
+// drain thread) do not perturb measurements made on the test thread.
+static thread_local allocCounts threadCounts = {0, 0};
+
+static void *countedAlloc(std::size_t size) {
+  threadCounts.count += 1;
+  threadCounts.bytes += size;
+
+  // `malloc(0)` may return null, but `operator new` must return a unique
+  // non-null pointer.
+  if (auto ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+  throw std::bad_alloc{};
+}
+
+void *operator new(std::size_t size) { return countedAlloc(size); }
+
+void *operator new[](std::size_t size) { return countedAlloc(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return countedAlloc(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return countedAlloc(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete(void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept {
+  std::free(ptr);
+}
+
+allocScope::allocScope() : start(threadCounts) {}
+
+allocCounts allocScope::counts() const {
+  return {threadCounts.count - start.count, threadCounts.bytes - start.bytes};
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+/// Number and total size of global `operator new` calls.
+struct allocCounts {
+  uint64_t count;
+  uint64_t bytes;
+};
+
+/// Counts the global `operator new` calls made by the current thread during
+/// the lifetime of the scope.  The test driver replaces the global allocation
+/// functions, so this works for any code that the driver calls, including code
+/// in the server library.
+class allocScope {
+public:
+  allocScope();
+
+  /// Allocations made since the scope began.
+  allocCounts counts() const;
+
+private:
+  allocCounts start;
+};
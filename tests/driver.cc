@@ -1,8 +1,26 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <memory_resource>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "alloc.h"
 #include "json.hpp"
+#include "mongoose.h"
 #include "server.h"
 
 struct stats {
@@ -168,9 +186,12 @@ void testLoadConfig(struct stats &stats) {
         nlohmann::json provider1;
         provider1["clientIdEnvVar"] = "CLIENT1_ID";
         provider1["clientSecretEnvVar"] = "CLIENT1_SECRET";
+        provider1["allow"] = nlohmann::json::array({"alice", "bob"});
+        provider1["block"] = nlohmann::json::array({"eve"});
 
         config["auth"]["kind"] = "oauthv2";
         config["auth"]["providers"] = {provider0, provider1};
+        config["auth"]["sessionSeconds"] = 3600u;
         return !validateConfiguration(config, /* silent */ true);
       }(),
       stats);
@@ -192,9 +213,12 @@ void testLoadConfig(struct stats &stats) {
         provider1["name"] = "guthub";
         provider1["clientIdEnvVar"] = "CLIENT1_ID";
         provider1["clientSecretEnvVar"] = "CLIENT1_SECRET";
+        provider1["allow"] = nlohmann::json::array({"alice", "bob"});
+        provider1["block"] = nlohmann::json::array({"eve"});
 
         config["auth"]["kind"] = "oauthv2";
         config["auth"]["providers"] = {provider0, provider1};
+        config["auth"]["sessionSeconds"] = 3600u;
         return !validateConfiguration(config, /* silent */ true);
       }(),
       stats);
@@ -214,9 +238,12 @@ void testLoadConfig(struct stats &stats) {
         nlohmann::json provider1;
         provider1["name"] = "github";
         provider1["clientSecretEnvVar"] = "CLIENT1_SECRET";
+        provider1["allow"] = nlohmann::json::array({"alice", "bob"});
+        provider1["block"] = nlohmann::json::array({"eve"});
 
         config["auth"]["kind"] = "oauthv2";
         config["auth"]["providers"] = {provider0, provider1};
+        config["auth"]["sessionSeconds"] = 3600u;
         return !validateConfiguration(config, /* silent */ true);
       }(),
       stats);
@@ -243,6 +270,140 @@ void testLoadConfig(struct stats &stats) {
       }(),
       stats);
 
+  check(
+      "non-boolean liveReload in config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+        config["core"]["liveReload"] = "yes";
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "negative feedEntries in core config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+        config["core"]["feedEntries"] = -1;
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "host without names in core config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+
+        nlohmann::json host;
+        host["names"] = nlohmann::json::array();
+        host["docRoot"] = dir;
+        host["templatePath"] = dir / "template.html";
+        config["core"]["hosts"] = nlohmann::json::array({host});
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "host with missing docRoot in core config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+
+        nlohmann::json host;
+        host["names"] = nlohmann::json::array({"wiki.example.com"});
+        host["docRoot"] = dir / "no-such-directory";
+        host["templatePath"] = dir / "template.html";
+        config["core"]["hosts"] = nlohmann::json::array({host});
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "valid hosts in core config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+
+        nlohmann::json host;
+        host["names"] = nlohmann::json::array({"wiki.example.com", "wiki"});
+        host["docRoot"] = dir;
+        host["templatePath"] = dir / "template.html";
+        host["cacheBytes"] = 1024u;
+        config["core"]["hosts"] = nlohmann::json::array({host});
+        return validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "non-array allow list in auth config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+
+        nlohmann::json provider;
+        provider["name"] = "github";
+        provider["clientIdEnvVar"] = "CLIENT_ID";
+        provider["clientSecretEnvVar"] = "CLIENT_SECRET";
+        provider["allow"] = "alice";
+
+        config["auth"]["kind"] = "oauthv2";
+        config["auth"]["providers"] = nlohmann::json::array({provider});
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "zero sessionSeconds in auth config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+        config["auth"]["kind"] = "oauthv2";
+        config["auth"]["providers"] = nlohmann::json::array();
+        config["auth"]["sessionSeconds"] = 0u;
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "zero requestsPerSecond in limits config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+        config["limits"]["requestsPerSecond"] = 0;
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
+  check(
+      "negative burst in limits config",
+      [&dir] {
+        nlohmann::json config;
+        config["core"]["port"] = 808;
+        config["core"]["docRoot"] = dir;
+        config["core"]["templatePath"] = dir / "template.html";
+        config["limits"]["burst"] = -1;
+        return !validateConfiguration(config, /* silent */ true);
+      }(),
+      stats);
+
   check(
       "valid github-based config",
       [&dir] {
@@ -260,14 +421,74 @@ void testLoadConfig(struct stats &stats) {
         provider1["name"] = "github";
         provider1["clientIdEnvVar"] = "CLIENT1_ID";
         provider1["clientSecretEnvVar"] = "CLIENT1_SECRET";
+        provider1["allow"] = nlohmann::json::array({"alice", "bob"});
+        provider1["block"] = nlohmann::json::array({"eve"});
 
         config["auth"]["kind"] = "oauthv2";
         config["auth"]["providers"] = {provider0, provider1};
+        config["auth"]["sessionSeconds"] = 3600u;
         return validateConfiguration(config, /* silent */ true);
       }(),
       stats);
 }
 
+void testLoadBundledConfig(struct stats &stats) {
+  check("bundled configuration needs no document root or template",
+        [] {
+          auto maybeConfig =
+              loadBundledConfiguration(R"({"core": {"port": 8080}})");
+          return maybeConfig && maybeConfig->bundled &&
+                 maybeConfig->port == 8080 && maybeConfig->docRoot.empty();
+        }(),
+        stats);
+
+  check("limits fill in defaults",
+        [] {
+          auto maybeConfig = loadBundledConfiguration(
+              R"({"core": {"port": 8080}, "limits": {"burst": 5}})");
+          return maybeConfig && maybeConfig->limits &&
+                 maybeConfig->limits->requestsPerSecond == 10 &&
+                 maybeConfig->limits->burst == 5 &&
+                 maybeConfig->limits->maxStreams == 16;
+        }(),
+        stats);
+
+  check("render budget fills in defaults",
+        [] {
+          auto maybeConfig = loadBundledConfiguration(
+              R"({"core": {"port": 8080, "maxRenderBytes": 0}})");
+          auto negative = loadBundledConfiguration(
+              R"({"core": {"port": 8080, "maxRenderMillis": -1}})");
+          return maybeConfig && maybeConfig->maxRenderMillis == 1000 &&
+                 maybeConfig->maxRenderBytes == 0 && !negative;
+        }(),
+        stats);
+
+  check("bundled configuration has no hosts",
+        [] {
+          return !loadBundledConfiguration(
+              R"({"core": {"port": 8080, "hosts": []}})");
+        }(),
+        stats);
+
+  check("configuration of a host",
+        [] {
+          auto config = *loadBundledConfiguration(
+              R"({"core": {"port": 8080, "cacheBytes": 4096}})");
+          config.docRoot = "/srv/main";
+          config.templatePath = "/srv/main.html";
+          config.hosts.push_back(
+              hostConfig{{"wiki"}, "/srv/wiki", "/srv/wiki.html", 1024});
+
+          auto host = configForHost(config, config.hosts.front());
+          return host.docRoot == "/srv/wiki" &&
+                 host.templatePath == "/srv/wiki.html" &&
+                 host.cacheBytes == 1024 && host.port == 8080 &&
+                 host.hosts.empty();
+        }(),
+        stats);
+}
+
 void testRenderText(struct stats &stats) {
   check("blank template non-empty",
         renderText(R"(Hello, World!)", "", /* silent */ true) != std::nullopt,
@@ -291,7 +512,7 @@ void testRenderText(struct stats &stats) {
       [] {
         auto result =
             renderText(R"(# Hello, World!)", "{{ body }}", /* silent */ true);
-        return *result == "<h1>Hello, World!</h1>\n";
+        return *result == "<h1 id=\"hello-world\">Hello, World!</h1>\n";
       }(),
       stats);
 
@@ -300,7 +521,8 @@ void testRenderText(struct stats &stats) {
       [] {
         auto result = renderText(R"(# Hello, World!)",
                                  "<body>{{ body }}</body>", /* silent */ true);
-        return *result == "<body><h1>Hello, World!</h1>\n</body>";
+        return *result ==
+               "<body><h1 id=\"hello-world\">Hello, World!</h1>\n</body>";
       }(),
       stats);
 
@@ -311,7 +533,427 @@ void testRenderText(struct stats &stats) {
             renderText(R"(# Hello, World!)",
                        "<body>{{ body }}{{ body }}</body>", /* silent */ true);
         return *result ==
-               "<body><h1>Hello, World!</h1>\n<h1>Hello, World!</h1>\n</body>";
+               "<body><h1 id=\"hello-world\">Hello, World!</h1>\n"
+               "<h1 id=\"hello-world\">Hello, World!</h1>\n</body>";
+      }(),
+      stats);
+
+  check(
+      "headings get ids and a table of contents",
+      [] {
+        auto result = renderText(
+            "# Guide\n\n## Set *up*\n\n### `make` & run\n\n## Set up\n\n"
+            "#### Deep\n\n## Set up-1\n\n# Guide\n",
+            "{{ toc }}|{{ body }}", /* silent */ true);
+        return *result == "<ul class=\"toc\">\n"
+                          "<li><a href=\"#guide\">Guide</a>\n"
+                          "<ul>\n"
+                          "<li><a href=\"#set-up\">Set up</a>\n"
+                          "<ul>\n"
+                          "<li><a href=\"#make--run\">make &amp; run</a></li>\n"
+                          "</ul>\n"
+                          "</li>\n"
+                          "<li><a href=\"#set-up-1\">Set up</a>\n"
+                          "<ul>\n"
+                          "<li><a href=\"#deep\">Deep</a></li>\n"
+                          "</ul>\n"
+                          "</li>\n"
+                          "<li><a href=\"#set-up-1-1\">Set up-1</a></li>\n"
+                          "</ul>\n"
+                          "</li>\n"
+                          "<li><a href=\"#guide-1\">Guide</a></li>\n"
+                          "</ul>\n"
+                          "|<h1 id=\"guide\">Guide</h1>\n"
+                          "<h2 id=\"set-up\">Set <em>up</em></h2>\n"
+                          "<h3 id=\"make--run\">"
+                          "<code>make</code> &amp; run</h3>\n"
+                          "<h2 id=\"set-up-1\">Set up</h2>\n"
+                          "<h4 id=\"deep\">Deep</h4>\n"
+                          "<h2 id=\"set-up-1-1\">Set up-1</h2>\n"
+                          "<h1 id=\"guide-1\">Guide</h1>\n";
+      }(),
+      stats);
+
+  check(
+      "table of contents is empty without headings",
+      [] {
+        auto result = renderText("Text with <h2> in it.\n",
+                                 "{{ toc }}|{{ body }}", /* silent */ true);
+        return *result == "|<p>Text with &lt;h2&gt; in it.</p>\n";
+      }(),
+      stats);
+
+  check(
+      "render watchdog stops pages that grow too large",
+      [] {
+        auto markDown = std::string{};
+        for (auto i = 0; i < 1000; ++i) {
+          markDown += "Paragraph with *emphasis*.\n\n";
+        }
+
+        auto roomy = renderWatchdog{{std::chrono::seconds{60}, 1 << 20}};
+        auto fits = renderText(markDown, "{{ body }}", /* silent */ true);
+        auto fitted = !roomy.tripped();
+        {
+          auto tight = renderWatchdog{{std::chrono::milliseconds{0}, 4096}};
+          auto cut = renderText(markDown, "{{ body }}", /* silent */ true);
+          if (cut || !tight.tripped()) {
+            return false;
+          }
+        }
+        auto again = renderText(markDown, "{{ body }}", /* silent */ true);
+        return fits && fitted && again && *again == *fits;
+      }(),
+      stats);
+
+  check(
+      "render watchdog stops pages that take too long",
+      [] {
+        auto markDown = std::string{};
+        for (auto i = 0; i < 100000; ++i) {
+          markDown += "- *a* **b** [c](d) `e`\n";
+        }
+
+        auto watchdog = renderWatchdog{{std::chrono::milliseconds{1}, 0}};
+        auto start = std::chrono::steady_clock::now();
+        auto result = renderText(markDown, "{{ body }}", /* silent */ true);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return !result && watchdog.tripped() &&
+               elapsed < std::chrono::milliseconds{500};
+      }(),
+      stats);
+
+  check(
+      "render watchdog stops pages before md4c calls back",
+      [] {
+        // Every blank line walks all the open lists, so the time md4c takes
+        // grows with the square of the size, all of it before the first
+        // callback.
+        auto markDown = std::string{};
+        for (auto i = 0; i < 40000; ++i) {
+          markDown += "1. ";
+        }
+        markDown += "a\n";
+        markDown += std::string(40000, '\n');
+
+        auto watchdog = renderWatchdog{{std::chrono::milliseconds{1}, 0}};
+        auto start = std::chrono::steady_clock::now();
+        auto result = renderText(markDown, "{{ body }}", /* silent */ true);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return !result && watchdog.tripped() &&
+               elapsed < std::chrono::milliseconds{200};
+      }(),
+      stats);
+
+  check(
+      "render watchdog turns down text larger than its budget",
+      [] {
+        auto watchdog = renderWatchdog{{std::chrono::milliseconds{0}, 16}};
+        auto small = renderText("Short.\n", "{{ body }}", /* silent */ true);
+        auto fitted = !watchdog.tripped();
+        auto large = renderText(std::string(100, '*'), "{{ body }}",
+                                /* silent */ true);
+        return small && fitted && !large && watchdog.tripped();
+      }(),
+      stats);
+}
+
+void testCompiledTemplate(struct stats &stats) {
+  const auto dir =
+      std::filesystem::temp_directory_path() / "magenta-template-test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+
+  auto writeFile = [&dir](const char *name, std::string_view text) {
+    auto stream = std::ofstream{dir / name};
+    stream << text;
+  };
+
+  writeFile("layout.html",
+            "{{> header }}<main>{{ body }}</main>{{> footer.htm }}");
+  writeFile("header.html", "<h>{{ title }}</h>");
+  writeFile("footer.htm", "<f/>");
+  writeFile("missing.html", "{{> nowhere }}");
+  writeFile("cycle.html", "{{> cycle }}");
+
+  check(
+      "fill slots and keep unknown placeholders",
+      [] {
+        auto layout = compiledTemplate::parse(
+            "<t>{{ title }}</t>{{ unknown }}{{body}}{{ title }}");
+        auto values = slotValues{};
+        values[templateSlot::TITLE] = "T";
+        values[templateSlot::BODY] = "B";
+
+        auto page = std::string{};
+        layout->fill(values, page);
+        return page == "<t>T</t>{{ unknown }}BT" &&
+               layout->uses(templateSlot::TITLE) == 2 &&
+               layout->uses(templateSlot::TOC) == 0;
+      }(),
+      stats);
+
+  check(
+      "inline partials",
+      [&dir] {
+        auto layout = compiledTemplate::load(dir / "layout.html");
+        auto values = slotValues{};
+        values[templateSlot::TITLE] = "T";
+        values[templateSlot::BODY] = "B";
+
+        auto page = std::string{};
+        layout->fill(values, page);
+
+        // Literal text around partials is merged into a single segment.
+        return page == "<h>T</h><main>B</main><f/>" &&
+               layout->segments().size() == 5 && !layout->isStale();
+      }(),
+      stats);
+
+  check(
+      "source inlines partials",
+      [&dir] {
+        auto layout = compiledTemplate::load(dir / "layout.html");
+        auto reparsed = compiledTemplate::parse(layout->source());
+        return layout->source() ==
+                   "<h>{{ title }}</h><main>{{ body }}</main><f/>" &&
+               reparsed->segments().size() == layout->segments().size();
+      }(),
+      stats);
+
+  check("missing partial",
+        compiledTemplate::load(dir / "missing.html", /* silent */ true) ==
+            std::nullopt,
+        stats);
+
+  check("recursive partial",
+        compiledTemplate::load(dir / "cycle.html", /* silent */ true) ==
+            std::nullopt,
+        stats);
+
+  check(
+      "layout is stale after partial changes",
+      [&dir] {
+        auto layout = compiledTemplate::load(dir / "layout.html");
+        auto footerPath = dir / "footer.htm";
+        std::filesystem::last_write_time(
+            footerPath, std::filesystem::last_write_time(footerPath) +
+                            std::chrono::seconds{10});
+        return layout && layout->isStale();
+      }(),
+      stats);
+
+  check(
+      "fill page slots",
+      [] {
+        auto layout = *compiledTemplate::parse(
+            "{{ title }}|{{ path }}|{{ breadcrumbs }}|{{ mtime }}|{{ body }}");
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto page = renderFile("/notes/hello.md",
+                               std::filesystem::path{ARTIFACTS_PATH} /
+                                   "hello.md",
+                               layout, arena);
+        auto prefix = std::string_view{
+            "Hello!|/notes/hello.md|<a href=\"/\">home</a> / "
+            "<a href=\"/notes/\">notes</a> / hello.md|"};
+
+        // The modification date looks like "2024-01-31".
+        return page && page->find(prefix) == 0 &&
+               page->substr(prefix.length() + 10, 2) == "|<";
+      }(),
+      stats);
+
+  check(
+      "title skips fenced code blocks and escapes HTML",
+      [] {
+        auto layout = *compiledTemplate::parse("{{ title }}");
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto page = renderText("```\n# Not this\n```\n# A <b> & c ##\n",
+                               layout, arena);
+        return page && *page == "A &lt;b&gt; &amp; c";
+      }(),
+      stats);
+
+  check(
+      "builtin layout fills like the runtime layout",
+      [] {
+        auto layout = compiledTemplate::load(
+            std::filesystem::path{ARTIFACTS_PATH} / "template.html");
+        auto builtin = builtinTemplate();
+        auto values = slotValues{};
+        values[templateSlot::BODY] = "<p>B</p>";
+
+        auto page = std::string{};
+        auto builtinPage = std::string{};
+        layout->fill(values, page);
+        builtin.fill(values, builtinPage);
+
+        // Filling part of the builtin layout walks its segments instead.
+        auto prefix = std::string{};
+        builtin.fill(values, prefix, 0, 1);
+        return builtinPage == page && page.find(prefix) == 0 &&
+               builtin.source() == layout->source() && !builtin.isStale();
+      }(),
+      stats);
+
+  std::filesystem::remove_all(dir);
+}
+
+void testHighlighting(struct stats &stats) {
+  const auto bodyOnly = *compiledTemplate::parse("{{ body }}");
+  auto render = [&bodyOnly](std::string_view markDownText) {
+    auto arena = std::pmr::monotonic_buffer_resource{};
+    return std::string{*renderText(markDownText, bodyOnly, arena)};
+  };
+
+  check("highlight C++",
+        render("```cpp\n#include <map>\nint x = 0x1F; // \"a\"\n```\n") ==
+            "<pre><code class=\"language-cpp\">"
+            "<span class=\"hl-pp\">#include &lt;map&gt;</span>\n"
+            "<span class=\"hl-kw\">int</span> x = "
+            "<span class=\"hl-num\">0x1F</span>; "
+            "<span class=\"hl-com\">// &quot;a&quot;</span>\n"
+            "</code></pre>\n",
+        stats);
+
+  check("highlight Python",
+        render("```Python\ndef f():\n    return None  # 'x'\n```\n") ==
+            "<pre><code class=\"language-Python\">"
+            "<span class=\"hl-kw\">def</span> f():\n"
+            "    <span class=\"hl-kw\">return</span> "
+            "<span class=\"hl-lit\">None</span>  "
+            "<span class=\"hl-com\"># 'x'</span>\n"
+            "</code></pre>\n",
+        stats);
+
+  check("highlight shell",
+        render("```sh\necho \"$HOME\" $1 a#b # c\n```\n") ==
+            "<pre><code class=\"language-sh\">echo "
+            "<span class=\"hl-str\">&quot;$HOME&quot;</span> "
+            "<span class=\"hl-var\">$1</span> a#b "
+            "<span class=\"hl-com\"># c</span>\n"
+            "</code></pre>\n",
+        stats);
+
+  check("highlight JSON",
+        render("```json\n{\"a\": [1.5, null]}\n```\n") ==
+            "<pre><code class=\"language-json\">{"
+            "<span class=\"hl-str\">&quot;a&quot;</span>: ["
+            "<span class=\"hl-num\">1.5</span>, "
+            "<span class=\"hl-lit\">null</span>]}\n"
+            "</code></pre>\n",
+        stats);
+
+  check("leave other languages and inline code alone",
+        render("```rust\nfn x<T>() {}\n```\n\n`int`\n") ==
+            "<pre><code class=\"language-rust\">fn x&lt;T&gt;() {}\n"
+            "</code></pre>\n<p><code>int</code></p>\n",
+        stats);
+
+  check(
+      "highlighted blocks are cached",
+      [&bodyOnly] {
+        auto markDownText = std::string_view{
+            "```c\nstatic int cached(void) { return 42; }\n```\n"};
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto first = renderText(markDownText, bodyOnly, arena);
+
+        alignas(std::max_align_t) std::byte buffer[16 * 1024];
+        auto stackArena =
+            std::pmr::monotonic_buffer_resource{buffer, sizeof(buffer)};
+        auto scope = allocScope{};
+        auto second = renderText(markDownText, bodyOnly, stackArena);
+        return scope.counts().count == 0 && first && second &&
+               *first == *second;
+      }(),
+      stats);
+}
+
+void testLiveReload(struct stats &stats) {
+  check(
+      "split HTML into top-level blocks",
+      [] {
+        auto blocks = splitHtmlBlocks("<h1>A</h1>\n<ul>\n<li><p>B</p></li>\n"
+                                      "</ul>\n<hr />\n<p>C<br />D</p>\n");
+        return blocks == std::vector<std::string>{
+                             "<h1>A</h1>\n",
+                             "<ul>\n<li><p>B</p></li>\n</ul>\n",
+                             "<hr />\n",
+                             "<p>C<br />D</p>\n",
+                         };
+      }(),
+      stats);
+
+  check(
+      "diff blocks",
+      [] {
+        auto before = std::vector<std::string>{"a", "b", "c", "d"};
+        auto after = std::vector<std::string>{"a", "x", "y", "d"};
+        auto change = diffBlocks(before, after);
+        auto appended = diffBlocks(before, {"a", "b", "c", "d", "e"});
+        auto removed = diffBlocks(before, {"a", "d"});
+        return formatBlockChange(change) ==
+                   R"({"start":1,"remove":2,"insert":["x","y"]})" &&
+               formatBlockChange(appended) ==
+                   R"({"start":4,"remove":0,"insert":["e"]})" &&
+               formatBlockChange(removed) ==
+                   R"({"start":1,"remove":2,"insert":[]})";
+      }(),
+      stats);
+
+  check(
+      "live page sends changed blocks",
+      [] {
+        auto path =
+            std::filesystem::temp_directory_path() / "magenta-live-test.md";
+        auto write = [&path](std::string_view text) {
+          auto stream = std::ofstream{path};
+          stream << text;
+        };
+
+        write("# Title\n\nFirst \"one\".\n\nLast.\n");
+        auto page = livePage::open(path);
+        auto unchanged = page->refresh();
+
+        write("# Title\n\nFirst \"two\".\n\nLast.\n");
+        std::filesystem::last_write_time(
+            path,
+            std::filesystem::last_write_time(path) + std::chrono::seconds{10});
+        auto changed = page->refresh();
+        std::filesystem::remove(path);
+
+        return !unchanged && changed &&
+               *changed == R"({"start":1,"remove":1,"insert":)"
+                           R"(["<p>First &quot;two&quot;.</p>\u000a"]})";
+      }(),
+      stats);
+
+  check(
+      "live page holds renders to the budget",
+      [] {
+        auto path =
+            std::filesystem::temp_directory_path() / "magenta-live-budget.md";
+        auto write = [&path](std::string_view text, int seconds) {
+          {
+            auto stream = std::ofstream{path};
+            stream << text;
+          }
+          std::filesystem::last_write_time(
+              path, std::filesystem::last_write_time(path) +
+                        std::chrono::seconds{seconds});
+        };
+
+        write("Short.\n", 0);
+        auto page = livePage::open(path, {std::chrono::milliseconds{0}, 64});
+        write(std::string(1000, 'x') + "\n", 10);
+        auto overBudget = page->refresh();
+        write("Back.\n", 20);
+        auto changed = page->refresh();
+        std::filesystem::remove(path);
+
+        return page && !overBudget && changed &&
+               *changed == R"({"start":0,"remove":1,"insert":)"
+                           R"(["<p>Back.</p>\u000a"]})";
       }(),
       stats);
 }
@@ -352,7 +994,7 @@ void testRenderFile(struct stats &stats) {
       [&dir] {
         auto result =
             renderFile(dir / "hello.md", "{{ body }}", /* silent */ true);
-        return *result == "<h1>Hello!</h1>\n<p>Text.</p>\n";
+        return *result == "<h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n";
       }(),
       stats);
 
@@ -361,7 +1003,7 @@ void testRenderFile(struct stats &stats) {
       [&dir] {
         auto result =
             renderFile(dir / "symlink.md", "{{ body }}", /* silent */ true);
-        return *result == "<h1>Hello!</h1>\n<p>Text.</p>\n";
+        return *result == "<h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n";
       }(),
       stats);
 }
@@ -385,7 +1027,7 @@ void testRenderDirectory(struct stats &stats) {
         auto result =
             renderDirectory("foo/", dir, "{{ body }}", /* silent */ true);
         return *result ==
-               R"(<h1>foo/</h1>
+               R"(<h1 id="foo">foo/</h1>
 <table>
 <thead>
 <tr>
@@ -415,14 +1057,1906 @@ void testRenderDirectory(struct stats &stats) {
       stats);
 }
 
+/// Count the lines in `text` that start with `prefix`.
+static size_t countLines(const std::string &text, const std::string &prefix) {
+  auto count = size_t{0};
+  auto stream = std::istringstream{text};
+  for (auto line = std::string{}; std::getline(stream, line);) {
+    count += line.rfind(prefix, 0) == 0;
+  }
+  return count;
+}
+
+/// Pull all chunks out of `stream`, waiting for the renderer as needed.
+static std::string drainStream(renderStream &stream) {
+  auto page = std::string{};
+  for (auto chunk = std::string{}; !stream.done();) {
+    if (stream.next(chunk)) {
+      page += chunk;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  return page;
+}
+
+void testMetadata(struct stats &stats) {
+  const auto noteText = std::string_view{"---\n"
+                                         "title: \"Notes: caching\"\n"
+                                         "date: 2024-03-01\n"
+                                         "tags: [perf, memory]\n"
+                                         "---\n"
+                                         "# Heading\n"};
+
+  check(
+      "front matter fills slots instead of the body",
+      [&] {
+        auto result = renderText(std::string{noteText},
+                                 "{{ title }}|{{ date }}|{{ tags }}|{{ body }}",
+                                 /* silent */ true);
+        return *result ==
+               "Notes: caching|2024-03-01|"
+               "<a class=\"tag\" href=\"/_tags/perf\">perf</a> "
+               "<a class=\"tag\" href=\"/_tags/memory\">memory</a>|"
+               "<h1 id=\"heading\">Heading</h1>\n";
+      }(),
+      stats);
+
+  check(
+      "front matter needs a closing fence",
+      [] {
+        auto fields = parseFrontMatter("---\ntitle: T\n\nText.\n");
+        return !fields && !parseFrontMatter("Text.\n---\n");
+      }(),
+      stats);
+
+  check(
+      "front matter with a block list of tags",
+      [] {
+        auto fields =
+            parseFrontMatter("---\r\ntags:\r\n  - a b\r\n  - 'c'\r\n"
+                             "date: 2024\r\n---\r\nText.");
+        auto tags = std::vector<std::string>{};
+        forEachTag(fields->tags,
+                   [&tags](std::string_view tag) { tags.emplace_back(tag); });
+        return tags == std::vector<std::string>{"a b", "c"} &&
+               fields->date == "2024" && fields->length == 47;
+      }(),
+      stats);
+
+  check(
+      "metadata index answers tag queries",
+      [] {
+        auto index = metadataIndex{{}};
+        auto v1 = metadataIndex::version{std::chrono::seconds{1}};
+        index.update("/a.md", v1, "---\ndate: 2024-01-01\ntags: x\n---\n# A");
+        index.update("/b.md", v1, "---\ndate: 2024-02-01\ntags: x, y\n---\n");
+        index.update("/c.md", v1, "# C");
+        auto tagged = index.tagged("x");
+        auto newestFirst = tagged.size() == 2 && tagged[0].uri == "/b.md" &&
+                           tagged[1].title == "A";
+
+        // Removing a page moves the last row in its place.
+        index.remove("/a.md");
+        auto afterRemove = index.tagged("x");
+        auto removed = afterRemove.size() == 1 && afterRemove[0].uri == "/b.md";
+        index.update("/b.md", v1, "# B");
+
+        return newestFirst && removed && index.size() == 2 &&
+               index.find("/c.md")->title == "C" && index.tags().empty() &&
+               index.tagged("x").empty();
+      }(),
+      stats);
+
+  check(
+      "metadata index reads only changed files",
+      [] {
+        namespace fs = std::filesystem;
+        auto root = fs::temp_directory_path() / "magenta-index-test";
+        fs::remove_all(root);
+        fs::create_directories(root / "sub");
+        fs::create_directories(root / ".hidden");
+        std::ofstream{root / "a.md"} << "---\ntags: t\n---\n";
+        std::ofstream{root / "sub" / "b.md"} << "# B\n";
+        std::ofstream{root / ".hidden" / "c.md"} << "# C\n";
+        std::ofstream{root / "d.txt"} << "D\n";
+
+        auto index = metadataIndex{root};
+        auto firstReads = index.refresh();
+        auto secondReads = index.refresh();
+
+        std::ofstream{root / "sub" / "b.md"} << "# Changed\n";
+        fs::last_write_time(root / "sub" / "b.md",
+                            fs::file_time_type::clock::now() +
+                                std::chrono::seconds{1});
+        fs::remove(root / "a.md");
+        auto thirdReads = index.refresh();
+        fs::remove_all(root);
+
+        return firstReads == 2 && secondReads == 0 && thirdReads == 1 &&
+               index.size() == 1 && !index.find("/a.md") &&
+               index.find("/sub/b.md")->title == "Changed" &&
+               index.tags().empty();
+      }(),
+      stats);
+
+  check(
+      "scanner finds changes apart from the index",
+      [] {
+        namespace fs = std::filesystem;
+        auto root = fs::temp_directory_path() / "magenta-scan-test";
+        fs::remove_all(root);
+        fs::create_directories(root);
+        std::ofstream{root / "a.md"} << "---\ntags: t\n---\n[b](b.md)\n";
+        std::ofstream{root / "b.md"} << "# B\n";
+
+        auto scanner = indexScanner{root};
+        auto first = scanner.scan();
+        auto second = scanner.scan();
+
+        auto index = metadataIndex{root};
+        auto reported = std::vector<std::string>{};
+        auto report = [&reported](std::string_view uri) {
+          reported.emplace_back(uri);
+        };
+        auto applied = index.apply(std::move(first), report);
+        std::sort(reported.begin(), reported.end());
+        reported.erase(std::unique(reported.begin(), reported.end()),
+                       reported.end());
+        auto firstReported = reported;
+
+        fs::remove(root / "a.md");
+        auto third = scanner.scan();
+        reported.clear();
+        index.apply(std::move(third), report);
+        std::sort(reported.begin(), reported.end());
+        fs::remove_all(root);
+
+        return applied == 2 && second.updated.empty() &&
+               second.removed.empty() && index.size() == 1 &&
+               firstReported ==
+                   std::vector<std::string>{"/a.md", "/b.md"} &&
+               reported == std::vector<std::string>{"/a.md", "/b.md"} &&
+               index.linking("/b.md").empty() && index.tags().empty();
+      }(),
+      stats);
+
+  check(
+      "directory listing shows indexed titles",
+      [] {
+        const auto dir = std::filesystem::path{ARTIFACTS_PATH};
+        auto layout = compiledTemplate::parse("{{ body }}");
+        auto index = metadataIndex{dir};
+        index.refresh();
+
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto result = renderDirectory("/", dir, *layout, index, arena,
+                                      /* silent */ true);
+        return result &&
+               result->find("<td><a href=\"/hello.md\">hello.md</a></td>\n"
+                            "<td>Hello!</td>") != std::string::npos;
+      }(),
+      stats);
+
+  check(
+      "tag view lists tagged pages",
+      [&] {
+        auto layout = compiledTemplate::parse("{{ body }}");
+        auto index = metadataIndex{{}};
+        index.update("/n.md", {}, noteText);
+
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto page = renderTagPage("/_tags/perf", "perf", index, *layout, arena,
+                                  /* silent */ true);
+        auto all = renderTagPage("/_tags/", "", index, *layout, arena,
+                                 /* silent */ true);
+        auto none = renderTagPage("/_tags/nope", "nope", index, *layout, arena,
+                                  /* silent */ true);
+        return page &&
+               page->find("<a href=\"/n.md\">Notes: caching</a>") !=
+                   std::string::npos &&
+               all && all->find("(2)") == std::string::npos &&
+               all->find("<a href=\"/_tags/memory\">memory</a> (1)") !=
+                   std::string::npos &&
+               !none;
+      }(),
+      stats);
+
+  check(
+      "links resolve against the page that holds them",
+      [] {
+        auto links = findLinks(
+            "/j/2023/a.md",
+            "---\ntitle: [x](/front.md)\n---\n"
+            "[b](b.md) [up](../index.md#top) [root](/c%20d.md?q=1) "
+            "[dir](./) [far](../../../x/) [b again](b.md) [self](a.md) "
+            "[web](https://example.com/a.md) [net](//example.com/) "
+            "[frag](#top) ![img](pic.png)\n\n"
+            "[ref]\n\n[ref]: ../../img/logo.png\n\n`[code](no.md)`\n");
+        return links == std::vector<std::string>{
+                            "/j/2023/b.md", "/j/index.md", "/c d.md",
+                            "/j/2023/", "/x/", "/img/logo.png"} &&
+               findLinks("/j/index.md", "[j](./) [k](/j/index.md)").empty() &&
+               findLinks("/a.md", "<https://example.com/> *b.md*").empty();
+      }(),
+      stats);
+
+  check(
+      "backlinks follow updates and removals",
+      [] {
+        auto index = metadataIndex{{}};
+        index.update("/a.md", {}, "# A\n[j](j/)");
+        index.update("/b.md", {}, "[j](/j/index.md) [a](a.md)");
+        index.update("/j/index.md", {}, "# J\n[a](../a.md)");
+        auto toJ = index.linking("/j/");
+        auto both = toJ.size() == 2 && toJ[0].uri == "/a.md" &&
+                    toJ[1].uri == "/b.md" &&
+                    index.linking("/j/index.md").size() == 2;
+
+        // Removing "/a.md" moves the last row into its place.
+        index.remove("/a.md");
+        index.update("/b.md", {}, "[a](a.md)");
+        auto toA = index.linking("/a.md");
+        return both && index.linking("/j/").empty() && toA.size() == 2 &&
+               toA[0].uri == "/b.md" && toA[1].title == "J";
+      }(),
+      stats);
+
+  check(
+      "refresh reports pages whose backlinks changed",
+      [] {
+        namespace fs = std::filesystem;
+        auto root = fs::temp_directory_path() / "magenta-links-test";
+        fs::remove_all(root);
+        fs::create_directories(root / "j");
+        std::ofstream{root / "a.md"} << "[j](j/) [gone](gone.md) [p](p.png)";
+        std::ofstream{root / "b.md"} << "# B\n";
+        std::ofstream{root / "j" / "index.md"} << "[x](x.txt) [t](/_tags/)";
+        std::ofstream{root / "p.png"} << "P";
+
+        auto index = metadataIndex{root};
+        index.refresh();
+        auto broken = index.brokenLinks();
+        auto firstBroken = broken.size() == 2 && broken[0].to == "/gone.md" &&
+                           broken[1].from == "/j/index.md" &&
+                           broken[1].to == "/j/x.txt";
+
+        std::ofstream{root / "a.md"} << "[b](b.md) [p](p.png)";
+        fs::last_write_time(root / "a.md", fs::file_time_type::clock::now() +
+                                               std::chrono::seconds{1});
+        fs::remove(root / "p.png");
+        auto changed = std::vector<std::string>{};
+        index.refresh(
+            [&changed](std::string_view uri) { changed.emplace_back(uri); });
+        broken = index.brokenLinks();
+        fs::remove_all(root);
+
+        return firstBroken &&
+               changed == std::vector<std::string>{"/a.md", "/j/index.md",
+                                                   "/b.md"} &&
+               index.linking("/b.md").size() == 1 && broken.size() == 2 &&
+               broken[0].to == "/j/x.txt" && broken[1].to == "/p.png";
+      }(),
+      stats);
+
+  check(
+      "retitling a page reports the pages that it links to",
+      [] {
+        auto index = metadataIndex{{}};
+        index.update("/a.md", {}, "# A\n[b](b.md) [c](c.md)");
+        index.update("/b.md", {}, "# B\n");
+        index.update("/c.md", {}, "# C\n");
+
+        auto report = [&index](std::string_view text) {
+          auto changes = indexChanges{};
+          changes.updated.push_back(parseIndexedPage("/a.md", {}, text));
+          auto changed = std::vector<std::string>{};
+          index.apply(std::move(changes), [&changed](std::string_view uri) {
+            changed.emplace_back(uri);
+          });
+          return changed;
+        };
+        auto sameTitle = report("# A\n[b](b.md) [c](c.md) more");
+        auto retitled = report("# A2\n[b](b.md)");
+        return sameTitle == std::vector<std::string>{"/a.md"} &&
+               retitled ==
+                   std::vector<std::string>{"/a.md", "/c.md", "/b.md"} &&
+               index.linking("/b.md")[0].title == "A2";
+      }(),
+      stats);
+
+  check(
+      "backlinks and broken links render from the index",
+      [] {
+        auto layout = compiledTemplate::parse("{{ backlinks }}|{{ body }}");
+        auto index = metadataIndex{{}};
+        index.update("/a.md", {}, "# A <&>\n[b](b.md) [c](c.md)");
+        index.update("/b.md", {}, "[a](a.md)");
+
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto page = renderFile("/b.md", {}, "# B", *layout, index, arena,
+                               /* silent */ true);
+        auto lonely = renderFile("/d.md", {}, "# D", *layout, index, arena,
+                                 /* silent */ true);
+        auto report = renderBrokenLinksPage("/_links/broken", index, *layout,
+                                            arena, /* silent */ true);
+        return page &&
+               page->rfind("<ul class=\"backlinks\"><li><a href=\"/a.md\">"
+                           "A &lt;&amp;&gt;</a></li></ul>|",
+                           0) == 0 &&
+               lonely && lonely->rfind("|<h1 id=\"d\">D</h1>", 0) == 0 &&
+               report &&
+               report->find("<td><a href=\"/a.md\">A &lt;&amp;&gt;</a></td>\n"
+                            "<td>/c.md</td>") != std::string::npos;
+      }(),
+      stats);
+}
+
+void testFeeds(struct stats &stats) {
+  namespace fs = std::filesystem;
+  auto root = fs::temp_directory_path() / "magenta-feed-test";
+  fs::remove_all(root);
+  fs::create_directories(root / "j" / "2023");
+  std::ofstream{root / "j" / "index.md"} << "# Journal\n";
+  std::ofstream{root / "j" / "2023" / "a.md"}
+      << "---\ndate: 2023-06-01\n---\n# June\n\nFirst <entry>.\n\nMore.\n";
+  std::ofstream{root / "j" / "2023" / "b.md"}
+      << "---\ndate: 2023-07-01\n---\n# July\n\nSecond.\n";
+  std::ofstream{root / "j" / "2023" / "c.md"}
+      << "---\ndate: 2023-05-01\n---\n# May\n\nOldest.\n";
+  std::ofstream{root / "other.md"} << "# Other\n";
+
+  auto index = metadataIndex{root};
+  index.refresh();
+
+  check(
+      "feed holds the newest entries with summaries",
+      [&] {
+        auto feeds = feedStore{2};
+        auto feed = feeds.find("/j/", index);
+        if (feed == nullptr) {
+          return false;
+        }
+
+        const auto &xml = feed->xml;
+        auto july = xml.find("<title>July</title>");
+        auto june = xml.find("<title>June</title>");
+        return xml.find("<title>Journal</title>") != std::string::npos &&
+               july != std::string::npos && june != std::string::npos &&
+               july < june && xml.find("May") == std::string::npos &&
+               xml.find("<updated>2023-07-01T00:00:00Z</updated>") < july &&
+               xml.find("&lt;p&gt;First &amp;lt;entry&amp;gt;.&lt;/p&gt;") !=
+                   std::string::npos &&
+               xml.find("More.") == std::string::npos &&
+               xml.find("Other") == std::string::npos;
+      }(),
+      stats);
+
+  check(
+      "feed is kept until a file under its directory changes",
+      [&] {
+        auto feeds = feedStore{20};
+        auto first = feeds.find("/j/", index);
+        auto etag = first->etag;
+        auto again = feeds.find("/j/", index);
+        feeds.invalidate("/other.md");
+        auto unaffected = feeds.find("/j/", index);
+
+        std::ofstream{root / "j" / "2023" / "b.md"} << "# July, edited\n";
+        fs::last_write_time(root / "j" / "2023" / "b.md",
+                            fs::file_time_type::clock::now() +
+                                std::chrono::seconds{1});
+        auto changed = std::vector<std::string>{};
+        index.refresh([&](std::string_view uri) {
+          changed.emplace_back(uri);
+          feeds.invalidate(uri);
+        });
+        auto updated = feeds.find("/j/", index);
+
+        return again == first && unaffected == first &&
+               changed == std::vector<std::string>{"/j/2023/b.md"} &&
+               updated->etag != etag &&
+               updated->xml.find("July, edited") != std::string::npos;
+      }(),
+      stats);
+
+  check("no feed without entries",
+        feedStore{20}.find("/nothing/", index) == nullptr, stats);
+
+  fs::remove_all(root);
+}
+
+void testRenderFiles(struct stats &stats) {
+  const auto dir = std::filesystem::path{ARTIFACTS_PATH};
+  const auto bodyOnly = *compiledTemplate::parse("{{ body }}");
+  const auto expected =
+      std::string{"<h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n"};
+
+  check(
+      "batch returns pages in order",
+      [&] {
+        auto paths = std::vector<std::filesystem::path>{
+            dir / "hello.md", dir / "foo-bar.md", dir / "symlink.md"};
+        auto pages = renderFiles(paths, bodyOnly, 4, /* silent */ true);
+        return pages.size() == 3 && pages[0] == expected && !pages[1] &&
+               pages[2] == expected;
+      }(),
+      stats);
+
+  check(
+      "batch hands out each page once, one at a time",
+      [&] {
+        auto paths = std::vector<std::filesystem::path>(64, dir / "hello.md");
+        auto seen = std::vector<int>(paths.size(), 0);
+        auto inside = std::atomic<int>{0};
+        auto overlapped = false;
+        renderFiles(
+            paths, bodyOnly,
+            [&](size_t index, std::optional<std::string_view> html) {
+              overlapped |= inside.fetch_add(1) != 0;
+              seen[index] += html && *html == expected ? 1 : 0;
+              inside.fetch_sub(1);
+            },
+            8, /* silent */ true);
+        return !overlapped && std::all_of(seen.begin(), seen.end(),
+                                          [](int count) { return count == 1; });
+      }(),
+      stats);
+
+  check("empty batch",
+        renderFiles({}, bodyOnly, 0, /* silent */ true).empty(), stats);
+
+  check(
+      "batch goes on past a file that throws",
+      [&] {
+        // Looking up a name that is too long throws.
+        auto paths = std::vector<std::filesystem::path>{
+            dir / "hello.md", dir / std::string(4096, 'x'), dir / "hello.md"};
+        auto pages = renderFiles(paths, bodyOnly, 2, /* silent */ true);
+        return pages.size() == 3 && pages[0] == expected && !pages[1] &&
+               pages[2] == expected;
+      }(),
+      stats);
+}
+
+void testRenderStream(struct stats &stats) {
+  const auto dir = std::filesystem::path{ARTIFACTS_PATH};
+  const auto bodyOnly = *compiledTemplate::parse("{{ body }}");
+
+  check("stream non-existent file",
+        renderStream::open("/foo-bar.md", dir / "foo-bar.md", bodyOnly, 1024,
+                           nullptr, {}, /* silent */ true) == nullptr,
+        stats);
+
+  check("stream with template without body",
+        renderStream::open("/hello.md", dir / "hello.md",
+                           *compiledTemplate::parse("<html></html>"), 1024,
+                           nullptr, {}, /* silent */ true) == nullptr,
+        stats);
+
+  check("stream with template with repeated body",
+        renderStream::open("/hello.md", dir / "hello.md",
+                           *compiledTemplate::parse("{{ body }}{{ body }}"),
+                           1024, nullptr, {}, /* silent */ true) == nullptr,
+        stats);
+
+  check(
+      "stream file",
+      [&dir] {
+        auto layout = *compiledTemplate::parse("<body>{{ body }}</body>");
+        auto stream =
+            renderStream::open("/hello.md", dir / "hello.md", layout, 1024);
+        return stream &&
+               drainStream(*stream) ==
+                   "<body><h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n</body>";
+      }(),
+      stats);
+
+  check(
+      "streamed pages show the same backlinks as rendered ones",
+      [&dir] {
+        auto layout = *compiledTemplate::parse("{{ backlinks }}|{{ body }}");
+        auto index = metadataIndex{{}};
+        index.update("/a.md", {}, "# A\n[hello](hello.md)");
+        auto stream = renderStream::open("/hello.md", dir / "hello.md", layout,
+                                         index, 1024);
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto whole = renderFile("/hello.md", dir / "hello.md", layout, index,
+                                arena, /* silent */ true);
+        return stream && whole &&
+               drainStream(*stream) == std::string_view{*whole} &&
+               whole->rfind("<ul class=\"backlinks\">", 0) == 0;
+      }(),
+      stats);
+
+  check(
+      "stream table of contents after the body only",
+      [&dir] {
+        auto layout = *compiledTemplate::parse(
+            "[{{ toc }}]{{ body }}[{{ toc }}]{{ title }}[{{ toc }}]");
+        auto stream =
+            renderStream::open("/hello.md", dir / "hello.md", layout, 1024);
+        const auto toc = std::string{"<ul class=\"toc\">\n"
+                                     "<li><a href=\"#hello\">Hello!</a></li>\n"
+                                     "</ul>\n"};
+        return stream && drainStream(*stream) ==
+                             "[]<h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n[" +
+                                 toc + "]Hello![" + toc + "]";
+      }(),
+      stats);
+
+  check(
+      "stream large file through a small window",
+      [] {
+        auto path = std::filesystem::temp_directory_path() / "magenta-big.md";
+        {
+          auto stream = std::ofstream{path};
+          stream << "# Big\n\n";
+          for (auto i = 0; i < 20000; ++i) {
+            stream << "## Section " << i << "\n\nSome *text*.\n\n";
+          }
+        }
+
+        auto layout = *compiledTemplate::parse(
+            "<title>{{ title }}</title>{{ path }}<body>{{ body }}</body>");
+        auto stream = renderStream::open("/big.md", path, layout, 1024);
+        auto streamed = stream ? drainStream(*stream) : std::string{};
+        auto arena = std::pmr::monotonic_buffer_resource{};
+        auto rendered = renderFile("/big.md", path, layout, arena);
+        std::filesystem::remove(path);
+        return stream && !stream->failed() && rendered &&
+               std::string_view{streamed} == *rendered &&
+               streamed.find("<title>Big</title>/big.md<body>") == 0;
+      }(),
+      stats);
+
+  check(
+      "stream stops once it goes over its budget",
+      [&bodyOnly] {
+        auto path = std::filesystem::temp_directory_path() / "magenta-slow.md";
+        {
+          auto stream = std::ofstream{path};
+          for (auto i = 0; i < 100000; ++i) {
+            stream << "- *a* **b** [c](d) `e`\n";
+          }
+        }
+
+        auto budget = renderBudget{std::chrono::milliseconds{1}, 0};
+        auto stream = renderStream::open("/slow.md", path, bodyOnly,
+                                         1024 * 1024, nullptr, budget);
+        auto html = stream ? drainStream(*stream) : std::string{};
+        std::filesystem::remove(path);
+        // The stream may stop while md4c is still going through the lines,
+        // before any HTML comes out.
+        return stream && stream->failed() &&
+               html.find("</ul>") == std::string::npos;
+      }(),
+      stats);
+
+  check(
+      "stream notifies when pieces are ready",
+      [&dir, &bodyOnly] {
+        auto notified = std::make_shared<std::atomic<int>>(0);
+        auto stream =
+            renderStream::open("/hello.md", dir / "hello.md", bodyOnly, 1024,
+                               [notified] { *notified += 1; });
+        auto html = stream ? drainStream(*stream) : std::string{};
+        return html == "<h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n" &&
+               *notified >= 1;
+      }(),
+      stats);
+
+  check(
+      "destroy stream early",
+      [&dir, &bodyOnly] {
+        auto stream =
+            renderStream::open("/hello.md", dir / "hello.md", bodyOnly, 1);
+        auto chunk = std::string{};
+        return stream && stream->next(chunk);
+      }(),
+      stats);
+}
+
+#ifndef _WIN32
+static bool endsWith(std::string_view text, std::string_view suffix) {
+  return text.length() >= suffix.length() &&
+         text.compare(text.length() - suffix.length(), suffix.length(),
+                      suffix) == 0;
+}
+
+/// Web server for the site under `root`, on a free loopback port, with one
+/// client connected to it.  The server stops when this goes out of scope.
+class testServer {
+public:
+  /// Write `configJson` to `root / "config.json"`, serving `root` with the
+  /// default template unless the configuration names another one, and start
+  /// the server.  SIGHUP makes it call `reload`.
+  testServer(const std::filesystem::path &root, nlohmann::json configJson,
+             siteLoader reload = nullptr)
+      : socketPath{std::filesystem::temp_directory_path() /
+                   (root.filename().string() + ".sock")} {
+    std::filesystem::remove(socketPath);
+
+    // Find a free port by binding to port zero.
+    auto address = sockaddr_in{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto length = socklen_t{sizeof(address)};
+    auto probe = ::socket(AF_INET, SOCK_STREAM, 0);
+    ::bind(probe, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address));
+    ::getsockname(probe, reinterpret_cast<struct sockaddr *>(&address),
+                  &length);
+    ::close(probe);
+
+    configJson["core"]["port"] = ntohs(address.sin_port);
+    configJson["core"]["docRoot"] = root.string();
+    if (!configJson["core"].contains("templatePath")) {
+      configJson["core"]["templatePath"] =
+          (std::filesystem::path{ARTIFACTS_PATH} / "template.html").string();
+    }
+    {
+      auto stream = std::ofstream{root / "config.json"};
+      stream << configJson.dump();
+    }
+    auto site = load(root);
+    if (!site) {
+      return;
+    }
+
+    server = std::thread{[this, site = std::move(*site),
+                          reload = std::move(reload)]() mutable {
+      startWebServer(std::move(site), std::move(reload), socketPath);
+    }};
+
+    for (auto i = 0; i < 500 && client < 0; ++i) {
+      client = ::socket(AF_INET, SOCK_STREAM, 0);
+      if (::connect(client, reinterpret_cast<struct sockaddr *>(&address),
+                    sizeof(address)) != 0) {
+        ::close(client);
+        client = -1;
+        std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      }
+    }
+    auto timeout = timeval{5, 0};
+    ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+
+  testServer(const testServer &) = delete;
+  testServer &operator=(const testServer &) = delete;
+
+  ~testServer() {
+    if (client >= 0) {
+      ::close(client);
+    }
+    if (!server.joinable()) {
+      return;
+    }
+
+    // Taking over the listener makes the server return.
+    auto listener = takeOverListener(socketPath);
+    server.join();
+    if (listener) {
+      ::close(*listener);
+    }
+    std::filesystem::remove(socketPath);
+  }
+
+  /// Snapshot of the site that `root / "config.json"` configures.
+  static std::optional<siteSnapshot> load(const std::filesystem::path &root) {
+    auto config = validateAndLoadConfiguration(root / "config.json");
+    auto layout = config ? compiledTemplate::load(config->templatePath)
+                         : std::nullopt;
+    if (!layout) {
+      return {};
+    }
+    return siteSnapshot{*config, *layout, "", {}};
+  }
+
+  /// Send `request` and read the response to it, which has a body of the
+  /// announced length unless `hasBody` is false, or a chunked body.
+  std::string exchange(std::string_view request, bool hasBody = true) {
+    if (client < 0) {
+      return {};
+    }
+
+    ::send(client, request.data(), request.length(), 0);
+    auto response = std::string{};
+    char buffer[4096];
+    for (;;) {
+      auto end = response.find("\r\n\r\n");
+      auto field = response.find("Content-Length: ");
+      auto chunked = response.find("Transfer-Encoding: chunked");
+      if (end != std::string::npos && chunked < end &&
+          endsWith(response, "\r\n0\r\n\r\n")) {
+        return response;
+      }
+      if (end != std::string::npos && field < end) {
+        auto bodyLength =
+            hasBody ? std::stoul(response.substr(field + 16)) : 0;
+        if (response.length() >= end + 4 + bodyLength) {
+          return response;
+        }
+      }
+      auto received = ::recv(client, buffer, sizeof(buffer), 0);
+      if (received <= 0) {
+        return response;
+      }
+      response.append(buffer, static_cast<size_t>(received));
+    }
+  }
+
+private:
+  std::filesystem::path socketPath;
+  std::thread server;
+  int client = -1;
+};
+#endif
+
+void testByteRanges(struct stats &stats) {
+  auto same = [](const std::optional<std::vector<byteRange>> &ranges,
+                 std::vector<std::pair<uint64_t, uint64_t>> expected) {
+    if (!ranges || ranges->size() != expected.size()) {
+      return false;
+    }
+    for (auto i = size_t{0}; i < expected.size(); ++i) {
+      if ((*ranges)[i].first != expected[i].first ||
+          (*ranges)[i].last != expected[i].second) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  check("parse single range",
+        same(parseRangeHeader("bytes=0-9", 100), {{0, 9}}), stats);
+
+  check("parse suffix and open ranges",
+        same(parseRangeHeader("bytes=-5, 95-", 100), {{95, 99}, {95, 99}}),
+        stats);
+
+  check("clip range past the end",
+        same(parseRangeHeader("Bytes=90-200,,-500", 100), {{90, 99}, {0, 99}}),
+        stats);
+
+  check("unsatisfiable ranges",
+        same(parseRangeHeader("bytes=100-, -0", 100), {}), stats);
+
+  check(
+      "ignore malformed ranges",
+      [] {
+        auto tooMany = std::string{"bytes=0-0"};
+        for (auto i = size_t{1}; i <= maxByteRanges; ++i) {
+          tooMany += "," + std::to_string(i) + "-" + std::to_string(i);
+        }
+        return !parseRangeHeader("bytes=9-1", 100) &&
+               !parseRangeHeader("items=0-9", 100) &&
+               !parseRangeHeader("bytes=", 100) &&
+               !parseRangeHeader("bytes=a-b", 100) &&
+               !parseRangeHeader(tooMany, 100);
+      }(),
+      stats);
+
+  check("format HTTP date",
+        formatHttpDate(784111777) == "Sun, 06 Nov 1994 08:49:37 GMT" &&
+            formatHttpDate(0) == "Thu, 01 Jan 1970 00:00:00 GMT",
+        stats);
+
+  const auto path =
+      std::filesystem::temp_directory_path() / "magenta-range-test.txt";
+  {
+    auto stream = std::ofstream{path};
+    stream << "0123456789abcdefghij";
+  }
+
+  auto drain = [](rangeBody &body, size_t window) {
+    auto text = std::string{};
+    while (!body.done()) {
+      text += body.next(window);
+    }
+    return text;
+  };
+
+  check(
+      "send single range",
+      [&path, &drain] {
+        auto body = rangeBody::open(path, 20, {{5, 14}}, "text/plain", "B");
+        return body && body->length() == 10 &&
+               drain(*body, 3) == "56789abcde" && body->next(3).empty();
+      }(),
+      stats);
+
+  check(
+      "send several ranges",
+      [&path, &drain] {
+        auto body = rangeBody::open(path, 20, {{0, 1}, {18, 19}},
+                                    "text/plain", "B");
+        auto expected = std::string{"--B\r\nContent-Type: text/plain\r\n"
+                                    "Content-Range: bytes 0-1/20\r\n\r\n"
+                                    "01\r\n"
+                                    "--B\r\nContent-Type: text/plain\r\n"
+                                    "Content-Range: bytes 18-19/20\r\n\r\n"
+                                    "ij\r\n"
+                                    "--B--\r\n"};
+        return body && body->length() == expected.length() &&
+               drain(*body, 7) == expected;
+      }(),
+      stats);
+
+  check("refuse ranges of a shrunken file",
+        !rangeBody::open(path, 40, {{30, 39}}, "text/plain", "B"), stats);
+
+  std::filesystem::remove(path);
+
+#ifndef _WIN32
+  check(
+      "answer further requests after ranges on one connection",
+      [] {
+        namespace fs = std::filesystem;
+        const auto root = fs::temp_directory_path() / "magenta-range-site";
+        fs::create_directories(root);
+        {
+          auto stream = std::ofstream{root / "data.txt"};
+          stream << "0123456789";
+        }
+
+        auto range = std::string{};
+        auto head = std::string{};
+        auto unsatisfiable = std::string{};
+        auto whole = std::string{};
+        {
+          auto server = testServer{root, nlohmann::json::object()};
+          range = server.exchange("GET /data.txt HTTP/1.1\r\n"
+                                  "Range: bytes=2-4\r\n\r\n");
+          head = server.exchange("HEAD /data.txt HTTP/1.1\r\n"
+                                 "Range: bytes=0-0\r\n\r\n",
+                                 false);
+          unsatisfiable = server.exchange("GET /data.txt HTTP/1.1\r\n"
+                                          "Range: bytes=50-\r\n\r\n");
+          whole = server.exchange("GET /data.txt HTTP/1.1\r\n\r\n");
+        }
+        fs::remove_all(root);
+
+        return range.rfind("HTTP/1.1 206 ", 0) == 0 && endsWith(range, "234") &&
+               head.rfind("HTTP/1.1 206 ", 0) == 0 &&
+               endsWith(head, "\r\n\r\n") &&
+               unsatisfiable.rfind("HTTP/1.1 416 ", 0) == 0 &&
+               whole.rfind("HTTP/1.1 200 ", 0) == 0 &&
+               endsWith(whole, "0123456789");
+      }(),
+      stats);
+#endif
+}
+
+void testReload(struct stats &stats) {
+#ifndef _WIN32
+  namespace fs = std::filesystem;
+  const auto root = fs::temp_directory_path() / "magenta-reload-site";
+  fs::create_directories(root);
+  {
+    auto stream = std::ofstream{root / "page.md"};
+    stream << "# Page\n";
+  }
+  {
+    auto stream = std::ofstream{root / "layout.html"};
+    stream << "<main>{{ body }}</main>";
+  }
+
+  auto configJson = nlohmann::json{};
+  configJson["core"]["templatePath"] = (root / "layout.html").string();
+  configJson["core"]["stats"] = true;
+
+  auto reloads = std::atomic<int>{0};
+  auto reloadAndWait = [&reloads] {
+    auto before = reloads.load();
+    std::raise(SIGHUP);
+    for (auto i = 0; i < 500 && reloads == before; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+    }
+  };
+
+  auto first = std::string{};
+  auto cached = std::string{};
+  auto changed = std::string{};
+  auto counters = nlohmann::json{};
+  {
+    auto server = testServer{root, configJson, [&root, &reloads] {
+                               auto site = testServer::load(root);
+                               reloads += 1;
+                               return site;
+                             }};
+    first = server.exchange("GET /page.md HTTP/1.1\r\n\r\n");
+
+    reloadAndWait();
+    cached = server.exchange("GET /page.md HTTP/1.1\r\n\r\n");
+    auto reply = server.exchange("GET /_stats HTTP/1.1\r\n\r\n");
+    counters = nlohmann::json::parse(reply.substr(reply.find("\r\n\r\n")),
+                                     nullptr, false);
+
+    {
+      auto stream = std::ofstream{root / "layout.html"};
+      stream << "<article>{{ body }}</article>";
+    }
+    reloadAndWait();
+    changed = server.exchange("GET /page.md HTTP/1.1\r\n\r\n");
+  }
+  fs::remove_all(root);
+
+  check("keep cached pages over a reload that leaves the site alone",
+        endsWith(first, "</main>") && endsWith(cached, "</main>") &&
+            counters.is_object() && counters["cache"]["hits"] == 1,
+        stats);
+
+  check("drop cached pages when a reload changes the layout",
+        endsWith(changed, "</article>"), stats);
+#endif
+}
+
+void testAccessLog(struct stats &stats) {
+  const auto dir = std::filesystem::temp_directory_path() / "magenta-log-test";
+  std::filesystem::remove_all(dir);
+  std::filesystem::create_directories(dir);
+
+  check("open log in non-existent directory",
+        accessLog::open(dir / "foo" / "access.log", 0, 0, 16,
+                        /* silent */ true) == nullptr,
+        stats);
+
+  check(
+      "log records",
+      [&dir] {
+        {
+          auto log = accessLog::open(dir / "access.log", 0, 0);
+          log->push(makeAccessRecord("GET", "/index.md", 200, 1234,
+                                     std::chrono::microseconds{15},
+                                     cacheOutcome::MISS));
+          log->push(makeAccessRecord("GET", "/\"quoted\"", 404, 10,
+                                     std::chrono::microseconds{2},
+                                     cacheOutcome::NONE));
+        }
+
+        auto content = fetchFileContents(dir / "access.log");
+        return content &&
+               content->find(R"("method":"GET","uri":"/index.md",)"
+                             R"("status":200,"bytes":1234,"renderUs":15,)"
+                             R"("cache":"miss"})") != std::string::npos &&
+               content->find(R"("uri":"/\"quoted\"","status":404)") !=
+                   std::string::npos;
+      }(),
+      stats);
+
+  check(
+      "log truncates long URIs",
+      [] {
+        auto uri = std::string(1000, 'x');
+        auto record = makeAccessRecord("GET", uri, 200, 0,
+                                       std::chrono::nanoseconds{0},
+                                       cacheOutcome::NONE);
+        return record.uriLength == accessRecord::maxUriLength;
+      }(),
+      stats);
+
+  check(
+      "log counts dropped records",
+      [&dir] {
+        const auto total = 10000;
+        auto dropped = uint64_t{0};
+        auto written = uint64_t{0};
+        {
+          auto log = accessLog::open(dir / "drops.log", 0, 0, 4);
+          for (auto i = 0; i < total; ++i) {
+            log->push(makeAccessRecord("GET", "/", 200, 0,
+                                       std::chrono::nanoseconds{0},
+                                       cacheOutcome::NONE));
+          }
+          dropped = log->droppedCount();
+          written = log->writtenCount();
+        }
+
+        auto content = fetchFileContents(dir / "drops.log");
+        auto records = countLines(*content, R"({"ts")");
+        return dropped > 0 && written <= records && records + dropped == total &&
+               countLines(*content, R"({"dropped")") > 0;
+      }(),
+      stats);
+
+  check(
+      "log rotates files",
+      [&dir] {
+        {
+          auto log = accessLog::open(dir / "rotate.log", 1, 2);
+          for (auto i = 0; i < 3; ++i) {
+            log->push(makeAccessRecord("GET", "/", 200, 0,
+                                       std::chrono::nanoseconds{0},
+                                       cacheOutcome::NONE));
+            while (log->writtenCount() != static_cast<uint64_t>(i + 1)) {
+              std::this_thread::yield();
+            }
+          }
+        }
+
+        return std::filesystem::exists(dir / "rotate.log.1") &&
+               std::filesystem::exists(dir / "rotate.log.2") &&
+               !std::filesystem::exists(dir / "rotate.log.3");
+      }(),
+      stats);
+
+#ifndef _WIN32
+  check(
+      "log the bytes of response bodies",
+      [&dir] {
+        const auto root = dir / "site";
+        std::filesystem::create_directories(root);
+        {
+          auto stream = std::ofstream{root / "data.txt"};
+          stream << "0123456789";
+        }
+        {
+          auto stream = std::ofstream{root / "page.md"};
+          stream << "# Page\n";
+        }
+        {
+          auto stream = std::ofstream{root / "big.md"};
+          stream << "# Big\n\n" << std::string(200, 'x') << "\n";
+        }
+
+        auto configJson = nlohmann::json{};
+        configJson["core"]["streamThresholdBytes"] = 64;
+        configJson["log"]["accessLogPath"] = (dir / "bodies.log").string();
+        auto page = std::string{};
+        auto big = std::string{};
+        {
+          auto server = testServer{root, configJson};
+          server.exchange("GET /data.txt HTTP/1.1\r\n\r\n");
+          page = server.exchange("GET /page.md HTTP/1.1\r\n\r\n");
+          big = server.exchange("GET /big.md HTTP/1.1\r\n\r\n");
+
+          // Mongoose closes the connection after a HEAD request for a file.
+          server.exchange("HEAD /data.txt HTTP/1.1\r\n\r\n", false);
+        }
+
+        // Length of the page, which the response announces or sends in
+        // chunks.
+        auto bodyLength = [](const std::string &response) {
+          auto field = response.find("Content-Length: ");
+          if (field != std::string::npos) {
+            return uint64_t{std::stoul(response.substr(field + 16))};
+          }
+          auto length = uint64_t{0};
+          auto offset = response.find("\r\n\r\n") + 4;
+          while (offset < response.length()) {
+            auto chunk = std::stoul(response.substr(offset), nullptr, 16);
+            length += chunk;
+            offset = response.find("\r\n", offset) + 2 + chunk + 2;
+          }
+          return length;
+        };
+
+        auto content = fetchFileContents(dir / "bodies.log");
+        auto logged = std::vector<std::pair<std::string, uint64_t>>{};
+        auto lines = std::istringstream{content ? *content : ""};
+        for (auto line = std::string{}; std::getline(lines, line);) {
+          auto record = nlohmann::json::parse(line, nullptr, false);
+          if (record.contains("uri")) {
+            logged.emplace_back(record["method"].get<std::string>() + " " +
+                                    record["uri"].get<std::string>(),
+                                record["bytes"].get<uint64_t>());
+          }
+        }
+
+        auto expected = std::vector<std::pair<std::string, uint64_t>>{
+            {"GET /data.txt", 10},
+            {"GET /page.md", bodyLength(page)},
+            {"GET /big.md", bodyLength(big)},
+            {"HEAD /data.txt", 0},
+        };
+        return big.find("Transfer-Encoding: chunked") != std::string::npos &&
+               bodyLength(big) > 200 && logged == expected;
+      }(),
+      stats);
+#endif
+
+  std::filesystem::remove_all(dir);
+}
+
+void testTracing(struct stats &stats) {
+  const auto path = std::filesystem::temp_directory_path() / "magenta.trace";
+
+  check(
+      "spans are not recorded when tracing is off",
+      [&path] {
+        { auto span = traceSpan{"ignored"}; }
+        startTracing();
+        stopTracing(path);
+        auto trace = nlohmann::json::parse(*fetchFileContents(path));
+        for (const auto &event : trace["traceEvents"]) {
+          if (event.value("name", "") == "ignored") {
+            return false;
+          }
+        }
+        return true;
+      }(),
+      stats);
+
+  check(
+      "spans from several threads",
+      [&path] {
+        startTracing();
+        { auto span = traceSpan{"outer", "/index.md"}; }
+        std::thread{[] { auto span = traceSpan{"worker"}; }}.join();
+        renderText("# Hello", "{{ body }}", /* silent */ true);
+        if (!stopTracing(path, /* silent */ true)) {
+          return false;
+        }
+
+        auto trace = nlohmann::json::parse(*fetchFileContents(path));
+        auto names = std::vector<std::string>{};
+        auto threadIds = std::vector<int>{};
+        auto detail = std::string{};
+        for (const auto &event : trace["traceEvents"]) {
+          if (event["ph"] == "X") {
+            names.push_back(event["name"]);
+            threadIds.push_back(event["tid"]);
+            if (event["name"] == "outer") {
+              detail = event["args"]["detail"];
+            }
+          }
+        }
+
+        auto contains = [&names](const char *name) {
+          return std::find(names.begin(), names.end(), name) != names.end();
+        };
+        return contains("outer") && contains("worker") && contains("md4c") &&
+               contains("fill") && detail == "/index.md" &&
+               std::adjacent_find(threadIds.begin(), threadIds.end(),
+                                  std::not_equal_to<int>{}) !=
+                   threadIds.end();
+      }(),
+      stats);
+
+  check(
+      "long details are cut short between characters",
+      [&path] {
+        // Each "é" takes two bytes, and the 64th byte is the first of one.
+        auto uri = "/" + std::string(62, 'a') + "\xc3\xa9\xc3\xa9";
+        startTracing();
+        { auto span = traceSpan{"long", uri}; }
+        if (!stopTracing(path, /* silent */ true)) {
+          return false;
+        }
+
+        auto trace = nlohmann::json::parse(*fetchFileContents(path), nullptr,
+                                           false);
+        if (!trace.is_object()) {
+          return false;
+        }
+        for (const auto &event : trace["traceEvents"]) {
+          if (event.value("name", "") == "long") {
+            return event["args"]["detail"] == uri.substr(0, 63);
+          }
+        }
+        return false;
+      }(),
+      stats);
+
+  std::filesystem::remove(path);
+}
+
+void testPageCache(struct stats &stats) {
+  const auto v1 = pageCache::version{std::chrono::seconds{1}};
+  const auto v2 = pageCache::version{std::chrono::seconds{2}};
+  const auto page = std::string(16 << 10, 'x');
+
+  check(
+      "page cache hits only the same version",
+      [&] {
+        auto cache = pageCache{1 << 20};
+        auto miss = cache.lookup("/a.md", v1);
+        cache.insert("/a.md", v1, "<p>A</p>");
+        auto hit = cache.lookup("/a.md", v1);
+        auto stale = cache.lookup("/a.md", v2);
+        auto stats = cache.stats();
+        return !miss && hit && *hit == "<p>A</p>" && !stale &&
+               stats.hits == 1 && stats.misses == 2 && stats.entries == 0 &&
+               stats.hitRatio() == 1.0 / 3;
+      }(),
+      stats);
+
+  check(
+      "page cache drops invalidated pages",
+      [&] {
+        auto cache = pageCache{1 << 20};
+        cache.insert("/a.md", v1, "<p>A</p>");
+        cache.insert("/b.md", v1, "<p>B</p>");
+        cache.invalidate("/a.md");
+        cache.invalidate("/missing.md");
+        auto stats = cache.stats();
+        return !cache.lookup("/a.md", v1) && cache.lookup("/b.md", v1) &&
+               stats.entries == 1 && stats.bytes == 5 + 8;
+      }(),
+      stats);
+
+  check(
+      "page cache stays within its budget",
+      [&] {
+        auto cache = pageCache{1 << 20};
+        for (auto i = 0; i < 1000; ++i) {
+          auto key = "/" + std::to_string(i) + ".md";
+          for (auto j = 0; j < 3; ++j) {
+            if (!cache.lookup(key, v1)) {
+              cache.insert(key, v1, page);
+            }
+          }
+        }
+        auto stats = cache.stats();
+        return stats.bytes <= stats.maxBytes && stats.entries > 0 &&
+               stats.evictions > 0;
+      }(),
+      stats);
+
+  check(
+      "page cache keeps hot pages through a scan",
+      [&] {
+        auto cache = pageCache{4 << 20};
+        auto fetch = [&](const std::string &key) {
+          if (cache.lookup(key, v1)) {
+            return true;
+          }
+          cache.insert(key, v1, page);
+          return false;
+        };
+
+        for (auto round = 0; round < 4; ++round) {
+          for (auto i = 0; i < 50; ++i) {
+            fetch("/hot/" + std::to_string(i) + ".md");
+          }
+        }
+        for (auto i = 0; i < 2000; ++i) {
+          fetch("/cold/" + std::to_string(i) + ".md");
+        }
+
+        auto hits = 0;
+        for (auto i = 0; i < 50; ++i) {
+          hits += fetch("/hot/" + std::to_string(i) + ".md") ? 1 : 0;
+        }
+        return hits >= 45;
+      }(),
+      stats);
+}
+
+void testRateLimiter(struct stats &stats) {
+  using namespace std::chrono_literals;
+  const auto start = rateLimiter::clock::now();
+  const auto alice = rateLimiter::clientKey{127, 0, 0, 1};
+  const auto bob = rateLimiter::clientKey{127, 0, 0, 2};
+
+  check(
+      "rate limiter admits bursts and then throttles",
+      [&] {
+        auto limiter = rateLimiter{2, 3};
+        auto admitted = 0;
+        for (auto i = 0; i < 3; ++i) {
+          admitted += limiter.admit(alice, start) ? 0 : 1;
+        }
+        auto maybeRetryAfter = limiter.admit(alice, start);
+        return admitted == 3 && maybeRetryAfter && *maybeRetryAfter == 1s &&
+               !limiter.admit(bob, start);
+      }(),
+      stats);
+
+  check(
+      "rate limiter refills buckets over time",
+      [&] {
+        auto limiter = rateLimiter{2, 1};
+        return !limiter.admit(alice, start) && limiter.admit(alice, start) &&
+               limiter.admit(alice, start + 400ms) &&
+               !limiter.admit(alice, start + 1000ms);
+      }(),
+      stats);
+
+  check(
+      "rate limiter evicts the least recently seen client",
+      [&] {
+        auto limiter = rateLimiter{1, 1, 8};
+        limiter.admit(alice, start);
+        for (uint8_t i = 0; i < 100; ++i) {
+          auto client = rateLimiter::clientKey{10, 0, 0, i};
+          if (limiter.admit(client, start + 1ms * i)) {
+            return false;
+          }
+        }
+
+        // Alice's empty bucket is long gone, so she starts with a full one.
+        return !limiter.admit(alice, start + 200ms);
+      }(),
+      stats);
+
+  check(
+      "rate limiter keys IPv6 clients on their /64",
+      [&] {
+        auto first = rateLimiter::clientKey{0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 1,
+                                            0, 0, 0, 0, 0, 0, 0, 1};
+        auto second = first;
+        second[15] = 2;
+        auto otherNetwork = first;
+        otherNetwork[7] = 2;
+        auto limiter = rateLimiter{1, 1};
+        return !limiter.admit(rateLimiter::keyOf(first, true), start) &&
+               limiter.admit(rateLimiter::keyOf(second, true), start) &&
+               !limiter.admit(rateLimiter::keyOf(otherNetwork, true), start) &&
+               rateLimiter::keyOf(alice, false) == alice;
+      }(),
+      stats);
+
+  check(
+      "rate limiter keys IPv4-mapped clients on their IPv4 address",
+      [&] {
+        auto mapped = rateLimiter::clientKey{0, 0, 0,    0,    0,   0, 0, 0,
+                                             0, 0, 0xff, 0xff, 127, 0, 0, 1};
+        auto other = mapped;
+        other[15] = 2;
+        return rateLimiter::keyOf(mapped, true) == alice &&
+               rateLimiter::keyOf(other, true) == bob;
+      }(),
+      stats);
+
+  check(
+      "rate limiter keeps IPv6 prefixes apart from IPv4 clients",
+      [&] {
+        auto prefix = rateLimiter::clientKey{0x7f, 0, 0, 1, 0, 0, 0, 0,
+                                             0,    0, 0, 0, 0, 0, 0, 1};
+        auto limiter = rateLimiter{1, 1};
+        return rateLimiter::keyOf(prefix, true) != alice &&
+               !limiter.admit(rateLimiter::keyOf(prefix, true), start) &&
+               !limiter.admit(rateLimiter::keyOf(alice, false), start);
+      }(),
+      stats);
+}
+
+/// Stands in for GitHub: trades the codes in `logins` for their logins.
+class localExchange : public tokenExchange {
+public:
+  explicit localExchange(std::map<std::string, std::string> logins)
+      : logins(std::move(logins)) {}
+
+  void exchange(size_t, std::string_view code, callback done) override {
+    auto found = logins.find(std::string{code});
+    done(found != logins.end() ? std::optional{found->second} : std::nullopt);
+  }
+
+private:
+  std::map<std::string, std::string> logins;
+};
+
+void testSessionAuth(struct stats &stats) {
+  auto toHex = [](const std::array<uint8_t, 32> &digest) {
+    auto hex = std::string{};
+    for (auto byte : digest) {
+      hex += "0123456789abcdef"[byte >> 4];
+      hex += "0123456789abcdef"[byte & 0xf];
+    }
+    return hex;
+  };
+
+  check("HMAC-SHA-256 matches RFC 4231",
+        toHex(hmacSha256("Jefe", "what do ya want for nothing?")) ==
+                "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec"
+                "3843" &&
+            toHex(hmacSha256(
+                std::string(131, '\xaa'),
+                "Test Using Larger Than Block-Size Key - Hash Key First")) ==
+                "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee3"
+                "7f54",
+        stats);
+
+  auto config = authConfig{};
+  config.providers.push_back(
+      providerConfig{"github", "MAGENTA_TEST_ID", "MAGENTA_TEST_SECRET",
+                     {"Alice", "bob"}, {}});
+  config.providers.push_back(providerConfig{
+      "github", "MAGENTA_TEST_ID", "MAGENTA_TEST_SECRET", {}, {"eve"}});
+  config.sessionSecretEnvVar = "MAGENTA_TEST_SESSION_SECRET";
+  config.sessionSeconds = 3600;
+
+  auto makeAuth = [&config] {
+    auto exchange = std::make_unique<localExchange>(
+        std::map<std::string, std::string>{{"alice-code", "alice"},
+                                           {"eve-code", "eve"}});
+    return sessionAuth::create(config, std::move(exchange),
+                               /* silent */ true);
+  };
+  const auto now = int64_t{1700000000};
+
+  check("sessions verify until they expire",
+        [&] {
+          auto auth = makeAuth();
+          auto token = auth->issue(0, "bob", now);
+          auto first = auth->verify(token, now + 10);
+          auto cached = auth->verify(token, now + 20);
+          return first && *first == "bob" && cached && *cached == "bob" &&
+                 !auth->verify(token, now + 3600);
+        }(),
+        stats);
+
+  check("sessions with a forged signature or login do not verify",
+        [&] {
+          auto auth = makeAuth();
+          auto token = auth->issue(0, "bob", now);
+          auto forged = token;
+          forged.back() = forged.back() == 'A' ? 'B' : 'A';
+          auto renamed = token;
+          renamed.replace(renamed.find("bob"), 3, "Bob");
+          auto other = makeAuth();
+          return auth->verify(token, now) && !auth->verify(forged, now) &&
+                 !auth->verify(renamed, now) && !other->verify(token, now) &&
+                 !auth->verify("", now);
+        }(),
+        stats);
+
+  check("allow and block lists apply to sessions",
+        [&] {
+          auto auth = makeAuth();
+          return auth->admits(0, "alice") && auth->admits(0, "ALICE") &&
+                 !auth->admits(0, "eve") && auth->admits(1, "mallory") &&
+                 !auth->admits(1, "Eve") &&
+                 !auth->verify(auth->issue(0, "mallory", now), now) &&
+                 auth->verify(auth->issue(1, "mallory", now), now);
+        }(),
+        stats);
+
+  check("logins with other characters get no session",
+        [&] {
+          auto auth = makeAuth();
+          return auth->issue(1, "a.b", now).empty() &&
+                 auth->issue(1, "", now).empty();
+        }(),
+        stats);
+
+  check("sign-in state is bound to its nonce and expires",
+        [&] {
+          auto auth = makeAuth();
+          auto state = auth->signState(1, "/j/?page=2", "nonce", now);
+          auto maybeLogin = auth->checkState(state, "nonce", now + 60);
+          return maybeLogin && maybeLogin->provider == 1 &&
+                 maybeLogin->returnUri == "/j/?page=2" &&
+                 !auth->checkState(state, "other", now) &&
+                 !auth->checkState(state, "", now) &&
+                 !auth->checkState(state, "nonce", now + 600);
+        }(),
+        stats);
+
+  check("sign-in returns only to paths on this site",
+        isLocalReturnUri("/j/?page=2") && !isLocalReturnUri("") &&
+            !isLocalReturnUri("j/") && !isLocalReturnUri("//evil.com") &&
+            !isLocalReturnUri("/\\evil.com") &&
+            !isLocalReturnUri("/\t/evil.com") &&
+            !isLocalReturnUri("/a\r\nSet-Cookie: session=x") &&
+            !isLocalReturnUri("/a\\b"),
+        stats);
+
+  check("sign-in state holds only safe return URIs",
+        [&] {
+          auto auth = makeAuth();
+          auto returnUri = [&](std::string_view uri) {
+            auto state = auth->signState(0, uri, "nonce", now);
+            auto maybeLogin = auth->checkState(state, "nonce", now);
+            return maybeLogin ? maybeLogin->returnUri : std::string{"none"};
+          };
+          return returnUri("/a\r\nSet-Cookie: session=x") == "/" &&
+                 returnUri("/\t/evil.com") == "/" &&
+                 returnUri("https://evil.com/") == "/" &&
+                 returnUri("/" + std::string(300, 'a')) == "/" &&
+                 returnUri("/" + std::string(100, 'a')) ==
+                     "/" + std::string(100, 'a');
+        }(),
+        stats);
+
+  check("sign-in trades codes through the exchange",
+        [&] {
+          auto auth = makeAuth();
+          auto tokens = std::vector<std::optional<std::string>>{};
+          auto collect = [&tokens](std::optional<std::string> token) {
+            tokens.push_back(std::move(token));
+          };
+          auth->finishLogin(0, "alice-code", now, collect);
+          auth->finishLogin(0, "eve-code", now, collect);
+          auth->finishLogin(0, "unknown", now, collect);
+          auth->finishLogin(2, "alice-code", now, collect);
+          return tokens.size() == 4 && tokens[0] &&
+                 auth->verify(*tokens[0], now) == "alice" && !tokens[1] &&
+                 !tokens[2] && !tokens[3];
+        }(),
+        stats);
+
+  check("sign-in needs providers and an exchange",
+        [&] {
+          auto noProviders = config;
+          noProviders.providers.clear();
+          return !sessionAuth::create(noProviders,
+                                      std::make_unique<localExchange>(
+                                          std::map<std::string, std::string>{}),
+                                      /* silent */ true) &&
+                 !sessionAuth::create(config, nullptr, /* silent */ true);
+        }(),
+        stats);
+
+#ifndef _WIN32
+  check("certificates that fail to load leave the TLS context alone",
+        [&] {
+          auto bundle =
+              std::filesystem::temp_directory_path() / "magenta-bad-ca.pem";
+          {
+            auto stream = std::ofstream{bundle};
+            stream << "-----BEGIN CERTIFICATE-----\n"
+                      "bm90IGEgY2VydGlmaWNhdGU=\n"
+                      "-----END CERTIFICATE-----\n";
+          }
+          ::setenv("MAGENTA_TEST_ID", "id", 1);
+          ::setenv("MAGENTA_TEST_SECRET", "secret", 1);
+          auto withBundle = config;
+          withBundle.caBundlePath = bundle;
+
+          // Stands in for the context of the exchange in use.
+          auto current = 0;
+          auto mgr = mg_mgr{};
+          mgr.tls_ctx = &current;
+          auto exchange =
+              makeGithubExchange(mgr, withBundle, /* silent */ true);
+          auto kept = mgr.tls_ctx == &current;
+          std::filesystem::remove(bundle);
+          return !exchange && kept;
+        }(),
+        stats);
+#endif
+}
+
+void testHandoff(struct stats &stats) {
+#ifndef _WIN32
+  const auto path = std::filesystem::temp_directory_path() / "magenta.sock";
+  std::filesystem::remove(path);
+
+  check("take over without a handoff socket", !takeOverListener(path), stats);
+
+  check(
+      "hand off a listening socket",
+      [&path] {
+        auto listener = ::socket(AF_INET, SOCK_STREAM, 0);
+        auto address = sockaddr_in{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        auto length = socklen_t{sizeof(address)};
+        if (::bind(listener, reinterpret_cast<struct sockaddr *>(&address),
+                   sizeof(address)) != 0 ||
+            ::listen(listener, 1) != 0 ||
+            ::getsockname(listener,
+                          reinterpret_cast<struct sockaddr *>(&address),
+                          &length) != 0) {
+          return false;
+        }
+
+        auto maybeHandoff = handoffSocket::open(path, /* silent */ true);
+        if (!maybeHandoff || maybeHandoff->serve(listener)) {
+          return false;
+        }
+
+        auto taken = std::optional<int>{};
+        auto thread = std::thread{[&] { taken = takeOverListener(path); }};
+        auto served = false;
+        for (auto i = 0; i < 500 && !served; ++i) {
+          served = maybeHandoff->serve(listener);
+          std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        }
+        thread.join();
+        ::close(listener);
+
+        // The new descriptor refers to the same socket.
+        auto adopted = sockaddr_in{};
+        length = sizeof(adopted);
+        auto same = served && taken &&
+                    ::getsockname(*taken,
+                                  reinterpret_cast<struct sockaddr *>(&adopted),
+                                  &length) == 0 &&
+                    adopted.sin_port == address.sin_port;
+        if (taken) {
+          ::close(*taken);
+        }
+        return same && !maybeHandoff->serve(listener);
+      }(),
+      stats);
+
+  std::filesystem::remove(path);
+#endif
+}
+
+void testIoRing(struct stats &stats) {
+#ifndef _WIN32
+  const auto dir = std::filesystem::path{ARTIFACTS_PATH};
+
+  // Reads wake up whoever listens on the other end of `fds`.
+  int fds[2];
+  ::socketpair(AF_UNIX, SOCK_DGRAM, 0, fds);
+  auto ring = ioRing::open(fds[1], 8, /* silent */ true);
+
+  // Poll the ring until `done` is set, waiting for wakeups in between.
+  auto wait = [&ring, &fds](const bool &done) {
+    char byte;
+    while (!done && ::recv(fds[0], &byte, 1, 0) == 1) {
+      ring->poll();
+    }
+    return done;
+  };
+
+  check(
+      "read a file through the ring",
+      [&] {
+        if (!ring) {
+          return true; // The platform or the build does not support rings.
+        }
+
+        auto done = false;
+        auto contents = std::optional<std::string>{};
+        auto started = ring->readFile(dir / "hello.md", [&](auto result) {
+          contents = std::move(result);
+          done = true;
+        });
+        return started && wait(done) && contents &&
+               *contents == *fetchFileContents(dir / "hello.md") &&
+               ring->pending() == 0;
+      }(),
+      stats);
+
+  check(
+      "read a non-existent file through the ring",
+      [&] {
+        if (!ring) {
+          return true;
+        }
+
+        auto done = false;
+        auto contents = std::optional<std::string>{"unchanged"};
+        ring->readFile(dir / "foo-bar.md", [&](auto result) {
+          contents = std::move(result);
+          done = true;
+        });
+        return wait(done) && !contents;
+      }(),
+      stats);
+
+  check(
+      "refuse reads while the ring is full",
+      [&] {
+        if (!ring) {
+          return true;
+        }
+
+        auto finished = 0;
+        auto started = 0;
+        for (auto i = 0; i < 8; ++i) {
+          started += ring->readFile(dir / "hello.md", [&](auto result) {
+            finished += result ? 1 : 0;
+          });
+        }
+
+        while (ring->pending() > 0) {
+          char byte;
+          ::recv(fds[0], &byte, 1, 0);
+          ring->poll();
+        }
+        return started > 0 && started < 8 && finished == started;
+      }(),
+      stats);
+
+  ring.reset();
+  ::close(fds[0]);
+  ::close(fds[1]);
+#endif
+}
+
+void testWakeup(struct stats &stats) {
+#ifndef _WIN32
+  check(
+      "wake the event loop from another thread",
+      [] {
+        auto mgr = mg_mgr{};
+        mg_mgr_init(&mgr);
+        auto waker = loopWaker::open(mgr, /* silent */ true);
+        if (!waker) {
+          mg_mgr_free(&mgr);
+          return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto thread = std::thread{[waker] {
+          std::this_thread::sleep_for(std::chrono::milliseconds{20});
+          waker->wake();
+        }};
+        while (!waker->woken() &&
+               std::chrono::steady_clock::now() - start <
+                   std::chrono::seconds{5}) {
+          mg_mgr_poll(&mgr, 10000);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        thread.join();
+        mg_mgr_free(&mgr);
+
+        // Waking a loop that is gone does nothing.
+        waker->wake();
+        return elapsed < std::chrono::seconds{5} && !waker->woken();
+      }(),
+      stats);
+#endif
+}
+
+void testAllocationBudgets(struct stats &stats) {
+  const auto dir = std::filesystem::path{ARTIFACTS_PATH};
+  const auto templateText = *fetchFileContents(dir / "template.html");
+  const auto layout = *compiledTemplate::load(dir / "template.html");
+  const auto bodyOnly = *compiledTemplate::parse("{{ body }}");
+  const auto builtin = builtinTemplate();
+
+  auto measure = [](auto fn) {
+    auto scope = allocScope{};
+    fn();
+    return scope.counts();
+  };
+
+  // Render once up front, so that one-time initialization does not count
+  // against the budgets below.
+  renderText("# Hello", templateText, /* silent */ true);
+
+  check(
+      "allocation budget for rendering text",
+      [&] {
+        auto counts = measure([&] {
+          renderText("# Hello!\n\nText.\n", templateText, /* silent */ true);
+        });
+        return counts.count <= 16 && counts.bytes <= 2048;
+      }(),
+      stats);
+
+  check(
+      "allocation count for rendering text is independent of text length",
+      [&] {
+        auto markDownText = std::string{};
+        for (auto i = 0; i < 1000; ++i) {
+          markDownText += "Paragraph with *emphasis* and `code`.\n\n";
+        }
+
+        auto counts = measure([&] {
+          renderText(markDownText, templateText, /* silent */ true);
+        });
+        return counts.count <= 16 &&
+               counts.bytes <= 8 * markDownText.length();
+      }(),
+      stats);
+
+  check(
+      "allocation budget for rendering a file",
+      [&] {
+        auto counts = measure([&] {
+          renderFile(dir / "hello.md", templateText, /* silent */ true);
+        });
+        return counts.count <= 24 && counts.bytes <= 3072;
+      }(),
+      stats);
+
+  check(
+      "rendering text into an arena does not use the global heap",
+      [&] {
+        alignas(std::max_align_t) std::byte buffer[16 * 1024];
+        auto arena =
+            std::pmr::monotonic_buffer_resource{buffer, sizeof(buffer)};
+        auto counts = measure([&] {
+          renderText("# Hello!\n\nText.\n", layout, arena, /* silent */ true);
+        });
+        return counts.count == 0;
+      }(),
+      stats);
+
+  check(
+      "rendering text with the builtin layout does not use the global heap",
+      [&] {
+        alignas(std::max_align_t) std::byte buffer[16 * 1024];
+        auto arena =
+            std::pmr::monotonic_buffer_resource{buffer, sizeof(buffer)};
+        auto counts = measure([&] {
+          renderText("# Hello!\n\nText.\n", builtin, arena,
+                     /* silent */ true);
+        });
+        return counts.count == 0;
+      }(),
+      stats);
+
+  check(
+      "rendering a file into an arena",
+      [&] {
+        alignas(std::max_align_t) std::byte buffer[16 * 1024];
+        auto arena =
+            std::pmr::monotonic_buffer_resource{buffer, sizeof(buffer)};
+        auto path = dir / "hello.md";
+        auto result = std::optional<std::pmr::string>{};
+        auto counts = measure([&] {
+          result = renderFile("/hello.md", path, bodyOnly, arena,
+                              /* silent */ true);
+        });
+        return counts.count <= 2 && result &&
+               *result == "<h1 id=\"hello\">Hello!</h1>\n<p>Text.</p>\n";
+      }(),
+      stats);
+
+  check(
+      "allocation budget for rendering a batch",
+      [&] {
+        auto paths = std::vector<std::filesystem::path>(100, dir / "hello.md");
+        auto counts = measure([&] {
+          renderFiles(
+              paths, layout, [](size_t, std::optional<std::string_view>) {}, 1,
+              /* silent */ true);
+        });
+        return counts.count <= 2 * paths.size() + 16;
+      }(),
+      stats);
+
+  check(
+      "allocation budget for rendering a directory",
+      [&] {
+        auto counts = measure([&] {
+          renderDirectory("/foo/", dir, templateText, /* silent */ true);
+        });
+        return counts.count <= 64 && counts.bytes <= 12288;
+      }(),
+      stats);
+
+  check(
+      "verifying a recently verified session does not use the global heap",
+      [&] {
+        auto config = authConfig{};
+        config.providers.push_back(providerConfig{"github", "", "", {}, {}});
+        config.sessionSecretEnvVar = "MAGENTA_TEST_SESSION_SECRET";
+        config.sessionSeconds = 60;
+        auto auth = sessionAuth::create(
+            config,
+            std::make_unique<localExchange>(
+                std::map<std::string, std::string>{}),
+            /* silent */ true);
+
+        auto token = auth->issue(0, "alice", 1000);
+        auth->verify(token, 1000);
+        auto verified = false;
+        auto counts =
+            measure([&] { verified = auth->verify(token, 1001).has_value(); });
+        return verified && counts.count == 0;
+      }(),
+      stats);
+}
+
 int main() {
   auto allStats = stats{};
 
   testLoadConfig(allStats);
+  testLoadBundledConfig(allStats);
   testRenderText(allStats);
+  testCompiledTemplate(allStats);
+  testHighlighting(allStats);
+  testLiveReload(allStats);
   testFetchFileContents(allStats);
   testRenderFile(allStats);
   testRenderDirectory(allStats);
+  testRenderFiles(allStats);
+  testMetadata(allStats);
+  testFeeds(allStats);
+  testRenderStream(allStats);
+  testByteRanges(allStats);
+  testReload(allStats);
+  testAccessLog(allStats);
+  testTracing(allStats);
+  testPageCache(allStats);
+  testRateLimiter(allStats);
+  testSessionAuth(allStats);
+  testHandoff(allStats);
+  testWakeup(allStats);
+  testIoRing(allStats);
+  testAllocationBudgets(allStats);
 
   std::cout << "passed: " << allStats.passCount << "    "
             << "failed: " << allStats.failedList.size() << std::endl;
@@ -0,0 +1,267 @@
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory_resource>
+#include <optional>
+#include <string>
+
+#include "args.hpp"
+#include "config.h"
+#include "html.h"
+#include "template.h"
+#include "util.h"
+
+/// Generates the C source for the bundle that the `MAGENTA_BUNDLE` CMake
+/// option packs into the magenta executable.  The source defines
+/// `mg_unpack()` and `mg_unlist()`, which back mongoose's `mg_fs_packed`.  See
+/// bundle.h for the layout of the bundle.
+struct magentaBundle {
+  static const int success = static_cast<int>(Err::NONE);
+  static const int failure = static_cast<int>(Err::CMD_ARGS);
+
+  static const char *help() {
+    return "Pack a template and a document root into C source for magenta.";
+  }
+
+  std::filesystem::path outputPath;
+  std::filesystem::path configPath;
+  std::filesystem::path templatePath;
+  std::filesystem::path docRoot;
+  bool prerender = false;
+
+  template <class F> void parse(F f) {
+    f(outputPath, "--output", "-o", args::help("Path of the C file to write"),
+      args::required());
+    f(configPath, "--config-path", "-c",
+      args::help("Path to the configuration file to bundle"),
+      args::required());
+    f(templatePath, "--template-path", "-t",
+      args::help("Path to the template file to bundle"), args::required());
+    f(docRoot, "--doc-root", "-d",
+      args::help(
+          "Path to the document root to bundle (none if not specified)"));
+    f(prerender, "--prerender", "-p",
+      args::help(
+          "Render Markdown files now instead of when they are served"),
+      args::set(true));
+  }
+
+  int run();
+};
+
+struct packedFile {
+  std::string data;
+  time_t mtime;
+};
+
+static time_t modificationTime(const std::filesystem::path &path) {
+  auto errCode = std::error_code{};
+  auto modified = std::filesystem::last_write_time(path, errCode);
+  if (errCode) {
+    return 0;
+  }
+
+  // C++17 has no conversion between the file clock and the system clock.
+  return std::chrono::system_clock::to_time_t(
+      std::chrono::system_clock::now() +
+      std::chrono::duration_cast<std::chrono::system_clock::duration>(
+          modified - std::filesystem::file_time_type::clock::now()));
+}
+
+/// Add the files in `docRoot` to `files`, rendering directory listings and,
+/// if `prerender` is true, Markdown files along the way.
+static bool packDocRoot(const std::filesystem::path &docRoot,
+                        const compiledTemplate &layout, bool prerender,
+                        std::map<std::string, packedFile> &files) {
+  auto pagePath = [](const std::string &uri) { return "/pages" + uri; };
+  auto render = [](auto maybeHtml) -> std::optional<std::string> {
+    if (!maybeHtml) {
+      return {};
+    }
+    return std::string{*maybeHtml};
+  };
+
+  auto arena = std::pmr::monotonic_buffer_resource{};
+  auto rootTime = modificationTime(docRoot);
+  auto directoryUris = std::map<std::string, std::filesystem::path>{
+      {"/", docRoot},
+  };
+
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(docRoot)) {
+    auto uri =
+        "/" + entry.path().lexically_relative(docRoot).generic_string();
+    if (entry.is_directory()) {
+      directoryUris.emplace(uri + "/", entry.path());
+      continue;
+    }
+
+    auto mtime = modificationTime(entry.path());
+    if (!prerender || entry.path().extension() != ".md") {
+      auto maybeData = fetchFileContents(entry.path());
+      if (!maybeData) {
+        std::cerr << "failed to read file: " << entry.path() << std::endl;
+        return false;
+      }
+      files["/root" + uri] = packedFile{std::move(*maybeData), mtime};
+      continue;
+    }
+
+    auto maybeHtml = render(renderFile(uri, entry.path(), layout, arena));
+    if (!maybeHtml) {
+      return false;
+    }
+    files[pagePath(uri)] = packedFile{std::move(*maybeHtml), mtime};
+    arena.release();
+  }
+
+  // Directories with an index page show that page, which is either rendered
+  // now or when it is served.  All other directories show a listing, which
+  // can always be rendered now, since the bundle never changes.
+  for (const auto &[uri, path] : directoryUris) {
+    auto indexPath = path / "index.md";
+    auto maybeHtml = std::optional<std::string>{};
+    if (!std::filesystem::exists(indexPath)) {
+      maybeHtml = render(renderDirectory(uri, path, layout, arena));
+    } else if (prerender) {
+      maybeHtml = render(renderFile(uri, indexPath, layout, arena));
+    } else {
+      continue;
+    }
+
+    if (!maybeHtml) {
+      return false;
+    }
+    files[pagePath(uri)] = packedFile{std::move(*maybeHtml), rootTime};
+    arena.release();
+  }
+
+  return true;
+}
+
+/// Write `files` as C source that defines `mg_unpack()` and `mg_unlist()`.
+/// Mongoose expects the files to be sorted by name, which also allows lookups
+/// by binary search.
+static std::string generateSource(
+    const std::map<std::string, packedFile> &files) {
+  auto source = std::string{"// Generated by magenta-bundle.  Do not edit.\n"
+                            "#include <stdlib.h>\n"
+                            "#include <string.h>\n"
+                            "#include <time.h>\n\n"};
+
+  auto index = size_t{0};
+  for (const auto &[name, file] : files) {
+    source += "static const unsigned char v" + std::to_string(index++) +
+              "[] = {\n";
+
+    // Each array ends in a NUL byte that is not part of the file, like with
+    // mongoose's own packer.
+    auto column = size_t{0};
+    char number[8];
+    for (auto ch : file.data) {
+      auto length = std::snprintf(number, sizeof(number), "%u,",
+                                  static_cast<unsigned char>(ch));
+      source.append(number, static_cast<size_t>(length));
+      if (++column % 24 == 0) {
+        source += '\n';
+      }
+    }
+    source += "0};\n";
+  }
+
+  source += "\nstatic const struct packed_file {\n"
+            "  const char *name;\n"
+            "  const unsigned char *data;\n"
+            "  size_t size;\n"
+            "  time_t mtime;\n"
+            "} packed_files[] = {\n";
+
+  index = 0;
+  for (const auto &[name, file] : files) {
+    auto entry = std::string{"  {\""};
+    appendJsonEscaped(entry, name);
+    source += entry + "\", v" + std::to_string(index) + ", sizeof(v" +
+              std::to_string(index) + ") - 1, " + std::to_string(file.mtime) +
+              "},\n";
+    index += 1;
+  }
+
+  source += "  {NULL, NULL, 0, 0},\n"
+            "};\n\n"
+            "static int compare_names(const void *name, const void *file) {\n"
+            "  return strcmp((const char *) name,\n"
+            "                ((const struct packed_file *) file)->name);\n"
+            "}\n\n"
+            "const char *mg_unlist(size_t no) {\n"
+            "  return packed_files[no].name;\n"
+            "}\n\n"
+            "const char *mg_unpack(const char *name, size_t *size, "
+            "time_t *mtime) {\n"
+            "  const struct packed_file *file =\n"
+            "      (const struct packed_file *) bsearch(\n"
+            "          name, packed_files, " +
+            std::to_string(files.size()) +
+            ",\n"
+            "          sizeof(packed_files[0]), compare_names);\n"
+            "  if (file == NULL) return NULL;\n"
+            "  if (size != NULL) *size = file->size;\n"
+            "  if (mtime != NULL) *mtime = file->mtime;\n"
+            "  return (const char *) file->data;\n"
+            "}\n";
+  return source;
+}
+
+int magentaBundle::run() {
+  auto files = std::map<std::string, packedFile>{};
+
+  auto maybeConfigText = fetchFileContents(configPath);
+  if (!maybeConfigText || !loadBundledConfiguration(*maybeConfigText)) {
+    std::cerr << "failed to load configuration from file: '"
+              << configPath.string() << "'" << std::endl;
+    return static_cast<int>(Err::FILE_IO);
+  }
+  files["/config.json"] =
+      packedFile{std::move(*maybeConfigText), modificationTime(configPath)};
+
+  auto maybeLayout = compiledTemplate::load(templatePath);
+  if (!maybeLayout) {
+    return static_cast<int>(Err::FILE_IO);
+  }
+  files["/template.html"] =
+      packedFile{maybeLayout->source(), modificationTime(templatePath)};
+
+  auto maybeNotFoundHtml = renderNotFoundPage(docRoot, *maybeLayout);
+  if (!maybeNotFoundHtml) {
+    std::cerr << "failed to load 404 page content" << std::endl;
+    return static_cast<int>(Err::FILE_IO);
+  }
+  files["/404.html"] =
+      packedFile{std::move(*maybeNotFoundHtml), modificationTime(docRoot)};
+
+  if (!docRoot.empty() &&
+      !packDocRoot(docRoot, *maybeLayout, prerender, files)) {
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  auto source = generateSource(files);
+  auto file = std::fopen(outputPath.string().c_str(), "wb");
+  if (file == nullptr ||
+      std::fwrite(source.data(), 1, source.length(), file) != source.length()) {
+    std::cerr << "failed to write bundle: '" << outputPath.string() << "'"
+              << std::endl;
+    if (file != nullptr) {
+      std::fclose(file);
+    }
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  std::fclose(file);
+  return static_cast<int>(Err::NONE);
+}
+
+int main(int argc, const char *argv[]) {
+  return args::parse<magentaBundle>(argc, argv);
+}
@@ -0,0 +1,160 @@
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+#include "args.hpp"
+#include "template.h"
+#include "util.h"
+
+/// Generates the C++ source for the layout that the `MAGENTA_BUILTIN_TEMPLATE`
+/// CMake option compiles into the magenta executable.  The literal segments of
+/// the layout become `constexpr` views into a single string, and filling the
+/// layout is a fixed sequence of appends whose total length is computed up
+/// front.
+struct magentaTemplate {
+  static const int success = static_cast<int>(Err::NONE);
+  static const int failure = static_cast<int>(Err::CMD_ARGS);
+
+  static const char *help() {
+    return "Compile a template into C++ source for magenta.";
+  }
+
+  std::filesystem::path outputPath;
+  std::filesystem::path templatePath;
+
+  template <class F> void parse(F f) {
+    f(outputPath, "--output", "-o",
+      args::help("Path of the C++ file to write"), args::required());
+    f(templatePath, "--template-path", "-t",
+      args::help("Path to the template file to compile"), args::required());
+  }
+
+  int run();
+};
+
+static const char *slotNames[] = {
+    "BODY",  "TITLE", "PATH", "BREADCRUMBS", "TOC",
+    "MTIME", "DATE",  "TAGS", "BACKLINKS",
+};
+
+/// Append `text` as a C++ string literal, starting a new line after each
+/// newline in `text`.
+static void appendStringLiteral(std::string &source, std::string_view text) {
+  source += "    \"";
+  for (auto ch : text) {
+    auto byte = static_cast<unsigned char>(ch);
+    if (ch == '\n') {
+      source += "\\n\"\n    \"";
+    } else if (ch == '"' || ch == '\\') {
+      source += '\\';
+      source += ch;
+    } else if (byte < 0x20 || byte >= 0x7f) {
+      // Always use three octal digits, so that the escape cannot swallow a
+      // digit that follows it.
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\%03o", byte);
+      source += escaped;
+    } else {
+      source += ch;
+    }
+  }
+  source += "\"";
+}
+
+static std::string generateSource(const compiledTemplate &layout,
+                                  const std::filesystem::path &templatePath) {
+  const auto &segments = layout.segments();
+  auto slotName = [](templateSlot slot) {
+    return std::string{"templateSlot::"} +
+           slotNames[static_cast<size_t>(slot)];
+  };
+
+  auto source = std::string{"// Generated by magenta-template from "};
+  source += templatePath.filename().string();
+  source += ".  Do not edit.\n"
+            "#include <array>\n"
+            "#include <memory_resource>\n"
+            "#include <optional>\n"
+            "#include <string>\n"
+            "#include <string_view>\n\n"
+            "#include \"template.h\"\n\n";
+
+  source += "static constexpr std::string_view text =\n";
+  appendStringLiteral(source, layout.literals());
+  source += ";\n\n";
+
+  for (auto index = size_t{0}; index < segments.size(); ++index) {
+    const auto &piece = segments[index];
+    if (!piece.slot) {
+      source += "static constexpr std::string_view literal" +
+                std::to_string(index) + " = text.substr(" +
+                std::to_string(piece.offset) + ", " +
+                std::to_string(piece.length) + ");\n";
+    }
+  }
+
+  source += "\nstatic const std::array<compiledTemplate::segment, " +
+            std::to_string(segments.size()) + "> segments = {{\n";
+  for (const auto &piece : segments) {
+    source += "    {" + std::to_string(piece.offset) + ", " +
+              std::to_string(piece.length) + ", ";
+    source += piece.slot ? slotName(*piece.slot) : "std::nullopt";
+    source += "},\n";
+  }
+  source += "}};\n\n";
+
+  source += "template <class String>\n"
+            "static void fill(const slotValues &values, String &page) {\n"
+            "  page.reserve(page.length() + " +
+            std::to_string(layout.literals().length());
+  for (const auto &piece : segments) {
+    if (piece.slot) {
+      source += " +\n               values[" + slotName(*piece.slot) +
+                "].length()";
+    }
+  }
+  source += ");\n";
+
+  for (auto index = size_t{0}; index < segments.size(); ++index) {
+    const auto &piece = segments[index];
+    source += piece.slot ? "  page.append(values[" + slotName(*piece.slot) +
+                               "]);\n"
+                         : "  page.append(literal" + std::to_string(index) +
+                               ");\n";
+  }
+  source += "}\n\n";
+
+  source += "compiledTemplate builtinTemplate() {\n"
+            "  return compiledTemplate::precompiled(\n"
+            "      text, segments.data(), segments.size(), fill<std::string>,\n"
+            "      fill<std::pmr::string>);\n"
+            "}\n";
+  return source;
+}
+
+int magentaTemplate::run() {
+  auto maybeLayout = compiledTemplate::load(templatePath);
+  if (!maybeLayout) {
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  auto source = generateSource(*maybeLayout, templatePath);
+  auto file = std::fopen(outputPath.string().c_str(), "wb");
+  if (file == nullptr ||
+      std::fwrite(source.data(), 1, source.length(), file) != source.length()) {
+    std::cerr << "failed to write template source: '" << outputPath.string()
+              << "'" << std::endl;
+    if (file != nullptr) {
+      std::fclose(file);
+    }
+    return static_cast<int>(Err::FILE_IO);
+  }
+
+  std::fclose(file);
+  return static_cast<int>(Err::NONE);
+}
+
+int main(int argc, const char *argv[]) {
+  return args::parse<magentaTemplate>(argc, argv);
+}